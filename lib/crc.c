@@ -0,0 +1,98 @@
+/* jgfs2
+ * (c) 2013 Justin Gottula
+ * The source code of this project is distributed under the terms of the
+ * simplified BSD license. See the LICENSE file for details.
+ */
+
+
+#include "crc.h"
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#else
+#include <pthread.h>
+#endif
+#include "debug.h"
+
+
+/* CRC-32C (Castagnoli), reflected */
+#define CRC32C_POLY UINT32_C(0x82f63b78)
+
+
+#if !defined(__SSE4_2__)
+/* slicing-by-8: table k gives the effect of a byte followed by k zero bytes,
+ * so that eight bytes can be folded in with eight independent lookups */
+static uint32_t crc_tbl[8][256];
+static pthread_once_t crc_tbl_once = PTHREAD_ONCE_INIT;
+
+
+static void crc_tbl_init(void) {
+	for (uint32_t i = 0; i < 256; ++i) {
+		uint32_t crc = i;
+		for (uint8_t bit = 0; bit < 8; ++bit) {
+			crc = (crc >> 1) ^ (CRC32C_POLY & -(crc & 1));
+		}
+		
+		crc_tbl[0][i] = crc;
+	}
+	
+	for (uint32_t i = 0; i < 256; ++i) {
+		for (uint8_t k = 1; k < 8; ++k) {
+			uint32_t prev = crc_tbl[k - 1][i];
+			crc_tbl[k][i] = (prev >> 8) ^ crc_tbl[0][prev & 0xff];
+		}
+	}
+}
+#endif
+
+/// @brief continues a CRC-32C over more data
+/// @param[in] crc  CRC of the data so far, or zero to start
+/// @param[in] buf  data
+/// @param[in] len  length of data in bytes
+/// @return CRC of everything so far
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len) {
+	const uint8_t *pos = buf;
+	crc = ~crc;
+	
+#if defined(__SSE4_2__)
+	uint64_t crc64 = crc;
+	for ( ; len >= 8; pos += 8, len -= 8) {
+		uint64_t word;
+		memcpy(&word, pos, sizeof(word));
+		
+		crc64 = _mm_crc32_u64(crc64, word);
+	}
+	crc = crc64;
+	
+	for ( ; len != 0; ++pos, --len) {
+		crc = _mm_crc32_u8(crc, *pos);
+	}
+#else
+	pthread_once(&crc_tbl_once, crc_tbl_init);
+	
+	for ( ; len >= 8; pos += 8, len -= 8) {
+		uint32_t lo = crc ^ (pos[0] | (pos[1] << 8) | (pos[2] << 16) |
+			((uint32_t)pos[3] << 24));
+		
+		crc = crc_tbl[7][lo & 0xff] ^ crc_tbl[6][(lo >> 8) & 0xff] ^
+			crc_tbl[5][(lo >> 16) & 0xff] ^ crc_tbl[4][lo >> 24] ^
+			crc_tbl[3][pos[4]] ^ crc_tbl[2][pos[5]] ^
+			crc_tbl[1][pos[6]] ^ crc_tbl[0][pos[7]];
+	}
+	
+	for ( ; len != 0; ++pos, --len) {
+		crc = (crc >> 8) ^ crc_tbl[0][(crc ^ *pos) & 0xff];
+	}
+#endif
+	
+	return ~crc;
+}
+
+/// @brief names the CRC-32C implementation selected at build time
+/// @return "sse4.2" or "slice8"
+const char *crc32c_impl(void) {
+#if defined(__SSE4_2__)
+	return "sse4.2";
+#else
+	return "slice8";
+#endif
+}
@@ -0,0 +1,19 @@
+/* jgfs2
+ * (c) 2013 Justin Gottula
+ * The source code of this project is distributed under the terms of the
+ * simplified BSD license. See the LICENSE file for details.
+ */
+
+
+#ifndef JGFS2_LIB_CRC_H
+#define JGFS2_LIB_CRC_H
+
+
+#include "jgfs2.h"
+
+
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len);
+const char *crc32c_impl(void);
+
+
+#endif
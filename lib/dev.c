@@ -63,7 +63,7 @@ void *dev_map(uint32_t sect_num, uint32_t sect_cnt, bool writable) {
 			__func__, sect_num, sect_num + sect_cnt);
 	}
 	
-	++dev.map_cnt;
+	__atomic_add_fetch(&dev.map_cnt, 1, __ATOMIC_RELAXED);
 	
 	if (dev.debug_map) {
 		debug_map_push(addr, sect_num, sect_cnt);
@@ -95,7 +95,7 @@ void dev_unmap(void *addr, uint32_t sect_num, uint32_t sect_cnt) {
 			__func__, addr, sect_num, sect_num + sect_cnt);
 	}
 	
-	--dev.map_cnt;
+	__atomic_sub_fetch(&dev.map_cnt, 1, __ATOMIC_RELAXED);
 	
 	if (dev.debug_map) {
 		debug_map_pop(addr, sect_num, sect_cnt);
@@ -127,6 +127,20 @@ void dev_msync(void *addr, uint32_t sect_num, uint32_t sect_cnt, bool async) {
 	}
 }
 
+void dev_writeback(uint32_t sect_num, uint32_t sect_cnt) {
+	if (sect_num + sect_cnt > dev.size_sect) {
+		errx("%s: bounds violation: [%" PRIu32 ", %" PRIu32 ") > %" PRIu32,
+			__func__, sect_num, sect_num + sect_cnt, dev.size_sect);
+	}
+	
+	/* only starts the writes; a dev_fsync afterward waits for them */
+	if (sync_file_range(dev.fd, SECT_TO_BYTE(sect_num), SECT_TO_BYTE(sect_cnt),
+		SYNC_FILE_RANGE_WRITE) < 0) {
+		err("%s: sync_file_range failed: sect [%" PRIu32 ", %" PRIu32 ")",
+			__func__, sect_num, sect_num + sect_cnt);
+	}
+}
+
 void dev_fsync(void) {
 	if (fsync(dev.fd) < 0) {
 		warn("fsync failed");
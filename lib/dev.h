@@ -34,6 +34,7 @@ extern struct dev dev;
 void *dev_map(uint32_t sect_num, uint32_t sect_cnt, bool writable);
 void dev_unmap(void *addr, uint32_t sect_num, uint32_t sect_cnt);
 void dev_msync(void *addr, uint32_t sect_num, uint32_t sect_cnt, bool async);
+void dev_writeback(uint32_t sect_num, uint32_t sect_cnt);
 
 void dev_fsync(void);
 
@@ -6,54 +6,1459 @@
 
 
 #include "extent.h"
+#include <pthread.h>
 #include "debug.h"
+#include "fs.h"
+#include "meta.h"
+#include "rbtree.h"
+#include "tree.h"
 
 
-/* TODO: need a higher-level function that will return a number of extents that
- * add up to the requested length if a single extent can't be found;
- * we can use the fact that we have access to the ext tree to allocate the
- * largest extents that we know about so files have the fewest possible frags;
- * use this when allocating file data extents */
+/* free space is kept on disk in two trees that always hold the same extents:
+ * one keyed by address and one keyed by length (and then address); while the
+ * filesystem is up, every free extent is also indexed in memory the same two
+ * ways, and allocations are served from there alone: the smallest extent that
+ * fits is found by size and carved from its start, and a freed extent is
+ * merged with whatever free neighbors it finds by address
+ *
+ * the device is also split up into chunks, each of which only ever has one
+ * type of thing allocated from it (see enum ext_type), so that tree nodes
+ * aren't strewn in among file data; a chunk takes on the type of the first
+ * thing allocated from it, and loses it again once it is all free; within its
+ * chunks, a type allocates right after the hint block it was given (a node's
+ * sibling, or the extent a file is growing from) or else where its last
+ * allocation ended, so that what is read in order is laid out in order, and
+ * failing that takes the smallest free run that fits; for that, each free
+ * extent is also split into one piece for each chunk it covers, and the
+ * pieces are indexed by size for each type of chunk; each chunk's type is kept
+ * in the tree by address too, and goes out to it in the same batches as free
+ * extents do
+ *
+ * chunks are grouped into allocation groups, each with an index and a lock of
+ * its own, so that threads allocating at once don't have to wait on each
+ * other; a free extent never crosses from one group into the next, and each
+ * thread is handed a group of its own to allocate from when it has no hint,
+ * taking from the groups after it once its own is full (which a hint to what
+ * it allocated last then keeps it in)
+ *
+ * the trees are only brought up to date in batches, when the filesystem is
+ * synced (see fs_fsync); changing them can make them split or drop nodes,
+ * which calls back in here, but by then that only changes the index in memory,
+ * and those changes go out in the same batch
+ *
+ * between batches, the trees are behind on what has been handed out, so they
+ * are only trusted at mount time if they were flushed when the filesystem was
+ * last unmounted; otherwise, free space is worked out again from what every
+ * other tree and the log take up, and the trees are made over from that */
 
-uint32_t ext_alloc(uint32_t len) {
-	/* traverse the ext tree horizontally and find a free extent that is
-	 * large enough */
+
+struct ext_free;
+
+/* the part of a free extent that is in one chunk, indexed by size among the
+ * free parts of every chunk in the group of the same type */
+struct ext_piece {
+	struct rb_node by_size;
+	
+	struct ext_free *ext;
+	uint32_t addr;
+	uint32_t len;
+};
+
+/* a free extent, as indexed in memory */
+struct ext_free {
+	struct rb_node by_addr;
+	struct rb_node by_size;
+	
+	uint32_t addr;
+	uint32_t len;
+	
+	/* the trees have this extent just as it is; if not, it is on the list of
+	 * extents to add to them */
+	bool disk;
+	struct ext_free *dirty_next;
+	struct ext_free *dirty_prev;
+	
+	/* one for each chunk the extent covers, in order */
+	uint32_t piece_cnt;
+	struct ext_piece pieces[];
+};
+
+/* an allocation group: everything in it is only touched with its lock held,
+ * the types of its chunks included */
+struct ext_group {
+	pthread_mutex_t lock;
+	
+	uint32_t first; // first block
+	uint32_t end;   // block after the group
+	
+	struct rb_tree idx_addr;
+	struct rb_tree idx_size;
+	uint64_t free_blk;
+	
+	/* the pieces of free extents, by the type of chunk they are in */
+	struct rb_tree idx_type[EXT_TYPE_DATA + 1];
+	
+	/* extents to add to the trees, and extents to take back out of them */
+	struct ext_free *dirty_head;
+	uint32_t dirty_cnt;
+	
+	struct jgfs2_extent *stale_tbl;
+	uint32_t stale_cnt;
+	uint32_t stale_max;
+	
+	/* chunks whose type the tree is behind on */
+	uint32_t chunk_dirty;
+	
+	/* where each type's last allocation in the group ended */
+	uint32_t type_next[EXT_TYPE_DATA + 1];
+	
+	struct ext_stats st;
+};
+
+/* an extent in use, and what it was allocated for */
+struct ext_used {
+	uint32_t addr;
+	uint32_t len;
+	uint8_t  type; // enum ext_type
+};
+
+/* extents in use, gathered up from the trees when free space is rebuilt */
+struct ext_list {
+	struct ext_used *tbl;
+	uint32_t cnt;
+	uint32_t max;
+};
+
+
+static struct ext_group *groups = NULL;
+static uint32_t group_cnt = 0;
+
+/* held while the trees are being brought up to date, which only one thread
+ * does at a time; the totals for that are kept under it too */
+static pthread_mutex_t flush_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct ext_stats ext_st;
+
+/* this thread is bringing the trees up to date, so calls back in here are on
+ * their behalf */
+static __thread bool ext_flushing = false;
+
+/* the group this thread allocates from when it has no hint, and the number
+ * the next thread to ask for one gets */
+static __thread uint32_t ext_home = UINT32_MAX;
+static uint32_t home_next = 0;
+
+/* the type of each chunk (enum ext_type), and the type the tree has for it */
+static uint8_t *chunk_tbl  = NULL;
+static uint8_t *chunk_disk = NULL;
+static uint32_t chunk_cnt  = 0;
+
+
+static int ext_cmp_addr(const struct rb_node *lhs, const struct rb_node *rhs) {
+	const struct ext_free *l = rb_entry(lhs, struct ext_free, by_addr);
+	const struct ext_free *r = rb_entry(rhs, struct ext_free, by_addr);
+	
+	return (l->addr > r->addr) - (l->addr < r->addr);
+}
+
+static int ext_cmp_size(const struct rb_node *lhs, const struct rb_node *rhs) {
+	const struct ext_free *l = rb_entry(lhs, struct ext_free, by_size);
+	const struct ext_free *r = rb_entry(rhs, struct ext_free, by_size);
+	
+	if (l->len != r->len) {
+		return (l->len > r->len) - (l->len < r->len);
+	}
+	return (l->addr > r->addr) - (l->addr < r->addr);
+}
+
+static int ext_cmp_piece(const struct rb_node *lhs,
+	const struct rb_node *rhs) {
+	const struct ext_piece *l = rb_entry(lhs, struct ext_piece, by_size);
+	const struct ext_piece *r = rb_entry(rhs, struct ext_piece, by_size);
+	
+	if (l->len != r->len) {
+		return (l->len > r->len) - (l->len < r->len);
+	}
+	return (l->addr > r->addr) - (l->addr < r->addr);
+}
+
+static key ext_key_addr(uint32_t addr) {
+	return (key){
+		.id   = addr,
+		.type = KEY_EXT_FREE,
+		.off  = 0,
+	};
+}
+
+static key ext_key_size(uint32_t len, uint32_t addr) {
+	return (key){
+		.id   = len,
+		.type = KEY_EXT_SIZE,
+		.off  = addr,
+	};
+}
+
+static key ext_key_chunk(uint32_t c) {
+	return (key){
+		.id   = c * EXT_CHUNK_BLK,
+		.type = KEY_EXT_CHUNK,
+		.off  = 0,
+	};
+}
+
+/// @brief finds the allocation group a block is in
+/// @param[in] addr  block number, which must be on the device
+/// @return group
+static struct ext_group *ext_group(uint32_t addr) {
+	return groups + (addr / EXT_GROUP_BLK);
+}
+
+/// @brief gets the range of blocks a chunk covers
+/// @param[in]  c      chunk number
+/// @param[out] first  first block
+/// @param[out] end    block after the chunk
+static void ext_chunk_range(uint32_t c, uint32_t *first, uint32_t *end) {
+	*first = c * EXT_CHUNK_BLK;
+	*end   = *first + EXT_CHUNK_BLK;
+	
+	if (*end > fs.size_blk) {
+		*end = fs.size_blk;
+	}
+}
+
+/// @brief puts a free extent in both trees
+/// @param[in] addr  first block
+/// @param[in] len   length in blocks
+static void ext_tree_add(uint32_t addr, uint32_t len) {
+	key k = ext_key_addr(addr);
+	tree_insert(fs.sblk->s_addr_ext_tree, &k, (struct item_data){
+		.len  = sizeof(len),
+		.data = &len,
+	});
+	
+	/* everything the size tree needs to know is in the key */
+	k = ext_key_size(len, addr);
+	tree_insert(fs.sblk->s_addr_ext_size_tree, &k, (struct item_data){
+		.len  = 0,
+		.data = &len,
+	});
+}
+
+/// @brief takes a free extent out of both trees
+/// @param[in] addr  first block
+/// @param[in] len   length in blocks
+static void ext_tree_del(uint32_t addr, uint32_t len) {
+	key k_addr = ext_key_addr(addr);
+	key k_size = ext_key_size(len, addr);
+	
+	if (!tree_remove(fs.sblk->s_addr_ext_tree, &k_addr) ||
+		!tree_remove(fs.sblk->s_addr_ext_size_tree, &k_size)) {
+		errx("%s: free extent 0x%" PRIx32 "+%" PRIu32 " is missing",
+			__func__, addr, len);
+	}
+}
+
+/// @brief adds a free extent to a group's index
+/// @param[in] g     group the extent is in
+/// @param[in] addr  first block
+/// @param[in] len   length in blocks
+/// @param[in] disk  the trees have it already
+static void ext_idx_add(struct ext_group *g, uint32_t addr, uint32_t len,
+	bool disk) {
+	uint32_t c_first = addr / EXT_CHUNK_BLK;
+	uint32_t piece_cnt = ((addr + len - 1) / EXT_CHUNK_BLK) - c_first + 1;
+	
+	struct ext_free *ext = malloc(sizeof(*ext) +
+		(piece_cnt * sizeof(*ext->pieces)));
+	
+	ext->addr = addr;
+	ext->len  = len;
+	ext->disk = disk;
+	
+	ext->dirty_next = NULL;
+	ext->dirty_prev = NULL;
+	if (!disk) {
+		ext->dirty_next = g->dirty_head;
+		if (g->dirty_head != NULL) {
+			g->dirty_head->dirty_prev = ext;
+		}
+		g->dirty_head = ext;
+		++g->dirty_cnt;
+	}
+	
+	rb_insert(&g->idx_addr, &ext->by_addr);
+	rb_insert(&g->idx_size, &ext->by_size);
+	
+	ext->piece_cnt = piece_cnt;
+	for (uint32_t i = 0; i < piece_cnt; ++i) {
+		struct ext_piece *piece = ext->pieces + i;
+		
+		uint32_t first, end;
+		ext_chunk_range(c_first + i, &first, &end);
+		
+		piece->ext  = ext;
+		piece->addr = (addr > first ? addr : first);
+		piece->len  = (addr + len < end ? addr + len : end) - piece->addr;
+		
+		rb_insert(&g->idx_type[chunk_tbl[c_first + i]], &piece->by_size);
+	}
+	
+	g->free_blk += len;
+}
+
+/// @brief adds a run of free blocks to the index, as one free extent in each
+/// group it falls in, none of which the trees have yet; only for when nothing
+/// else is running
+/// @param[in] addr  first block
+/// @param[in] len   length in blocks
+static void ext_idx_add_range(uint32_t addr, uint32_t len) {
+	uint32_t end = addr + len;
+	
+	while (addr < end) {
+		struct ext_group *g = ext_group(addr);
+		uint32_t piece_end = (g->end < end ? g->end : end);
+		
+		ext_idx_add(g, addr, piece_end - addr, false);
+		addr = piece_end;
+	}
+}
+
+/// @brief takes a free extent off its group's dirty list
+/// @param[in] g    group the extent is in
+/// @param[in] ext  free extent, on the list
+static void ext_idx_undirty(struct ext_group *g, struct ext_free *ext) {
+	if (ext->dirty_prev != NULL) {
+		ext->dirty_prev->dirty_next = ext->dirty_next;
+	} else {
+		g->dirty_head = ext->dirty_next;
+	}
+	if (ext->dirty_next != NULL) {
+		ext->dirty_next->dirty_prev = ext->dirty_prev;
+	}
+	
+	ext->dirty_next = NULL;
+	ext->dirty_prev = NULL;
+	--g->dirty_cnt;
+}
+
+/// @brief takes a free extent out of a group's index, and frees it
+/// @param[in] g    group the extent is in
+/// @param[in] ext  free extent
+static void ext_idx_del(struct ext_group *g, struct ext_free *ext) {
+	rb_remove(&g->idx_addr, &ext->by_addr);
+	rb_remove(&g->idx_size, &ext->by_size);
+	
+	uint32_t c_first = ext->addr / EXT_CHUNK_BLK;
+	for (uint32_t i = 0; i < ext->piece_cnt; ++i) {
+		rb_remove(&g->idx_type[chunk_tbl[c_first + i]],
+			&ext->pieces[i].by_size);
+	}
+	
+	g->free_blk -= ext->len;
+	
+	if (ext->disk) {
+		if (g->stale_cnt == g->stale_max) {
+			g->stale_max = (g->stale_max != 0 ? g->stale_max * 2 : 64);
+			g->stale_tbl = realloc(g->stale_tbl,
+				g->stale_max * sizeof(*g->stale_tbl));
+		}
+		
+		g->stale_tbl[g->stale_cnt++] = (struct jgfs2_extent){
+			.e_addr = ext->addr,
+			.e_len  = ext->len,
+		};
+	} else {
+		ext_idx_undirty(g, ext);
+	}
+	
+	free(ext);
+}
+
+/// @brief allocates part of a free extent
+/// @param[in] g     group the extent is in
+/// @param[in] ext   free extent
+/// @param[in] addr  first block to allocate, within the free extent
+/// @param[in] len   blocks to allocate, within the free extent
+static void ext_carve(struct ext_group *g, struct ext_free *ext, uint32_t addr,
+	uint32_t len) {
+	uint32_t have_addr = ext->addr;
+	uint32_t have_end  = ext->addr + ext->len;
+	
+	ext_idx_del(g, ext);
+	if (addr > have_addr) {
+		ext_idx_add(g, have_addr, addr - have_addr, false);
+	}
+	if (addr + len < have_end) {
+		ext_idx_add(g, addr + len, have_end - (addr + len), false);
+	}
+	
+	++g->st.allocs;
+}
+
+/// @brief finds the free extent in a group that a block falls in, or else the
+/// first one after it
+/// @param[in] g     group
+/// @param[in] addr  block number
+/// @return free extent, or NULL if there are none at or after the block
+static struct ext_free *ext_find(struct ext_group *g, uint32_t addr) {
+	struct ext_free probe = {
+		.addr = addr,
+	};
+	
+	struct rb_node *next = rb_lower_bound(&g->idx_addr, &probe.by_addr);
+	struct rb_node *prev = (next != NULL ?
+		rb_prev(next) : rb_last(&g->idx_addr));
+	
+	if (prev != NULL) {
+		struct ext_free *ext = rb_entry(prev, struct ext_free, by_addr);
+		if (ext->addr + ext->len > addr) {
+			return ext;
+		}
+	}
+	
+	return (next != NULL ? rb_entry(next, struct ext_free, by_addr) : NULL);
+}
+
+/// @brief finds the smallest free extent in a group that is long enough
+/// @param[in] g    group
+/// @param[in] len  length in blocks
+/// @return free extent, or NULL if none is long enough
+static struct ext_free *ext_fit(struct ext_group *g, uint32_t len) {
+	struct ext_free probe = {
+		.addr = 0,
+		.len  = len,
+	};
+	
+	struct rb_node *node = rb_lower_bound(&g->idx_size, &probe.by_size);
+	return (node != NULL ? rb_entry(node, struct ext_free, by_size) : NULL);
+}
+
+/// @brief allocates the smallest free extent in a group that is long enough,
+/// or the start of it
+/// @param[in]  g     group
+/// @param[in]  len   length in blocks
+/// @param[out] addr  first block
+/// @return false if no free extent is long enough
+static bool ext_take(struct ext_group *g, uint32_t len, uint32_t *addr) {
+	struct ext_free *ext = ext_fit(g, len);
+	if (ext == NULL) {
+		return false;
+	}
+	
+	*addr = ext->addr;
+	ext_carve(g, ext, *addr, len);
+	
+	return true;
+}
+
+/// @brief allocates from the first run of free blocks at or after a block, if
+/// it is long enough before the end of a range of blocks in a group
+/// @param[in]  g      group
+/// @param[in]  first  first block of the range
+/// @param[in]  end    block after the range
+/// @param[in]  len    length in blocks
+/// @param[out] addr   first block
+/// @return false if the run isn't long enough
+static bool ext_take_within(struct ext_group *g, uint32_t first, uint32_t end,
+	uint32_t len, uint32_t *addr) {
+	struct ext_free *ext = ext_find(g, first);
+	if (ext == NULL || ext->addr >= end) {
+		return false;
+	}
+	
+	uint32_t run_first = (ext->addr > first ? ext->addr : first);
+	uint32_t run_end   = (ext->addr + ext->len < end ?
+		ext->addr + ext->len : end);
+	
+	if (run_end - run_first < len) {
+		return false;
+	}
+	
+	*addr = run_first;
+	ext_carve(g, ext, run_first, len);
+	
+	return true;
+}
+
+/// @brief finds the smallest free piece of a chunk of one type in a group that
+/// is long enough
+/// @param[in] g     group
+/// @param[in] type  enum ext_type
+/// @param[in] len   length in blocks
+/// @return piece, or NULL if none is long enough
+static struct ext_piece *ext_fit_typed(struct ext_group *g, uint8_t type,
+	uint32_t len) {
+	struct ext_piece probe = {
+		.addr = 0,
+		.len  = len,
+	};
+	
+	struct rb_node *node = rb_lower_bound(&g->idx_type[type], &probe.by_size);
+	return (node != NULL ? rb_entry(node, struct ext_piece, by_size) : NULL);
+}
+
+/// @brief moves the free pieces of a chunk over to another type's index; a
+/// chunk only changes type when it is first allocated from or once it is all
+/// free again, so it seldom has more than one or two
+/// @param[in] g     group the chunk is in
+/// @param[in] c     chunk number
+/// @param[in] type  enum ext_type it is about to be
+static void ext_chunk_refile(struct ext_group *g, uint32_t c, uint8_t type) {
+	uint32_t first, end;
+	ext_chunk_range(c, &first, &end);
+	
+	struct ext_free *ext = ext_find(g, first);
+	while (ext != NULL && ext->addr < end) {
+		struct ext_piece *piece =
+			ext->pieces + (c - (ext->addr / EXT_CHUNK_BLK));
+		
+		rb_remove(&g->idx_type[chunk_tbl[c]], &piece->by_size);
+		rb_insert(&g->idx_type[type], &piece->by_size);
+		
+		struct rb_node *next = rb_next(&ext->by_addr);
+		ext = (next != NULL ? rb_entry(next, struct ext_free, by_addr) : NULL);
+	}
+}
+
+/// @brief changes the type of a chunk
+/// @param[in] g     group the chunk is in
+/// @param[in] c     chunk number
+/// @param[in] type  enum ext_type
+static void ext_chunk_set(struct ext_group *g, uint32_t c, uint8_t type) {
+	ext_chunk_refile(g, c, type);
+	
+	if (chunk_tbl[c] == chunk_disk[c]) {
+		++g->chunk_dirty;
+	}
+	
+	chunk_tbl[c] = type;
+	
+	if (chunk_tbl[c] == chunk_disk[c]) {
+		--g->chunk_dirty;
+	}
+}
+
+/// @brief gives every chunk that an allocated extent overlaps a type, if it
+/// doesn't have one already
+/// @param[in] g     group the extent is in
+/// @param[in] addr  first block
+/// @param[in] len   length in blocks
+/// @param[in] type  enum ext_type
+static void ext_chunk_claim(struct ext_group *g, uint32_t addr, uint32_t len,
+	uint8_t type) {
+	uint32_t last = (addr + len - 1) / EXT_CHUNK_BLK;
+	for (uint32_t c = addr / EXT_CHUNK_BLK; c <= last; ++c) {
+		if (chunk_tbl[c] == EXT_TYPE_NONE) {
+			ext_chunk_set(g, c, type);
+		}
+	}
+	
+	g->type_next[type] = addr + len;
+}
+
+/// @brief takes the type away from every chunk that a free extent covers all
+/// of
+/// @param[in] g     group the extent is in
+/// @param[in] addr  first block
+/// @param[in] len   length in blocks
+static void ext_chunk_release(struct ext_group *g, uint32_t addr,
+	uint32_t len) {
+	uint32_t end = addr + len;
+	
+	for (uint32_t c = CEIL(addr, EXT_CHUNK_BLK); c < chunk_cnt; ++c) {
+		uint32_t chunk_end = (c + 1) * EXT_CHUNK_BLK;
+		if (chunk_end > fs.size_blk) {
+			chunk_end = fs.size_blk;
+		}
+		
+		if (chunk_end > end) {
+			break;
+		}
+		
+		if (chunk_tbl[c] != EXT_TYPE_NONE) {
+			ext_chunk_set(g, c, EXT_TYPE_NONE);
+		}
+	}
+}
+
+/// @brief allocates an extent from the chunks of one type in a group: right
+/// after the hint, then where the type left off, then the smallest free piece
+/// of any of its chunks that fits, and then from a chunk that nothing has been
+/// allocated from yet
+/// @param[in]  g     group
+/// @param[in]  len   length in blocks, no more than a chunk
+/// @param[in]  type  enum ext_type
+/// @param[in]  hint  block to allocate after, or zero for none
+/// @param[out] addr  first block
+/// @return false if none of its chunks, and no untyped chunk, has room
+static bool ext_take_typed(struct ext_group *g, uint32_t len, uint8_t type,
+	uint32_t hint, uint32_t *addr) {
+	uint32_t first, end;
+	
+	if (hint != 0 && hint >= g->first && hint < g->end) {
+		uint32_t c = hint / EXT_CHUNK_BLK;
+		ext_chunk_range(c, &first, &end);
+		
+		if ((chunk_tbl[c] == type || chunk_tbl[c] == EXT_TYPE_NONE) &&
+			ext_take_within(g, hint, end, len, addr)) {
+			return true;
+		}
+	}
+	
+	uint32_t next = g->type_next[type];
+	if (next != 0 && next < g->end) {
+		uint32_t c = next / EXT_CHUNK_BLK;
+		ext_chunk_range(c, &first, &end);
+		
+		if (chunk_tbl[c] == type && ext_take_within(g, next, end, len, addr)) {
+			return true;
+		}
+	}
+	
+	struct ext_piece *piece = ext_fit_typed(g, type, len);
+	if (piece == NULL) {
+		piece = ext_fit_typed(g, EXT_TYPE_NONE, len);
+	}
+	if (piece == NULL) {
+		return false;
+	}
+	
+	*addr = piece->addr;
+	ext_carve(g, piece->ext, *addr, len);
+	
+	return true;
+}
+
+/// @brief frees an extent within a group, merging it with the free extents on
+/// either side
+/// @param[in] g     group the extent is in
+/// @param[in] addr  first block
+/// @param[in] len   length in blocks
+static void ext_give(struct ext_group *g, uint32_t addr, uint32_t len) {
+	struct ext_free probe = {
+		.addr = addr,
+	};
+	
+	struct rb_node *next = rb_lower_bound(&g->idx_addr, &probe.by_addr);
+	struct rb_node *prev = (next != NULL ?
+		rb_prev(next) : rb_last(&g->idx_addr));
+	
+	struct ext_free *right = (next != NULL ?
+		rb_entry(next, struct ext_free, by_addr) : NULL);
+	struct ext_free *left  = (prev != NULL ?
+		rb_entry(prev, struct ext_free, by_addr) : NULL);
+	
+	if ((right != NULL && right->addr < addr + len) ||
+		(left != NULL && left->addr + left->len > addr)) {
+		struct ext_free *over = (left != NULL &&
+			left->addr + left->len > addr ? left : right);
+		errx("%s: 0x%" PRIx32 "+%" PRIu32 " overlaps free extent 0x%"
+			PRIx32 "+%" PRIu32, __func__, addr, len, over->addr, over->len);
+	}
+	
+	if (right != NULL && right->addr == addr + len) {
+		len += right->len;
+		ext_idx_del(g, right);
+		
+		++g->st.merges;
+	}
+	
+	if (left != NULL && left->addr + left->len == addr) {
+		addr = left->addr;
+		len += left->len;
+		ext_idx_del(g, left);
+		
+		++g->st.merges;
+	}
+	
+	ext_idx_add(g, addr, len, false);
+	ext_chunk_release(g, addr, len);
+	
+	++g->st.deallocs;
+}
+
+/// @brief finds where a run of blocks stops being in chunks that data can go
+/// in: data chunks, and chunks with no type yet
+/// @param[in] addr  first block
+/// @param[in] end   block after the run
+/// @return block after the part of the run that is in such chunks
+static uint32_t ext_data_end(uint32_t addr, uint32_t end) {
+	for (uint32_t c = addr / EXT_CHUNK_BLK; c * EXT_CHUNK_BLK < end; ++c) {
+		if (chunk_tbl[c] != EXT_TYPE_DATA && chunk_tbl[c] != EXT_TYPE_NONE) {
+			return (c * EXT_CHUNK_BLK > addr ? c * EXT_CHUNK_BLK : addr);
+		}
+	}
+	
+	return end;
+}
+
+/// @brief allocates the part of the free extent that a block falls in that
+/// starts at that block, or as much of it as is needed, as far as it stays in
+/// chunks that data can go in
+/// @param[in]  hint  block number
+/// @param[in]  len   most blocks to take
+/// @param[out] ext   extent allocated
+/// @return false if the block isn't free, or isn't in such a chunk
+static bool ext_take_at(uint32_t hint, uint32_t len, struct jgfs2_extent *ext) {
+	struct ext_group *g = ext_group(hint);
+	
+	struct ext_free *have = ext_find(g, hint);
+	if (have == NULL || have->addr > hint) {
+		return false;
+	}
+	
+	uint32_t have_end = ext_data_end(hint, have->addr + have->len);
+	if (have_end == hint) {
+		return false;
+	}
+	
+	ext->e_addr = hint;
+	ext->e_len  = (have_end - hint < len ? have_end - hint : len);
+	
+	ext_carve(g, have, ext->e_addr, ext->e_len);
 	
-	static uint32_t alloc_ptr = 100;
+	return true;
+}
+
+/// @brief allocates from the start of a free piece of a data chunk (or of a
+/// chunk with no type yet) on, carrying on into the chunks after it as far as
+/// its free extent and chunks that data can go in both go
+/// @param[in]  piece  free piece
+/// @param[in]  len    most blocks to take
+/// @param[out] ext    extent allocated
+static void ext_take_piece(struct ext_piece *piece, uint32_t len,
+	struct jgfs2_extent *ext) {
+	struct ext_free *have = piece->ext;
+	uint32_t have_end = ext_data_end(piece->addr, have->addr + have->len);
+	
+	ext->e_addr = piece->addr;
+	ext->e_len  = (have_end - piece->addr < len ? have_end - piece->addr : len);
+	
+	ext_carve(ext_group(piece->addr), have, ext->e_addr, ext->e_len);
+}
+
+/// @brief allocates the smallest free piece of a data chunk (or of a chunk
+/// with no type yet) in any group that is long enough, or the start of it
+/// @param[in]  len  length in blocks
+/// @param[out] ext  extent allocated
+/// @return false if no such piece is long enough
+static bool ext_take_fit_data(uint32_t len, struct jgfs2_extent *ext) {
+	struct ext_piece *best = NULL;
+	
+	for (uint32_t i = 0; i < group_cnt; ++i) {
+		struct ext_piece *have[] = {
+			ext_fit_typed(groups + i, EXT_TYPE_DATA, len),
+			ext_fit_typed(groups + i, EXT_TYPE_NONE, len),
+		};
+		
+		for (uint32_t j = 0; j < 2; ++j) {
+			if (have[j] != NULL && (best == NULL || have[j]->len < best->len)) {
+				best = have[j];
+			}
+		}
+	}
+	
+	if (best == NULL) {
+		return false;
+	}
+	
+	ext_take_piece(best, len, ext);
+	
+	return true;
+}
+
+/// @brief allocates the largest free piece of a data chunk (or of a chunk with
+/// no type yet) in any group, along with whatever follows it in chunks like it
+/// @param[in]  len  most blocks to take
+/// @param[out] ext  extent allocated
+/// @return false if no such chunk has anything free
+static bool ext_take_largest_data(uint32_t len, struct jgfs2_extent *ext) {
+	struct ext_piece *best = NULL;
+	
+	for (uint32_t i = 0; i < group_cnt; ++i) {
+		struct rb_node *node[] = {
+			rb_last(&groups[i].idx_type[EXT_TYPE_DATA]),
+			rb_last(&groups[i].idx_type[EXT_TYPE_NONE]),
+		};
+		
+		for (uint32_t j = 0; j < 2; ++j) {
+			if (node[j] == NULL) {
+				continue;
+			}
+			
+			struct ext_piece *have =
+				rb_entry(node[j], struct ext_piece, by_size);
+			if (best == NULL || have->len > best->len) {
+				best = have;
+			}
+		}
+	}
+	
+	if (best == NULL) {
+		return false;
+	}
+	
+	ext_take_piece(best, len, ext);
+	
+	return true;
+}
+
+/// @brief allocates the smallest free extent in any group that is long
+/// enough, or the start of it
+/// @param[in]  len  length in blocks
+/// @param[out] ext  extent allocated
+/// @return false if no free extent is long enough
+static bool ext_take_fit(uint32_t len, struct jgfs2_extent *ext) {
+	struct ext_free *best = NULL;
+	
+	for (uint32_t i = 0; i < group_cnt; ++i) {
+		struct ext_free *have = ext_fit(groups + i, len);
+		if (have != NULL && (best == NULL || have->len < best->len)) {
+			best = have;
+		}
+	}
+	
+	if (best == NULL) {
+		return false;
+	}
+	
+	ext->e_addr = best->addr;
+	ext->e_len  = len;
+	
+	ext_carve(ext_group(best->addr), best, ext->e_addr, ext->e_len);
+	
+	return true;
+}
+
+/// @brief allocates the largest free extent in any group, whole
+/// @param[out] ext  extent allocated
+/// @return false if nothing is free
+static bool ext_take_largest(struct jgfs2_extent *ext) {
+	struct ext_free *best = NULL;
+	
+	for (uint32_t i = 0; i < group_cnt; ++i) {
+		struct rb_node *node = rb_last(&groups[i].idx_size);
+		if (node == NULL) {
+			continue;
+		}
+		
+		struct ext_free *have = rb_entry(node, struct ext_free, by_size);
+		if (best == NULL || have->len > best->len) {
+			best = have;
+		}
+	}
+	
+	if (best == NULL) {
+		return false;
+	}
+	
+	ext->e_addr = best->addr;
+	ext->e_len  = best->len;
+	
+	ext_carve(ext_group(best->addr), best, ext->e_addr, ext->e_len);
+	
+	return true;
+}
+
+/// @brief picks the group an allocation looks in first: the one its hint is
+/// in, or else this thread's own
+/// @param[in] hint  block the allocation would best follow, or zero for none
+/// @return group number
+static uint32_t ext_group_start(uint32_t hint) {
+	if (hint != 0 && hint < fs.size_blk) {
+		return hint / EXT_GROUP_BLK;
+	}
+	
+	/* threads are spread over the groups in the order they first allocate */
+	if (ext_home == UINT32_MAX) {
+		ext_home = __atomic_fetch_add(&home_next, 1, __ATOMIC_RELAXED);
+	}
+	
+	return ext_home % group_cnt;
+}
+
+/// @brief allocates an extent, from a chunk of the given type if it is no
+/// longer than one; each group is tried in turn, starting with the hint's (or
+/// this thread's own), before settling for a chunk of another type
+/// @param[in] len   length in blocks, no more than a group
+/// @param[in] type  what it is for (enum ext_type)
+/// @param[in] hint  block it would best follow (the node next to it, or the
+/// extent before it), or zero for none
+/// @return first block
+uint32_t ext_alloc(uint32_t len, uint8_t type, uint32_t hint) {
+	if (len == 0 || len > EXT_GROUP_BLK) {
+		errx("%s: bad length: %" PRIu32, __func__, len);
+	}
+	if (type == EXT_TYPE_NONE || type > EXT_TYPE_DATA) {
+		errx("%s: bad type: %" PRIu8, __func__, type);
+	}
+	
+	/* the trees are only changed from in here while they are being flushed,
+	 * so tree nodes wanted from in here are for them */
+	if (type == EXT_TYPE_META && ext_flushing) {
+		type = EXT_TYPE_EXT;
+	}
+	
+	uint32_t start = ext_group_start(hint);
+	
+	for (uint32_t pass = 0; pass < 2; ++pass) {
+		for (uint32_t i = 0; i < group_cnt; ++i) {
+			struct ext_group *g = groups + ((start + i) % group_cnt);
+			
+			pthread_mutex_lock(&g->lock);
+			
+			uint32_t addr;
+			bool found;
+			if (pass == 0) {
+				found = (len <= EXT_CHUNK_BLK &&
+					ext_take_typed(g, len, type, hint, &addr));
+			} else {
+				found = ext_take(g, len, &addr);
+				if (found) {
+					++g->st.strays;
+				}
+			}
+			
+			if (found) {
+				ext_chunk_claim(g, addr, len, type);
+				
+				if (i != 0) {
+					++g->st.steals;
+				}
+			}
+			
+			pthread_mutex_unlock(&g->lock);
+			
+			if (found) {
+				return addr;
+			}
+		}
+	}
+	
+	errx("%s: no free extent of %" PRIu32 " blocks", __func__, len);
+}
+
+/// @brief allocates blocks as a number of extents, for when they don't have to
+/// be contiguous: if the hint block is free, whatever follows it is used
+/// first, so the blocks carry on from an extent that ends there; after that,
+/// the largest free runs in data chunks (and chunks with no type yet) are
+/// used until one is enough for what is left, which is then the smallest that
+/// is; the free extents in other chunks are only used, the same way, once
+/// there is nothing left in those, and each one counts as a stray
+/// @param[in]  len   length in blocks
+/// @param[in]  hint  block to start at if it is free, or zero for none
+/// @param[out] out   extents allocated
+/// @param[in]  max   most extents to allocate
+/// @return number of extents allocated, or zero (with nothing allocated) if
+/// there isn't enough free space to do it in that many
+uint32_t ext_alloc_multi(uint32_t len, uint32_t hint,
+	struct jgfs2_extent *out, uint32_t max) {
+	if (len == 0) {
+		errx("%s: zero-length extent", __func__);
+	}
+	if (max == 0) {
+		errx("%s: no room for extents", __func__);
+	}
+	
+	/* this looks at every group, so it holds all of their locks, always
+	 * taken in the same order */
+	uint64_t free_blk = 0;
+	struct ext_stats *before = malloc(group_cnt * sizeof(*before));
+	
+	for (uint32_t i = 0; i < group_cnt; ++i) {
+		pthread_mutex_lock(&groups[i].lock);
+		
+		free_blk += groups[i].free_blk;
+		before[i] = groups[i].st;
+	}
+	
+	uint32_t cnt = 0, want = len;
+	
+	if (len > free_blk) {
+		goto done;
+	}
+	
+	if (hint != 0 && hint < fs.size_blk && ext_take_at(hint, want, out)) {
+		want -= out[cnt++].e_len;
+	}
+	
+	while (want != 0 && cnt < max) {
+		if (ext_take_fit_data(want, out + cnt) ||
+			ext_take_largest_data(want, out + cnt)) {
+			want -= out[cnt++].e_len;
+		} else if (ext_take_fit(want, out + cnt)) {
+			++ext_group(out[cnt].e_addr)->st.strays;
+			++cnt;
+			want = 0;
+		} else if (ext_take_largest(out + cnt)) {
+			++ext_group(out[cnt].e_addr)->st.strays;
+			want -= out[cnt++].e_len;
+		} else {
+			break;
+		}
+	}
+	
+	/* put back what was taken, and act as though it never was */
+	if (want != 0) {
+		while (cnt != 0) {
+			--cnt;
+			ext_give(ext_group(out[cnt].e_addr), out[cnt].e_addr,
+				out[cnt].e_len);
+		}
+		
+		for (uint32_t i = 0; i < group_cnt; ++i) {
+			groups[i].st = before[i];
+		}
+		goto done;
+	}
+	
+	for (uint32_t i = 0; i < cnt; ++i) {
+		ext_chunk_claim(ext_group(out[i].e_addr), out[i].e_addr,
+			out[i].e_len, EXT_TYPE_DATA);
+	}
+	
+	/* counted in the group the first extent came from */
+	struct ext_group *g = ext_group(out[0].e_addr);
+	++g->st.multi_allocs;
+	g->st.multi_frags += cnt;
+	
+done:
+	for (uint32_t i = group_cnt; i != 0; --i) {
+		pthread_mutex_unlock(&groups[i - 1].lock);
+	}
+	
+	free(before);
+	
+	return cnt;
+}
+
+/// @brief frees an extent
+/// @param[in] addr  first block
+/// @param[in] len   length in blocks
+void ext_dealloc(uint32_t addr, uint32_t len) {
+	if (len == 0 || addr < fs.data_blk_first || addr > fs.size_blk ||
+		len > fs.size_blk - addr) {
+		errx("%s: bad extent: 0x%" PRIx32 "+%" PRIu32, __func__, addr, len);
+	}
+	
+	/* nothing allocated crosses a group boundary, but the caller may free
+	 * two allocations that sit side by side as one */
+	uint32_t end = addr + len;
+	while (addr < end) {
+		struct ext_group *g = ext_group(addr);
+		uint32_t piece_end = (g->end < end ? g->end : end);
+		
+		pthread_mutex_lock(&g->lock);
+		ext_give(g, addr, piece_end - addr);
+		pthread_mutex_unlock(&g->lock);
+		
+		addr = piece_end;
+	}
+}
+
+/// @brief writes one change that a group has waiting to the free space trees;
+/// the group's lock is let go of while the trees are changed, since that can
+/// allocate from it or free into it
+/// @param[in] g  group
+/// @return false if the group had nothing waiting
+static bool ext_flush_one(struct ext_group *g) {
+	pthread_mutex_lock(&g->lock);
+	
+	/* an extent may be added under the same address as one that is still to
+	 * be removed, so everything stale goes first, every time */
+	if (g->stale_cnt != 0) {
+		struct jgfs2_extent stale = g->stale_tbl[--g->stale_cnt];
+		pthread_mutex_unlock(&g->lock);
+		
+		ext_tree_del(stale.e_addr, stale.e_len);
+	} else if (g->dirty_head != NULL) {
+		/* the extent can be allocated out from under the insertion itself,
+		 * and then has to come back out again */
+		struct ext_free *ext = g->dirty_head;
+		ext_idx_undirty(g, ext);
+		ext->disk = true;
+		
+		uint32_t addr = ext->addr, len = ext->len;
+		pthread_mutex_unlock(&g->lock);
+		
+		ext_tree_add(addr, len);
+	} else if (g->chunk_dirty != 0) {
+		uint32_t c = g->first / EXT_CHUNK_BLK;
+		while (chunk_tbl[c] == chunk_disk[c]) {
+			++c;
+		}
+		
+		/* the chunk can change type again while the tree is being changed,
+		 * and then has to be written out again */
+		uint8_t old = chunk_disk[c], type = chunk_tbl[c];
+		chunk_disk[c] = type;
+		--g->chunk_dirty;
+		
+		pthread_mutex_unlock(&g->lock);
+		
+		key k = ext_key_chunk(c);
+		if (old != EXT_TYPE_NONE &&
+			!tree_remove(fs.sblk->s_addr_ext_tree, &k)) {
+			errx("%s: chunk %" PRIu32 " is missing", __func__, c);
+		}
+		if (type != EXT_TYPE_NONE) {
+			tree_insert(fs.sblk->s_addr_ext_tree, &k, (struct item_data){
+				.len  = sizeof(type),
+				.data = &type,
+			});
+		}
+	} else {
+		pthread_mutex_unlock(&g->lock);
+		return false;
+	}
+	
+	return true;
+}
+
+/// @brief brings the free space trees up to date with the index; the nodes
+/// they gain and lose while this goes on are part of the same batch
+void ext_flush(void) {
+	/* the trees are being changed by this very thread */
+	if (ext_flushing) {
+		return;
+	}
+	
+	pthread_mutex_lock(&flush_lock);
+	
+	bool dirty = false;
+	for (uint32_t i = 0; i < group_cnt && !dirty; ++i) {
+		struct ext_group *g = groups + i;
+		
+		pthread_mutex_lock(&g->lock);
+		dirty = (g->stale_cnt != 0 || g->dirty_head != NULL ||
+			g->chunk_dirty != 0);
+		pthread_mutex_unlock(&g->lock);
+	}
+	
+	if (!dirty) {
+		pthread_mutex_unlock(&flush_lock);
+		return;
+	}
+	
+	ext_flushing = true;
 	
-	//TODO("remove dummy code");
-	return alloc_ptr++;
+	/* the caller may be in the middle of an operation on another tree */
+	tree_stat_aside();
+	
+	/* one change from each group at a time, until none of them has any */
+	for (bool busy = true; busy; ) {
+		busy = false;
+		
+		for (uint32_t i = 0; i < group_cnt; ++i) {
+			if (ext_flush_one(groups + i)) {
+				++ext_st.flushed;
+				busy = true;
+			}
+		}
+	}
+	
+	fs.sblk->s_free_blk = ext_free_blk();
+	++ext_st.flushes;
+	
+	tree_stat_resume();
+	
+	ext_flushing = false;
+	pthread_mutex_unlock(&flush_lock);
+}
+
+/// @brief counts the free blocks
+/// @return number of blocks
+uint32_t ext_free_blk(void) {
+	uint64_t free_blk = 0;
+	
+	for (uint32_t i = 0; i < group_cnt; ++i) {
+		pthread_mutex_lock(&groups[i].lock);
+		free_blk += groups[i].free_blk;
+		pthread_mutex_unlock(&groups[i].lock);
+	}
+	
+	return free_blk;
+}
+
+/// @brief finds out what the chunk that a block is in was allocated for
+/// @param[in] addr  block number
+/// @return enum ext_type
+uint8_t ext_chunk_type(uint32_t addr) {
+	struct ext_group *g = ext_group(addr);
+	
+	pthread_mutex_lock(&g->lock);
+	uint8_t type = chunk_tbl[addr / EXT_CHUNK_BLK];
+	pthread_mutex_unlock(&g->lock);
+	
+	return type;
+}
+
+/// @brief gets the allocator's totals, over every group
+/// @return totals
+struct ext_stats ext_stats(void) {
+	pthread_mutex_lock(&flush_lock);
+	
+	struct ext_stats stats = ext_st;
+	stats.groups = group_cnt;
+	
+	for (uint32_t i = 0; i < group_cnt; ++i) {
+		struct ext_group *g = groups + i;
+		pthread_mutex_lock(&g->lock);
+		
+		stats.free_blk     += g->free_blk;
+		stats.extents      += g->idx_addr.cnt;
+		stats.allocs       += g->st.allocs;
+		stats.deallocs     += g->st.deallocs;
+		stats.merges       += g->st.merges;
+		stats.strays       += g->st.strays;
+		stats.steals       += g->st.steals;
+		stats.multi_allocs += g->st.multi_allocs;
+		stats.multi_frags  += g->st.multi_frags;
+		stats.dirty        += g->dirty_cnt + g->stale_cnt + g->chunk_dirty;
+		
+		pthread_mutex_unlock(&g->lock);
+	}
+	
+	pthread_mutex_unlock(&flush_lock);
+	
+	return stats;
+}
+
+/// @brief forgets every group, and the type of every chunk
+static void ext_idx_free(void) {
+	for (uint32_t i = 0; i < group_cnt; ++i) {
+		struct ext_group *g = groups + i;
+		
+		struct rb_node *node;
+		while ((node = rb_first(&g->idx_addr)) != NULL) {
+			struct ext_free *ext = rb_entry(node, struct ext_free, by_addr);
+			
+			rb_remove(&g->idx_addr, &ext->by_addr);
+			free(ext);
+		}
+		
+		free(g->stale_tbl);
+		pthread_mutex_destroy(&g->lock);
+	}
+	
+	free(groups);
+	groups    = NULL;
+	group_cnt = 0;
+	
+	free(chunk_tbl);
+	free(chunk_disk);
+	chunk_tbl  = NULL;
+	chunk_disk = NULL;
+	chunk_cnt  = 0;
+}
+
+/// @brief empties the index, leaving one empty group for each EXT_GROUP_BLK
+/// blocks of the device
+static void ext_idx_reset(void) {
+	ext_idx_free();
+	
+	group_cnt = CEIL(fs.size_blk, EXT_GROUP_BLK);
+	groups    = calloc(group_cnt, sizeof(*groups));
+	
+	for (uint32_t i = 0; i < group_cnt; ++i) {
+		struct ext_group *g = groups + i;
+		
+		pthread_mutex_init(&g->lock, NULL);
+		
+		g->first = i * EXT_GROUP_BLK;
+		g->end   = (g->first + EXT_GROUP_BLK < fs.size_blk ?
+			g->first + EXT_GROUP_BLK : fs.size_blk);
+		
+		rb_init(&g->idx_addr, ext_cmp_addr);
+		rb_init(&g->idx_size, ext_cmp_size);
+		
+		for (uint8_t t = EXT_TYPE_NONE; t <= EXT_TYPE_DATA; ++t) {
+			rb_init(&g->idx_type[t], ext_cmp_piece);
+		}
+	}
+	
+	chunk_cnt  = CEIL(fs.size_blk, EXT_CHUNK_BLK);
+	chunk_tbl  = calloc(chunk_cnt, sizeof(*chunk_tbl));
+	chunk_disk = calloc(chunk_cnt, sizeof(*chunk_disk));
+	
+	memset(&ext_st, 0, sizeof(ext_st));
+}
+
+/// @brief sets up the free space trees on a new filesystem, with everything
+/// past what they take up themselves as free extents; the trees are empty
+/// until the first ext_flush
+void ext_new(void) {
+	uint16_t node_blk = fs.sblk->s_ext_node_blk;
+	
+	ext_idx_reset();
+	ext_idx_add_range(fs.data_blk_first, fs.size_blk - fs.data_blk_first);
+	
+	fs.sblk->s_addr_ext_tree      = ext_alloc(node_blk, EXT_TYPE_EXT, 0);
+	fs.sblk->s_addr_ext_size_tree = ext_alloc(node_blk, EXT_TYPE_EXT,
+		fs.sblk->s_addr_ext_tree + node_blk);
+	
+	tree_init(fs.sblk->s_addr_ext_tree, node_blk, 0);
+	tree_init(fs.sblk->s_addr_ext_size_tree, node_blk, 0);
+	
+	/* the trees are flushed before the filesystem is first mounted */
+	fs.sblk->s_free_blk   = 0;
+	fs.sblk->s_free_clean = true;
+}
+
+/// @brief reads every free extent, and the type of every chunk, from the tree
+/// by address into the index
+static void ext_load(void) {
+	key k = ext_key_addr(0), found;
+	uint32_t item = 0;
+	while (tree_seek(fs.sblk->s_addr_ext_tree, &k, false, &found, sizeof(item),
+		&item)) {
+		if (found.type == KEY_EXT_CHUNK) {
+			uint32_t c = found.id / EXT_CHUNK_BLK;
+			
+			/* a free extent from before the chunk may reach into it */
+			ext_chunk_refile(ext_group(found.id), c, (uint8_t)item);
+			chunk_tbl[c] = chunk_disk[c] = (uint8_t)item;
+		} else {
+			struct ext_group *g = ext_group(found.id);
+			if (item > g->end - found.id) {
+				errx("%s: free extent 0x%" PRIx32 "+%" PRIu32 " crosses "
+					"into the next group", __func__, found.id, item);
+			}
+			
+			ext_idx_add(g, found.id, item, true);
+		}
+		
+		k = found;
+		++k.off;
+		item = 0;
+	}
+	
+	uint64_t free_blk = 0;
+	for (uint32_t i = 0; i < group_cnt; ++i) {
+		free_blk += groups[i].free_blk;
+	}
+	
+	if (free_blk != fs.sblk->s_free_blk) {
+		warnx("free space trees have %" PRIu64 " blocks, not %" PRIu32,
+			free_blk, fs.sblk->s_free_blk);
+	}
+}
+
+/// @brief adds an extent to a list of them
+/// @param[in] addr  first block
+/// @param[in] len   length in blocks
+/// @param[in] type  enum ext_type
+/// @param[in] arg   list (struct ext_list)
+static void ext_list_add(uint32_t addr, uint32_t len, uint8_t type,
+	void *arg) {
+	struct ext_list *list = arg;
+	
+	if (list->cnt == list->max) {
+		list->max = (list->max != 0 ? list->max * 2 : 256);
+		list->tbl = realloc(list->tbl, list->max * sizeof(*list->tbl));
+	}
+	
+	list->tbl[list->cnt++] = (struct ext_used){
+		.addr = addr,
+		.len  = len,
+		.type = type,
+	};
+}
+
+static int ext_list_cmp(const void *lhs, const void *rhs) {
+	const struct ext_used *l = lhs, *r = rhs;
+	return (l->addr > r->addr) - (l->addr < r->addr);
+}
+
+/// @brief works out free space from scratch, as everything that isn't taken up
+/// by the log, by the statistics table, by a metadata tree or by the roots of
+/// the free space trees, and
+/// empties the free space trees so that all of it goes back into them at the
+/// next flush
+static void ext_rebuild(void) {
+	warnx("free space trees were not up to date; rebuilding them");
+	++ext_st.rebuilds;
+	
+	struct ext_list used = { NULL, 0, 0 };
+	
+	uint16_t node_blk = fs.sblk->s_ext_node_blk;
+	ext_list_add(fs.sblk->s_addr_ext_tree, node_blk, EXT_TYPE_EXT, &used);
+	ext_list_add(fs.sblk->s_addr_ext_size_tree, node_blk, EXT_TYPE_EXT,
+		&used);
+	ext_list_add(fs.sblk->s_addr_log, fs.sblk->s_log_blk, EXT_TYPE_META,
+		&used);
+	ext_list_add(fs.sblk->s_addr_stat, fs.sblk->s_stat_blk, EXT_TYPE_META,
+		&used);
+	
+	for (uint32_t i = 0; i < meta_part_cnt(); ++i) {
+		tree_blk_walk(meta_part_root(i), ext_list_add, &used);
+	}
+	
+	qsort(used.tbl, used.cnt, sizeof(*used.tbl), ext_list_cmp);
+	
+	/* whatever is left between the extents in use is free */
+	uint32_t free_first = fs.data_blk_first;
+	for (uint32_t i = 0; i < used.cnt; ++i) {
+		const struct ext_used *ext = used.tbl + i;
+		
+		if (ext->addr > free_first) {
+			ext_idx_add_range(free_first, ext->addr - free_first);
+		}
+		if (ext->addr + ext->len > free_first) {
+			free_first = ext->addr + ext->len;
+		}
+	}
+	
+	if (free_first < fs.size_blk) {
+		ext_idx_add_range(free_first, fs.size_blk - free_first);
+	}
+	
+	/* what is in use says what type each chunk is */
+	for (uint32_t i = 0; i < used.cnt; ++i) {
+		const struct ext_used *ext = used.tbl + i;
+		ext_chunk_claim(ext_group(ext->addr), ext->addr, ext->len, ext->type);
+	}
+	
+	free(used.tbl);
+	
+	/* the rest of the old trees' nodes are free now too */
+	if (!fs.mount_opt.read_only) {
+		tree_init(fs.sblk->s_addr_ext_tree, node_blk, 0);
+		tree_init(fs.sblk->s_addr_ext_size_tree, node_blk, 0);
+		
+		ext_flush();
+	}
+}
+
+/// @brief brings every free extent into the index, and marks the trees as
+/// being behind until they are flushed at unmount
+void ext_init(void) {
+	tree_stat_open(fs.sblk->s_addr_ext_tree);
+	tree_stat_open(fs.sblk->s_addr_ext_size_tree);
+	
+	ext_idx_reset();
+	
+	if (fs.sblk->s_free_clean) {
+		ext_load();
+	} else {
+		ext_rebuild();
+	}
+	
+	if (!fs.mount_opt.read_only) {
+		fs.sblk->s_free_clean = false;
+	}
+}
+
+/// @brief writes out whatever the free space trees are missing, and forgets
+/// the index; only for when the filesystem is going away
+void ext_done(void) {
+	if (!fs.mount_opt.read_only) {
+		ext_flush();
+		fs.sblk->s_free_clean = true;
+	}
+	
+	ext_idx_free();
 }
 
 /* TODO: look into lazy allocation features of linux for when we have to get
  * zeroed extents (holes) for the library user (or will we just use the
  * read(2)/write(2) convention of filling a user buffer?) */
-
-/* FIX for the tree->aloc->tree feedback loop:
- * 
- * add new param to ext_alloc, ext_dealloc called 'in_mem', used by node_split,
- * that is set when node_split is operating on the ext tree
- * 
- * when in_mem, keep track of alloc'd and dealloc'd regions in a list/tree
- * when in_mem, consult list/tree in addition to the ext tree itself
- * PROBLEM: what if the ext tree is in a state of temporary brokenness?
- * 
- * when NOT in_mem, complain exceedingly loudly if the list/tree is not empty
- * 
- * new function, ext_flush, that "flushes" the list by calling ext_(de)alloc
- * (note that those functions may, in turn, alter the list if they have issues)
- * 
- * update node_split to use in_mem
- * update node_split to call ext_flush at the END of its TOP-LEVEL recursion
- */
-
-/* IDEA: two ext trees that track only free space
- * 
- * one is sorted by offset
- * the other is sorted by length
- * 
- * use the one sorted by length for allocations (find just the right size)
- * use the one sorted by offset for deallocations (find the addr we need)
- * 
- * when one tree is modified, update the other
- */
@@ -12,7 +12,58 @@
 #include "jgfs2.h"
 
 
-uint32_t ext_alloc(uint32_t len);
+/* blocks in each allocation chunk */
+#define EXT_CHUNK_BLK 4096
+
+/* blocks in each allocation group, which is a run of chunks with a free space
+ * index and a lock of its own */
+#define EXT_GROUP_BLK (EXT_CHUNK_BLK * 8)
+
+
+/* what a chunk has been allocated for */
+enum ext_type {
+	EXT_TYPE_NONE = 0, // nothing yet
+	EXT_TYPE_META = 1, // metadata tree nodes and the log
+	EXT_TYPE_EXT  = 2, // free space tree nodes
+	EXT_TYPE_DATA = 3, // overflow items and file data
+};
+
+
+struct ext_stats {
+	uint64_t free_blk;     // free blocks
+	uint64_t extents;      // free extents
+	uint64_t groups;       // allocation groups
+	
+	uint64_t allocs;       // extents allocated
+	uint64_t deallocs;     // extents freed
+	uint64_t merges;       // freed extents merged with a neighbor
+	uint64_t strays;       // allocations that went outside their type's chunks
+	uint64_t steals;       // allocations served outside the group they wanted
+	
+	uint64_t multi_allocs; // multi-extent allocations
+	uint64_t multi_frags;  // extents they came to
+	
+	uint64_t flushes;      // batches of changes written to the free space trees
+	uint64_t flushed;      // extents added to or removed from the trees by them
+	uint64_t dirty;        // changes not yet written to the trees
+	uint64_t rebuilds;     // times free space was worked out from scratch
+};
+
+
+uint32_t ext_alloc(uint32_t len, uint8_t type, uint32_t hint);
+uint32_t ext_alloc_multi(uint32_t len, uint32_t hint,
+	struct jgfs2_extent *out, uint32_t max);
+void ext_dealloc(uint32_t addr, uint32_t len);
+
+void ext_flush(void);
+
+uint32_t ext_free_blk(void);
+uint8_t ext_chunk_type(uint32_t addr);
+struct ext_stats ext_stats(void);
+
+void ext_new(void);
+void ext_init(void);
+void ext_done(void);
 
 
 #endif
@@ -9,7 +9,11 @@
 #include <time.h>
 #include "debug.h"
 #include "dev.h"
+#include "extent.h"
+#include "log.h"
+#include "meta.h"
 #include "new.h"
+#include "tree.h"
 
 
 struct fs fs;
@@ -100,6 +104,25 @@ void fs_msync_blk(void *addr, uint32_t blk_num, uint32_t blk_cnt, bool async) {
 	dev_msync(addr, sect_num, sect_cnt, async);
 }
 
+void fs_writeback_blk(uint32_t blk_num, uint32_t blk_cnt) {
+	if (blk_num + blk_cnt > fs.size_blk) {
+		errx("%s: bounds violation: [%" PRIu32 ", %" PRIu32 ") > %" PRIu32,
+			__func__, blk_num, blk_num + blk_cnt, fs.size_blk);
+	}
+	
+	uint32_t sect_num = blk_num * fs.sblk->s_blk_size;
+	uint32_t sect_cnt = blk_cnt * fs.sblk->s_blk_size;
+	
+	dev_writeback(sect_num, sect_cnt);
+}
+
+void fs_fsync(void) {
+	/* whatever the allocator handed out has to be on disk along with whatever
+	 * is in it */
+	ext_flush();
+	dev_fsync();
+}
+
 bool fs_sblk_check(const struct jgfs2_super_block *sblk) {
 	if (memcmp(sblk->s_magic, JGFS2_MAGIC, sizeof(sblk->s_magic)) != 0) {
 		warnx("not jgfs2 or invalid super block");
@@ -113,6 +136,30 @@ bool fs_sblk_check(const struct jgfs2_super_block *sblk) {
 		return false;
 	}
 	
+	if (sblk->s_meta_part_cnt == 0 ||
+		sblk->s_meta_part_cnt > JGFS2_LIMIT_META_PART ||
+		(sblk->s_meta_part_cnt & (sblk->s_meta_part_cnt - 1)) != 0) {
+		warnx("invalid number of meta tree partitions (%" PRIu16 ")",
+			sblk->s_meta_part_cnt);
+		return false;
+	}
+	
+	/* a node is at least one block; beyond that, it can't exceed the max */
+	uint16_t node_blk[] = { sblk->s_ext_node_blk, sblk->s_meta_node_blk };
+	for (size_t i = 0; i < sizeof(node_blk) / sizeof(*node_blk); ++i) {
+		if (node_blk[i] == 0 || (node_blk[i] > 1 &&
+			SECT_TO_BYTE((uint32_t)node_blk[i] * sblk->s_blk_size) >
+			JGFS2_NODE_SIZE_MAX)) {
+			warnx("invalid tree node size (%" PRIu16 " blocks)", node_blk[i]);
+			return false;
+		}
+	}
+	
+	if (sblk->s_log_blk < 2) {
+		warnx("invalid intent log size (%" PRIu32 " blocks)", sblk->s_log_blk);
+		return false;
+	}
+	
 	if (sblk->s_total_sect > dev.size_sect) {
 		warnx("filesystem exceeds device bounds (%" PRIu32 " > %" PRIu32 ")",
 			sblk->s_total_sect, dev.size_sect);
@@ -157,10 +204,18 @@ void fs_init(const char *dev_path,
 	
 	fs.boot = fs_map_sect(JGFS2_BOOT_SECT, fs.sblk->s_boot_sect, true);
 	
+	check_init();
+	node_csum_init();
+	node_dirty_init();
+	
 	if (new_sblk != NULL) {
 		fs_new_post();
 	}
 	
+	meta_init();
+	ext_init();
+	log_init();
+	
 	if (fs.sblk->s_mtime > time(NULL)) {
 		warnx("last mount time is in the future: %s",
 			ctime((const time_t *)&fs.sblk->s_mtime));
@@ -175,6 +230,14 @@ void fs_init(const char *dev_path,
 
 void fs_done(void) {
 	if (fs.init) {
+		log_done();
+		meta_done();
+		ext_done();
+		tree_done();
+		leaf_bloom_done();
+		node_csum_done();
+		node_dirty_done();
+		
 		fs_unmap_sect(fs.boot, JGFS2_BOOT_SECT, fs.sblk->s_boot_sect);
 		
 		dev_unmap(fs.vbr, JGFS2_VBR_SECT, 1);
@@ -58,6 +58,8 @@ void fs_msync_sect(void *addr, uint32_t sect_num, uint32_t sect_cnt,
 void *fs_map_blk(uint32_t blk_num, uint32_t blk_cnt, bool writable);
 void fs_unmap_blk(void *addr, uint32_t blk_num, uint32_t blk_cnt);
 void fs_msync_blk(void *addr, uint32_t blk_num, uint32_t blk_cnt, bool async);
+void fs_writeback_blk(uint32_t blk_num, uint32_t blk_cnt);
+void fs_fsync(void);
 
 bool fs_sblk_check(const struct jgfs2_super_block *sblk);
 
@@ -7,8 +7,17 @@
 
 #include "jgfs2.h"
 #include "debug.h"
+#include "extent.h"
 #include "fs.h"
+#include "meta.h"
 #include "new.h"
+#include "tree.h"
+
+
+static_assert(JGFS2_STAT_FILL_BUCKETS == NODE_FILL_BUCKETS,
+	"public and tree fill buckets must match");
+static_assert(JGFS2_STAT_LEVEL_MAX == TREE_MAX_DEPTH,
+	"public level limit must match the deepest tree");
 
 
 static bool lib_init = false;
@@ -25,9 +34,118 @@ static void jgfs2_clean_up(void) {
 }
 
 void jgfs2_stat(uint32_t *blk_size, uint32_t *blk_total, uint32_t *blk_used) {
-	/**blk_size  = fs.blk_size;
+	*blk_size  = fs.blk_size;
 	*blk_total = fs.size_blk;
-	*blk_used  = blk_bmap_cnt(true);*/
+	
+	/* nodes set aside for the free space trees count as used */
+	*blk_used = fs.size_blk - ext_free_blk();
+}
+
+/// @brief adds one tree's running totals (and, optionally, its per-level
+/// figures) to statistics that may cover several trees
+/// @param[in]     root_addr  block number of root node
+/// @param[in,out] stats      statistics to add to
+/// @param[in,out] levels     per-level figures to add to, or NULL for none
+static void jgfs2_tree_stats_add(uint32_t root_addr,
+	struct jgfs2_tree_stats *stats, struct tree_level_stats *levels) {
+	struct tree_stats totals = tree_stat(root_addr);
+	
+	if (totals.height > stats->height) {
+		stats->height = totals.height;
+	}
+	stats->nodes   += totals.nodes;
+	stats->items   += totals.items;
+	stats->bytes   += totals.bytes;
+	stats->ovf_blk += totals.ovf_blk;
+	for (uint8_t i = 0; i < JGFS2_STAT_FILL_BUCKETS; ++i) {
+		stats->fill[i] += totals.fill[i];
+	}
+	
+	if (levels != NULL) {
+		struct tree_level_stats walked[TREE_MAX_DEPTH];
+		uint8_t depth = tree_stat_walk(root_addr, &totals, walked);
+		
+		for (uint8_t i = 0; i < depth; ++i) {
+			levels[i].nodes    += walked[i].nodes;
+			levels[i].elems    += walked[i].elems;
+			levels[i].used     += walked[i].used;
+			levels[i].capacity += walked[i].capacity;
+		}
+	}
+}
+
+/// @brief reports on a tree; the running totals are always at hand, while the
+/// figures that need a full walk are only worked out if asked for
+/// @param[in]  tree   which tree
+/// @param[in]  walk   also walk the whole tree (which must not change while
+/// this is going on)
+/// @param[out] stats  statistics
+void jgfs2_tree_stats(enum jgfs2_tree tree, bool walk,
+	struct jgfs2_tree_stats *stats) {
+	memset(stats, 0, sizeof(*stats));
+	
+	struct tree_level_stats levels[TREE_MAX_DEPTH];
+	memset(levels, 0, sizeof(levels));
+	
+	if (tree == JGFS2_TREE_EXT) {
+		jgfs2_tree_stats_add(fs.sblk->s_addr_ext_tree, stats,
+			(walk ? levels : NULL));
+		jgfs2_tree_stats_add(fs.sblk->s_addr_ext_size_tree, stats,
+			(walk ? levels : NULL));
+	} else if (tree == JGFS2_TREE_META) {
+		for (uint32_t i = 0; i < meta_part_cnt(); ++i) {
+			jgfs2_tree_stats_add(meta_part_root(i), stats,
+				(walk ? levels : NULL));
+		}
+	} else {
+		errx("%s: unknown tree: %d", __func__, tree);
+	}
+	
+	if (!walk) {
+		return;
+	}
+	
+	stats->walked = true;
+	
+	/* every level but the bottom one is made of branches, and each elem in
+	 * them is a child; a level could do with as few nodes as it takes to hold
+	 * everything on it when packed full */
+	uint64_t branches = 0, children = 0;
+	uint64_t nodes_min = 0;
+	for (uint8_t i = 0; i < stats->height; ++i) {
+		const struct tree_level_stats *level = levels + i;
+		
+		if (i < stats->height - 1) {
+			branches += level->nodes;
+			children += level->elems;
+		}
+		
+		if (level->capacity != 0) {
+			stats->level_fill[i] = (double)level->used / level->capacity;
+			
+			uint64_t node_cap = level->capacity / level->nodes;
+			nodes_min += (level->used == 0 ? 1 : CEIL(level->used, node_cap));
+		}
+	}
+	
+	stats->fanout  = (branches != 0 ? (double)children / branches : 0.);
+	stats->balance = (stats->nodes != 0 ?
+		(double)nodes_min / stats->nodes : 0.);
+}
+
+/// @brief commits every tree change made so far and waits for it to reach the
+/// device
+void jgfs2_sync(void) {
+	tree_txn_sync();
+	
+	/* the free space trees catch up, even if no group was open */
+	fs_fsync();
+}
+
+/// @brief reports how much checking tree operations have done so far
+/// @param[out] stats  check statistics
+void jgfs2_check_stats(struct jgfs2_check_stats *stats) {
+	*stats = check_stats();
 }
 
 static void jgfs2_init_common(void) {
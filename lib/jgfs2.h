@@ -26,7 +26,7 @@ extern "C" {
 	(((uint16_t)(_maj) * 0x100) + (uint16_t)(_min))
 
 #define JGFS2_VER_MAJOR   0x00
-#define JGFS2_VER_MINOR   0x01
+#define JGFS2_VER_MINOR   0x11
 #define JGFS2_VER_TOTAL   JGFS2_VER_EXPAND(JGFS2_VER_MAJOR, JGFS2_VER_MINOR)
 
 #define JGFS2_MAGIC       "JGF2"
@@ -35,8 +35,18 @@ extern "C" {
 #define JGFS2_SBLK_SECT   1
 #define JGFS2_BOOT_SECT   2
 
-#define JGFS2_LIMIT_LABEL 63
-#define JGFS2_LIMIT_NAME  255
+#define JGFS2_LIMIT_LABEL     63
+#define JGFS2_LIMIT_NAME      255
+#define JGFS2_LIMIT_META_PART 64
+
+#define JGFS2_NODE_SIZE_MIN   0x1000
+#define JGFS2_NODE_SIZE_MAX   0x100000
+
+#define JGFS2_LOG_SIZE_MIN     0x10000
+#define JGFS2_LOG_SIZE_DEFAULT 0x100000
+
+#define JGFS2_STAT_FILL_BUCKETS 8
+#define JGFS2_STAT_LEVEL_MAX    32
 
 
 enum jgfs2_mode {
@@ -61,6 +71,19 @@ enum jgfs2_mode {
 	JGFS2_S_IXOTH = 0000001,
 };
 
+enum jgfs2_tree {
+	JGFS2_TREE_EXT  = 0, // free space trees, by address and by size
+	JGFS2_TREE_META = 1, // metadata tree, all partitions together
+};
+
+enum jgfs2_check_level {
+	JGFS2_CHECK_DEFAULT = 0, // whatever the library was built to do
+	JGFS2_CHECK_OFF     = 1, // no checks
+	JGFS2_CHECK_HEADER  = 2, // header sanity on every node visited
+	JGFS2_CHECK_SAMPLED = 3, // header sanity, plus deep checks on 1 in N ops
+	JGFS2_CHECK_FULL    = 4, // header sanity and deep checks on every node
+};
+
 /*enum jgfs2_attr {
 	JGFS2_A_NONE = 0,
 };*/
@@ -93,10 +116,26 @@ struct __attribute__((__packed__)) jgfs2_super_block {
 	
 	char     s_label[JGFS2_LIMIT_LABEL + 1]; // null-terminated volume label
 	
-	uint32_t s_addr_ext_tree;  // address of extent tree
-	uint32_t s_addr_meta_tree; // address of metadata tree
+	uint32_t s_addr_ext_tree;  // address of free space tree, by address
+	uint32_t s_addr_meta_tree; // address of metadata tree (partition 0)
 	
-	char     s_rsvd[0x18a];
+	uint16_t s_meta_part_cnt;  // number of metadata tree partitions
+	uint32_t s_addr_meta_part[JGFS2_LIMIT_META_PART - 1]; // partitions 1+
+	
+	uint16_t s_ext_node_blk;   // blocks per extent tree node
+	uint16_t s_meta_node_blk;  // blocks per metadata tree node
+	
+	uint32_t s_addr_log;       // address of intent log
+	uint32_t s_log_blk;        // blocks in intent log, header included
+	
+	uint32_t s_addr_ext_size_tree; // address of free space tree, by size
+	uint32_t s_free_blk;       // blocks in the free space trees
+	uint8_t  s_free_clean;     // free space trees were up to date at unmount
+	
+	uint32_t s_addr_stat;      // address of tree statistics table
+	uint32_t s_stat_blk;       // blocks in tree statistics table
+	
+	char     s_rsvd[0x6f];
 };
 
 struct jgfs2_mkfs_param {
@@ -109,13 +148,55 @@ struct jgfs2_mkfs_param {
 	
 	uint16_t blk_size;   // sectors per block; zero: auto-select
 	
+	uint16_t meta_parts; // metadata tree partitions (power of 2); zero: one
+	
+	uint32_t ext_node_size;  // bytes per extent tree node; zero: default
+	uint32_t meta_node_size; // bytes per metadata tree node; zero: default
+	
+	bool     meta_buffered;  // true: metadata trees buffer writes in branches
+	
+	uint32_t log_size;   // bytes for the intent log; zero: default
+	
 	bool     zap_vbr;    // true: zero the volume boot record
 	bool     zap_boot;   // true: zero the boot area
 };
 
+struct jgfs2_tree_stats {
+	uint8_t  height;  // levels, counting the root's and the leaves'
+	uint32_t nodes;   // nodes on every level
+	uint64_t items;   // items in the leaves
+	uint64_t bytes;   // item data, counting overflow items at full length
+	uint32_t ovf_blk; // blocks in overflow extents
+	uint32_t fill[JGFS2_STAT_FILL_BUCKETS]; // leaves by fullness, in eighths
+	
+	/* only filled in by a full walk */
+	bool     walked;
+	double   fanout;  // average children per branch
+	double   balance; // fewest nodes that could hold every level / nodes used
+	double   level_fill[JGFS2_STAT_LEVEL_MAX]; // capacity used, root first
+};
+
+struct jgfs2_check_counter {
+	uint64_t checks; // checks performed
+	uint64_t nsec;   // time spent on them
+};
+
+struct jgfs2_check_stats {
+	struct jgfs2_check_counter header;  // header sanity checks
+	struct jgfs2_check_counter sampled; // deep checks on sampled operations
+	struct jgfs2_check_counter full;    // deep checks at JGFS2_CHECK_FULL
+};
+
 struct jgfs2_mount_options {
 	bool read_only; // disallow write operations
 	bool debug_map; // debug memory mappings
+	
+	uint8_t index_levels; // tree levels to keep indexed in memory; zero: none
+	uint8_t bloom_bits;   // Bloom filter bits per leaf item; zero: no filters
+	
+	uint8_t  check_level;  // tree operation checks (enum jgfs2_check_level)
+	uint32_t check_sample; // JGFS2_CHECK_SAMPLED: 1 in N ops; zero: default
+	bool     check_dirty;  // track written nodes for check_dirty
 };
 
 
@@ -130,6 +211,10 @@ static_assert(sizeof(struct jgfs2_super_block) == 0x200,
 
 
 void jgfs2_stat(uint32_t *blk_size, uint32_t *blk_total, uint32_t *blk_used);
+void jgfs2_tree_stats(enum jgfs2_tree tree, bool walk,
+	struct jgfs2_tree_stats *stats);
+void jgfs2_check_stats(struct jgfs2_check_stats *stats);
+void jgfs2_sync(void);
 
 void jgfs2_init(const char *dev_path,
 	const struct jgfs2_mount_options *mount_opt);
@@ -0,0 +1,545 @@
+/* jgfs2
+ * (c) 2013 Justin Gottula
+ * The source code of this project is distributed under the terms of the
+ * simplified BSD license. See the LICENSE file for details.
+ */
+
+
+#include "log.h"
+#include <errno.h>
+#include <pthread.h>
+#include "crc.h"
+#include "debug.h"
+#include "extent.h"
+#include "fs.h"
+
+
+/* without copy-on-write, making a tree operation durable means writing out
+ * every node it touched, in place; the intent log records the operation
+ * itself instead, so that syncing it is one sequential append and one flush of
+ * the blocks appended to; the trees reach the device later, when a checkpoint
+ * flushes everything, after which the records before it aren't needed anymore
+ * and their space is used again
+ *
+ * on mount, the records after the last checkpoint are replayed in order; each
+ * operation leaves its key in a definite state (there with some item, or not
+ * there), so replaying one whose changes already made it into the trees does
+ * no harm
+ *
+ * two logged operations on the same key must be ordered by the caller, as the
+ * records go in the log in the order the operations began */
+
+
+/* checkpoint in the background once this fraction of the log is in use */
+#define LOG_CKPT_FRAC 2
+
+/* records bigger than this fraction of the log are not logged; the operation
+ * is made durable with a checkpoint instead */
+#define LOG_REC_FRAC  4
+
+
+struct log_state {
+	bool init;
+	bool writable;
+	
+	struct log_hdr *hdr;  // first block of the log
+	uint8_t        *area; // the rest of it, which the records go in
+	uint64_t        area_size;
+	
+	pthread_mutex_t lock;
+	pthread_cond_t  cond; // space freed, operation done, or checkpoint wanted
+	
+	uint64_t head;    // where the next record goes
+	uint64_t flushed; // every record before this is on the device
+	uint64_t ckpt;    // every record before this is in the trees on the device
+	
+	/* operations whose records are in the log but which haven't finished
+	 * changing the tree, by which side of the last checkpoint they began on */
+	uint32_t applying[2];
+	uint8_t  epoch;
+	
+	/* one flush of the log, and one checkpoint, at a time */
+	pthread_mutex_t sync_lock;
+	pthread_mutex_t ckpt_lock;
+	
+	pthread_t ckpt_thread;
+	bool      ckpt_stop;
+	
+	struct log_stats stats;
+};
+
+
+static struct log_state lg = {
+	.init = false,
+	
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+	
+	.sync_lock = PTHREAD_MUTEX_INITIALIZER,
+	.ckpt_lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+
+static uint32_t log_hdr_csum(const struct log_hdr *hdr) {
+	const uint8_t *mem = (const uint8_t *)hdr;
+	size_t off = offsetof(struct log_hdr, csum);
+	
+	uint32_t crc = crc32c(0, mem, off);
+	
+	off += sizeof(hdr->csum);
+	return crc32c(crc, mem + off, sizeof(*hdr) - off);
+}
+
+static uint32_t log_rec_csum(const struct log_rec *rec) {
+	const uint8_t *mem = (const uint8_t *)rec;
+	size_t off = offsetof(struct log_rec, csum) + sizeof(rec->csum);
+	
+	return crc32c(0, mem + off, sizeof(*rec) + rec->data_len - off);
+}
+
+/// @brief writes a checkpoint into the log header, and waits for it to reach
+/// the device
+/// @param[in] ckpt_lsn  lsn that every record before is in the trees
+static void log_hdr_write(uint64_t ckpt_lsn) {
+	lg.hdr->ckpt_lsn = ckpt_lsn;
+	lg.hdr->csum     = log_hdr_csum(lg.hdr);
+	
+	fs_msync_blk(lg.hdr, fs.sblk->s_addr_log, 1, false);
+}
+
+/// @brief writes part of the log out to the device and waits for it to get
+/// there
+/// @param[in] begin  lsn to start at
+/// @param[in] end    lsn to stop at
+static void log_flush(uint64_t begin, uint64_t end) {
+	/* the range wraps around at most once */
+	while (begin < end) {
+		uint64_t off = begin % lg.area_size;
+		uint64_t len = end - begin;
+		if (len > lg.area_size - off) {
+			len = lg.area_size - off;
+		}
+		
+		uint32_t blk_first = off / fs.blk_size;
+		uint32_t blk_end   = CEIL(off + len, fs.blk_size);
+		
+		fs_msync_blk(lg.area + BLK_TO_BYTE((uint64_t)blk_first),
+			fs.sblk->s_addr_log + 1 + blk_first, blk_end - blk_first, false);
+		
+		begin += len;
+	}
+}
+
+/// @brief finds the record at an lsn, if there is a valid one there
+/// @param[in] lsn  lsn of record, which is not where a wrap happens
+/// @return pointer to record, or NULL if there isn't one
+static const struct log_rec *log_rec_at(uint64_t lsn) {
+	uint64_t off = lsn % lg.area_size;
+	const struct log_rec *rec = (const struct log_rec *)(lg.area + off);
+	
+	/* stale records from the last time around have the wrong lsn */
+	if (rec->lsn != lsn || rec->len < sizeof(*rec) ||
+		rec->len % LOG_REC_ALIGN != 0 || rec->len > lg.area_size - off ||
+		sizeof(*rec) + rec->data_len > rec->len) {
+		return NULL;
+	}
+	
+	if (log_rec_csum(rec) != rec->csum) {
+		return NULL;
+	}
+	
+	return rec;
+}
+
+/// @brief determines whether a record at an lsn would have to go after the
+/// wrap instead
+/// @param[in] lsn  where the record would start
+/// @param[in] len  length of record
+/// @return bytes to skip to get to the start of the log, or zero for none
+static uint64_t log_wrap_len(uint64_t lsn, uint32_t len) {
+	uint64_t left = lg.area_size - (lsn % lg.area_size);
+	
+	return (left < sizeof(struct log_rec) || left < len ? left : 0);
+}
+
+/// @brief puts a record in the log, waiting for a checkpoint to make room if
+/// need be; lg.lock must be held
+/// @param[in] op         operation (enum log_op)
+/// @param[in] root_addr  block number of root node
+/// @param[in] key        key
+/// @param[in] item       item, or an empty one for none
+/// @param[in] len        length of record
+/// @return which side of the last checkpoint the operation began on
+static uint8_t log_append(uint8_t op, uint32_t root_addr, const key *key,
+	struct item_data item, uint32_t len) {
+	uint64_t wrap;
+	while ((wrap = log_wrap_len(lg.head, len)),
+		lg.area_size - (lg.head - lg.ckpt) < wrap + len) {
+		pthread_cond_broadcast(&lg.cond);
+		pthread_cond_wait(&lg.cond, &lg.lock);
+	}
+	
+	if (wrap != 0) {
+		/* with too little room for a header, the reader knows to skip ahead
+		 * on its own */
+		if (wrap >= sizeof(struct log_rec)) {
+			struct log_rec *pad =
+				(struct log_rec *)(lg.area + (lg.head % lg.area_size));
+			
+			memset(pad, 0, sizeof(*pad));
+			pad->len  = wrap;
+			pad->lsn  = lg.head;
+			pad->op   = LOG_OP_PAD;
+			pad->csum = log_rec_csum(pad);
+		}
+		
+		lg.head += wrap;
+	}
+	
+	struct log_rec *rec =
+		(struct log_rec *)(lg.area + (lg.head % lg.area_size));
+	
+	rec->len       = len;
+	rec->lsn       = lg.head;
+	rec->op        = op;
+	rec->root_addr = root_addr;
+	rec->key       = *key;
+	rec->data_len  = item.len;
+	
+	if (item.len != 0) {
+		memcpy(rec->data, item.data, item.len);
+	}
+	memset(rec->data + item.len, 0, len - (sizeof(*rec) + item.len));
+	
+	rec->csum = log_rec_csum(rec);
+	
+	lg.head += len;
+	++lg.stats.records;
+	
+	if (lg.head - lg.ckpt >= lg.area_size / LOG_CKPT_FRAC) {
+		pthread_cond_broadcast(&lg.cond);
+	}
+	
+	uint8_t epoch = lg.epoch;
+	++lg.applying[epoch];
+	
+	return epoch;
+}
+
+/// @brief makes an operation's change to its tree
+/// @param[in] op         operation (enum log_op)
+/// @param[in] root_addr  block number of root node
+/// @param[in] key        key
+/// @param[in] item       item, if any
+/// @return for removals, whether the key was there
+static bool log_apply(uint8_t op, uint32_t root_addr, const key *key,
+	struct item_data item) {
+	switch (op) {
+	case LOG_OP_INSERT:
+		tree_insert(root_addr, key, item);
+		return true;
+	case LOG_OP_REMOVE:
+		return tree_remove(root_addr, key);
+	case LOG_OP_UPDATE:
+		tree_remove(root_addr, key);
+		tree_insert(root_addr, key, item);
+		return true;
+	default:
+		errx("%s: unknown op %" PRIu8, __func__, op);
+	}
+}
+
+/// @brief logs an operation and then carries it out
+/// @param[in] op         operation (enum log_op)
+/// @param[in] root_addr  block number of root node
+/// @param[in] key        key
+/// @param[in] item       item, or an empty one for none
+/// @return for removals, whether the key was there
+static bool log_op(uint8_t op, uint32_t root_addr, const key *key,
+	struct item_data item) {
+	if (!lg.writable) {
+		errx("%s: log is not writable", __func__);
+	}
+	
+	uint64_t len = CEIL(sizeof(struct log_rec) + item.len, LOG_REC_ALIGN) *
+		LOG_REC_ALIGN;
+	
+	/* a record this big would keep the log from doing its job */
+	if (len > lg.area_size / LOG_REC_FRAC) {
+		bool result = log_apply(op, root_addr, key, item);
+		log_checkpoint();
+		
+		return result;
+	}
+	
+	pthread_mutex_lock(&lg.lock);
+	uint8_t epoch = log_append(op, root_addr, key, item, len);
+	pthread_mutex_unlock(&lg.lock);
+	
+	bool result = log_apply(op, root_addr, key, item);
+	
+	pthread_mutex_lock(&lg.lock);
+	if (--lg.applying[epoch] == 0) {
+		pthread_cond_broadcast(&lg.cond);
+	}
+	pthread_mutex_unlock(&lg.lock);
+	
+	return result;
+}
+
+/// @brief inserts an item into a tree, logging it first; the key must not
+/// already be there
+/// @param[in] root_addr  block number of root node
+/// @param[in] key        key
+/// @param[in] item       item
+void log_insert(uint32_t root_addr, const key *key, struct item_data item) {
+	log_op(LOG_OP_INSERT, root_addr, key, item);
+}
+
+/// @brief removes an item from a tree, logging it first
+/// @param[in] root_addr  block number of root node
+/// @param[in] key        key
+/// @return true if the key was there
+bool log_remove(uint32_t root_addr, const key *key) {
+	return log_op(LOG_OP_REMOVE, root_addr, key,
+		(struct item_data){ .len = 0, .data = NULL });
+}
+
+/// @brief replaces an item in a tree, or inserts it if the key isn't there,
+/// logging it first
+/// @param[in] root_addr  block number of root node
+/// @param[in] key        key
+/// @param[in] item       item
+void log_update(uint32_t root_addr, const key *key, struct item_data item) {
+	log_op(LOG_OP_UPDATE, root_addr, key, item);
+}
+
+/// @brief makes every logged operation so far durable, by writing the records
+/// out rather than the trees; threads that sync at the same time share a
+/// single flush
+void log_sync(void) {
+	pthread_mutex_lock(&lg.lock);
+	uint64_t target = lg.head;
+	pthread_mutex_unlock(&lg.lock);
+	
+	pthread_mutex_lock(&lg.sync_lock);
+	pthread_mutex_lock(&lg.lock);
+	
+	/* whoever had the flush before may have taken care of this one */
+	if (lg.flushed < target) {
+		uint64_t begin = lg.flushed;
+		uint64_t end   = lg.head;
+		
+		pthread_mutex_unlock(&lg.lock);
+		log_flush(begin, end);
+		pthread_mutex_lock(&lg.lock);
+		
+		if (lg.flushed < end) {
+			lg.flushed = end;
+		}
+		++lg.stats.syncs;
+	}
+	
+	pthread_mutex_unlock(&lg.lock);
+	pthread_mutex_unlock(&lg.sync_lock);
+}
+
+/// @brief flushes the trees to the device, so that the records logged so far
+/// aren't needed anymore
+void log_checkpoint(void) {
+	pthread_mutex_lock(&lg.ckpt_lock);
+	pthread_mutex_lock(&lg.lock);
+	
+	uint64_t target = lg.head;
+	
+	/* operations that began before this have to finish changing their trees
+	 * before the trees are flushed; ones that begin after are counted apart */
+	uint8_t epoch = lg.epoch;
+	lg.epoch ^= 1;
+	
+	while (lg.applying[epoch] != 0) {
+		pthread_cond_wait(&lg.cond, &lg.lock);
+	}
+	
+	pthread_mutex_unlock(&lg.lock);
+	
+	if (target != lg.ckpt) {
+		/* the nodes were changed in place, so whatever the kernel hasn't
+		 * written yet goes out with the rest of the device (the log too) */
+		fs_fsync();
+		log_hdr_write(target);
+		
+		pthread_mutex_lock(&lg.lock);
+		
+		lg.ckpt = target;
+		if (lg.flushed < target) {
+			lg.flushed = target;
+		}
+		++lg.stats.checkpoints;
+		
+		pthread_cond_broadcast(&lg.cond);
+		pthread_mutex_unlock(&lg.lock);
+	}
+	
+	pthread_mutex_unlock(&lg.ckpt_lock);
+}
+
+/// @brief gets the log's totals so far
+/// @return totals
+struct log_stats log_stats(void) {
+	pthread_mutex_lock(&lg.lock);
+	
+	struct log_stats stats = lg.stats;
+	stats.used = lg.head - lg.ckpt;
+	stats.size = lg.area_size;
+	
+	pthread_mutex_unlock(&lg.lock);
+	
+	return stats;
+}
+
+static void *log_ckpt_main(void *arg) {
+	pthread_mutex_lock(&lg.lock);
+	
+	while (!lg.ckpt_stop) {
+		if (lg.head - lg.ckpt < lg.area_size / LOG_CKPT_FRAC) {
+			pthread_cond_wait(&lg.cond, &lg.lock);
+			continue;
+		}
+		
+		pthread_mutex_unlock(&lg.lock);
+		log_checkpoint();
+		pthread_mutex_lock(&lg.lock);
+	}
+	
+	pthread_mutex_unlock(&lg.lock);
+	
+	return NULL;
+}
+
+/// @brief goes through the records after the last checkpoint, replaying them
+/// @param[in] apply  actually replay them, rather than just count them
+/// @return lsn after the last valid record
+static uint64_t log_replay(bool apply) {
+	uint64_t lsn = lg.ckpt;
+	
+	while (lsn - lg.ckpt < lg.area_size) {
+		uint64_t left = lg.area_size - (lsn % lg.area_size);
+		if (left < sizeof(struct log_rec)) {
+			lsn += left;
+			continue;
+		}
+		
+		const struct log_rec *rec = log_rec_at(lsn);
+		if (rec == NULL) {
+			break;
+		}
+		
+		if (rec->op != LOG_OP_PAD) {
+			if (apply) {
+				struct item_data item = {
+					.len  = rec->data_len,
+					.data = (void *)rec->data,
+				};
+				
+				/* the insert may have made it into the tree already */
+				key rec_key = rec->key;
+				log_apply((rec->op == LOG_OP_INSERT ? LOG_OP_UPDATE : rec->op),
+					rec->root_addr, &rec_key, item);
+			}
+			
+			++lg.stats.replayed;
+		}
+		
+		lsn += rec->len;
+	}
+	
+	return lsn;
+}
+
+/// @brief reserves and clears the log on a new filesystem
+void log_new(void) {
+	fs.sblk->s_addr_log = ext_alloc(fs.sblk->s_log_blk, EXT_TYPE_META, 0);
+	
+	void *log = fs_map_blk(fs.sblk->s_addr_log, fs.sblk->s_log_blk, true);
+	memset(log, 0, BLK_TO_BYTE((uint64_t)fs.sblk->s_log_blk));
+	
+	struct log_hdr *hdr = log;
+	memcpy(hdr->magic, LOG_MAGIC, sizeof(hdr->magic));
+	hdr->ckpt_lsn = 0;
+	hdr->csum     = log_hdr_csum(hdr);
+	
+	fs_msync_blk(log, fs.sblk->s_addr_log, fs.sblk->s_log_blk, false);
+	fs_unmap_blk(log, fs.sblk->s_addr_log, fs.sblk->s_log_blk);
+}
+
+/// @brief maps the log, replays whatever an unclean shutdown left in it, and
+/// starts checkpointing in the background
+void log_init(void) {
+	lg.writable = !fs.mount_opt.read_only;
+	
+	lg.hdr = fs_map_blk(fs.sblk->s_addr_log, fs.sblk->s_log_blk, lg.writable);
+	lg.area      = (uint8_t *)lg.hdr + fs.blk_size;
+	lg.area_size = BLK_TO_BYTE((uint64_t)fs.sblk->s_log_blk - 1);
+	
+	if (memcmp(lg.hdr->magic, LOG_MAGIC, sizeof(lg.hdr->magic)) != 0 ||
+		log_hdr_csum(lg.hdr) != lg.hdr->csum) {
+		errx("%s: invalid log header", __func__);
+	}
+	
+	memset(&lg.stats, 0, sizeof(lg.stats));
+	lg.applying[0] = lg.applying[1] = 0;
+	lg.epoch = 0;
+	
+	lg.ckpt = lg.hdr->ckpt_lsn;
+	
+	lg.head = lg.flushed = log_replay(lg.writable);
+	
+	if (!lg.writable) {
+		if (lg.stats.replayed != 0) {
+			warnx("%" PRIu64 " log records need replaying, which a read-only "
+				"mount can't do", lg.stats.replayed);
+		}
+		
+		lg.init = true;
+		return;
+	}
+	
+	if (lg.stats.replayed != 0) {
+		warnx("replayed %" PRIu64 " log records", lg.stats.replayed);
+		log_checkpoint();
+	}
+	
+	lg.ckpt_stop = false;
+	if ((errno = pthread_create(&lg.ckpt_thread, NULL, log_ckpt_main,
+		NULL)) != 0) {
+		err("%s: pthread_create failed", __func__);
+	}
+	
+	lg.init = true;
+}
+
+/// @brief stops background checkpointing and takes one last checkpoint, so
+/// that there is nothing to replay on the next mount
+void log_done(void) {
+	if (!lg.init) {
+		return;
+	}
+	
+	if (lg.writable) {
+		pthread_mutex_lock(&lg.lock);
+		lg.ckpt_stop = true;
+		pthread_cond_broadcast(&lg.cond);
+		pthread_mutex_unlock(&lg.lock);
+		
+		pthread_join(lg.ckpt_thread, NULL);
+		
+		log_checkpoint();
+	}
+	
+	fs_unmap_blk(lg.hdr, fs.sblk->s_addr_log, fs.sblk->s_log_blk);
+	
+	lg.hdr  = NULL;
+	lg.area = NULL;
+	lg.init = false;
+}
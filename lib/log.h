@@ -0,0 +1,77 @@
+/* jgfs2
+ * (c) 2013 Justin Gottula
+ * The source code of this project is distributed under the terms of the
+ * simplified BSD license. See the LICENSE file for details.
+ */
+
+
+#ifndef JGFS2_LIB_LOG_H
+#define JGFS2_LIB_LOG_H
+
+
+#include "jgfs2.h"
+#include "tree.h"
+
+
+#define LOG_MAGIC "JGFL"
+
+/* records start on boundaries of this many bytes */
+#define LOG_REC_ALIGN 8
+
+
+enum log_op {
+	LOG_OP_PAD    = 0, // filler up to the end of the log, where it wraps
+	LOG_OP_INSERT = 1, // key was inserted
+	LOG_OP_REMOVE = 2, // key was removed, if it was there
+	LOG_OP_UPDATE = 3, // key was set to the item, whether it was there or not
+};
+
+
+/* first block of the log */
+struct __attribute__((__packed__)) log_hdr {
+	char     magic[4]; // must be "JGFL"
+	uint32_t csum;     // CRC-32C of the header, skipping this field
+	
+	uint64_t ckpt_lsn; // every record before this is in the trees
+};
+
+/* each record starts at its lsn, which is the number of bytes written to the
+ * log before it (wrapping around the blocks after the header) */
+struct __attribute__((__packed__)) log_rec {
+	uint32_t csum;      // CRC-32C of the rest of the record, payload included
+	uint32_t len;       // bytes in the record, padding included
+	uint64_t lsn;       // where the record starts
+	
+	uint8_t  op;        // enum log_op
+	uint32_t root_addr; // tree operated on
+	key      key;
+	
+	uint32_t data_len;  // payload length
+	uint8_t  data[];
+};
+
+struct log_stats {
+	uint64_t records;     // records appended
+	uint64_t syncs;       // flushes of the log to the device
+	uint64_t checkpoints; // checkpoints taken
+	uint64_t replayed;    // records replayed when mounted
+	
+	uint64_t used;        // bytes of records not yet checkpointed
+	uint64_t size;        // bytes the log can hold
+};
+
+
+void log_insert(uint32_t root_addr, const key *key, struct item_data item);
+bool log_remove(uint32_t root_addr, const key *key);
+void log_update(uint32_t root_addr, const key *key, struct item_data item);
+
+void log_sync(void);
+void log_checkpoint(void);
+struct log_stats log_stats(void);
+
+void log_new(void);
+void log_init(void);
+void log_done(void);
+
+
+#endif
@@ -0,0 +1,151 @@
+/* jgfs2
+ * (c) 2013 Justin Gottula
+ * The source code of this project is distributed under the terms of the
+ * simplified BSD license. See the LICENSE file for details.
+ */
+
+
+#include "meta.h"
+#include <pthread.h>
+#include <sched.h>
+#include "debug.h"
+#include "extent.h"
+#include "fs.h"
+#include "tree.h"
+
+
+/* the meta tree is split by key id into equal ranges, each with its own root;
+ * partition p holds ids [p << part_shift, (p + 1) << part_shift), so that
+ * finding a partition is a shift and finding its root is an array lookup */
+struct meta_part {
+	pthread_mutex_t lock;
+	
+	uint32_t root;
+	
+	/* allocator hint: lowest id in this partition not known to be in use */
+	uint64_t next_id;
+	uint64_t end_id;
+} __attribute__((__aligned__(64)));
+
+
+static uint32_t part_cnt = 0;
+static uint8_t  part_shift;
+static struct meta_part parts[JGFS2_LIMIT_META_PART];
+
+
+/* the super block is packed, so its fields can't be reached through pointers */
+static uint32_t meta_part_get_addr(uint32_t part) {
+	if (part == 0) {
+		return fs.sblk->s_addr_meta_tree;
+	} else {
+		return fs.sblk->s_addr_meta_part[part - 1];
+	}
+}
+
+static void meta_part_set_addr(uint32_t part, uint32_t addr) {
+	if (part == 0) {
+		fs.sblk->s_addr_meta_tree = addr;
+	} else {
+		fs.sblk->s_addr_meta_part[part - 1] = addr;
+	}
+}
+
+uint32_t meta_part_cnt(void) {
+	return part_cnt;
+}
+
+/// @brief finds the partition that a key id belongs to
+/// @param[in] id  key id
+/// @return partition number
+uint32_t meta_part_of(uint32_t id) {
+	return (part_shift >= 32 ? 0 : id >> part_shift);
+}
+
+/// @brief gets the root of a partition
+/// @param[in] part  partition number
+/// @return block number of the partition's root node
+uint32_t meta_part_root(uint32_t part) {
+	if (part >= part_cnt) {
+		errx("%s: part >= part_cnt: part %" PRIu32 " part_cnt %" PRIu32,
+			__func__, part, part_cnt);
+	}
+	
+	return parts[part].root;
+}
+
+/// @brief gets the root of the partition that a key id belongs to
+/// @param[in] id  key id
+/// @return block number of the partition's root node
+uint32_t meta_root(uint32_t id) {
+	return parts[meta_part_of(id)].root;
+}
+
+/// @brief allocates an unused key id, preferring the partition that belongs to
+/// the current cpu so that concurrent creates stay out of each other's way
+/// @return new key id
+uint32_t meta_alloc_id(void) {
+	int cpu = sched_getcpu();
+	uint32_t first = (cpu < 0 ? 0 : (uint32_t)cpu % part_cnt);
+	
+	for (uint32_t i = 0; i < part_cnt; ++i) {
+		struct meta_part *part = parts + ((first + i) % part_cnt);
+		
+		pthread_mutex_lock(&part->lock);
+		if (part->next_id < part->end_id) {
+			uint32_t id = part->next_id++;
+			
+			pthread_mutex_unlock(&part->lock);
+			return id;
+		}
+		pthread_mutex_unlock(&part->lock);
+	}
+	
+	errx("%s: all %" PRIu32 " partitions are out of ids", __func__, part_cnt);
+}
+
+/// @brief allocates and initializes the roots of all partitions on a new
+/// filesystem
+/// @param[in] flags  tree flavor for every partition (enum node_flag)
+void meta_new(uint8_t flags) {
+	uint32_t hint = 0;
+	for (uint32_t i = 0; i < fs.sblk->s_meta_part_cnt; ++i) {
+		uint32_t addr = node_alloc(fs.sblk->s_meta_node_blk, hint);
+		hint = addr + fs.sblk->s_meta_node_blk;
+		
+		meta_part_set_addr(i, addr);
+		tree_init(addr, fs.sblk->s_meta_node_blk, flags);
+	}
+}
+
+void meta_init(void) {
+	part_cnt   = fs.sblk->s_meta_part_cnt;
+	part_shift = 32 - __builtin_ctz(part_cnt);
+	
+	for (uint32_t i = 0; i < part_cnt; ++i) {
+		struct meta_part *part = parts + i;
+		
+		pthread_mutex_init(&part->lock, NULL);
+		
+		part->root    = meta_part_get_addr(i);
+		part->next_id = (part_shift >= 32 ? 0 : (uint64_t)i << part_shift);
+		part->end_id  = (part_shift >= 32 ? UINT64_C(1) << 32 :
+			(uint64_t)(i + 1) << part_shift);
+		
+		tree_stat_open(part->root);
+		
+		/* ids are handed out in increasing order, so the next free one is past
+		 * the last key in the tree */
+		key last;
+		if (tree_last_key(part->root, &last)) {
+			part->next_id = (uint64_t)last.id + 1;
+		}
+	}
+}
+
+void meta_done(void) {
+	for (uint32_t i = 0; i < part_cnt; ++i) {
+		pthread_mutex_destroy(&parts[i].lock);
+	}
+	
+	part_cnt = 0;
+}
@@ -0,0 +1,27 @@
+/* jgfs2
+ * (c) 2013 Justin Gottula
+ * The source code of this project is distributed under the terms of the
+ * simplified BSD license. See the LICENSE file for details.
+ */
+
+
+#ifndef JGFS2_LIB_META_H
+#define JGFS2_LIB_META_H
+
+
+#include "jgfs2.h"
+
+
+uint32_t meta_part_cnt(void);
+uint32_t meta_part_of(uint32_t id);
+uint32_t meta_part_root(uint32_t part);
+uint32_t meta_root(uint32_t id);
+
+uint32_t meta_alloc_id(void);
+
+void meta_new(uint8_t flags);
+void meta_init(void);
+void meta_done(void);
+
+
+#endif
@@ -14,12 +14,17 @@
 #include "dev.h"
 #include "extent.h"
 #include "fs.h"
+#include "log.h"
+#include "meta.h"
 #include "tree.h"
 
 
 /* use page-size blocks */
 #define JGFS2_DEFAULT_BLK_SIZE (PAGE_SIZE / JGFS2_SECT_SIZE)
 
+/* use nodes the size of a typical page, unless told otherwise */
+#define JGFS2_DEFAULT_NODE_SIZE 0x1000
+
 /* allocate one inode for every 4 blocks */
 #define JGFS2_DEFAULT_INODE_RATIO 4
 
@@ -28,6 +33,48 @@ struct jgfs2_mkfs_param mkfs_param;
 struct jgfs2_super_block new_sblk;
 
 
+static uint16_t fs_new_node_blk(const char *tree_name, uint32_t node_size) {
+	uint32_t blk_byte = SECT_TO_BYTE(mkfs_param.blk_size);
+	
+	if (node_size == 0) {
+		node_size = JGFS2_DEFAULT_NODE_SIZE;
+	} else if (node_size < JGFS2_NODE_SIZE_MIN ||
+		node_size > JGFS2_NODE_SIZE_MAX ||
+		(node_size & (node_size - 1)) != 0) {
+		errx("%s tree node size must be a power of 2 from %d to %d bytes",
+			tree_name, JGFS2_NODE_SIZE_MIN, JGFS2_NODE_SIZE_MAX);
+	}
+	
+	/* a node is never smaller than a block */
+	if (node_size <= blk_byte) {
+		return 1;
+	} else if (node_size % blk_byte != 0) {
+		errx("%s tree node size must be a multiple of the block size",
+			tree_name);
+	}
+	
+	return node_size / blk_byte;
+}
+
+static uint32_t fs_new_log_blk(uint32_t log_size) {
+	if (log_size == 0) {
+		log_size = JGFS2_LOG_SIZE_DEFAULT;
+	} else if (log_size < JGFS2_LOG_SIZE_MIN) {
+		errx("intent log size must be at least %d bytes", JGFS2_LOG_SIZE_MIN);
+	}
+	
+	/* the header takes a block of its own */
+	uint32_t log_blk = CEIL(log_size, SECT_TO_BYTE(mkfs_param.blk_size));
+	
+	/* it is allocated in one piece, which has to fit in an allocation group */
+	if (log_blk > EXT_GROUP_BLK) {
+		errx("intent log size must be at most %" PRIu32 " blocks",
+			(uint32_t)EXT_GROUP_BLK);
+	}
+	
+	return (log_blk < 2 ? 2 : log_blk);
+}
+
 void fs_new_init_root_dir(void) {
 	/*struct jgfs2_inode *root_inode;
 	root_inode = inode_get(0);
@@ -73,6 +120,28 @@ const struct jgfs2_super_block *fs_new(const char *dev_path,
 			SECT_TO_BYTE(mkfs_param.blk_size));
 	}
 	
+	if (mkfs_param.meta_parts == 0) {
+		mkfs_param.meta_parts = 1;
+	} else if (mkfs_param.meta_parts > JGFS2_LIMIT_META_PART ||
+		(mkfs_param.meta_parts & (mkfs_param.meta_parts - 1)) != 0) {
+		errx("meta tree partitions must be a power of 2 no greater than %d",
+			JGFS2_LIMIT_META_PART);
+	}
+	
+	uint16_t ext_node_blk  = fs_new_node_blk("ext", mkfs_param.ext_node_size);
+	uint16_t meta_node_blk = fs_new_node_blk("meta",
+		mkfs_param.meta_node_size);
+	
+	warnx("using %" PRIu32 "-byte ext tree nodes, %" PRIu32
+		"-byte meta tree nodes",
+		SECT_TO_BYTE((uint32_t)ext_node_blk * mkfs_param.blk_size),
+		SECT_TO_BYTE((uint32_t)meta_node_blk * mkfs_param.blk_size));
+	
+	uint32_t log_blk = fs_new_log_blk(mkfs_param.log_size);
+	
+	warnx("using a %" PRIu32 "-byte intent log",
+		SECT_TO_BYTE(log_blk * mkfs_param.blk_size));
+	
 	TODO("device size checks");
 	/* note that not all size variables have been initialized at this point */
 	
@@ -86,6 +155,13 @@ const struct jgfs2_super_block *fs_new(const char *dev_path,
 	
 	new_sblk.s_blk_size = mkfs_param.blk_size;
 	
+	new_sblk.s_meta_part_cnt = mkfs_param.meta_parts;
+	
+	new_sblk.s_ext_node_blk  = ext_node_blk;
+	new_sblk.s_meta_node_blk = meta_node_blk;
+	
+	new_sblk.s_log_blk = log_blk;
+	
 	new_sblk.s_ctime = time(NULL);
 	new_sblk.s_mtime = 0;
 	
@@ -120,23 +196,27 @@ void fs_new_post(void) {
 		SECT_TO_BYTE(JGFS2_BOOT_SECT + fs.sblk->s_boot_sect));
 	fs_unmap_sect(slack, JGFS2_BOOT_SECT, fs.sblk->s_boot_sect);
 	
-	fs.sblk->s_addr_ext_tree  = ext_alloc(1);
-	fs.sblk->s_addr_meta_tree = ext_alloc(1);
+	ext_new();
+	log_new();
+	tree_stat_new();
+	
+	meta_new(mkfs_param.meta_buffered ? NODE_BUFFERED : 0);
 	
-	tree_init(fs.sblk->s_addr_ext_tree);
-	tree_init(fs.sblk->s_addr_meta_tree);
+	/* the free space trees are read back in when the filesystem is mounted */
+	ext_flush();
 	
 	tree_dump(fs.sblk->s_addr_ext_tree);
+	tree_dump(fs.sblk->s_addr_ext_size_tree);
 	tree_dump(fs.sblk->s_addr_meta_tree);
 	
 	/* init tree roots */
 	/* set used areas as allocated */
 	/* add root dir to meta tree */
 	
-	TODO("ext tree init");
 	TODO("meta tree init");
 	TODO("root dir and other items");
 	
 	check_print(check_tree(fs.sblk->s_addr_ext_tree), true);
+	check_print(check_tree(fs.sblk->s_addr_ext_size_tree), true);
 	check_print(check_tree(fs.sblk->s_addr_meta_tree), true);
 }
@@ -0,0 +1,376 @@
+/* jgfs2
+ * (c) 2013 Justin Gottula
+ * The source code of this project is distributed under the terms of the
+ * simplified BSD license. See the LICENSE file for details.
+ */
+
+
+#include "rbtree.h"
+
+
+/* an intrusive red-black tree, for indexes that only ever live in memory;
+ * nodes are embedded in whatever they index, and a struct can be in several
+ * trees at once by embedding a node for each */
+
+
+static bool rb_red(const struct rb_node *node) {
+	return (node != NULL && node->red);
+}
+
+/// @brief points a node's parent (or the tree, for the root) at a new child
+/// in place of the old one
+/// @param[in] tree    tree
+/// @param[in] parent  parent of the old child, or NULL if it is the root
+/// @param[in] old     old child
+/// @param[in] new     new child, or NULL
+static void rb_set_child(struct rb_tree *tree, struct rb_node *parent,
+	const struct rb_node *old, struct rb_node *new) {
+	if (parent == NULL) {
+		tree->root = new;
+	} else if (parent->left == old) {
+		parent->left = new;
+	} else {
+		parent->right = new;
+	}
+}
+
+static void rb_rotate_left(struct rb_tree *tree, struct rb_node *node) {
+	struct rb_node *pivot = node->right;
+	
+	node->right = pivot->left;
+	if (pivot->left != NULL) {
+		pivot->left->parent = node;
+	}
+	
+	pivot->parent = node->parent;
+	rb_set_child(tree, node->parent, node, pivot);
+	
+	pivot->left  = node;
+	node->parent = pivot;
+}
+
+static void rb_rotate_right(struct rb_tree *tree, struct rb_node *node) {
+	struct rb_node *pivot = node->left;
+	
+	node->left = pivot->right;
+	if (pivot->right != NULL) {
+		pivot->right->parent = node;
+	}
+	
+	pivot->parent = node->parent;
+	rb_set_child(tree, node->parent, node, pivot);
+	
+	pivot->right = node;
+	node->parent = pivot;
+}
+
+/// @brief sets up an empty tree
+/// @param[in] tree  tree
+/// @param[in] cmp   ordering of nodes
+void rb_init(struct rb_tree *tree, rb_cmp_func cmp) {
+	tree->root = NULL;
+	tree->cmp  = cmp;
+	tree->cnt  = 0;
+}
+
+/// @brief adds a node to a tree; nodes that compare equal go in after the ones
+/// already there
+/// @param[in] tree  tree
+/// @param[in] node  node, not in any tree
+void rb_insert(struct rb_tree *tree, struct rb_node *node) {
+	struct rb_node *parent = NULL;
+	struct rb_node **link  = &tree->root;
+	
+	while (*link != NULL) {
+		parent = *link;
+		link = (tree->cmp(node, parent) < 0 ? &parent->left : &parent->right);
+	}
+	
+	node->parent = parent;
+	node->left   = NULL;
+	node->right  = NULL;
+	node->red    = true;
+	
+	*link = node;
+	++tree->cnt;
+	
+	/* a red node with a red parent is the only thing that can be wrong; the
+	 * root is black, so a red parent always has a parent of its own */
+	while ((parent = node->parent) != NULL && parent->red) {
+		struct rb_node *grand = parent->parent;
+		
+		if (parent == grand->left) {
+			struct rb_node *uncle = grand->right;
+			
+			if (rb_red(uncle)) {
+				parent->red = false;
+				uncle->red  = false;
+				grand->red  = true;
+				
+				node = grand;
+				continue;
+			}
+			
+			if (node == parent->right) {
+				rb_rotate_left(tree, parent);
+				parent = node;
+			}
+			
+			parent->red = false;
+			grand->red  = true;
+			rb_rotate_right(tree, grand);
+			
+			/* the top of this subtree is black again */
+			break;
+		} else {
+			struct rb_node *uncle = grand->left;
+			
+			if (rb_red(uncle)) {
+				parent->red = false;
+				uncle->red  = false;
+				grand->red  = true;
+				
+				node = grand;
+				continue;
+			}
+			
+			if (node == parent->left) {
+				rb_rotate_right(tree, parent);
+				parent = node;
+			}
+			
+			parent->red = false;
+			grand->red  = true;
+			rb_rotate_left(tree, grand);
+			
+			/* the top of this subtree is black again */
+			break;
+		}
+	}
+	
+	tree->root->red = false;
+}
+
+/// @brief restores the balance of a tree after a black node was taken out
+/// @param[in] tree    tree
+/// @param[in] node    node that took the removed node's place, or NULL
+/// @param[in] parent  parent of that place
+static void rb_remove_fixup(struct rb_tree *tree, struct rb_node *node,
+	struct rb_node *parent) {
+	/* the path through node is one black node short */
+	while (node != tree->root && !rb_red(node)) {
+		if (node == parent->left) {
+			struct rb_node *sib = parent->right;
+			
+			if (sib->red) {
+				sib->red    = false;
+				parent->red = true;
+				rb_rotate_left(tree, parent);
+				
+				sib = parent->right;
+			}
+			
+			if (!rb_red(sib->left) && !rb_red(sib->right)) {
+				sib->red = true;
+				
+				node   = parent;
+				parent = node->parent;
+				continue;
+			}
+			
+			if (!rb_red(sib->right)) {
+				sib->left->red = false;
+				sib->red       = true;
+				rb_rotate_right(tree, sib);
+				
+				sib = parent->right;
+			}
+			
+			sib->red        = parent->red;
+			parent->red     = false;
+			sib->right->red = false;
+			rb_rotate_left(tree, parent);
+		} else {
+			struct rb_node *sib = parent->left;
+			
+			if (sib->red) {
+				sib->red    = false;
+				parent->red = true;
+				rb_rotate_right(tree, parent);
+				
+				sib = parent->left;
+			}
+			
+			if (!rb_red(sib->left) && !rb_red(sib->right)) {
+				sib->red = true;
+				
+				node   = parent;
+				parent = node->parent;
+				continue;
+			}
+			
+			if (!rb_red(sib->left)) {
+				sib->right->red = false;
+				sib->red        = true;
+				rb_rotate_left(tree, sib);
+				
+				sib = parent->left;
+			}
+			
+			sib->red       = parent->red;
+			parent->red    = false;
+			sib->left->red = false;
+			rb_rotate_right(tree, parent);
+		}
+		
+		node = tree->root;
+	}
+	
+	if (node != NULL) {
+		node->red = false;
+	}
+}
+
+/// @brief takes a node out of a tree
+/// @param[in] tree  tree
+/// @param[in] node  node, which must be in the tree
+void rb_remove(struct rb_tree *tree, struct rb_node *node) {
+	struct rb_node *child, *parent;
+	bool red;
+	
+	if (node->left == NULL || node->right == NULL) {
+		child  = (node->left != NULL ? node->left : node->right);
+		parent = node->parent;
+		red    = node->red;
+		
+		if (child != NULL) {
+			child->parent = parent;
+		}
+		rb_set_child(tree, parent, node, child);
+	} else {
+		/* the successor has no left child, so it comes out easily, and then
+		 * takes the node's place (and color) */
+		struct rb_node *succ = node->right;
+		while (succ->left != NULL) {
+			succ = succ->left;
+		}
+		
+		child = succ->right;
+		red   = succ->red;
+		
+		if (succ->parent == node) {
+			parent = succ;
+		} else {
+			parent = succ->parent;
+			
+			if (child != NULL) {
+				child->parent = parent;
+			}
+			parent->left = child;
+			
+			succ->right = node->right;
+			node->right->parent = succ;
+		}
+		
+		succ->left = node->left;
+		node->left->parent = succ;
+		
+		succ->parent = node->parent;
+		rb_set_child(tree, node->parent, node, succ);
+		
+		succ->red = node->red;
+	}
+	
+	--tree->cnt;
+	
+	if (!red) {
+		rb_remove_fixup(tree, child, parent);
+	}
+}
+
+/// @brief finds the least node in a tree
+/// @param[in] tree  tree
+/// @return node, or NULL if the tree is empty
+struct rb_node *rb_first(const struct rb_tree *tree) {
+	struct rb_node *node = tree->root;
+	
+	while (node != NULL && node->left != NULL) {
+		node = node->left;
+	}
+	
+	return node;
+}
+
+/// @brief finds the greatest node in a tree
+/// @param[in] tree  tree
+/// @return node, or NULL if the tree is empty
+struct rb_node *rb_last(const struct rb_tree *tree) {
+	struct rb_node *node = tree->root;
+	
+	while (node != NULL && node->right != NULL) {
+		node = node->right;
+	}
+	
+	return node;
+}
+
+/// @brief finds the node after a node
+/// @param[in] node  node
+/// @return next node, or NULL if this is the last one
+struct rb_node *rb_next(const struct rb_node *node) {
+	if (node->right != NULL) {
+		node = node->right;
+		while (node->left != NULL) {
+			node = node->left;
+		}
+		
+		return (struct rb_node *)node;
+	}
+	
+	while (node->parent != NULL && node == node->parent->right) {
+		node = node->parent;
+	}
+	
+	return node->parent;
+}
+
+/// @brief finds the node before a node
+/// @param[in] node  node
+/// @return previous node, or NULL if this is the first one
+struct rb_node *rb_prev(const struct rb_node *node) {
+	if (node->left != NULL) {
+		node = node->left;
+		while (node->right != NULL) {
+			node = node->right;
+		}
+		
+		return (struct rb_node *)node;
+	}
+	
+	while (node->parent != NULL && node == node->parent->left) {
+		node = node->parent;
+	}
+	
+	return node->parent;
+}
+
+/// @brief finds the least node that is not less than a probe
+/// @param[in] tree   tree
+/// @param[in] probe  node to compare against, which need not be in the tree
+/// @return node, or NULL if every node is less than the probe
+struct rb_node *rb_lower_bound(const struct rb_tree *tree,
+	const struct rb_node *probe) {
+	struct rb_node *node  = tree->root;
+	struct rb_node *found = NULL;
+	
+	while (node != NULL) {
+		if (tree->cmp(node, probe) < 0) {
+			node = node->right;
+		} else {
+			found = node;
+			node  = node->left;
+		}
+	}
+	
+	return found;
+}
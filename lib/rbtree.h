@@ -0,0 +1,52 @@
+/* jgfs2
+ * (c) 2013 Justin Gottula
+ * The source code of this project is distributed under the terms of the
+ * simplified BSD license. See the LICENSE file for details.
+ */
+
+
+#ifndef JGFS2_LIB_RBTREE_H
+#define JGFS2_LIB_RBTREE_H
+
+
+#include "jgfs2.h"
+
+
+/* gets the struct that an rb_node is embedded in */
+#define rb_entry(_node, _type, _member) \
+	((_type *)((char *)(_node) - offsetof(_type, _member)))
+
+
+struct rb_node {
+	struct rb_node *parent;
+	struct rb_node *left;
+	struct rb_node *right;
+	
+	bool red;
+};
+
+/* orders two nodes: negative, zero or positive, as with memcmp */
+typedef int (*rb_cmp_func)(const struct rb_node *lhs,
+	const struct rb_node *rhs);
+
+struct rb_tree {
+	struct rb_node *root;
+	rb_cmp_func cmp;
+	
+	size_t cnt;
+};
+
+
+void rb_init(struct rb_tree *tree, rb_cmp_func cmp);
+void rb_insert(struct rb_tree *tree, struct rb_node *node);
+void rb_remove(struct rb_tree *tree, struct rb_node *node);
+
+struct rb_node *rb_first(const struct rb_tree *tree);
+struct rb_node *rb_last(const struct rb_tree *tree);
+struct rb_node *rb_next(const struct rb_node *node);
+struct rb_node *rb_prev(const struct rb_node *node);
+struct rb_node *rb_lower_bound(const struct rb_tree *tree,
+	const struct rb_node *probe);
+
+
+#endif
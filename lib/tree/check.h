@@ -16,6 +16,23 @@
 #include "tree.h"
 
 
+/* the most checking tree operations will do, whatever the filesystem is
+ * mounted with; building with -DCHECK_LEVEL_MAX=JGFS2_CHECK_OFF compiles the
+ * checks out of them entirely */
+#ifndef CHECK_LEVEL_MAX
+#define CHECK_LEVEL_MAX JGFS2_CHECK_FULL
+#endif
+
+/* how much checking a filesystem mounted with JGFS2_CHECK_DEFAULT gets */
+#ifndef CHECK_LEVEL_DEFAULT
+#define CHECK_LEVEL_DEFAULT JGFS2_CHECK_HEADER
+#endif
+
+/* with JGFS2_CHECK_SAMPLED, deep checks are done on 1 in this many operations
+ * unless the mount options say otherwise */
+#define CHECK_SAMPLE_DEFAULT 64
+
+
 enum check_result_type {
 	RESULT_TYPE_OK     = 0,
 	RESULT_TYPE_TREE   = 1,
@@ -32,22 +49,28 @@ enum check_error_code {
 	ERR_TREE_NEXT_ORDER = 4,    // next->next goes backwards
 	ERR_TREE_PREV_SKIP  = 5,    // prev->prev skips a node
 	ERR_TREE_PREV_ORDER = 6,    // prev->prev goes forwards
+	ERR_TREE_LEVEL      = 7,    // leaf above the bottom level, or vice versa
 	
 	ERR_NODE_THIS     = 0,      // hdr.this is wrong
 	ERR_NODE_EMPTY    = 1,      // !root and no elems
 	ERR_NODE_OVERFLOW = 2,      // too much item data
 	ERR_NODE_SORT     = 3,      // key[0] > key[1]
 	ERR_NODE_DUPE     = 4,      // key @ elem_idx[0] == key @ elem_idx[1]
-	#warning generalize prev/next and depth checks to all nodes
+	ERR_NODE_PREFIX   = 5,      // leaf key prefix too long
+	ERR_NODE_SIZE     = 6,      // size differs from parent's
+	ERR_NODE_HEADER   = 7,      // hdr field out of range
 	
 	ERR_BRANCH_PARENT      = 1, // hdr.this != child.parent
 	ERR_BRANCH_EMPTY_CHILD = 2, // child.hdr.cnt == 0
 	ERR_BRANCH_KEY         = 3, // elem.key != child.keys[0]
+	ERR_BRANCH_BUFFER      = 4, // message buffer malformed
 	
 	ERR_LEAF_PREV_BRANCH = 1,   // prev points to a branch
 	ERR_LEAF_NEXT_BRANCH = 2,   // next points to a branch
-	ERR_LEAF_UNCONTIG    = 3,   // wasted space between item data
+	ERR_LEAF_UNCONTIG    = 3,   // heap space neither used nor in hdr.frag
 	ERR_LEAF_OVERLAP     = 4,   // elem data regions overlap
+	ERR_LEAF_HEAP        = 5,   // elem data outside the heap
+	ERR_LEAF_OVF         = 6,   // overflow ref of the wrong size
 	
 	ERR_ITEM_TYPE    = 1,       // invalid item type
 	ERR_ITEM_KEY_ID  = 2,       // inappropriate key id for item type
@@ -68,8 +91,8 @@ struct node_check_error {
 	uint32_t code;
 	uint32_t node_addr;
 	
-	uint16_t elem_cnt;
-	uint16_t elem_idx[2];
+	uint32_t elem_cnt;
+	uint32_t elem_idx[2];
 	key      key[2];
 };
 
@@ -77,8 +100,8 @@ struct branch_check_error {
 	uint32_t code;
 	uint32_t branch_addr;
 	
-	uint16_t elem_cnt;
-	uint16_t elem_idx;
+	uint32_t elem_cnt;
+	uint32_t elem_idx;
 	node_ref elem;
 };
 
@@ -86,8 +109,8 @@ struct leaf_check_error {
 	uint32_t code;
 	uint32_t leaf_addr;
 	
-	uint16_t elem_cnt;
-	uint16_t elem_idx[2];
+	uint32_t elem_cnt;
+	uint32_t elem_idx[2];
 	item_ref elem[2];
 };
 
@@ -117,8 +140,12 @@ void check_print(struct check_result result, bool fatal);
 /* tree checking */
 struct check_result check_tree(uint32_t root_addr);
 
+/* incremental checking */
+struct check_result check_dirty(void);
+
 /* node checking */
 struct check_result check_node(uint32_t node_addr, bool recurse);
+struct check_result check_node_hdr(const node_ptr node, uint32_t node_addr);
 
 /* branch checking */
 struct check_result check_branch(const node_ptr branch);
@@ -129,5 +156,26 @@ struct check_result check_leaf(const node_ptr leaf);
 /* item checking */
 struct check_result check_item(const key *key, struct item_data item);
 
+/* operation checks */
+void check_init(void);
+void check_op_begin(void);
+bool check_op_deep(void);
+void check_node_visit(const node_ptr node, uint32_t node_addr, bool latched);
+struct jgfs2_check_stats check_stats(void);
+
+
+/// @brief checks a node that a tree operation has come to, as thoroughly as
+/// the check level calls for
+/// @param[in] node       pointer to node
+/// @param[in] node_addr  block number the node was read from
+/// @param[in] latched    whether the node is latched; nodes that aren't (such
+/// as copies made by optimistic lookups) only get header checks
+static void check_visit(const node_ptr node, uint32_t node_addr,
+	bool latched) {
+	if (CHECK_LEVEL_MAX != JGFS2_CHECK_OFF) {
+		check_node_visit(node, node_addr, latched);
+	}
+}
+
 
 #endif
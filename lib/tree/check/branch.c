@@ -9,12 +9,67 @@
 #include "../../debug.h"
 
 
+/// @brief determines whether a branch's message buffer is made up of whole,
+/// sensible messages that fill exactly as much of it as it says
+/// @param[in] branch  pointer to branch node
+/// @return true if the buffer checks out
+static bool check_branch_buf(const node_ptr branch) {
+	if (branch->hdr.buf_used > node_buf_size(branch)) {
+		return false;
+	}
+	
+	uint32_t off = 0;
+	while (off < branch->hdr.buf_used) {
+		if (branch->hdr.buf_used - off < sizeof(struct buf_msg)) {
+			return false;
+		}
+		
+		const struct buf_msg *msg =
+			(const struct buf_msg *)(branch_buf(branch) + off);
+		
+		if (msg->op == BUF_OP_INSERT) {
+			if (msg->ovf && msg->len != sizeof(struct item_ovf)) {
+				return false;
+			}
+		} else if (msg->op != BUF_OP_REMOVE || msg->len != 0 || msg->ovf) {
+			return false;
+		}
+		
+		off += buf_msg_size(msg);
+	}
+	
+	return (off == branch->hdr.buf_used);
+}
+
 struct check_result check_branch(const node_ptr branch) {
 	struct check_result result = { RESULT_TYPE_OK };
 	
-	for (uint16_t i = 0; i < branch->hdr.cnt; ++i) {
-		const node_ref *elem = branch->b_elems + i;
-		node_ptr child = node_map(elem->addr, false);
+	/* the keys in a buffered tree's branches only ever go down (see
+	 * node_update_ref_in_parent), so they are merely no greater than their
+	 * children's first keys, and their leaves may be empty */
+	bool buffered = (branch->hdr.flags & NODE_BUFFERED);
+	
+	if (!check_branch_buf(branch)) {
+		result.type = RESULT_TYPE_BRANCH;
+		result.branch = (struct branch_check_error){
+			.code        = ERR_BRANCH_BUFFER,
+			.branch_addr = branch->hdr.this,
+			
+			.elem_cnt = 0,
+		};
+		
+		goto done;
+	}
+	
+	/* the branch may be checked in the middle of a tree operation, with writers
+	 * working further down; they can't restructure its children while it is
+	 * held, but they can change what is in them, so each child is latched
+	 * (top down, like any descent) while it is looked at */
+	for (uint32_t i = 0; i < branch->hdr.cnt; ++i) {
+		node_ref elem = branch_elem(branch, i);
+		
+		node_latch(elem.addr, false);
+		node_ptr child = node_map(elem.addr, false);
 		
 		bool bad = false;
 		uint32_t code = 0;
@@ -22,14 +77,16 @@ struct check_result check_branch(const node_ptr branch) {
 			bad = true;
 			code = ERR_BRANCH_PARENT;
 		} else if (child->hdr.cnt == 0) {
-			bad = true;
+			bad = !(buffered && child->hdr.leaf);
 			code = ERR_BRANCH_EMPTY_CHILD;
-		} else if (key_cmp(&elem->key, node_first_key(child)) != 0) {
+		} else if (buffered ? node_key_cmp(child, 0, &elem.key) < 0 :
+			node_key_cmp(child, 0, &elem.key) != 0) {
 			bad = true;
 			code = ERR_BRANCH_KEY;
 		}
 		
 		node_unmap(child);
+		node_unlatch(elem.addr, false);
 		
 		if (bad) {
 			result.type = RESULT_TYPE_BRANCH;
@@ -39,7 +96,7 @@ struct check_result check_branch(const node_ptr branch) {
 				
 				.elem_cnt = 1,
 				.elem_idx = i,
-				.elem     = *elem,
+				.elem     = elem,
 			};
 			
 			goto done;
@@ -13,9 +13,59 @@ void check_print(struct check_result result, bool fatal) {
 	if (result.type == RESULT_TYPE_OK) {
 		return;
 	} else if (result.type == RESULT_TYPE_TREE) {
-		//const struct tree_check_error *err = &result.tree;
+		const struct tree_check_error *err = &result.tree;
 		
-		TODO("report for tree results");
+		warnx("check_tree on 0x%" PRIx32 " failed:", err->root_addr);
+		
+		bool have_desc = true;
+		const char *err_desc;
+		switch (err->code) {
+		case ERR_TREE_SORT:
+			err_desc = "key sort violation between nodes";
+			break;
+		case ERR_TREE_DUPE:
+			err_desc = "key dupe between nodes";
+			break;
+		case ERR_TREE_NEXT_SKIP:
+			err_desc = "next skips a node";
+			break;
+		case ERR_TREE_NEXT_ORDER:
+			err_desc = "next goes backwards";
+			break;
+		case ERR_TREE_PREV_SKIP:
+			err_desc = "prev skips a node";
+			break;
+		case ERR_TREE_PREV_ORDER:
+			err_desc = "prev goes forwards";
+			break;
+		case ERR_TREE_LEVEL:
+			err_desc = "node on the wrong level";
+			break;
+		default:
+			have_desc = false;
+		}
+		
+		if (have_desc) {
+			warnx("%s", err_desc);
+		} else {
+			warnx("unknown error (%" PRIu32 ")", err->code);
+			err_desc = "unknown error";
+		}
+		
+		const node_ptr node = node_map(err->node_addr, false);
+		
+		warnx("node 0x%" PRIx32 " (%s) prev 0x%" PRIx32 " next 0x%" PRIx32,
+			err->node_addr, (node->hdr.leaf ? "leaf" : "branch"),
+			node->hdr.prev, node->hdr.next);
+		
+		switch (err->code) {
+		case ERR_TREE_SORT:
+		case ERR_TREE_DUPE:
+			warnx("first key %s", key_str(&err->key));
+			break;
+		}
+		
+		node_unmap(node);
 	} else if (result.type == RESULT_TYPE_NODE) {
 		const struct node_check_error *err = &result.node;
 		const node_ptr node = node_map(err->node_addr, false);
@@ -40,6 +90,15 @@ void check_print(struct check_result result, bool fatal) {
 		case ERR_NODE_DUPE:
 			err_desc = "key dupe";
 			break;
+		case ERR_NODE_PREFIX:
+			err_desc = "key prefix too long";
+			break;
+		case ERR_NODE_SIZE:
+			err_desc = "node size differs from parent";
+			break;
+		case ERR_NODE_HEADER:
+			err_desc = "header field out of range";
+			break;
 		default:
 			have_desc = false;
 		}
@@ -57,12 +116,23 @@ void check_print(struct check_result result, bool fatal) {
 			break;
 		case ERR_NODE_OVERFLOW:
 			warnx("%" PRIu32 " used > %" PRIu32 " possible",
-				node_used(node), node_size_usable());
+				node_used(node), node_capacity(node));
+			break;
+		case ERR_NODE_PREFIX:
+			warnx("hdr.pfx_len %" PRIu8, node->hdr.pfx_len);
+			break;
+		case ERR_NODE_SIZE:
+			warnx("hdr.size_blk %" PRIu16, node->hdr.size_blk);
+			break;
+		case ERR_NODE_HEADER:
+			warnx("hdr.size_blk %" PRIu16 " cnt %" PRIu32 " heap_top 0x%"
+				PRIx32 " buf_used %" PRIu32, node->hdr.size_blk,
+				node->hdr.cnt, node->hdr.heap_top, node->hdr.buf_used);
 			break;
 		}
 		
-		for (uint16_t i = 0; i < err->elem_cnt; ++i) {
-			warnx("[elem %" PRIu16 "] key %s",
+		for (uint32_t i = 0; i < err->elem_cnt; ++i) {
+			warnx("[elem %" PRIu32 "] key %s",
 				err->elem_idx[1], key_str(&err->key[1]));
 		}
 		
@@ -85,6 +155,9 @@ void check_print(struct check_result result, bool fatal) {
 		case ERR_BRANCH_KEY:
 			err_desc = "wrong key in node_ref";
 			break;
+		case ERR_BRANCH_BUFFER:
+			err_desc = "malformed message buffer";
+			break;
 		default:
 			have_desc = false;
 		}
@@ -100,7 +173,7 @@ void check_print(struct check_result result, bool fatal) {
 		if (err->elem_cnt > 0) {
 			child = node_map(err->elem.addr, false);
 			
-			warnx("[elem %" PRIu16 "] key %s addr 0x%" PRIx32,
+			warnx("[elem %" PRIu32 "] key %s addr 0x%" PRIx32,
 				err->elem_idx, key_str(&err->elem.key), err->elem.addr);
 		}
 		
@@ -109,7 +182,14 @@ void check_print(struct check_result result, bool fatal) {
 			warnx("child believes its parent is 0x%" PRIx32, child->hdr.parent);
 			break;
 		case ERR_BRANCH_KEY:
-			warnx("actual first key: %s", key_str(node_first_key(child)));
+		{
+			key first_key = node_first_key(child);
+			warnx("actual first key: %s", key_str(&first_key));
+			break;
+		}
+		case ERR_BRANCH_BUFFER:
+			warnx("hdr.buf_used %" PRIu32 " of %" PRIu32,
+				branch->hdr.buf_used, node_buf_size(branch));
 			break;
 		}
 		
@@ -133,11 +213,17 @@ void check_print(struct check_result result, bool fatal) {
 			err_desc = "next points to branch";
 			break;
 		case ERR_LEAF_UNCONTIG:
-			err_desc = "uncontiguous item data";
+			err_desc = "unaccounted heap space";
 			break;
 		case ERR_LEAF_OVERLAP:
 			err_desc = "overlapping item data";
 			break;
+		case ERR_LEAF_HEAP:
+			err_desc = "item data outside heap";
+			break;
+		case ERR_LEAF_OVF:
+			err_desc = "bad overflow ref";
+			break;
 		default:
 			have_desc = false;
 		}
@@ -156,11 +242,19 @@ void check_print(struct check_result result, bool fatal) {
 		case ERR_LEAF_NEXT_BRANCH:
 			warnx("next 0x%" PRIx32, leaf->hdr.next);
 			break;
+		case ERR_LEAF_UNCONTIG:
+		case ERR_LEAF_HEAP:
+			warnx("heap_top 0x%" PRIx32 " frag %" PRIu32,
+				leaf->hdr.heap_top, leaf->hdr.frag);
+			break;
 		}
 		
-		for (uint16_t i = 0; i < err->elem_cnt; ++i) {
-			warnx("[elem %" PRIu16 "] key %s off 0x%" PRIx32 " len 0x%"PRIx32,
-				err->elem_idx[i], key_str(&err->elem[i].key),
+		for (uint32_t i = 0; i < err->elem_cnt; ++i) {
+			node_ref ref;
+			key_decode(&err->elem[i].key, &ref.key);
+			
+			warnx("[elem %" PRIu32 "] key %s off 0x%" PRIx32 " len 0x%"PRIx32,
+				err->elem_idx[i], key_str(&ref.key),
 				err->elem[i].off, err->elem[i].len);
 		}
 		
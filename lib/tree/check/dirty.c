@@ -0,0 +1,269 @@
+/* jgfs2
+ * (c) 2013 Justin Gottula
+ * The source code of this project is distributed under the terms of the
+ * simplified BSD license. See the LICENSE file for details.
+ */
+
+
+#include "../check.h"
+#include "../../debug.h"
+
+
+/* check_tree walks everything, which makes it too slow to run after every
+ * operation on a big tree; anything an operation can break, though, is in a
+ * node it wrote to or in the links between such a node and the ones around it,
+ * so checking just those catches the same problems as they are made; like
+ * check_tree, this is for when no tree operations are running */
+
+
+static int check_dirty_cmp(const void *lhs, const void *rhs) {
+	uint32_t l = *(const uint32_t *)lhs, r = *(const uint32_t *)rhs;
+	return (l > r) - (l < r);
+}
+
+/// @brief makes up a tree-level failure for a node
+/// @param[in] code       error code
+/// @param[in] node_addr  block number of node at fault
+/// @param[in] err_key    key to report, if any
+/// @return result of the check
+static struct check_result check_dirty_fail(uint32_t code, uint32_t node_addr,
+	key err_key) {
+	return (struct check_result){
+		.type = RESULT_TYPE_TREE,
+		.tree = {
+			.code      = code,
+			.root_addr = node_find_root(node_addr),
+			
+			.node_addr = node_addr,
+			.key       = err_key,
+		},
+	};
+}
+
+/// @brief makes sure a node and its right sibling agree on being neighbors,
+/// are on the same level, and have keys in order between them
+/// @param[in] node  pointer to node
+/// @return result of the check
+static struct check_result check_dirty_next(const node_ptr node) {
+	struct check_result result = { RESULT_TYPE_OK };
+	
+	node_ptr next = node_map(node->hdr.next, false);
+	
+	if (next->hdr.prev != node->hdr.this) {
+		result = check_dirty_fail(ERR_TREE_PREV_SKIP, next->hdr.this,
+			(key){ 0 });
+	} else if (next->hdr.leaf != node->hdr.leaf) {
+		result = check_dirty_fail(ERR_TREE_LEVEL, next->hdr.this, (key){ 0 });
+	} else if (node->hdr.cnt != 0 && next->hdr.cnt != 0) {
+		key last  = node_key(node, node->hdr.cnt - 1);
+		key first = node_key(next, 0);
+		
+		int8_t cmp = key_cmp(&last, &first);
+		if (cmp >= 0) {
+			result = check_dirty_fail((cmp > 0 ? ERR_TREE_SORT : ERR_TREE_DUPE),
+				next->hdr.this, first);
+		}
+	}
+	
+	node_unmap(next);
+	return result;
+}
+
+/// @brief makes sure a branch's children link from each one to the next, and
+/// that the last one links to the first child of the branch's right sibling
+/// @param[in] branch  pointer to branch node
+/// @return result of the check
+static struct check_result check_dirty_children(const node_ptr branch) {
+	struct check_result result = { RESULT_TYPE_OK };
+	
+	uint32_t after = 0;
+	if (branch->hdr.next != 0) {
+		node_ptr next = node_map(branch->hdr.next, false);
+		after = (next->hdr.cnt != 0 ? branch_addr(next)[0] : 0);
+		node_unmap(next);
+	}
+	
+	for (uint32_t i = 0; i < branch->hdr.cnt; ++i) {
+		uint32_t child_addr = branch_addr(branch)[i];
+		uint32_t want = (i + 1 < branch->hdr.cnt ?
+			branch_addr(branch)[i + 1] : after);
+		
+		node_ptr child = node_map(child_addr, false);
+		uint32_t next_addr = child->hdr.next;
+		node_unmap(child);
+		
+		if (next_addr != want) {
+			result = check_dirty_fail(ERR_TREE_NEXT_SKIP, child_addr,
+				(key){ 0 });
+			break;
+		}
+	}
+	
+	return result;
+}
+
+/// @brief makes sure a node's parent still refers to it, under a key that
+/// agrees with the node's first key
+/// @param[in] node  pointer to node, which is not the root
+/// @return result of the check
+static struct check_result check_dirty_parent(const node_ptr node) {
+	struct check_result result = { RESULT_TYPE_OK };
+	
+	node_ptr parent = node_map(node->hdr.parent, false);
+	bool buffered = (parent->hdr.flags & NODE_BUFFERED);
+	
+	uint32_t idx;
+	if (parent->hdr.leaf ||
+		!branch_search_addr(parent, node->hdr.this, &idx)) {
+		result.type = RESULT_TYPE_BRANCH;
+		result.branch = (struct branch_check_error){
+			.code        = ERR_BRANCH_PARENT,
+			.branch_addr = parent->hdr.this,
+			
+			.elem_cnt = 0,
+		};
+	} else if (node->hdr.cnt != 0) {
+		/* same rules as check_branch */
+		node_ref elem = branch_elem(parent, idx);
+		int8_t cmp = node_key_cmp(node, 0, &elem.key);
+		
+		if (buffered ? cmp < 0 : cmp != 0) {
+			result.type = RESULT_TYPE_BRANCH;
+			result.branch = (struct branch_check_error){
+				.code        = ERR_BRANCH_KEY,
+				.branch_addr = parent->hdr.this,
+				
+				.elem_cnt = 1,
+				.elem_idx = idx,
+				.elem     = elem,
+			};
+		}
+	}
+	
+	node_unmap(parent);
+	return result;
+}
+
+/// @brief checks a node in relation to its neighbors, and on its own too if it
+/// was written to
+/// @param[in] node_addr  block number of node
+/// @param[in] dirty      whether the node itself was written to; the ones that
+/// weren't are only here because a neighbor was, so only their links matter
+/// @return result of the check
+static struct check_result check_dirty_node(uint32_t node_addr, bool dirty) {
+	struct check_result result = { RESULT_TYPE_OK };
+	
+	if (dirty) {
+		result = check_node(node_addr, false);
+		if (result.type != RESULT_TYPE_OK) {
+			return result;
+		}
+	}
+	
+	node_ptr node = node_map(node_addr, false);
+	
+	if (node->hdr.prev != 0) {
+		node_ptr prev = node_map(node->hdr.prev, false);
+		bool linked = (prev->hdr.next == node_addr);
+		node_unmap(prev);
+		
+		if (!linked) {
+			result = check_dirty_fail(ERR_TREE_NEXT_SKIP, node->hdr.prev,
+				(key){ 0 });
+			goto done;
+		}
+	}
+	
+	if (node->hdr.next != 0) {
+		result = check_dirty_next(node);
+		if (result.type != RESULT_TYPE_OK) {
+			goto done;
+		}
+	}
+	
+	if (node->hdr.parent != 0) {
+		result = check_dirty_parent(node);
+		if (result.type != RESULT_TYPE_OK) {
+			goto done;
+		}
+	} else if (node->hdr.prev != 0 || node->hdr.next != 0) {
+		result = check_dirty_fail(ERR_TREE_LEVEL, node_addr, (key){ 0 });
+		goto done;
+	}
+	
+	if (dirty && !node->hdr.leaf) {
+		result = check_dirty_children(node);
+	}
+	
+done:
+	node_unmap(node);
+	return result;
+}
+
+struct check_result check_dirty(void) {
+	struct check_result result = { RESULT_TYPE_OK };
+	
+	uint32_t dirty_cnt;
+	uint32_t *dirty = node_dirty_take(&dirty_cnt);
+	if (dirty == NULL) {
+		return result;
+	}
+	
+	/* each dirty node brings its parent and siblings along, which may be
+	 * dirty themselves */
+	uint32_t *addrs = malloc(sizeof(uint32_t) * dirty_cnt * 4);
+	uint32_t cnt = 0;
+	
+	for (uint32_t i = 0; i < dirty_cnt; ++i) {
+		node_ptr node = node_map(dirty[i], false);
+		
+		if (node->hdr.parent != 0) {
+			addrs[cnt++] = node->hdr.parent;
+		}
+		if (node->hdr.prev != 0) {
+			addrs[cnt++] = node->hdr.prev;
+		}
+		if (node->hdr.next != 0) {
+			addrs[cnt++] = node->hdr.next;
+		}
+		
+		node_unmap(node);
+	}
+	
+	qsort(dirty, dirty_cnt, sizeof(uint32_t), check_dirty_cmp);
+	qsort(addrs, cnt, sizeof(uint32_t), check_dirty_cmp);
+	
+	/* both lists are sorted, so they can be walked side by side to tell the
+	 * dirty nodes from the ones that are only neighbors */
+	uint32_t d = 0;
+	for (uint32_t i = 0; i < dirty_cnt; ++i) {
+		result = check_dirty_node(dirty[i], true);
+		if (result.type != RESULT_TYPE_OK) {
+			goto done;
+		}
+	}
+	
+	for (uint32_t i = 0; i < cnt; ++i) {
+		if (i != 0 && addrs[i] == addrs[i - 1]) {
+			continue;
+		}
+		
+		while (d < dirty_cnt && dirty[d] < addrs[i]) {
+			++d;
+		}
+		if (d < dirty_cnt && dirty[d] == addrs[i]) {
+			continue;
+		}
+		
+		result = check_dirty_node(addrs[i], false);
+		if (result.type != RESULT_TYPE_OK) {
+			goto done;
+		}
+	}
+	
+done:
+	free(addrs);
+	free(dirty);
+	
+	return result;
+}
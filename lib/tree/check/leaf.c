@@ -9,8 +9,27 @@
 #include "../../debug.h"
 
 
+/* the heap region taken up by one elem's data */
+struct leaf_data_span {
+	uint32_t off;
+	uint32_t len;
+	uint32_t idx;
+};
+
+
+/// @brief orders data spans by offset, for qsort
+/// @param[in] lhs  pointer to first span
+/// @param[in] rhs  pointer to second span
+/// @return sign of (lhs offset - rhs offset)
+static int leaf_data_span_cmp(const void *lhs, const void *rhs) {
+	const struct leaf_data_span *l = lhs, *r = rhs;
+	
+	return (l->off > r->off) - (l->off < r->off);
+}
+
 struct check_result check_leaf(const node_ptr leaf) {
 	struct check_result result = { RESULT_TYPE_OK };
+	struct leaf_data_span *spans = NULL;
 	
 	if (leaf->hdr.cnt > 0) {
 		if (leaf->hdr.prev != 0) {
@@ -46,48 +65,124 @@ struct check_result check_leaf(const node_ptr leaf) {
 			}
 		}
 		
-		uint32_t last_off = node_size_byte();
-		for (uint16_t i = 0; i < leaf->hdr.cnt; ++i) {
-			const item_ref *elem = leaf->l_elems + i;
+		/* the heap has to start past the refs, and every elem's data has to
+		 * lie within it; empty data takes up no space, so its offset is left
+		 * behind whenever the top of the heap is given back */
+		uint32_t heap_top = leaf->hdr.heap_top;
+		uint32_t refs_end = sizeof(struct node_hdr) +
+			(leaf->hdr.cnt * leaf_ref_size(leaf));
+		if (heap_top < refs_end || heap_top > node_size_byte(leaf)) {
+			result.type = RESULT_TYPE_LEAF;
+			result.leaf = (struct leaf_check_error){
+				.code      = ERR_LEAF_HEAP,
+				.leaf_addr = leaf->hdr.this,
+				
+				.elem_cnt = 0,
+			};
 			
-			if (last_off != elem->off + elem->len) {
+			goto done;
+		}
+		
+		spans = malloc(sizeof(*spans) * leaf->hdr.cnt);
+		uint32_t span_cnt = 0;
+		uint32_t used = 0;
+		
+		for (uint32_t i = 0; i < leaf->hdr.cnt; ++i) {
+			item_ref elem = leaf_elem(leaf, i);
+			
+			if (elem.len != 0 && (elem.off < heap_top ||
+				elem.off + elem.len > node_size_byte(leaf))) {
 				result.type = RESULT_TYPE_LEAF;
 				result.leaf = (struct leaf_check_error){
-					.code      = (last_off < elem->off + elem->len ?
-						ERR_LEAF_UNCONTIG : ERR_LEAF_OVERLAP),
+					.code      = ERR_LEAF_HEAP,
 					.leaf_addr = leaf->hdr.this,
 					
 					.elem_cnt    = 1,
 					.elem_idx[0] = i,
-					.elem[0]     = *elem,
+					.elem[0]     = elem,
 				};
 				
-				if (i < leaf->hdr.cnt - 1) {
-					result.leaf.elem_cnt    = 2;
-					result.leaf.elem_idx[1] = i + 1;
-					result.leaf.elem[1]     = *(elem + 1);
-				}
+				goto done;
+			}
+			
+			/* empty items take up no space, wherever they claim to be */
+			if (elem.len != 0) {
+				spans[span_cnt++] = (struct leaf_data_span){
+					.off = elem.off,
+					.len = elem.len,
+					.idx = i,
+				};
+			}
+			used += elem.len;
+		}
+		
+		/* data is in no particular order, so sort it by offset to look for
+		 * neighbors that overlap */
+		qsort(spans, span_cnt, sizeof(*spans), leaf_data_span_cmp);
+		
+		for (uint32_t i = 1; i < span_cnt; ++i) {
+			if (spans[i - 1].off + spans[i - 1].len > spans[i].off) {
+				result.type = RESULT_TYPE_LEAF;
+				result.leaf = (struct leaf_check_error){
+					.code      = ERR_LEAF_OVERLAP,
+					.leaf_addr = leaf->hdr.this,
+					
+					.elem_cnt    = 2,
+					.elem_idx[0] = spans[i - 1].idx,
+					.elem_idx[1] = spans[i].idx,
+					.elem[0]     = leaf_elem(leaf, spans[i - 1].idx),
+					.elem[1]     = leaf_elem(leaf, spans[i].idx),
+				};
 				
 				goto done;
 			}
+		}
+		
+		/* whatever part of the heap isn't item data must be a known hole */
+		if (used + leaf->hdr.frag != node_size_byte(leaf) - heap_top) {
+			result.type = RESULT_TYPE_LEAF;
+			result.leaf = (struct leaf_check_error){
+				.code      = ERR_LEAF_UNCONTIG,
+				.leaf_addr = leaf->hdr.this,
+				
+				.elem_cnt = 0,
+			};
 			
-			last_off -= elem->len;
+			goto done;
 		}
 	}
 	
-	const item_ref *elem_end = leaf->l_elems + leaf->hdr.cnt;
-	for (const item_ref *elem = leaf->l_elems; elem < elem_end; ++elem) {
+	for (uint32_t i = 0; i < leaf->hdr.cnt; ++i) {
+		const item_loc *loc = leaf_loc(leaf, i);
+		
+		if (loc->ovf && loc->len != sizeof(struct item_ovf)) {
+			result.type = RESULT_TYPE_LEAF;
+			result.leaf = (struct leaf_check_error){
+				.code      = ERR_LEAF_OVF,
+				.leaf_addr = leaf->hdr.this,
+				
+				.elem_cnt    = 1,
+				.elem_idx[0] = i,
+				.elem[0]     = leaf_elem(leaf, i),
+			};
+			
+			goto done;
+		}
+		
+		key elem_key = node_key(leaf, i);
 		struct item_data item = {
-			.len  = elem->len,
-			.data = leaf_elem_data(leaf, (elem - leaf->l_elems)),
+			.len  = loc->len,
+			.data = leaf_elem_data(leaf, i),
+			.ovf  = loc->ovf,
 		};
 		
-		result = check_item(&elem->key, item);
+		result = check_item(&elem_key, item);
 		if (result.type != RESULT_TYPE_OK) {
 			goto done;
 		}
 	}
 	
 done:
+	free(spans);
 	return result;
 }
@@ -9,6 +9,51 @@
 #include "../../debug.h"
 
 
+/// @brief checks only what can be checked from a node's header, without
+/// looking at its elems or at any other node; cheap enough to do on every node
+/// a tree operation comes to
+/// @param[in] node       pointer to node
+/// @param[in] node_addr  block number the node was read from
+/// @return result of the check
+struct check_result check_node_hdr(const node_ptr node, uint32_t node_addr) {
+	struct check_result result = { RESULT_TYPE_OK };
+	
+	/* ERR_NODE_THIS is zero, so it can't double as "no error" */
+	bool bad = true;
+	uint32_t code;
+	if (node->hdr.this != node_addr) {
+		code = ERR_NODE_THIS;
+	} else if (node->hdr.size_blk == 0 ||
+		node_size_byte(node) > JGFS2_NODE_SIZE_MAX) {
+		code = ERR_NODE_HEADER;
+	} else if (node->hdr.leaf && node->hdr.pfx_len >= KEY_ENC_LEN) {
+		code = ERR_NODE_PREFIX;
+	} else if (node->hdr.leaf && (node->hdr.heap_top > node_size_byte(node) ||
+		node->hdr.heap_top < sizeof(struct node_hdr) +
+		((uint64_t)node->hdr.cnt * leaf_ref_size(node)))) {
+		code = ERR_NODE_HEADER;
+	} else if (!node->hdr.leaf && node->hdr.cnt == 0) {
+		code = ERR_NODE_EMPTY;
+	} else if (!node->hdr.leaf && (node->hdr.cnt > branch_cap(node) ||
+		node->hdr.buf_used > node_buf_size(node))) {
+		code = ERR_NODE_HEADER;
+	} else {
+		bad = false;
+	}
+	
+	if (bad) {
+		result.type = RESULT_TYPE_NODE;
+		result.node = (struct node_check_error){
+			.code      = code,
+			.node_addr = node_addr,
+			
+			.elem_cnt = 0,
+		};
+	}
+	
+	return result;
+}
+
 struct check_result check_node(uint32_t node_addr, bool recurse) {
 	struct check_result result = { RESULT_TYPE_OK };
 	const node_ptr node = node_map(node_addr, false);
@@ -26,8 +71,11 @@ struct check_result check_node(uint32_t node_addr, bool recurse) {
 	}
 	
 	/* if we are empty and not the root node, or if the root is an empty branch
-	 * node, then this check fails */
-	if (node->hdr.cnt == 0 && (node->hdr.parent != 0 || !node->hdr.leaf)) {
+	 * node, then this check fails; buffered trees are allowed to keep empty
+	 * leaves around (see tree_buf_drop) */
+	bool empty_ok = (node->hdr.leaf && (node->hdr.parent == 0 ||
+		(node->hdr.flags & NODE_BUFFERED)));
+	if (node->hdr.cnt == 0 && !empty_ok) {
 		result.type = RESULT_TYPE_NODE;
 		result.node = (struct node_check_error){
 			.code      = ERR_NODE_EMPTY,
@@ -39,7 +87,40 @@ struct check_result check_node(uint32_t node_addr, bool recurse) {
 		goto done;
 	}
 	
-	if (node_used(node) > node_size_usable()) {
+	/* every node in a tree is the size its root was made with */
+	if (node->hdr.parent != 0) {
+		node_ptr parent = node_map(node->hdr.parent, false);
+		bool same_size = (node_size_blk(parent) == node_size_blk(node));
+		node_unmap(parent);
+		
+		if (!same_size) {
+			result.type = RESULT_TYPE_NODE;
+			result.node = (struct node_check_error){
+				.code      = ERR_NODE_SIZE,
+				.node_addr = node_addr,
+				
+				.elem_cnt = 0,
+			};
+			
+			goto done;
+		}
+	}
+	
+	/* a prefix as long as the whole key would leave no way to tell the keys
+	 * apart, so it is never made that long */
+	if (node->hdr.leaf && node->hdr.pfx_len >= KEY_ENC_LEN) {
+		result.type = RESULT_TYPE_NODE;
+		result.node = (struct node_check_error){
+			.code      = ERR_NODE_PREFIX,
+			.node_addr = node_addr,
+			
+			.elem_cnt = 0,
+		};
+		
+		goto done;
+	}
+	
+	if (node_used(node) > node_capacity(node)) {
 		result.type = RESULT_TYPE_NODE;
 		result.node = (struct node_check_error){
 			.code      = ERR_NODE_OVERFLOW,
@@ -52,12 +133,11 @@ struct check_result check_node(uint32_t node_addr, bool recurse) {
 	}
 	
 	if (node->hdr.leaf) {
-		const item_ref *elem_end = node->l_elems + node->hdr.cnt;
-		for (const item_ref *elem = node->l_elems + 1;
-			elem < elem_end; ++elem) {
-			const item_ref *elem_prev = elem - 1;
+		for (uint32_t idx = 1; idx < node->hdr.cnt; ++idx) {
+			key_enc enc_prev = leaf_key_enc(node, idx - 1);
+			key_enc enc      = leaf_key_enc(node, idx);
 			
-			int8_t cmp = key_cmp(&elem_prev->key, &elem->key);
+			int8_t cmp = key_enc_cmp(&enc_prev, &enc);
 			
 			if (cmp >= 0) {
 				result.type = RESULT_TYPE_NODE;
@@ -66,22 +146,21 @@ struct check_result check_node(uint32_t node_addr, bool recurse) {
 					.node_addr = node_addr,
 					
 					.elem_cnt = 2,
-					.elem_idx[0] = elem_prev - node->l_elems,
-					.elem_idx[1] = elem - node->l_elems,
-					.key[0]      = elem_prev->key,
-					.key[1]      = elem->key,
+					.elem_idx[0] = idx - 1,
+					.elem_idx[1] = idx,
+					.key[0]      = node_key(node, idx - 1),
+					.key[1]      = node_key(node, idx),
 				};
 				
 				goto done;
 			}
 		}
 	} else {
-		const node_ref *elem_end = node->b_elems + node->hdr.cnt;
-		for (const node_ref *elem = node->b_elems + 1;
-			elem < elem_end; ++elem) {
-			const node_ref *elem_prev = elem - 1;
+		for (uint32_t i = 1; i < node->hdr.cnt; ++i) {
+			node_ref elem_prev = branch_elem(node, i - 1);
+			node_ref elem      = branch_elem(node, i);
 			
-			int8_t cmp = key_cmp(&elem_prev->key, &elem->key);
+			int8_t cmp = key_cmp(&elem_prev.key, &elem.key);
 			
 			if (cmp >= 0) {
 				result.type = RESULT_TYPE_NODE;
@@ -90,10 +169,10 @@ struct check_result check_node(uint32_t node_addr, bool recurse) {
 					.node_addr = node_addr,
 					
 					.elem_cnt = 2,
-					.elem_idx[0] = elem_prev - node->b_elems,
-					.elem_idx[1] = elem - node->b_elems,
-					.key[0]      = elem_prev->key,
-					.key[1]      = elem->key,
+					.elem_idx[0] = i - 1,
+					.elem_idx[1] = i,
+					.key[0]      = elem_prev.key,
+					.key[1]      = elem.key,
 				};
 				
 				goto done;
@@ -108,10 +187,8 @@ struct check_result check_node(uint32_t node_addr, bool recurse) {
 		result = check_branch(node);
 		
 		if (recurse) {
-			const node_ref *elem_end = node->b_elems + node->hdr.cnt;
-			for (const node_ref *elem = node->b_elems;
-				elem < elem_end; ++elem) {
-				result = check_node(elem->addr, true);
+			for (uint32_t i = 0; i < node->hdr.cnt; ++i) {
+				result = check_node(branch_addr(node)[i], true);
 				if (result.type != RESULT_TYPE_OK) {
 					goto done;
 				}
@@ -9,19 +9,117 @@
 #include "../../debug.h"
 
 
-struct check_result check_tree(uint32_t root_addr) {
+/// @brief walks one level of a tree along its sibling links, making sure that
+/// the links agree with each other, that every node is a leaf exactly when it
+/// is on the bottom level, and that keys keep increasing from node to node;
+/// for a level of branches, the level below is walked alongside it, and has to
+/// turn up exactly the children of this level, in order
+/// @param[in] root_addr  block number of root node
+/// @param[in] level      level to check; the root's is 0
+/// @param[in] depth      number of levels in the tree
+/// @return result of the check
+static struct check_result check_tree_level(uint32_t root_addr,
+	uint8_t level, uint8_t depth) {
 	struct check_result result = { RESULT_TYPE_OK };
+	bool bottom = (level == depth - 1);
+	
+	uint32_t prev_addr = 0;
+	uint32_t child_prev = 0;
+	uint32_t child_next = (bottom ? 0 :
+		tree_level_first(root_addr, level + 1));
+	
+	bool have_last = false;
+	key last;
+	
+	uint32_t node_addr = tree_level_first(root_addr, level);
+	while (node_addr != 0) {
+		node_ptr node = node_map(node_addr, false);
+		
+		uint32_t code = 0;
+		uint32_t err_addr = node_addr;
+		key err_key = { 0 };
+		
+		if (node->hdr.leaf != bottom) {
+			code = ERR_TREE_LEVEL;
+		} else if (node->hdr.prev != prev_addr) {
+			code = ERR_TREE_PREV_SKIP;
+		} else if (node->hdr.cnt != 0) {
+			key first = node_key(node, 0);
+			
+			int8_t cmp = (have_last ? key_cmp(&last, &first) : -1);
+			if (cmp >= 0) {
+				code = (cmp > 0 ? ERR_TREE_SORT : ERR_TREE_DUPE);
+				err_key = first;
+			}
+			
+			have_last = true;
+			last = node_key(node, node->hdr.cnt - 1);
+		}
+		
+		/* the children's links have to lead from each one to the next, even
+		 * across parents */
+		for (uint32_t i = 0; code == 0 && !bottom && i < node->hdr.cnt; ++i) {
+			if (branch_addr(node)[i] != child_next) {
+				code = ERR_TREE_NEXT_SKIP;
+				err_addr = (child_prev != 0 ? child_prev : node_addr);
+			} else {
+				child_prev = child_next;
+				child_next = tree_level_next(child_next);
+			}
+		}
+		
+		uint32_t next_addr = node->hdr.next;
+		node_unmap(node);
+		
+		if (code != 0) {
+			result.type = RESULT_TYPE_TREE;
+			result.tree = (struct tree_check_error){
+				.code      = code,
+				.root_addr = root_addr,
+				
+				.node_addr = err_addr,
+				.key       = err_key,
+			};
+			
+			return result;
+		}
+		
+		prev_addr = node_addr;
+		node_addr = next_addr;
+	}
+	
+	/* the level below has nodes that no branch on this level refers to */
+	if (child_next != 0) {
+		result.type = RESULT_TYPE_TREE;
+		result.tree = (struct tree_check_error){
+			.code      = ERR_TREE_NEXT_SKIP,
+			.root_addr = root_addr,
+			
+			.node_addr = child_prev,
+		};
+	}
 	
-	TODO("tree-specific checks");
-	// check for overall tree consistency:
-	// dupes between nodes
-	// node n's largest key not less than node n+1's smallest
+	return result;
+}
+
+struct check_result check_tree(uint32_t root_addr) {
+	struct check_result result = { RESULT_TYPE_OK };
 	
 	result = check_node(root_addr, true);
 	if (result.type != RESULT_TYPE_OK) {
 		goto done;
 	}
 	
+	/* only once each node is known to be sane on its own are the levels
+	 * walked as a whole */
+	uint8_t depth = tree_depth(root_addr);
+	for (uint8_t level = 0; level < depth; ++level) {
+		result = check_tree_level(root_addr, level, depth);
+		if (result.type != RESULT_TYPE_OK) {
+			goto done;
+		}
+	}
+	
 done:
 	return result;
 }
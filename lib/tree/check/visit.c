@@ -0,0 +1,140 @@
+/* jgfs2
+ * (c) 2013 Justin Gottula
+ * The source code of this project is distributed under the terms of the
+ * simplified BSD license. See the LICENSE file for details.
+ */
+
+
+#include "../check.h"
+#include <time.h>
+#include "../../debug.h"
+#include "../../fs.h"
+
+
+/* header checks take so little time that timing each one would cost more than
+ * the check; each thread counts them up on its own and times one in this many,
+ * which stands in for the rest when the batch is added to the totals */
+#define CHECK_HDR_BATCH 64
+
+#define CHECK_STAT_ADD(_field, _n) \
+	__atomic_add_fetch(&check_totals._field, (_n), __ATOMIC_RELAXED)
+#define CHECK_STAT_GET(_field) \
+	__atomic_load_n(&check_totals._field, __ATOMIC_RELAXED)
+
+
+static uint8_t  check_level = JGFS2_CHECK_OFF;
+static uint32_t check_sample;
+
+static struct jgfs2_check_stats check_totals;
+
+/* whether the operation this thread is in the middle of gets deep checks */
+static __thread bool     op_deep = false;
+static __thread uint32_t op_cnt  = 0;
+static __thread uint32_t hdr_cnt = 0;
+
+
+static uint64_t check_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	
+	return (ts.tv_sec * UINT64_C(1000000000)) + ts.tv_nsec;
+}
+
+/// @brief settles on the check level from the mount options and the build,
+/// and starts the counters over
+void check_init(void) {
+	uint8_t level = fs.mount_opt.check_level;
+	if (level == JGFS2_CHECK_DEFAULT) {
+		level = CHECK_LEVEL_DEFAULT;
+	}
+	
+	if (level > CHECK_LEVEL_MAX) {
+		warnx("check level %" PRIu8 " not built in; using %d",
+			level, CHECK_LEVEL_MAX);
+		level = CHECK_LEVEL_MAX;
+	}
+	
+	check_level  = level;
+	check_sample = (fs.mount_opt.check_sample != 0 ?
+		fs.mount_opt.check_sample : CHECK_SAMPLE_DEFAULT);
+	
+	memset(&check_totals, 0, sizeof(check_totals));
+}
+
+/// @brief marks the start of a tree operation, deciding whether the nodes it
+/// comes to get deep checks
+void check_op_begin(void) {
+	op_deep = (check_level == JGFS2_CHECK_FULL ||
+		(check_level == JGFS2_CHECK_SAMPLED && ++op_cnt % check_sample == 0));
+}
+
+/// @brief tells whether the current operation gets deep checks, which it can
+/// only get on nodes it latches
+/// @return true if it does
+bool check_op_deep(void) {
+	return op_deep;
+}
+
+/// @brief does the work of check_visit (which see); any failure is fatal
+void check_node_visit(const node_ptr node, uint32_t node_addr, bool latched) {
+	if (check_level == JGFS2_CHECK_OFF) {
+		return;
+	}
+	
+	bool timed = (++hdr_cnt % CHECK_HDR_BATCH == 0);
+	uint64_t begin = (timed ? check_now() : 0);
+	
+	struct check_result result = check_node_hdr(node, node_addr);
+	
+	if (timed) {
+		CHECK_STAT_ADD(header.checks, CHECK_HDR_BATCH);
+		CHECK_STAT_ADD(header.nsec, (check_now() - begin) * CHECK_HDR_BATCH);
+	}
+	
+	if (result.type != RESULT_TYPE_OK) {
+		check_print(result, true);
+	}
+	
+	/* a deep check looks at every elem, and at the children of a branch, so
+	 * it is only safe with the node held */
+	if (!op_deep || !latched) {
+		return;
+	}
+	
+	begin = check_now();
+	result = check_node(node_addr, false);
+	uint64_t nsec = check_now() - begin;
+	
+	if (check_level == JGFS2_CHECK_FULL) {
+		CHECK_STAT_ADD(full.checks, 1);
+		CHECK_STAT_ADD(full.nsec, nsec);
+	} else {
+		CHECK_STAT_ADD(sampled.checks, 1);
+		CHECK_STAT_ADD(sampled.nsec, nsec);
+	}
+	
+	if (result.type != RESULT_TYPE_OK) {
+		check_print(result, true);
+	}
+}
+
+/// @brief reports how many checks tree operations have done, and how long
+/// they took; header checks are added up in batches, so the last few of each
+/// thread's may not be counted yet
+/// @return check statistics
+struct jgfs2_check_stats check_stats(void) {
+	return (struct jgfs2_check_stats){
+		.header = {
+			.checks = CHECK_STAT_GET(header.checks),
+			.nsec   = CHECK_STAT_GET(header.nsec),
+		},
+		.sampled = {
+			.checks = CHECK_STAT_GET(sampled.checks),
+			.nsec   = CHECK_STAT_GET(sampled.nsec),
+		},
+		.full = {
+			.checks = CHECK_STAT_GET(full.checks),
+			.nsec   = CHECK_STAT_GET(full.nsec),
+		},
+	};
+}
@@ -6,6 +6,277 @@
 
 
 #include "item.h"
+#include "../debug.h"
 
 
+/* which inode fields differ from their defaults and are therefore present in
+ * the encoding; i_mode and i_ctime are always present */
+enum inode_enc_flags {
+	INODE_ENC_ATTR  = (1 << 0),
+	INODE_ENC_UID   = (1 << 1),
+	INODE_ENC_GID   = (1 << 2),
+	INODE_ENC_SIZE  = (1 << 3),
+	INODE_ENC_NLINK = (1 << 4), // i_nlink != 1
+	INODE_ENC_GEN   = (1 << 5),
+	INODE_ENC_MTIME = (1 << 6), // i_mtime != i_ctime
+	INODE_ENC_ATIME = (1 << 7), // i_atime != i_mtime
+};
 
+
+struct item_codec {
+	uint32_t view_len;
+	uint32_t (*encode)(const void *view, uint8_t *buf);
+	bool (*decode)(const uint8_t *buf, uint32_t len, void *view);
+};
+
+
+/* encoders write LEB128 varints: 7 bits per byte, low bits first, with the
+ * high bit set on every byte but the last */
+static uint8_t *varint_put(uint8_t *buf, uint64_t val) {
+	while (val >= 0x80) {
+		*(buf++) = (val & 0x7f) | 0x80;
+		val >>= 7;
+	}
+	*(buf++) = val;
+	
+	return buf;
+}
+
+static bool varint_get(const uint8_t **buf, const uint8_t *end,
+	uint64_t *val) {
+	*val = 0;
+	
+	for (uint8_t shift = 0; shift < 64; shift += 7) {
+		if (*buf == end) {
+			return false;
+		}
+		
+		uint8_t byte = *((*buf)++);
+		*val |= (uint64_t)(byte & 0x7f) << shift;
+		
+		if ((byte & 0x80) == 0) {
+			return true;
+		}
+	}
+	
+	return false;
+}
+
+/* signed values are zigzagged first so that small negatives stay short */
+static uint64_t zigzag(int64_t val) {
+	return ((uint64_t)val << 1) ^ (uint64_t)(val >> 63);
+}
+
+static int64_t unzigzag(uint64_t val) {
+	return (int64_t)(val >> 1) ^ -(int64_t)(val & 1);
+}
+
+static bool varint_get_u32(const uint8_t **buf, const uint8_t *end,
+	uint32_t *val) {
+	uint64_t wide;
+	if (!varint_get(buf, end, &wide) || wide > UINT32_MAX) {
+		return false;
+	}
+	
+	*val = wide;
+	return true;
+}
+
+static bool varint_get_u16(const uint8_t **buf, const uint8_t *end,
+	uint16_t *val) {
+	uint64_t wide;
+	if (!varint_get(buf, end, &wide) || wide > UINT16_MAX) {
+		return false;
+	}
+	
+	*val = wide;
+	return true;
+}
+
+static bool varint_get_s64(const uint8_t **buf, const uint8_t *end,
+	int64_t *val) {
+	uint64_t wide;
+	if (!varint_get(buf, end, &wide)) {
+		return false;
+	}
+	
+	*val = unzigzag(wide);
+	return true;
+}
+
+
+/* inodes: a flags byte, then i_mode and i_ctime, then whichever other fields
+ * are flagged; i_mtime is stored relative to i_ctime, and i_atime relative to
+ * i_mtime, since they are usually close together */
+static uint32_t inode_encode(const void *view, uint8_t *buf) {
+	const struct inode_item *inode = view;
+	
+	uint8_t flags = 0;
+	flags |= (inode->i_attr  != 0 ? INODE_ENC_ATTR  : 0);
+	flags |= (inode->i_uid   != 0 ? INODE_ENC_UID   : 0);
+	flags |= (inode->i_gid   != 0 ? INODE_ENC_GID   : 0);
+	flags |= (inode->i_size  != 0 ? INODE_ENC_SIZE  : 0);
+	flags |= (inode->i_nlink != 1 ? INODE_ENC_NLINK : 0);
+	flags |= (inode->i_gen   != 0 ? INODE_ENC_GEN   : 0);
+	flags |= (inode->i_mtime != inode->i_ctime ? INODE_ENC_MTIME : 0);
+	flags |= (inode->i_atime != inode->i_mtime ? INODE_ENC_ATIME : 0);
+	
+	uint8_t *pos = buf;
+	*(pos++) = flags;
+	
+	pos = varint_put(pos, inode->i_mode);
+	pos = varint_put(pos, zigzag(inode->i_ctime));
+	
+	if (flags & INODE_ENC_ATTR) {
+		pos = varint_put(pos, inode->i_attr);
+	}
+	if (flags & INODE_ENC_UID) {
+		pos = varint_put(pos, inode->i_uid);
+	}
+	if (flags & INODE_ENC_GID) {
+		pos = varint_put(pos, inode->i_gid);
+	}
+	if (flags & INODE_ENC_SIZE) {
+		pos = varint_put(pos, inode->i_size);
+	}
+	if (flags & INODE_ENC_NLINK) {
+		pos = varint_put(pos, inode->i_nlink);
+	}
+	if (flags & INODE_ENC_GEN) {
+		pos = varint_put(pos, inode->i_gen);
+	}
+	if (flags & INODE_ENC_MTIME) {
+		pos = varint_put(pos,
+			zigzag((uint64_t)inode->i_mtime - (uint64_t)inode->i_ctime));
+	}
+	if (flags & INODE_ENC_ATIME) {
+		pos = varint_put(pos,
+			zigzag((uint64_t)inode->i_atime - (uint64_t)inode->i_mtime));
+	}
+	
+	return pos - buf;
+}
+
+static bool inode_decode(const uint8_t *buf, uint32_t len, void *view) {
+	struct inode_item *inode = view;
+	const uint8_t *pos = buf, *end = buf + len;
+	
+	if (len == 0) {
+		return false;
+	}
+	uint8_t flags = *(pos++);
+	
+	uint16_t mode;
+	int64_t ctime;
+	if (!varint_get_u16(&pos, end, &mode) ||
+		!varint_get_s64(&pos, end, &ctime)) {
+		return false;
+	}
+	
+	uint32_t attr = 0, size = 0, nlink = 1, gen = 0;
+	uint16_t uid = 0, gid = 0;
+	int64_t mtime_delta = 0, atime_delta = 0;
+	
+	if (((flags & INODE_ENC_ATTR) && !varint_get_u32(&pos, end, &attr)) ||
+		((flags & INODE_ENC_UID) && !varint_get_u16(&pos, end, &uid)) ||
+		((flags & INODE_ENC_GID) && !varint_get_u16(&pos, end, &gid)) ||
+		((flags & INODE_ENC_SIZE) && !varint_get_u32(&pos, end, &size)) ||
+		((flags & INODE_ENC_NLINK) && !varint_get_u32(&pos, end, &nlink)) ||
+		((flags & INODE_ENC_GEN) && !varint_get_u32(&pos, end, &gen)) ||
+		((flags & INODE_ENC_MTIME) &&
+			!varint_get_s64(&pos, end, &mtime_delta)) ||
+		((flags & INODE_ENC_ATIME) &&
+			!varint_get_s64(&pos, end, &atime_delta))) {
+		return false;
+	}
+	
+	/* trailing garbage means this wasn't really an encoded inode */
+	if (pos != end) {
+		return false;
+	}
+	
+	int64_t mtime = (uint64_t)ctime + (uint64_t)mtime_delta;
+	int64_t atime = (uint64_t)mtime + (uint64_t)atime_delta;
+	
+	*inode = (struct inode_item){
+		.i_attr  = attr,
+		.i_mode  = mode,
+		.i_uid   = uid,
+		.i_gid   = gid,
+		.i_size  = size,
+		.i_atime = atime,
+		.i_ctime = ctime,
+		.i_mtime = mtime,
+		.i_nlink = nlink,
+		.i_gen   = gen,
+	};
+	
+	return true;
+}
+
+
+static const struct item_codec item_codecs[] = {
+	[KEY_INODE] = {
+		.view_len = sizeof(struct inode_item),
+		.encode   = inode_encode,
+		.decode   = inode_decode,
+	},
+};
+
+
+static const struct item_codec *item_codec_get(uint8_t type) {
+	if (type >= sizeof(item_codecs) / sizeof(*item_codecs) ||
+		item_codecs[type].encode == NULL) {
+		return NULL;
+	}
+	
+	return item_codecs + type;
+}
+
+/// @brief determines whether an item type has a compact encoding
+/// @param[in] type  item type (enum item_key)
+/// @return true if item_encode and item_decode handle the type
+bool item_has_codec(uint8_t type) {
+	return (item_codec_get(type) != NULL);
+}
+
+/// @brief gets the size of the struct view of an item type
+/// @param[in] type  item type (enum item_key)
+/// @return size of the decoded struct in bytes
+uint32_t item_view_len(uint8_t type) {
+	const struct item_codec *codec = item_codec_get(type);
+	if (codec == NULL) {
+		errx("%s: no codec for item type 0x%02" PRIx8, __func__, type);
+	}
+	
+	return codec->view_len;
+}
+
+/// @brief encodes an item from its struct view into its compact on-disk form
+/// @param[in]  type  item type (enum item_key)
+/// @param[in]  view  pointer to struct view of item
+/// @param[out] buf   buffer of at least ITEM_ENC_MAX bytes
+/// @return encoded length in bytes
+uint32_t item_encode(uint8_t type, const void *view, uint8_t *buf) {
+	const struct item_codec *codec = item_codec_get(type);
+	if (codec == NULL) {
+		errx("%s: no codec for item type 0x%02" PRIx8, __func__, type);
+	}
+	
+	return codec->encode(view, buf);
+}
+
+/// @brief decodes an item from its compact on-disk form into its struct view
+/// @param[in]  type  item type (enum item_key)
+/// @param[in]  buf   encoded item
+/// @param[in]  len   encoded length in bytes
+/// @param[out] view  pointer to struct view of item
+/// @return false if the encoding is malformed
+bool item_decode(uint8_t type, const uint8_t *buf, uint32_t len, void *view) {
+	const struct item_codec *codec = item_codec_get(type);
+	if (codec == NULL) {
+		errx("%s: no codec for item type 0x%02" PRIx8, __func__, type);
+	}
+	
+	return codec->decode(buf, len, view);
+}
@@ -13,14 +13,22 @@
 #include "key.h"
 
 
+/* longest encoding of any item type that has a codec */
+#define ITEM_ENC_MAX 64
+
+
 enum item_key {
-	KEY_INODE = 0x01,
+	KEY_INODE     = 0x01,
+	KEY_EXT_FREE  = 0x02, // free extent: id is its address, item its length
+	KEY_EXT_SIZE  = 0x03, // free extent: id is its length, off its address
+	KEY_EXT_CHUNK = 0x04, // chunk: id is its first block, item its type
 };
 
 
 struct item_data {
 	uint32_t len;
 	void *data;
+	bool ovf;  // data is a reference to an overflow extent
 };
 
 struct __attribute__((__packed__)) inode_item {
@@ -42,4 +50,10 @@ struct __attribute__((__packed__)) inode_item {
 };
 
 
+bool item_has_codec(uint8_t type);
+uint32_t item_view_len(uint8_t type);
+uint32_t item_encode(uint8_t type, const void *view, uint8_t *buf);
+bool item_decode(uint8_t type, const uint8_t *buf, uint32_t len, void *view);
+
+
 #endif
@@ -9,26 +9,71 @@
 #include "../debug.h"
 
 
+/* keys compare as 72-bit integers, which fit in one 128-bit compare */
+static unsigned __int128 key_norm_int(key_norm norm) {
+	return ((unsigned __int128)norm.hi << 8) | norm.lo;
+}
+
 int8_t key_cmp(const key *lhs, const key *rhs) {
-	if (lhs->id > rhs->id) {
-		return 1;
-	} else if (lhs->id < rhs->id) {
-		return -1;
-	}
+	return key_norm_cmp(key_normalize(lhs), key_normalize(rhs));
+}
+
+key_norm key_normalize(const key *key) {
+	return (key_norm){
+		.hi = ((uint64_t)key->id << 32) | ((uint64_t)key->type << 24) |
+			(key->off >> 8),
+		.lo = key->off & 0xff,
+	};
+}
+
+void key_denormalize(key_norm norm, key *out) {
+	out->id   = norm.hi >> 32;
+	out->type = (norm.hi >> 24) & 0xff;
+	out->off  = ((norm.hi & 0xffffff) << 8) | norm.lo;
+}
+
+int8_t key_norm_cmp(key_norm lhs, key_norm rhs) {
+	unsigned __int128 l = key_norm_int(lhs);
+	unsigned __int128 r = key_norm_int(rhs);
 	
-	if (lhs->type > rhs->type) {
-		return 1;
-	} else if (lhs->type < rhs->type) {
-		return -1;
-	}
+	return (l > r) - (l < r);
+}
+
+key_enc key_encode(const key *key) {
+	return (key_enc){ {
+		key->id >> 24, key->id >> 16, key->id >> 8, key->id,
+		key->type,
+		key->off >> 24, key->off >> 16, key->off >> 8, key->off,
+	} };
+}
+
+void key_decode(const key_enc *enc, key *out) {
+	const uint8_t *b = enc->b;
+	
+	out->id   = ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) |
+		((uint32_t)b[2] << 8) | b[3];
+	out->type = b[4];
+	out->off  = ((uint32_t)b[5] << 24) | ((uint32_t)b[6] << 16) |
+		((uint32_t)b[7] << 8) | b[8];
+}
+
+key_norm key_enc_norm(const key_enc *enc) {
+	key_norm norm = {
+		.hi = 0,
+		.lo = enc->b[KEY_ENC_LEN - 1],
+	};
 	
-	if (lhs->off > rhs->off) {
-		return 1;
-	} else if (lhs->off < rhs->off) {
-		return -1;
+	for (uint8_t i = 0; i < KEY_ENC_LEN - 1; ++i) {
+		norm.hi = (norm.hi << 8) | enc->b[i];
 	}
 	
-	return 0;
+	return norm;
+}
+
+int8_t key_enc_cmp(const key_enc *lhs, const key_enc *rhs) {
+	int cmp = memcmp(lhs->b, rhs->b, KEY_ENC_LEN);
+	
+	return (cmp > 0) - (cmp < 0);
 }
 
 const char *key_str(const key *key) {
@@ -18,9 +18,33 @@ typedef struct __attribute__((__packed__)) {
 	uint32_t off;
 } key;
 
+/* a key packed into integers that sort in the same order: id, type and the
+ * upper 24 bits of off make up hi, and the lower 8 bits of off make up lo */
+typedef struct {
+	uint64_t hi;
+	uint8_t  lo;
+} key_norm;
+
+/* the same 72-bit integer in big-endian byte order (id, type, off), so that
+ * encoded keys sort with memcmp */
+#define KEY_ENC_LEN 9
+
+typedef struct __attribute__((__packed__)) {
+	uint8_t b[KEY_ENC_LEN];
+} key_enc;
+
 
 int8_t key_cmp(const key *lhs, const key *rhs);
 const char *key_str(const key *key);
 
+key_norm key_normalize(const key *key);
+void key_denormalize(key_norm norm, key *out);
+int8_t key_norm_cmp(key_norm lhs, key_norm rhs);
+
+key_enc key_encode(const key *key);
+void key_decode(const key_enc *enc, key *out);
+key_norm key_enc_norm(const key_enc *enc);
+int8_t key_enc_cmp(const key_enc *lhs, const key_enc *rhs);
+
 
 #endif
@@ -9,6 +9,7 @@
 #define JGFS2_LIB_TREE_NODE_H
 
 
+#include <pthread.h>
 #include "../fs.h"
 #include "key.h"
 #include "item.h"
@@ -36,12 +37,35 @@
 	}
 
 
+/* leaves are counted in the root's fill histogram by how full they are, in
+ * steps of 1/NODE_FILL_BUCKETS */
+#define NODE_FILL_BUCKETS 8
+
+
+/* a leaf elem as a whole: its full encoded key and where its data lives */
 typedef struct __attribute__((__packed__)) {
-	key key;
+	key_enc key;
 	uint32_t len;
 	uint32_t off;
 } item_ref;
 
+/* what a leaf actually stores for each elem: the location of its data,
+ * followed by its encoded key minus the prefix that every key in the leaf
+ * shares (which is kept once, in the header); refs are kept sorted, but data
+ * is placed wherever the heap at the end of the node has room and is never
+ * moved on insert or removal, only when the heap is compacted */
+typedef struct __attribute__((__packed__)) {
+	uint32_t len : 31;
+	uint32_t ovf : 1;  // data is a struct item_ovf
+	uint32_t off;
+} item_loc;
+
+/* stands in for the data of an item too big to keep in a leaf */
+struct __attribute__((__packed__)) item_ovf {
+	uint32_t addr;
+	uint32_t len;
+};
+
 typedef struct __attribute__((__packed__)) {
 	key key;
 	uint32_t addr;
@@ -51,24 +75,65 @@ typedef struct __attribute__((__packed__)) {
 	key key;
 } elem;
 
+/* nodes written while in a commit group, whose writeback waits until the
+ * group commits (see tree/txn.c) */
+struct node_wb_list {
+	pthread_mutex_t lock;
+	
+	struct node_wb_ent *ents;
+	uint32_t cnt;
+	uint32_t max;
+};
+
 struct __attribute__((__packed__)) node_hdr {
 	bool leaf;
-	uint16_t cnt;
+	uint32_t cnt;
 	uint32_t this;
 	uint32_t prev;
 	uint32_t next;
 	uint32_t parent;
+	
+	/* every node in a tree has the same size, but each tree picks its own */
+	uint16_t size_blk;
+	
+	/* every node in a tree has the same flags, too */
+	uint8_t flags;
+	
+	/* buffered branches only */
+	uint32_t buf_used;
+	
+	/* leaves only */
+	uint8_t pfx_len;
+	uint8_t pfx[KEY_ENC_LEN - 1];
+	uint32_t heap_top;
+	uint32_t frag;
+	
+	/* the root's fill bucket this leaf is counted in, plus one; zero if it
+	 * isn't counted (branches never are) */
+	uint8_t fill;
+	
+	/* CRC-32C of the whole node, leaving out this field (see node/csum.c) */
+	uint32_t csum;
 };
 
 struct __attribute__((__packed__)) node {
 	struct node_hdr hdr;
 	
 	union {
-		node_ref b_elems[0];
-		item_ref l_elems[0];
+		uint8_t l_refs[0];
 	};
 };
 
+/* a pending insert or removal in a buffered branch; messages are kept in the
+ * order they arrived, so the last one for a key is the one that counts */
+struct __attribute__((__packed__)) buf_msg {
+	key_enc key;
+	uint8_t op;
+	uint32_t len : 31;
+	uint32_t ovf : 1;  // data is a struct item_ovf
+	uint8_t data[0];
+};
+
 union elem_payload {
 	uint32_t b_addr;
 	struct item_data l_item;
@@ -78,41 +143,193 @@ union elem_payload {
 typedef struct node *node_ptr;
 
 
-static uint32_t node_size_blk(void) {
-	return 1;
+enum node_flag {
+	NODE_BUFFERED = (1 << 0), // branches hold messages for their subtrees
+};
+
+enum buf_op {
+	BUF_OP_INSERT = 0, // insert the item, replacing any with the same key
+	BUF_OP_REMOVE = 1, // remove the item with the key, if there is one
+};
+
+
+/* what a leaf's Bloom filter says about a key */
+enum bloom_answer {
+	BLOOM_NONE,   // no filter (the node may not even be a leaf)
+	BLOOM_ABSENT, // definitely not in the leaf
+	BLOOM_MAYBE,  // possibly in the leaf
+};
+
+struct leaf_bloom_stats {
+	uint32_t filters;   // leaves that have a filter
+	size_t   footprint; // memory used by all filters, in bytes
+	
+	uint64_t queries;   // lookups that consulted a filter
+	uint64_t negatives; // lookups a filter answered with "absent"
+	uint64_t false_pos; // lookups a filter let through in vain
+	uint64_t rebuilds;  // filters built from scratch
+};
+
+
+static uint32_t node_size_blk(const node_ptr node) {
+	return node->hdr.size_blk;
 }
 
-static uint32_t node_size_byte(void) {
-	return node_size_blk() * fs.blk_size;
+static uint32_t node_size_byte(const node_ptr node) {
+	return node_size_blk(node) * fs.blk_size;
 }
 
-static uint32_t node_size_usable(void) {
-	return node_size_byte() - sizeof(struct node_hdr);
+static uint32_t node_size_usable(const node_ptr node) {
+	return node_size_byte(node) - sizeof(struct node_hdr);
 }
 
-static elem *node_elem(const node_ptr node, uint16_t idx) {
-	if (node->hdr.leaf) {
-		return (elem *)(node->l_elems + idx);
+
+/* branches of buffered trees give the last three quarters of the node over to
+ * a buffer of messages on their way down to the leaves; the fewer children a
+ * branch has, the more messages each flush carries to one of them */
+static uint32_t node_buf_size(const node_ptr node) {
+	if (!node->hdr.leaf && (node->hdr.flags & NODE_BUFFERED)) {
+		return node_size_byte(node) / 4 * 3;
 	} else {
-		return (elem *)(node->b_elems + idx);
+		return 0;
 	}
 }
 
+static uint8_t *branch_buf(const node_ptr branch) {
+	return (uint8_t *)branch + (node_size_byte(branch) -
+		node_buf_size(branch));
+}
+
+static uint32_t buf_msg_size(const struct buf_msg *msg) {
+	return sizeof(struct buf_msg) + msg->len;
+}
+
+static struct item_data buf_msg_item(const struct buf_msg *msg) {
+	return (struct item_data){
+		.len  = msg->len,
+		.data = (void *)msg->data,
+		.ovf  = msg->ovf,
+	};
+}
+
+
+/* branch elems are stored as parallel arrays rather than as node_refs, so that
+ * searches can scan a contiguous, aligned run of integer keys: first the high
+ * parts of the normalized keys, then the child block numbers, then the low
+ * parts of the keys; each array has room for branch_cap() elems */
+#define BRANCH_ARR_OFF 64
+
+static_assert(sizeof(struct node_hdr) <= BRANCH_ARR_OFF,
+	"struct node_hdr must not run into the branch arrays");
+
+static uint32_t branch_cap(const node_ptr branch) {
+	return (node_size_byte(branch) - node_buf_size(branch) - BRANCH_ARR_OFF) /
+		sizeof(node_ref);
+}
+
+static uint64_t *branch_key_hi(const node_ptr branch) {
+	return (uint64_t *)((uint8_t *)branch + BRANCH_ARR_OFF);
+}
+
+static uint32_t *branch_addr(const node_ptr branch) {
+	return (uint32_t *)(branch_key_hi(branch) + branch_cap(branch));
+}
+
+static uint8_t *branch_key_lo(const node_ptr branch) {
+	return (uint8_t *)(branch_addr(branch) + branch_cap(branch));
+}
+
+
+/* leaf refs all have the same size, which depends on the prefix length */
+static uint32_t leaf_ref_size(const node_ptr leaf) {
+	return sizeof(item_loc) + (KEY_ENC_LEN - leaf->hdr.pfx_len);
+}
+
+static item_loc *leaf_loc(const node_ptr leaf, uint32_t idx) {
+	return (item_loc *)(leaf->l_refs + (idx * leaf_ref_size(leaf)));
+}
+
+static uint8_t *leaf_key_sfx(const node_ptr leaf, uint32_t idx) {
+	return (uint8_t *)(leaf_loc(leaf, idx) + 1);
+}
+
 
 /* debugging */
 void node_dump(uint32_t node_addr, bool recurse);
 
 /* allocation */
-uint32_t node_alloc(void);
-void node_dealloc(uint32_t node_addr);
+uint32_t node_alloc(uint32_t size_blk, uint32_t hint);
+void node_dealloc(uint32_t node_addr, uint32_t size_blk);
+void node_dealloc_release(uint32_t node_addr);
 
 /* mapping */
 node_ptr node_map(uint32_t node_addr, bool writable);
+node_ptr node_map_try(uint32_t node_addr, uint32_t *size_blk);
 void node_unmap(const node_ptr node);
+void node_unmap_try(const node_ptr node, uint32_t node_addr,
+	uint32_t size_blk);
+void node_map_track(const node_ptr node, bool fresh);
+
+/* latching */
+void node_latch(uint32_t node_addr, bool excl);
+bool node_try_latch(uint32_t node_addr, bool excl);
+void node_unlatch(uint32_t node_addr, bool excl);
+bool node_latch_excl(uint32_t node_addr);
+void node_version_write_begin(uint32_t node_addr);
+void node_version_write_end(uint32_t node_addr);
+bool node_version_read(uint32_t node_addr, uint64_t *version);
+bool node_version_check(uint32_t node_addr, uint64_t version);
+
+/* checksums */
+uint32_t node_csum(const node_ptr node);
+bool node_csum_check(const node_ptr node, uint32_t node_addr);
+void node_csum_verify(const node_ptr node, uint32_t node_addr);
+bool node_csum_update(node_ptr node, bool fresh);
+void node_csum_fresh(uint32_t node_addr);
+void node_csum_init(void);
+void node_csum_done(void);
+
+/* deferred writeback */
+void node_wb_init(struct node_wb_list *list);
+void node_wb_attach(struct node_wb_list *list);
+bool node_wb_defer(const node_ptr node);
+uint32_t node_wb_flush(struct node_wb_list *list);
+
+/* dirty tracking */
+void node_dirty_mark(uint32_t node_addr);
+void node_dirty_dead(uint32_t node_addr, bool dead);
+uint32_t *node_dirty_take(uint32_t *cnt);
+void node_dirty_init(void);
+void node_dirty_done(void);
+
+/* data heap */
+uint32_t leaf_heap_gap(const node_ptr leaf);
+void leaf_heap_release(node_ptr leaf, uint32_t idx);
+void leaf_heap_compact(node_ptr leaf);
+
+/* Bloom filters */
+void leaf_bloom_build(const node_ptr leaf);
+void leaf_bloom_offer(const node_ptr leaf, uint64_t version);
+void leaf_bloom_add(const node_ptr leaf, const key *key);
+void leaf_bloom_remove(const node_ptr leaf);
+void leaf_bloom_drop(uint32_t node_addr);
+enum bloom_answer leaf_bloom_query(uint32_t node_addr, const key *key);
+void leaf_bloom_false_pos(void);
+struct leaf_bloom_stats leaf_bloom_stats(void);
+void leaf_bloom_done(void);
+
+/* message buffers */
+bool branch_buf_append(node_ptr branch, const key *key, uint8_t op,
+	struct item_data item);
+const struct buf_msg *branch_buf_find(const node_ptr branch, const key *key);
+bool branch_buf_max_key(const node_ptr branch, key *out);
+uint32_t branch_buf_busiest(const node_ptr branch);
+uint8_t *branch_buf_take(node_ptr branch, uint32_t idx, uint32_t *len);
+void branch_buf_split(node_ptr dst, node_ptr src);
 
 /* initialization */
-node_ptr node_init(uint32_t node_addr, bool leaf, uint32_t parent,
-	uint32_t prev, uint32_t next);
+node_ptr node_init(uint32_t node_addr, uint32_t size_blk, bool leaf,
+	uint8_t flags, uint32_t parent, uint32_t prev, uint32_t next);
 node_ptr node_copy_init(uint32_t dst_addr, const node_ptr src, uint32_t parent,
 	uint32_t prev, uint32_t next);
 
@@ -121,39 +338,60 @@ bool node_is_root(uint32_t node_addr);
 uint32_t node_find_root(uint32_t node_addr);
 
 /* space usage */
+uint32_t node_capacity(const node_ptr node);
 uint32_t node_used(const node_ptr node);
 uint32_t node_free(const node_ptr node);
+uint32_t node_insert_cost(const node_ptr node, const key *key,
+	uint32_t data_len);
+
+/* key prefixes */
+uint8_t leaf_pfx_fit(const node_ptr leaf, const key_enc *enc);
+void leaf_pfx_set(node_ptr leaf, uint8_t pfx_len, const uint8_t *pfx);
+void leaf_pfx_admit(node_ptr leaf, const key_enc *first, const key_enc *last);
+void leaf_pfx_compact(node_ptr leaf);
 
 /* keys */
-key *node_key(const node_ptr node, uint16_t idx);
-key *node_first_key(const node_ptr node);
+key node_key(const node_ptr node, uint32_t idx);
+key node_first_key(const node_ptr node);
+key_enc leaf_key_enc(const node_ptr leaf, uint32_t idx);
+int8_t node_key_cmp(const node_ptr node, uint32_t idx, const key *key);
+int8_t node_key_cmp_enc(const node_ptr node, uint32_t idx, const key_enc *enc);
 
 /* elements */
-uint32_t node_elem_weight(const node_ptr node, uint16_t idx);
-void node_elem_fill(node_ptr node, uint16_t idx, const key *key,
+uint32_t node_elem_weight(const node_ptr node, uint32_t idx);
+void node_elem_fill(node_ptr node, uint32_t idx, const key *key,
 	union elem_payload payload);
-void *leaf_elem_data(const node_ptr leaf, uint16_t idx);
+void *leaf_elem_data(const node_ptr leaf, uint32_t idx);
+item_ref leaf_elem(const node_ptr leaf, uint32_t idx);
+node_ref branch_elem(const node_ptr branch, uint32_t idx);
+void branch_elem_set_key(node_ptr branch, uint32_t idx, const key *key);
 
 /* bulk operations */
 void node_zero_all(node_ptr node);
-void node_zero_range(node_ptr node, uint16_t first);
-void node_shift_forward(node_ptr node, uint16_t first, uint16_t last,
-	uint16_t diff_elem, uint32_t diff_data);
-void node_shift_backward(node_ptr node, uint16_t first, uint16_t last,
-	uint16_t diff_elem, uint32_t diff_data);
-void node_append_multiple(node_ptr dst, const node_ptr src, uint16_t src_idx,
-	uint16_t elem_cnt, uint32_t data_len);
-void node_prepend_multiple(node_ptr dst, const node_ptr src, uint16_t src_idx,
-	uint16_t elem_cnt, uint32_t data_len);
+void node_zero_range(node_ptr node, uint32_t first);
+void node_shift_forward(node_ptr node, uint32_t first, uint32_t last,
+	uint32_t diff_elem);
+void node_shift_backward(node_ptr node, uint32_t first, uint32_t last,
+	uint32_t diff_elem);
+void node_append_multiple(node_ptr dst, const node_ptr src, uint32_t src_idx,
+	uint32_t elem_cnt);
+void node_prepend_multiple(node_ptr dst, const node_ptr src, uint32_t src_idx,
+	uint32_t elem_cnt);
 
 /* searching */
-bool node_search(const node_ptr node, const key *key, uint16_t *out);
-uint16_t node_search_hypo(const node_ptr node, const key *key);
+bool node_search(const node_ptr node, const key *key, uint32_t *out);
+uint32_t node_search_hypo(const node_ptr node, const key *key);
+uint32_t branch_search_idx(const node_ptr branch, const key *key);
 uint32_t branch_search(const node_ptr branch, const key *key);
-node_ref *branch_search_addr(const node_ptr branch, uint32_t addr);
+bool branch_search_addr(const node_ptr branch, uint32_t addr, uint32_t *out);
+const char *branch_search_impl(void);
 
 /* modifying */
 void node_update_ref_in_parent(const node_ptr node);
+void node_reparent(uint32_t node_addr, uint32_t parent_addr);
+void node_reparent_children(const node_ptr branch);
+bool node_insert(node_ptr node, const key *key, union elem_payload payload);
+void node_remove(node_ptr node, uint32_t idx);
 
 
 /* TODO: make a pass through all node code and delete/static-ify all functions
@@ -10,15 +10,65 @@
 #include "../../extent.h"
 
 
-/// @brief allocates a free block for use as a tree node
+/* nodes this thread has freed but still holds latched */
+#define NODE_DEALLOC_DEFER_MAX 64
+
+
+struct node_dealloc_ent {
+	uint32_t addr;
+	uint32_t size_blk;
+};
+
+
+/* a node is freed while its latch is still held, and is unmapped (writing its
+ * checksum) after that; its blocks only go back to the allocator once the
+ * latch is let go of, so that nobody else can have them in the meantime */
+static __thread struct node_dealloc_ent defer_tbl[NODE_DEALLOC_DEFER_MAX];
+static __thread uint32_t defer_cnt = 0;
+
+
+/// @brief allocates free blocks for use as a tree node
+/// @param[in] size_blk  node size in blocks
+/// @param[in] hint      block the node would best follow (the end of its
+/// sibling or parent), or zero for none
 /// @return block number
-uint32_t node_alloc(void) {
-	return ext_alloc(node_size_blk());
+uint32_t node_alloc(uint32_t size_blk, uint32_t hint) {
+	return ext_alloc(size_blk, EXT_TYPE_META, hint);
+}
+
+/// @brief deallocates the blocks of a tree node
+/// @param[in] node_addr  block number
+/// @param[in] size_blk   node size in blocks
+void node_dealloc(uint32_t node_addr, uint32_t size_blk) {
+	node_dirty_dead(node_addr, true);
+	
+	if (!node_latch_excl(node_addr)) {
+		ext_dealloc(node_addr, size_blk);
+		return;
+	}
+	
+	if (defer_cnt == NODE_DEALLOC_DEFER_MAX) {
+		errx("%s: too many nodes freed under latch: node 0x%" PRIx32,
+			__func__, node_addr);
+	}
+	
+	defer_tbl[defer_cnt++] = (struct node_dealloc_ent){
+		.addr     = node_addr,
+		.size_blk = size_blk,
+	};
 }
 
-/// @brief deallocates a tree node block
+/// @brief gives back the blocks of a node freed while it was latched, now that
+/// this thread has let go of it for good
 /// @param[in] node_addr  block number
-void node_dealloc(uint32_t node_addr) {
-	TODO("implement this");
-	/*ext_dealloc(node_addr, node_size_blk());*/
+void node_dealloc_release(uint32_t node_addr) {
+	for (uint32_t i = 0; i < defer_cnt; ++i) {
+		if (defer_tbl[i].addr == node_addr) {
+			uint32_t size_blk = defer_tbl[i].size_blk;
+			defer_tbl[i] = defer_tbl[--defer_cnt];
+			
+			ext_dealloc(node_addr, size_blk);
+			return;
+		}
+	}
 }
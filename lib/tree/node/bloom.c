@@ -0,0 +1,383 @@
+/* jgfs2
+ * (c) 2013 Justin Gottula
+ * The source code of this project is distributed under the terms of the
+ * simplified BSD license. See the LICENSE file for details.
+ */
+
+
+#include "../node.h"
+#include <pthread.h>
+#include "../../debug.h"
+
+
+#define BLOOM_BUCKETS 256
+
+/* a filter is sized for at least this many keys, so that nearly empty leaves
+ * don't have to be rebuilt over and over as they fill up */
+#define BLOOM_KEYS_MIN 32
+
+#define BLOOM_HASHES_MAX 16
+
+/* filters in different buckets change at the same time, so the counters that
+ * cover all of them are atomic */
+#define BLOOM_STAT_ADD(_field, _n) \
+	__atomic_add_fetch(&bloom_stats._field, (_n), __ATOMIC_RELAXED)
+#define BLOOM_STAT_SUB(_field, _n) \
+	__atomic_sub_fetch(&bloom_stats._field, (_n), __ATOMIC_RELAXED)
+#define BLOOM_STAT_GET(_field) \
+	__atomic_load_n(&bloom_stats._field, __ATOMIC_RELAXED)
+
+
+/* filters live only in memory, keyed by leaf block number; each one holds
+ * every key its leaf has, plus (until the next rebuild) keys that have since
+ * been removed from it, so it can only ever err toward "maybe"; whoever
+ * changes a filter must hold its leaf's latch exclusively, or hold it shared
+ * when building a filter that doesn't exist yet */
+struct leaf_bloom {
+	struct leaf_bloom *next;
+	
+	uint32_t addr;
+	
+	uint32_t cap;     // keys the filter was sized for
+	uint32_t added;   // keys added since the last rebuild
+	uint32_t removed; // keys removed since the last rebuild
+	
+	uint32_t bit_cnt;
+	uint8_t  hash_cnt;
+	uint64_t bits[];
+};
+
+struct bloom_bucket {
+	pthread_mutex_t lock;
+	struct leaf_bloom *list;
+};
+
+
+static struct bloom_bucket bloom_tbl[BLOOM_BUCKETS] = {
+	[0 ... (BLOOM_BUCKETS - 1)] = {
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.list = NULL,
+	},
+};
+
+static struct leaf_bloom_stats bloom_stats;
+
+
+static struct bloom_bucket *leaf_bloom_bucket(uint32_t leaf_addr) {
+	/* fibonacci hashing spreads out sequentially allocated blocks */
+	return bloom_tbl + ((leaf_addr * UINT32_C(2654435769)) >> 24) %
+		BLOOM_BUCKETS;
+}
+
+static struct leaf_bloom **leaf_bloom_find(struct bloom_bucket *bucket,
+	uint32_t leaf_addr) {
+	struct leaf_bloom **entry = &bucket->list;
+	while (*entry != NULL && (*entry)->addr != leaf_addr) {
+		entry = &(*entry)->next;
+	}
+	
+	return entry;
+}
+
+static size_t leaf_bloom_size(const struct leaf_bloom *bloom) {
+	return sizeof(*bloom) + (bloom->bit_cnt / 8);
+}
+
+/// @brief takes a filter out of its bucket and frees it; expects the bucket to
+/// be locked
+/// @param[in] entry  link to the filter, from leaf_bloom_find
+static void leaf_bloom_free(struct leaf_bloom **entry) {
+	struct leaf_bloom *bloom = *entry;
+	*entry = bloom->next;
+	
+	BLOOM_STAT_SUB(filters, 1);
+	BLOOM_STAT_SUB(footprint, leaf_bloom_size(bloom));
+	free(bloom);
+}
+
+/// @brief mixes a normalized key into a hash from which all of a filter's bit
+/// positions are derived
+/// @param[in] norm  normalized key
+/// @return 64-bit hash
+static uint64_t leaf_bloom_hash(key_norm norm) {
+	uint64_t hash = norm.hi ^ (norm.lo * UINT64_C(0x9e3779b97f4a7c15));
+	
+	hash ^= hash >> 30;
+	hash *= UINT64_C(0xbf58476d1ce4e5b9);
+	hash ^= hash >> 27;
+	hash *= UINT64_C(0x94d049bb133111eb);
+	hash ^= hash >> 31;
+	
+	return hash;
+}
+
+/// @brief sets or tests the bits for a key, using double hashing to get as
+/// many positions as needed out of one hash
+/// @param[in] bloom  pointer to filter
+/// @param[in] norm   normalized key
+/// @param[in] set    set the bits instead of testing them
+/// @return true if all of the key's bits were already set
+static bool leaf_bloom_bits(struct leaf_bloom *bloom, key_norm norm,
+	bool set) {
+	uint64_t hash = leaf_bloom_hash(norm);
+	uint64_t h1 = (uint32_t)hash;
+	uint64_t h2 = (hash >> 32) | 1;
+	
+	bool all = true;
+	for (uint8_t i = 0; i < bloom->hash_cnt; ++i) {
+		uint32_t bit = (h1 + (i * h2)) % bloom->bit_cnt;
+		uint64_t mask = UINT64_C(1) << (bit % 64);
+		
+		all = all && (bloom->bits[bit / 64] & mask) != 0;
+		if (set) {
+			bloom->bits[bit / 64] |= mask;
+		}
+	}
+	
+	return all;
+}
+
+/// @brief builds a filter from scratch out of a leaf's current keys, replacing
+/// the filter it had, if any; expects the bucket to be locked
+/// @param[in] bucket  bucket the leaf belongs to
+/// @param[in] leaf    pointer to leaf node
+static struct leaf_bloom *leaf_bloom_make(struct bloom_bucket *bucket,
+	const node_ptr leaf) {
+	uint8_t bits_per_key = fs.mount_opt.bloom_bits;
+	
+	uint32_t cap = leaf->hdr.cnt * 2;
+	if (cap < BLOOM_KEYS_MIN) {
+		cap = BLOOM_KEYS_MIN;
+	}
+	
+	uint32_t bit_cnt = CEIL(cap * bits_per_key, 64) * 64;
+	
+	/* k = ln 2 * (bits per key) is what minimizes false positives */
+	uint8_t hash_cnt = (bits_per_key * 69 + 50) / 100;
+	if (hash_cnt < 1) {
+		hash_cnt = 1;
+	} else if (hash_cnt > BLOOM_HASHES_MAX) {
+		hash_cnt = BLOOM_HASHES_MAX;
+	}
+	
+	struct leaf_bloom **entry = leaf_bloom_find(bucket, leaf->hdr.this);
+	struct leaf_bloom *old = *entry;
+	
+	struct leaf_bloom *bloom = calloc(1, sizeof(*bloom) + (bit_cnt / 8));
+	bloom->next     = (old != NULL ? old->next : NULL);
+	bloom->addr     = leaf->hdr.this;
+	bloom->cap      = cap;
+	bloom->added    = leaf->hdr.cnt;
+	bloom->removed  = 0;
+	bloom->bit_cnt  = bit_cnt;
+	bloom->hash_cnt = hash_cnt;
+	
+	for (uint32_t i = 0; i < leaf->hdr.cnt; ++i) {
+		key_enc enc = leaf_key_enc(leaf, i);
+		leaf_bloom_bits(bloom, key_enc_norm(&enc), true);
+	}
+	
+	if (old != NULL) {
+		BLOOM_STAT_SUB(footprint, leaf_bloom_size(old));
+		free(old);
+		
+		*entry = bloom;
+	} else {
+		BLOOM_STAT_ADD(filters, 1);
+		
+		bloom->next = bucket->list;
+		bucket->list = bloom;
+	}
+	
+	BLOOM_STAT_ADD(footprint, leaf_bloom_size(bloom));
+	BLOOM_STAT_ADD(rebuilds, 1);
+	
+	return bloom;
+}
+
+/// @brief builds a leaf's filter from its current keys, replacing the filter
+/// it had, if any; the leaf must be latched
+/// @param[in] leaf  pointer to leaf node
+void leaf_bloom_build(const node_ptr leaf) {
+	ASSERT_LEAF(leaf);
+	
+	if (fs.mount_opt.bloom_bits == 0) {
+		return;
+	}
+	
+	struct bloom_bucket *bucket = leaf_bloom_bucket(leaf->hdr.this);
+	pthread_mutex_lock(&bucket->lock);
+	
+	leaf_bloom_make(bucket, leaf);
+	
+	pthread_mutex_unlock(&bucket->lock);
+}
+
+/// @brief builds a leaf's filter while reading the leaf without a latch, but
+/// only if the leaf has no filter yet and doesn't change while it is read
+/// @param[in] leaf     pointer to leaf node, not latched
+/// @param[in] version  version of the leaf recorded before it was mapped
+void leaf_bloom_offer(const node_ptr leaf, uint64_t version) {
+	if (fs.mount_opt.bloom_bits == 0) {
+		return;
+	}
+	
+	uint32_t leaf_addr = leaf->hdr.this;
+	
+	struct bloom_bucket *bucket = leaf_bloom_bucket(leaf_addr);
+	pthread_mutex_lock(&bucket->lock);
+	
+	/* writers lock the bucket only after latching the leaf, so if the version
+	 * still holds once the filter is built, anyone changing the leaf will find
+	 * this filter and keep it up to date; if it doesn't, the filter may have
+	 * missed keys that were on the move, and nobody else has seen it yet */
+	if (*leaf_bloom_find(bucket, leaf_addr) == NULL &&
+		node_version_check(leaf_addr, version)) {
+		leaf_bloom_make(bucket, leaf);
+		
+		if (!node_version_check(leaf_addr, version)) {
+			leaf_bloom_free(leaf_bloom_find(bucket, leaf_addr));
+		}
+	}
+	
+	pthread_mutex_unlock(&bucket->lock);
+}
+
+/// @brief adds a key that was just inserted into a leaf to its filter,
+/// building the filter first if it doesn't have one or if it has outgrown the
+/// size it was built for; the leaf must be latched exclusively
+/// @param[in] leaf  pointer to leaf node
+/// @param[in] key   key of new elem
+void leaf_bloom_add(const node_ptr leaf, const key *key) {
+	ASSERT_LEAF(leaf);
+	
+	if (fs.mount_opt.bloom_bits == 0) {
+		return;
+	}
+	
+	struct bloom_bucket *bucket = leaf_bloom_bucket(leaf->hdr.this);
+	pthread_mutex_lock(&bucket->lock);
+	
+	struct leaf_bloom *bloom = *leaf_bloom_find(bucket, leaf->hdr.this);
+	if (bloom == NULL || bloom->added == bloom->cap) {
+		/* the key is already in the leaf, so it goes in with the rest */
+		leaf_bloom_make(bucket, leaf);
+	} else {
+		leaf_bloom_bits(bloom, key_normalize(key), true);
+		++bloom->added;
+	}
+	
+	pthread_mutex_unlock(&bucket->lock);
+}
+
+/// @brief notes that a key was removed from a leaf: its bits stay set, but
+/// once enough keys have gone the filter is rebuilt so that they stop causing
+/// false positives; the leaf must be latched exclusively
+/// @param[in] leaf  pointer to leaf node
+void leaf_bloom_remove(const node_ptr leaf) {
+	ASSERT_LEAF(leaf);
+	
+	if (fs.mount_opt.bloom_bits == 0) {
+		return;
+	}
+	
+	struct bloom_bucket *bucket = leaf_bloom_bucket(leaf->hdr.this);
+	pthread_mutex_lock(&bucket->lock);
+	
+	struct leaf_bloom *bloom = *leaf_bloom_find(bucket, leaf->hdr.this);
+	if (bloom != NULL && ++bloom->removed > bloom->added / 2) {
+		leaf_bloom_make(bucket, leaf);
+	}
+	
+	pthread_mutex_unlock(&bucket->lock);
+}
+
+/// @brief throws away the filter for a node that is no longer a leaf (or no
+/// longer exists), if it has one; the node must be latched exclusively
+/// @param[in] node_addr  block number of node
+void leaf_bloom_drop(uint32_t node_addr) {
+	if (fs.mount_opt.bloom_bits == 0) {
+		return;
+	}
+	
+	struct bloom_bucket *bucket = leaf_bloom_bucket(node_addr);
+	pthread_mutex_lock(&bucket->lock);
+	
+	struct leaf_bloom **entry = leaf_bloom_find(bucket, node_addr);
+	if (*entry != NULL) {
+		leaf_bloom_free(entry);
+	}
+	
+	pthread_mutex_unlock(&bucket->lock);
+}
+
+/// @brief asks a node's filter whether a key could be in it; only leaves have
+/// filters, so a node without one may or may not be a leaf
+/// @param[in] node_addr  block number of node
+/// @param[in] key        key to look for
+/// @return what the filter says
+enum bloom_answer leaf_bloom_query(uint32_t node_addr, const key *key) {
+	if (fs.mount_opt.bloom_bits == 0) {
+		return BLOOM_NONE;
+	}
+	
+	enum bloom_answer answer = BLOOM_NONE;
+	
+	struct bloom_bucket *bucket = leaf_bloom_bucket(node_addr);
+	pthread_mutex_lock(&bucket->lock);
+	
+	struct leaf_bloom *bloom = *leaf_bloom_find(bucket, node_addr);
+	if (bloom != NULL) {
+		answer = (leaf_bloom_bits(bloom, key_normalize(key), false) ?
+			BLOOM_MAYBE : BLOOM_ABSENT);
+	}
+	
+	pthread_mutex_unlock(&bucket->lock);
+	
+	if (answer != BLOOM_NONE) {
+		BLOOM_STAT_ADD(queries, 1);
+		if (answer == BLOOM_ABSENT) {
+			BLOOM_STAT_ADD(negatives, 1);
+		}
+	}
+	
+	return answer;
+}
+
+/// @brief counts a lookup that a leaf's filter let through, but that didn't
+/// find its key in the leaf
+void leaf_bloom_false_pos(void) {
+	BLOOM_STAT_ADD(false_pos, 1);
+}
+
+/// @brief reports on the filters of every leaf
+/// @return filter statistics
+struct leaf_bloom_stats leaf_bloom_stats(void) {
+	return (struct leaf_bloom_stats){
+		.filters   = BLOOM_STAT_GET(filters),
+		.footprint = BLOOM_STAT_GET(footprint),
+		
+		.queries   = BLOOM_STAT_GET(queries),
+		.negatives = BLOOM_STAT_GET(negatives),
+		.false_pos = BLOOM_STAT_GET(false_pos),
+		.rebuilds  = BLOOM_STAT_GET(rebuilds),
+	};
+}
+
+/// @brief throws away every filter; only for when the filesystem is going away
+/// and nothing else is running
+void leaf_bloom_done(void) {
+	for (uint32_t i = 0; i < BLOOM_BUCKETS; ++i) {
+		struct leaf_bloom *bloom = bloom_tbl[i].list;
+		while (bloom != NULL) {
+			struct leaf_bloom *next = bloom->next;
+			free(bloom);
+			
+			bloom = next;
+		}
+		
+		bloom_tbl[i].list = NULL;
+	}
+	
+	bloom_stats = (struct leaf_bloom_stats){ 0 };
+}
@@ -0,0 +1,205 @@
+/* jgfs2
+ * (c) 2013 Justin Gottula
+ * The source code of this project is distributed under the terms of the
+ * simplified BSD license. See the LICENSE file for details.
+ */
+
+
+#include "../node.h"
+#include "../../debug.h"
+
+
+/// @brief gets the message at an offset into a branch's buffer
+/// @param[in] branch  pointer to buffered branch node
+/// @param[in] off     byte offset into buffer
+/// @return pointer to message
+static struct buf_msg *branch_buf_msg(const node_ptr branch, uint32_t off) {
+	return (struct buf_msg *)(branch_buf(branch) + off);
+}
+
+/// @brief finds the child a buffered message will be passed down to
+/// @param[in] branch  pointer to buffered branch node
+/// @param[in] msg     pointer to message
+/// @return elem index of child
+static uint32_t branch_buf_route(const node_ptr branch,
+	const struct buf_msg *msg) {
+	key msg_key;
+	key_decode(&msg->key, &msg_key);
+	
+	return branch_search_idx(branch, &msg_key);
+}
+
+/// @brief appends a message to a branch's buffer, if there is room for it
+/// @param[in] branch  pointer to buffered branch node
+/// @param[in] key     key of item
+/// @param[in] op      what to do with the item (enum buf_op)
+/// @param[in] item    item to insert (BUF_OP_INSERT only)
+/// @return false if the buffer does not have enough free space
+bool branch_buf_append(node_ptr branch, const key *key, uint8_t op,
+	struct item_data item) {
+	uint32_t len = (op == BUF_OP_INSERT ? item.len : 0);
+	if (branch->hdr.buf_used + sizeof(struct buf_msg) + len >
+		node_buf_size(branch)) {
+		return false;
+	}
+	
+	struct buf_msg *msg = branch_buf_msg(branch, branch->hdr.buf_used);
+	
+	msg->key = key_encode(key);
+	msg->op  = op;
+	msg->len = len;
+	msg->ovf = (op == BUF_OP_INSERT && item.ovf);
+	
+	if (len != 0) {
+		memcpy(msg->data, item.data, len);
+	}
+	
+	branch->hdr.buf_used += buf_msg_size(msg);
+	
+	return true;
+}
+
+/// @brief finds the most recent message in a branch's buffer for a key
+/// @param[in] branch  pointer to buffered branch node
+/// @param[in] key     key to search for
+/// @return pointer to message, or NULL if the buffer has none for the key
+const struct buf_msg *branch_buf_find(const node_ptr branch, const key *key) {
+	key_enc enc = key_encode(key);
+	const struct buf_msg *found = NULL;
+	
+	/* messages vary in size, so the buffer can only be walked forward */
+	uint32_t off = 0;
+	while (off < branch->hdr.buf_used) {
+		const struct buf_msg *msg = branch_buf_msg(branch, off);
+		
+		if (key_enc_cmp(&msg->key, &enc) == 0) {
+			found = msg;
+		}
+		
+		off += buf_msg_size(msg);
+	}
+	
+	return found;
+}
+
+/// @brief finds the greatest key that any message in a branch's buffer is for
+/// @param[in]  branch  pointer to buffered branch node
+/// @param[out] out     greatest key
+/// @return false if the buffer is empty
+bool branch_buf_max_key(const node_ptr branch, key *out) {
+	if (branch->hdr.buf_used == 0) {
+		return false;
+	}
+	
+	key_enc max = branch_buf_msg(branch, 0)->key;
+	
+	uint32_t off = 0;
+	while (off < branch->hdr.buf_used) {
+		const struct buf_msg *msg = branch_buf_msg(branch, off);
+		
+		if (key_enc_cmp(&msg->key, &max) > 0) {
+			max = msg->key;
+		}
+		
+		off += buf_msg_size(msg);
+	}
+	
+	key_decode(&max, out);
+	return true;
+}
+
+/// @brief finds the child that the most messages in a branch's buffer are
+/// headed for
+/// @param[in] branch  pointer to buffered branch node with a nonempty buffer
+/// @return elem index of child
+uint32_t branch_buf_busiest(const node_ptr branch) {
+	ASSERT_BRANCH(branch);
+	
+	uint32_t *counts = calloc(branch->hdr.cnt, sizeof(uint32_t));
+	
+	uint32_t off = 0;
+	while (off < branch->hdr.buf_used) {
+		const struct buf_msg *msg = branch_buf_msg(branch, off);
+		
+		++counts[branch_buf_route(branch, msg)];
+		
+		off += buf_msg_size(msg);
+	}
+	
+	uint32_t busiest = 0;
+	for (uint32_t i = 1; i < branch->hdr.cnt; ++i) {
+		if (counts[i] > counts[busiest]) {
+			busiest = i;
+		}
+	}
+	
+	free(counts);
+	return busiest;
+}
+
+/// @brief takes every message headed for one child out of a branch's buffer,
+/// keeping the rest in order
+/// @param[in]  branch  pointer to buffered branch node
+/// @param[in]  idx     elem index of child
+/// @param[out] len     total length of the messages taken, in bytes
+/// @return newly allocated copy of the messages taken, in order
+uint8_t *branch_buf_take(node_ptr branch, uint32_t idx, uint32_t *len) {
+	ASSERT_BRANCH(branch);
+	
+	uint8_t *taken = malloc(branch->hdr.buf_used);
+	*len = 0;
+	
+	uint32_t off_read  = 0;
+	uint32_t off_write = 0;
+	while (off_read < branch->hdr.buf_used) {
+		struct buf_msg *msg = branch_buf_msg(branch, off_read);
+		uint32_t size = buf_msg_size(msg);
+		
+		if (branch_buf_route(branch, msg) == idx) {
+			memcpy(taken + *len, msg, size);
+			*len += size;
+		} else {
+			memmove(branch_buf_msg(branch, off_write), msg, size);
+			off_write += size;
+		}
+		
+		off_read += size;
+	}
+	
+	memset(branch_buf_msg(branch, off_write), 0, *len);
+	branch->hdr.buf_used = off_write;
+	
+	return taken;
+}
+
+/// @brief moves the messages that belong to the right half of a freshly split
+/// branch over to it, once the elems themselves have been moved
+/// @param[in] dst  pointer to right half, with an empty buffer
+/// @param[in] src  pointer to left half
+void branch_buf_split(node_ptr dst, node_ptr src) {
+	ASSERT_BRANCH(dst);
+	ASSERT_BRANCH(src);
+	
+	key first = node_first_key(dst);
+	key_enc first_enc = key_encode(&first);
+	
+	uint32_t off_read  = 0;
+	uint32_t off_write = 0;
+	while (off_read < src->hdr.buf_used) {
+		struct buf_msg *msg = branch_buf_msg(src, off_read);
+		uint32_t size = buf_msg_size(msg);
+		
+		if (key_enc_cmp(&msg->key, &first_enc) >= 0) {
+			memcpy(branch_buf_msg(dst, dst->hdr.buf_used), msg, size);
+			dst->hdr.buf_used += size;
+		} else {
+			memmove(branch_buf_msg(src, off_write), msg, size);
+			off_write += size;
+		}
+		
+		off_read += size;
+	}
+	
+	memset(branch_buf_msg(src, off_write), 0, src->hdr.buf_used - off_write);
+	src->hdr.buf_used = off_write;
+}
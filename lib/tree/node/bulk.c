@@ -9,142 +9,121 @@
 #include "../../debug.h"
 
 
-/// @brief zeroes the entire node, except the header
+/// @brief zeroes the entire node, except the header, leaving a leaf with an
+/// empty data heap or a branch with an empty message buffer
 /// @param[in] node  pointer to node
 void node_zero_all(node_ptr node) {
 	uint8_t *zero_begin = (uint8_t *)node + sizeof(struct node_hdr);
-	uint8_t *zero_end   = (uint8_t *)node + node_size_byte();
+	uint8_t *zero_end   = (uint8_t *)node + node_size_byte(node);
 	
 	memset(zero_begin, 0, (zero_end - zero_begin));
+	
+	node->hdr.heap_top = node_size_byte(node);
+	node->hdr.frag     = 0;
+	
+	node->hdr.buf_used = 0;
+}
+
+/// @brief moves a range of branch elems, each array separately
+/// @param[in] dst       pointer to destination node
+/// @param[in] src       pointer to source node
+/// @param[in] dst_idx   first index in destination
+/// @param[in] src_idx   first index in source
+/// @param[in] elem_cnt  number of elems
+static void branch_move(node_ptr dst, const node_ptr src, uint32_t dst_idx,
+	uint32_t src_idx, uint32_t elem_cnt) {
+	memmove(branch_key_hi(dst) + dst_idx, branch_key_hi(src) + src_idx,
+		elem_cnt * sizeof(uint64_t));
+	memmove(branch_addr(dst) + dst_idx, branch_addr(src) + src_idx,
+		elem_cnt * sizeof(uint32_t));
+	memmove(branch_key_lo(dst) + dst_idx, branch_key_lo(src) + src_idx,
+		elem_cnt * sizeof(uint8_t));
+}
+
+/// @brief moves a range of refs within a leaf; their data stays put
+/// @param[in] leaf      pointer to leaf node
+/// @param[in] dst_idx   first index to move to
+/// @param[in] src_idx   first index to move from
+/// @param[in] elem_cnt  number of elems
+static void leaf_move(node_ptr leaf, uint32_t dst_idx, uint32_t src_idx,
+	uint32_t elem_cnt) {
+	memmove(leaf_loc(leaf, dst_idx), leaf_loc(leaf, src_idx),
+		elem_cnt * leaf_ref_size(leaf));
 }
 
 /// @brief zeroes all elems in a node, starting from a particular index
 /// @param[in] node   pointer to node
 /// @param[in] first  first index to zero
-void node_zero_range(node_ptr node, uint16_t first) {
+void node_zero_range(node_ptr node, uint32_t first) {
 	if (first >= node->hdr.cnt) {
-		errx("%s: first exceeds bounds: node 0x%" PRIx32 ": %" PRIu16
-			" >= %" PRIu16, __func__, node->hdr.this, first, node->hdr.cnt);
+		errx("%s: first exceeds bounds: node 0x%" PRIx32 ": %" PRIu32
+			" >= %" PRIu32, __func__, node->hdr.this, first, node->hdr.cnt);
 	}
 	
-	uint8_t *zero_begin;
-	uint8_t *zero_end;
-	
 	if (node->hdr.leaf) {
-		const item_ref *elem_first = node->l_elems + first;
+		for (uint32_t i = first; i < node->hdr.cnt; ++i) {
+			leaf_heap_release(node, i);
+		}
 		
-		zero_begin = (uint8_t *)elem_first;
-		zero_end   = (uint8_t *)leaf_elem_data(node, first) + elem_first->len;
+		memset(leaf_loc(node, first), 0,
+			(node->hdr.cnt - first) * leaf_ref_size(node));
 	} else {
-		const node_ref *elem_first = node->b_elems + first;
+		uint32_t zero_cnt = branch_cap(node) - first;
 		
-		zero_begin = (uint8_t *)elem_first;
-		zero_end   = (uint8_t *)node + node_size_byte();
+		memset(branch_key_hi(node) + first, 0, zero_cnt * sizeof(uint64_t));
+		memset(branch_addr(node) + first, 0, zero_cnt * sizeof(uint32_t));
+		memset(branch_key_lo(node) + first, 0, zero_cnt * sizeof(uint8_t));
 	}
-	
-	memset(zero_begin, 0, (zero_end - zero_begin));
 }
 
-/// @brief shifts all elems in a node to a higher index (and offset)
+/// @brief shifts all elems in a node to a higher index
 /// @param[in] node       pointer to node
 /// @param[in] first      first index to shift
 /// @param[in] last       last index to shift
 /// @param[in] diff_elem  amount by which to shift elems
-/// @param[in] diff_data  amount by which to shift data offsets (if leaf node)
-void node_shift_forward(node_ptr node, uint16_t first, uint16_t last,
-	uint16_t diff_elem, uint32_t diff_data) {
+void node_shift_forward(node_ptr node, uint32_t first, uint32_t last,
+	uint32_t diff_elem) {
 	if (first > last) {
-		errx("%s: first > last: node 0x%" PRIx32 ": %" PRIu16
-			" >= %" PRIu16, __func__, node->hdr.this, first, last);
+		errx("%s: first > last: node 0x%" PRIx32 ": %" PRIu32
+			" >= %" PRIu32, __func__, node->hdr.this, first, last);
 	} else if (last >= node->hdr.cnt) {
-		errx("%s: last exceeds bounds: node 0x%" PRIx32 ": %" PRIu16
-			" >= %" PRIu16, __func__, node->hdr.this, last, node->hdr.cnt);
-	} else if (UINT16_MAX - diff_elem < last) {
-		errx("%s: will exceed bounds: node 0x%" PRIx32 ": %" PRIu16 " + %"
-			PRIu16 " >= %" PRIu16,
+		errx("%s: last exceeds bounds: node 0x%" PRIx32 ": %" PRIu32
+			" >= %" PRIu32, __func__, node->hdr.this, last, node->hdr.cnt);
+	} else if (UINT32_MAX - diff_elem < last) {
+		errx("%s: will exceed bounds: node 0x%" PRIx32 ": %" PRIu32 " + %"
+			PRIu32 " >= %" PRIu32,
 			__func__, node->hdr.this, last, diff_elem, node->hdr.cnt);
 	}
 	
-	if (diff_data != 0) {
-		ASSERT_LEAF(node);
-		
-		uint8_t *data_begin = leaf_elem_data(node, last);
-		uint8_t *data_end   = leaf_elem_data(node, first) +
-			node->l_elems[first].len;
-		
-		memmove(data_begin - diff_data, data_begin, (data_end - data_begin));
-	}
-	
 	if (node->hdr.leaf) {
-		item_ref *elem_first = node->l_elems + first;
-		item_ref *elem_last  = node->l_elems + last;
-		
-		for (item_ref *elem = elem_last; elem >= elem_first; --elem) {
-			item_ref *elem_dst = elem + diff_elem;
-			
-			*elem_dst = *elem;
-			elem_dst->off -= diff_data;
-		}
+		leaf_move(node, first + diff_elem, first, (last - first) + 1);
 	} else {
-		node_ref *elem_first = node->b_elems + first;
-		node_ref *elem_last  = node->b_elems + last;
-		
-		for (node_ref *elem = elem_last; elem >= elem_first; --elem) {
-			node_ref *elem_dst = elem + diff_elem;
-			
-			*elem_dst = *elem;
-		}
+		branch_move(node, node, first + diff_elem, first, (last - first) + 1);
 	}
 }
 
-/// @brief shifts all elems in a node to a lower index (and offset)
+/// @brief shifts all elems in a node to a lower index
 /// @param[in] node       pointer to node
 /// @param[in] first      first index to shift
 /// @param[in] last       last index to shift
 /// @param[in] diff_elem  amount by which to shift elems
-/// @param[in] diff_data  amount by which to shift data offsets (if leaf node)
-void node_shift_backward(node_ptr node, uint16_t first, uint16_t last,
-	uint16_t diff_elem, uint32_t diff_data) {
+void node_shift_backward(node_ptr node, uint32_t first, uint32_t last,
+	uint32_t diff_elem) {
 	if (first > last) {
-		errx("%s: first > last: node 0x%" PRIx32 ": %" PRIu16
-			" >= %" PRIu16, __func__, node->hdr.this, first, last);
+		errx("%s: first > last: node 0x%" PRIx32 ": %" PRIu32
+			" >= %" PRIu32, __func__, node->hdr.this, first, last);
 	} else if (last >= node->hdr.cnt) {
-		errx("%s: last exceeds bounds: node 0x%" PRIx32 ": %" PRIu16
-			" >= %" PRIu16, __func__, node->hdr.this, last, node->hdr.cnt);
+		errx("%s: last exceeds bounds: node 0x%" PRIx32 ": %" PRIu32
+			" >= %" PRIu32, __func__, node->hdr.this, last, node->hdr.cnt);
 	} else if (first < diff_elem) {
-		errx("%s: will exceed bounds: node 0x%" PRIx32 ": %" PRIu16 " - %"
-			PRIu16 " < 0", __func__, node->hdr.this, first, diff_elem);
-	}
-	
-	if (diff_data != 0) {
-		ASSERT_LEAF(node);
-		
-		uint8_t *data_begin = leaf_elem_data(node, last);
-		uint8_t *data_end   = leaf_elem_data(node, first) +
-			node->l_elems[first].len;
-		
-		memmove(data_begin + diff_data, data_begin, (data_end - data_begin));
+		errx("%s: will exceed bounds: node 0x%" PRIx32 ": %" PRIu32 " - %"
+			PRIu32 " < 0", __func__, node->hdr.this, first, diff_elem);
 	}
 	
 	if (node->hdr.leaf) {
-		item_ref *elem_first = node->l_elems + first;
-		item_ref *elem_last  = node->l_elems + last;
-		
-		for (item_ref *elem = elem_first; elem <= elem_last; ++elem) {
-			item_ref *elem_dst = elem - diff_elem;
-			
-			*elem_dst = *elem;
-			elem_dst->off += diff_data;
-		}
+		leaf_move(node, first - diff_elem, first, (last - first) + 1);
 	} else {
-		node_ref *elem_first = node->b_elems + first;
-		node_ref *elem_last  = node->b_elems + last;
-		
-		for (node_ref *elem = elem_first; elem <= elem_last; ++elem) {
-			node_ref *elem_dst = elem - diff_elem;
-			
-			*elem_dst = *elem;
-		}
+		branch_move(node, node, first - diff_elem, first, (last - first) + 1);
 	}
 }
 
@@ -154,54 +133,65 @@ void node_shift_backward(node_ptr node, uint16_t first, uint16_t last,
 /// @param[in] dst_idx   first index in destination to copy to
 /// @param[in] src_idx   first index in source to copy from
 /// @param[in] elem_cnt  number of elements to copy
-/// @param[in] data_len  total length of element data in the range, if any
 static void node_xfer_multiple(node_ptr dst, const node_ptr src,
-	uint16_t dst_idx, uint16_t src_idx, uint16_t elem_cnt, uint32_t data_len) {
+	uint32_t dst_idx, uint32_t src_idx, uint32_t elem_cnt) {
 	if (src_idx + elem_cnt > src->hdr.cnt) {
-		errx("%s: [%" PRIu16 ", %" PRIu16 ") > %" PRIu16 ": dst 0x%" PRIx32
-			" src 0x%" PRIx32 " src_idx %" PRIu16 " dst_idx %" PRIu16
-			" elem_cnt %" PRIu16 " data_len %" PRIu32,
+		errx("%s: [%" PRIu32 ", %" PRIu32 ") > %" PRIu32 ": dst 0x%" PRIx32
+			" src 0x%" PRIx32 " src_idx %" PRIu32 " dst_idx %" PRIu32
+			" elem_cnt %" PRIu32,
 			__func__, src_idx, src_idx + elem_cnt, src->hdr.cnt, dst->hdr.this,
-			src->hdr.this, src_idx, dst_idx, elem_cnt, data_len);
+			src->hdr.this, src_idx, dst_idx, elem_cnt);
 	}
 	
 	if (dst->hdr.leaf) {
 		ASSERT_LEAF(src);
 		
-		uint32_t dst_off;
-		if (dst->hdr.cnt == 0) {
-			dst_off = node_size_byte();
-		} else {
-			dst_off = dst->l_elems[dst_idx].off;
-		}
-		
-		item_ref *elem_dst       = dst->l_elems + dst_idx;
-		const item_ref *elem_src = src->l_elems + src_idx;
-		while (elem_cnt-- != 0) {
-			*elem_dst = *elem_src;
+		/* the two leaves needn't have the same prefix, so keys are copied by
+		 * way of their full encoding; data goes on top of the heap */
+		uint8_t pfx_len = dst->hdr.pfx_len;
+		for (uint32_t i = 0; i < elem_cnt; ++i) {
+			const item_loc *loc_src = leaf_loc(src, src_idx + i);
+			item_loc       *loc_dst = leaf_loc(dst, dst_idx + i);
+			
+			key_enc enc = leaf_key_enc(src, src_idx + i);
 			
-			dst_off -= elem_src->len;
-			elem_dst->off = dst_off;
+			dst->hdr.heap_top -= loc_src->len;
+			memcpy((uint8_t *)dst + dst->hdr.heap_top,
+				leaf_elem_data(src, src_idx + i), loc_src->len);
 			
-			++elem_dst;
-			++elem_src;
+			loc_dst->len = loc_src->len;
+			loc_dst->ovf = loc_src->ovf;
+			loc_dst->off = dst->hdr.heap_top;
+			memcpy(leaf_key_sfx(dst, dst_idx + i), enc.b + pfx_len,
+				KEY_ENC_LEN - pfx_len);
 		}
-		
-		uint8_t       *data_dst = (uint8_t *)dst + dst_off;
-		const uint8_t *data_src = leaf_elem_data(src, src_idx + (elem_cnt - 1));
-		
-		memcpy(data_dst, data_src, data_len);
 	} else {
 		ASSERT_BRANCH(src);
 		
-		node_ref *elem_dst       = dst->b_elems + dst_idx;
-		const node_ref *elem_src = src->b_elems + src_idx;
-		while (elem_cnt-- != 0) {
-			*elem_dst = *elem_src;
-			
-			++elem_dst;
-			++elem_src;
+		branch_move(dst, src, dst_idx, src_idx, elem_cnt);
+	}
+}
+
+/// @brief readies a leaf for a range of elems that is about to be copied into
+/// it: its heap is compacted if it has holes, and its key prefix is made to
+/// cover the new keys
+/// @param[in] dst       pointer to destination node
+/// @param[in] src       pointer to source node
+/// @param[in] src_idx   first index in source to copy from
+/// @param[in] elem_cnt  number of elements to copy
+static void node_xfer_prepare(node_ptr dst, const node_ptr src,
+	uint32_t src_idx, uint32_t elem_cnt) {
+	if (dst->hdr.leaf && elem_cnt != 0) {
+		ASSERT_LEAF(src);
+		
+		if (dst->hdr.frag != 0) {
+			leaf_heap_compact(dst);
 		}
+		
+		key_enc first = leaf_key_enc(src, src_idx);
+		key_enc last  = leaf_key_enc(src, src_idx + (elem_cnt - 1));
+		
+		leaf_pfx_admit(dst, &first, &last);
 	}
 }
 
@@ -210,11 +200,12 @@ static void node_xfer_multiple(node_ptr dst, const node_ptr src,
 /// @param[in] src       pointer to source node
 /// @param[in] src_idx   first index in source to copy from
 /// @param[in] elem_cnt  number of elements to copy
-/// @param[in] data_len  total length of element data in the range, if any
-void node_append_multiple(node_ptr dst, const node_ptr src, uint16_t src_idx,
-	uint16_t elem_cnt, uint32_t data_len) {
-	uint16_t dst_idx = dst->hdr.cnt;
-	node_xfer_multiple(dst, src, dst_idx, src_idx, elem_cnt, data_len);
+void node_append_multiple(node_ptr dst, const node_ptr src, uint32_t src_idx,
+	uint32_t elem_cnt) {
+	node_xfer_prepare(dst, src, src_idx, elem_cnt);
+	
+	uint32_t dst_idx = dst->hdr.cnt;
+	node_xfer_multiple(dst, src, dst_idx, src_idx, elem_cnt);
 	dst->hdr.cnt += elem_cnt;
 }
 
@@ -223,12 +214,12 @@ void node_append_multiple(node_ptr dst, const node_ptr src, uint16_t src_idx,
 /// @param[in] src       pointer to source node
 /// @param[in] src_idx   first index in source to copy from
 /// @param[in] elem_cnt  number of elements to copy
-/// @param[in] data_len  total length of element data in the range, if any
-void node_prepend_multiple(node_ptr dst, const node_ptr src, uint16_t src_idx,
-	uint16_t elem_cnt, uint32_t data_len) {
-	node_shift_forward(dst, 0, dst->hdr.cnt - 1, elem_cnt, data_len);
+void node_prepend_multiple(node_ptr dst, const node_ptr src, uint32_t src_idx,
+	uint32_t elem_cnt) {
+	node_xfer_prepare(dst, src, src_idx, elem_cnt);
+	node_shift_forward(dst, 0, dst->hdr.cnt - 1, elem_cnt);
 	
-	uint16_t dst_idx = 0;
-	node_xfer_multiple(dst, src, dst_idx, src_idx, elem_cnt, data_len);
+	uint32_t dst_idx = 0;
+	node_xfer_multiple(dst, src, dst_idx, src_idx, elem_cnt);
 	dst->hdr.cnt += elem_cnt;
 }
@@ -0,0 +1,131 @@
+/* jgfs2
+ * (c) 2013 Justin Gottula
+ * The source code of this project is distributed under the terms of the
+ * simplified BSD license. See the LICENSE file for details.
+ */
+
+
+#include "../node.h"
+#include "../../crc.h"
+#include "../../debug.h"
+
+
+/* each node carries a CRC-32C of its own contents, which every writer brings
+ * up to date as it unmaps the node; a node is verified the first time it is
+ * mapped after the filesystem is mounted, and is trusted after that, since
+ * anything that changes it from then on goes through node_unmap */
+
+
+/* one bit for each block, set once the node starting there has been verified
+ * (or was created) since the filesystem was mounted; pages of the bitmap that
+ * nothing ever touches are never actually allocated */
+static uint64_t *seen_map = NULL;
+
+
+/// @brief determines whether a node has been verified already
+/// @param[in] node_addr  block number of node
+/// @return true if it has
+static bool node_csum_seen(uint32_t node_addr) {
+	return ((__atomic_load_n(seen_map + (node_addr / 64), __ATOMIC_RELAXED) &
+		(UINT64_C(1) << (node_addr % 64))) != 0);
+}
+
+/// @brief calculates the checksum of a node
+/// @param[in] node  pointer to node
+/// @return checksum that belongs in the node's header
+uint32_t node_csum(const node_ptr node) {
+	const uint8_t *mem = (const uint8_t *)node;
+	size_t off = offsetof(struct node_hdr, csum);
+	
+	uint32_t crc = crc32c(0, mem, off);
+	
+	off += sizeof(node->hdr.csum);
+	return crc32c(crc, mem + off, node_size_byte(node) - off);
+}
+
+/// @brief checks a node's checksum, if it has not been verified yet since the
+/// filesystem was mounted
+/// @param[in] node       pointer to node
+/// @param[in] node_addr  block number of node
+/// @return false if the checksum is wrong
+bool node_csum_check(const node_ptr node, uint32_t node_addr) {
+	if (node_csum_seen(node_addr)) {
+		return true;
+	}
+	
+	/* a node that someone else is in the middle of changing will be verified
+	 * on a later mapping instead */
+	uint64_t version;
+	if (!node_version_read(node_addr, &version) &&
+		!node_latch_excl(node_addr)) {
+		return true;
+	}
+	
+	uint32_t csum = node_csum(node);
+	
+	if (!node_version_check(node_addr, version)) {
+		return true;
+	}
+	
+	if (csum != node->hdr.csum) {
+		return false;
+	}
+	
+	node_csum_fresh(node_addr);
+	return true;
+}
+
+/// @brief verifies a node's checksum, if it has not been verified yet since
+/// the filesystem was mounted; a mismatch is fatal
+/// @param[in] node       pointer to node
+/// @param[in] node_addr  block number of node
+void node_csum_verify(const node_ptr node, uint32_t node_addr) {
+	if (!node_csum_check(node, node_addr)) {
+		errx("%s: checksum mismatch: node 0x%" PRIx32 " (0x%08" PRIx32
+			" != 0x%08" PRIx32 ")", __func__, node_addr, node_csum(node),
+			node->hdr.csum);
+	}
+}
+
+/// @brief brings a node's checksum up to date, if this thread is the one that
+/// can have changed it
+/// @param[in] node   pointer to node, mapped writable
+/// @param[in] fresh  the node was just created by this thread
+/// @return true if the node had changed since its checksum was last updated
+bool node_csum_update(node_ptr node, bool fresh) {
+	/* a writable mapping alone doesn't make this thread the writer; a thread
+	 * that doesn't hold the latch would race the one that does over the
+	 * checksum, and could store one for contents that are still changing */
+	if (!fresh && !node_latch_excl(node->hdr.this)) {
+		return false;
+	}
+	
+	uint32_t csum = node_csum(node);
+	
+	/* leave pages that weren't changed clean */
+	if (node->hdr.csum == csum) {
+		return false;
+	}
+	
+	node->hdr.csum = csum;
+	return true;
+}
+
+/// @brief marks a node as not needing to be verified, either because it just
+/// was or because it was just created
+/// @param[in] node_addr  block number of node
+void node_csum_fresh(uint32_t node_addr) {
+	__atomic_or_fetch(seen_map + (node_addr / 64),
+		UINT64_C(1) << (node_addr % 64), __ATOMIC_RELAXED);
+}
+
+/// @brief sets up for verifying nodes as they are first mapped
+void node_csum_init(void) {
+	seen_map = calloc((fs.size_blk + 63) / 64, sizeof(uint64_t));
+}
+
+/// @brief forgets which nodes have been verified
+void node_csum_done(void) {
+	free(seen_map);
+	seen_map = NULL;
+}
@@ -12,24 +12,34 @@
 /// @brief dumps branch elems
 /// @param[in] branch  pointer to node
 static void node_dump_branch(node_ptr branch) {
-	const node_ref *elem_end = branch->b_elems + branch->hdr.cnt;
-	for (const node_ref *elem = branch->b_elems; elem < elem_end; ++elem) {
-		fprintf(stderr, "        branch %-4" PRIdPTR " %s addr 0x%" PRIx32 "\n",
-			(elem - branch->b_elems), key_str(&elem->key), elem->addr);
+	for (uint32_t i = 0; i < branch->hdr.cnt; ++i) {
+		node_ref elem = branch_elem(branch, i);
+		
+		fprintf(stderr, "        branch %-4" PRIu32 " %s addr 0x%" PRIx32 "\n",
+			i, key_str(&elem.key), elem.addr);
 	}
 }
 
 /// @brief dumps leaf elems
 /// @param[in] leaf  pointer to node
 static void node_dump_leaf(node_ptr leaf) {
-	const item_ref *elem_end = leaf->l_elems + leaf->hdr.cnt;
-	for (const item_ref *elem = leaf->l_elems; elem < elem_end; ++elem) {
-		fprintf(stderr, "        item %-4" PRIdPTR " %s len %" PRIu32 "\n",
-			(elem - leaf->l_elems), key_str(&elem->key), elem->len);
+	for (uint32_t i = 0; i < leaf->hdr.cnt; ++i) {
+		const item_loc *loc = leaf_loc(leaf, i);
+		key elem_key = node_key(leaf, i);
+		
+		if (loc->ovf) {
+			const struct item_ovf *ovf = leaf_elem_data(leaf, i);
+			
+			fprintf(stderr, "        item %-4" PRIu32 " %s len %" PRIu32
+				" @ 0x%" PRIx32 "\n", i, key_str(&elem_key), ovf->len,
+				ovf->addr);
+		} else {
+			fprintf(stderr, "        item %-4" PRIu32 " %s len %" PRIu32 "\n",
+				i, key_str(&elem_key), loc->len);
+		}
 		
-		if (elem->len != 0) {
-			uint16_t idx = (elem - leaf->l_elems);
-			dump_mem(leaf_elem_data(leaf, idx), elem->len);
+		if (loc->len != 0 && !loc->ovf) {
+			dump_mem(leaf_elem_data(leaf, i), loc->len);
 		}
 	}
 }
@@ -41,20 +51,26 @@ void node_dump(uint32_t node_addr, bool recurse) {
 	node_ptr node = node_map(node_addr, false);
 	
 	warnx("%s: this 0x%" PRIx32 " parent 0x%" PRIx32 " prev 0x%" PRIx32
-		" next 0x%" PRIx32 " cnt %" PRIu16 " free %" PRIu32,
+		" next 0x%" PRIx32 " cnt %" PRIu32 " free %" PRIu32,
 		__func__, node->hdr.this, node->hdr.parent, node->hdr.prev,
 		node->hdr.next, node->hdr.cnt, node_free(node));
 	
 	if (node->hdr.leaf) {
+		warnx("%s: pfx_len %" PRIu8 " heap_top 0x%" PRIx32 " frag %" PRIu32,
+			__func__, node->hdr.pfx_len, node->hdr.heap_top, node->hdr.frag);
+		
 		node_dump_leaf(node);
 	} else {
+		if (node->hdr.flags & NODE_BUFFERED) {
+			warnx("%s: buf_used %" PRIu32 " of %" PRIu32,
+				__func__, node->hdr.buf_used, node_buf_size(node));
+		}
+		
 		node_dump_branch(node);
 		
 		if (recurse) {
-			const node_ref *elem_end = node->b_elems + node->hdr.cnt;
-			for (const node_ref *elem = node->b_elems;
-				elem < elem_end; ++elem) {
-				node_dump(elem->addr, true);
+			for (uint32_t i = 0; i < node->hdr.cnt; ++i) {
+				node_dump(branch_addr(node)[i], true);
 			}
 		}
 	}
@@ -0,0 +1,187 @@
+/* jgfs2
+ * (c) 2013 Justin Gottula
+ * The source code of this project is distributed under the terms of the
+ * simplified BSD license. See the LICENSE file for details.
+ */
+
+
+#include "../node.h"
+#include <pthread.h>
+#include "../../debug.h"
+
+
+/* when the filesystem is mounted with check_dirty, every node written to is
+ * remembered until the next node_dirty_take, so that a checker can look at
+ * just the nodes that changed instead of walking whole trees; each node is on
+ * the list at most once, which the bitmap sees to */
+
+
+struct dirty_set {
+	bool track;
+	
+	/* one bit per block: on the list, and deallocated */
+	uint64_t *listed;
+	uint64_t *dead;
+	
+	pthread_mutex_t lock;
+	uint32_t *list;
+	uint32_t  list_cnt;
+	uint32_t  list_max;
+};
+
+
+static struct dirty_set dirty = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+
+/// @brief tests a node's bit in a bitmap
+/// @param[in] map        bitmap
+/// @param[in] node_addr  block number of node
+/// @return true if the bit is set
+static bool dirty_bit_test(const uint64_t *map, uint32_t node_addr) {
+	return ((__atomic_load_n(map + (node_addr / 64), __ATOMIC_RELAXED) &
+		(UINT64_C(1) << (node_addr % 64))) != 0);
+}
+
+/// @brief sets a node's bit in a bitmap
+/// @param[in] map        bitmap
+/// @param[in] node_addr  block number of node
+/// @return true if the bit was already set
+static bool dirty_bit_set(uint64_t *map, uint32_t node_addr) {
+	uint64_t bit = UINT64_C(1) << (node_addr % 64);
+	
+	return ((__atomic_fetch_or(map + (node_addr / 64), bit,
+		__ATOMIC_RELAXED) & bit) != 0);
+}
+
+/// @brief clears a node's bit in a bitmap
+/// @param[in] map        bitmap
+/// @param[in] node_addr  block number of node
+/// @return true if the bit was set
+static bool dirty_bit_clear(uint64_t *map, uint32_t node_addr) {
+	uint64_t bit = UINT64_C(1) << (node_addr % 64);
+	
+	return ((__atomic_fetch_and(map + (node_addr / 64), ~bit,
+		__ATOMIC_RELAXED) & bit) != 0);
+}
+
+/// @brief notes that a node was written to
+/// @param[in] node_addr  block number of node
+void node_dirty_mark(uint32_t node_addr) {
+	if (!dirty.track) {
+		return;
+	}
+	
+	/* nodes that were let go of are still unmapped after the fact */
+	if (dirty_bit_test(dirty.dead, node_addr)) {
+		return;
+	}
+	
+	if (dirty_bit_test(dirty.listed, node_addr)) {
+		return;
+	}
+	
+	/* bits are only changed with the lock held, so that node_dirty_take and
+	 * node_dirty_dead can't get in between a bit being set and the node being
+	 * listed */
+	pthread_mutex_lock(&dirty.lock);
+	
+	if (dirty_bit_test(dirty.dead, node_addr) ||
+		dirty_bit_set(dirty.listed, node_addr)) {
+		pthread_mutex_unlock(&dirty.lock);
+		return;
+	}
+	
+	if (dirty.list_cnt == dirty.list_max) {
+		dirty.list_max = (dirty.list_max != 0 ? dirty.list_max * 2 : 64);
+		dirty.list = realloc(dirty.list, dirty.list_max * sizeof(uint32_t));
+	}
+	
+	dirty.list[dirty.list_cnt++] = node_addr;
+	
+	pthread_mutex_unlock(&dirty.lock);
+}
+
+/// @brief notes that a node was deallocated, and so should no longer be
+/// checked, or that its block was made into a node again
+/// @param[in] node_addr  block number of node
+/// @param[in] dead       true if deallocated
+void node_dirty_dead(uint32_t node_addr, bool dead) {
+	if (!dirty.track) {
+		return;
+	}
+	
+	pthread_mutex_lock(&dirty.lock);
+	
+	if (dead) {
+		dirty_bit_set(dirty.dead, node_addr);
+		dirty_bit_clear(dirty.listed, node_addr);
+	} else {
+		dirty_bit_clear(dirty.dead, node_addr);
+	}
+	
+	pthread_mutex_unlock(&dirty.lock);
+}
+
+/// @brief takes every node written to since the last time, starting over
+/// @param[out] cnt  number of nodes
+/// @return newly allocated array of block numbers, or NULL if there are none
+uint32_t *node_dirty_take(uint32_t *cnt) {
+	*cnt = 0;
+	if (!dirty.track) {
+		return NULL;
+	}
+	
+	pthread_mutex_lock(&dirty.lock);
+	
+	uint32_t *list = dirty.list;
+	uint32_t list_cnt = dirty.list_cnt;
+	
+	dirty.list     = NULL;
+	dirty.list_cnt = 0;
+	dirty.list_max = 0;
+	
+	/* a node that died after it was listed has had its bit taken away; one
+	 * that was listed again since then has it back, but only counts once */
+	for (uint32_t i = 0; i < list_cnt; ++i) {
+		if (dirty_bit_clear(dirty.listed, list[i])) {
+			list[(*cnt)++] = list[i];
+		}
+	}
+	
+	pthread_mutex_unlock(&dirty.lock);
+	
+	if (*cnt == 0) {
+		free(list);
+		list = NULL;
+	}
+	
+	return list;
+}
+
+/// @brief sets up dirty node tracking, if the mount options ask for it
+void node_dirty_init(void) {
+	dirty.track = fs.mount_opt.check_dirty;
+	
+	if (dirty.track) {
+		dirty.listed = calloc((fs.size_blk + 63) / 64, sizeof(uint64_t));
+		dirty.dead   = calloc((fs.size_blk + 63) / 64, sizeof(uint64_t));
+	}
+}
+
+/// @brief stops tracking dirty nodes and forgets them
+void node_dirty_done(void) {
+	free(dirty.list);
+	free(dirty.dead);
+	free(dirty.listed);
+	
+	dirty.track = false;
+	
+	dirty.listed = NULL;
+	dirty.dead   = NULL;
+	
+	dirty.list     = NULL;
+	dirty.list_cnt = 0;
+	dirty.list_max = 0;
+}
@@ -13,14 +13,14 @@
 /// @param[in] node  pointer to node
 /// @param[in] idx   elem index
 /// @return total elem weight in bytes
-uint32_t node_elem_weight(const node_ptr node, uint16_t idx) {
+uint32_t node_elem_weight(const node_ptr node, uint32_t idx) {
 	if (idx >= node->hdr.cnt) {
-		errx("%s: idx >= cnt: node 0x%" PRIx32 " idx %" PRIu16 " cnt %" PRIu16,
+		errx("%s: idx >= cnt: node 0x%" PRIx32 " idx %" PRIu32 " cnt %" PRIu32,
 			__func__, node->hdr.this, idx, node->hdr.cnt);
 	}
 	
 	if (node->hdr.leaf) {
-		return sizeof(item_ref) + node->l_elems[idx].len;
+		return leaf_ref_size(node) + leaf_loc(node, idx)->len;
 	} else {
 		return sizeof(node_ref);
 	}
@@ -31,29 +31,32 @@ uint32_t node_elem_weight(const node_ptr node, uint16_t idx) {
 /// @param[in] idx      elem index
 /// @param[in] key      new key
 /// @param[in] payload  new payload
-void node_elem_fill(node_ptr node, uint16_t idx, const key *key,
+void node_elem_fill(node_ptr node, uint32_t idx, const key *key,
 	union elem_payload payload) {
 	if (node->hdr.leaf) {
-		item_ref *elem = node->l_elems + idx;
+		key_enc enc = key_encode(key);
+		uint8_t pfx_len = node->hdr.pfx_len;
 		
-		uint32_t off;
-		if (idx == 0) {
-			off = node_size_byte() - payload.l_item.len;
-		} else {
-			off = (elem - 1)->off - payload.l_item.len;
+		if (memcmp(node->hdr.pfx, enc.b, pfx_len) != 0) {
+			errx("%s: key lacks prefix: leaf 0x%" PRIx32 " key %s",
+				__func__, node->hdr.this, key_str(key));
 		}
 		
-		elem->key = *key;
-		elem->len = payload.l_item.len;
-		elem->off = off;
+		item_loc *loc = leaf_loc(node, idx);
+		
+		/* data goes on top of the heap, wherever the elem is in order */
+		node->hdr.heap_top -= payload.l_item.len;
+		
+		loc->len = payload.l_item.len;
+		loc->ovf = payload.l_item.ovf;
+		loc->off = node->hdr.heap_top;
+		memcpy(leaf_key_sfx(node, idx), enc.b + pfx_len, KEY_ENC_LEN - pfx_len);
 		
 		uint8_t *data = leaf_elem_data(node, idx);
 		memcpy(data, payload.l_item.data, payload.l_item.len);
 	} else {
-		node_ref *elem = node->b_elems + idx;
-		
-		elem->key  = *key;
-		elem->addr = payload.b_addr;
+		branch_elem_set_key(node, idx, key);
+		branch_addr(node)[idx] = payload.b_addr;
 	}
 }
 
@@ -61,13 +64,69 @@ void node_elem_fill(node_ptr node, uint16_t idx, const key *key,
 /// @param[in] node  pointer to leaf node
 /// @param[in] idx   elem index
 /// @return pointer to elem data within the node
-void *leaf_elem_data(const node_ptr leaf, uint16_t idx) {
+void *leaf_elem_data(const node_ptr leaf, uint32_t idx) {
+	ASSERT_LEAF(leaf);
+	
+	if (idx >= leaf->hdr.cnt) {
+		errx("%s: idx >= cnt: leaf 0x%" PRIx32 " idx %" PRIu32 " cnt %" PRIu32,
+			__func__, leaf->hdr.this, idx, leaf->hdr.cnt);
+	}
+	
+	return (uint8_t *)leaf + leaf_loc(leaf, idx)->off;
+}
+
+/// @brief gets the full key and data location of a leaf elem
+/// @param[in] leaf  pointer to leaf node
+/// @param[in] idx   elem index
+/// @return elem's encoded key, data length and data offset
+item_ref leaf_elem(const node_ptr leaf, uint32_t idx) {
 	ASSERT_LEAF(leaf);
 	
 	if (idx >= leaf->hdr.cnt) {
-		errx("%s: idx >= cnt: leaf 0x%" PRIx32 " idx %" PRIu16 " cnt %" PRIu16,
+		errx("%s: idx >= cnt: leaf 0x%" PRIx32 " idx %" PRIu32 " cnt %" PRIu32,
 			__func__, leaf->hdr.this, idx, leaf->hdr.cnt);
 	}
 	
-	return (uint8_t *)leaf + leaf->l_elems[idx].off;
+	const item_loc *loc = leaf_loc(leaf, idx);
+	
+	return (item_ref){
+		.key = leaf_key_enc(leaf, idx),
+		.len = loc->len,
+		.off = loc->off,
+	};
+}
+
+/// @brief gets the key and child block number of a branch elem
+/// @param[in] branch  pointer to branch node
+/// @param[in] idx     elem index
+/// @return elem's key and child block number
+node_ref branch_elem(const node_ptr branch, uint32_t idx) {
+	ASSERT_BRANCH(branch);
+	
+	if (idx >= branch->hdr.cnt) {
+		errx("%s: idx >= cnt: branch 0x%" PRIx32 " idx %" PRIu32
+			" cnt %" PRIu32, __func__, branch->hdr.this, idx, branch->hdr.cnt);
+	}
+	
+	node_ref ref;
+	key_denormalize((key_norm){
+		.hi = branch_key_hi(branch)[idx],
+		.lo = branch_key_lo(branch)[idx],
+	}, &ref.key);
+	ref.addr = branch_addr(branch)[idx];
+	
+	return ref;
+}
+
+/// @brief changes the key of a branch elem
+/// @param[in] branch  pointer to branch node
+/// @param[in] idx     elem index
+/// @param[in] key     new key
+void branch_elem_set_key(node_ptr branch, uint32_t idx, const key *key) {
+	ASSERT_BRANCH(branch);
+	
+	key_norm norm = key_normalize(key);
+	
+	branch_key_hi(branch)[idx] = norm.hi;
+	branch_key_lo(branch)[idx] = norm.lo;
 }
@@ -0,0 +1,68 @@
+/* jgfs2
+ * (c) 2013 Justin Gottula
+ * The source code of this project is distributed under the terms of the
+ * simplified BSD license. See the LICENSE file for details.
+ */
+
+
+#include "../node.h"
+#include "../../debug.h"
+
+
+/// @brief determines the contiguous space between the end of a leaf's refs and
+/// the top of its data heap
+/// @param[in] leaf  pointer to leaf node
+/// @return bytes available without compacting the heap
+uint32_t leaf_heap_gap(const node_ptr leaf) {
+	ASSERT_LEAF(leaf);
+	
+	uint32_t refs_end = sizeof(struct node_hdr) +
+		(leaf->hdr.cnt * leaf_ref_size(leaf));
+	
+	return leaf->hdr.heap_top - refs_end;
+}
+
+/// @brief zeroes the data of a leaf elem that is going away and accounts for
+/// the hole it leaves in the heap
+/// @param[in] leaf  pointer to leaf node
+/// @param[in] idx   elem index
+void leaf_heap_release(node_ptr leaf, uint32_t idx) {
+	item_loc *loc = leaf_loc(leaf, idx);
+	
+	memset(leaf_elem_data(leaf, idx), 0, loc->len);
+	
+	/* data right at the top of the heap can simply be given back */
+	if (loc->off == leaf->hdr.heap_top) {
+		leaf->hdr.heap_top += loc->len;
+	} else {
+		leaf->hdr.frag += loc->len;
+	}
+}
+
+/// @brief packs a leaf's item data against the end of the node, in elem order,
+/// so that all of its free space is contiguous again
+/// @param[in] leaf  pointer to leaf node
+void leaf_heap_compact(node_ptr leaf) {
+	ASSERT_LEAF(leaf);
+	
+	/* nodes can be far too big to stage on the stack */
+	uint8_t *heap_buf = malloc(node_size_byte(leaf));
+	
+	uint32_t off = node_size_byte(leaf);
+	for (uint32_t i = 0; i < leaf->hdr.cnt; ++i) {
+		item_loc *loc = leaf_loc(leaf, i);
+		
+		off -= loc->len;
+		memcpy(heap_buf + off, leaf_elem_data(leaf, i), loc->len);
+		loc->off = off;
+	}
+	
+	uint8_t *node_buf = (uint8_t *)leaf;
+	memset(node_buf + leaf->hdr.heap_top, 0, off - leaf->hdr.heap_top);
+	memcpy(node_buf + off, heap_buf + off, node_size_byte(leaf) - off);
+	
+	leaf->hdr.heap_top = off;
+	leaf->hdr.frag     = 0;
+	
+	free(heap_buf);
+}
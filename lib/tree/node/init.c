@@ -11,14 +11,20 @@
 
 /// @brief initializes a node
 /// @param[in] node_addr  block number of new node
+/// @param[in] size_blk   node size in blocks
 /// @param[in] leaf       initialize as a leaf node
+/// @param[in] flags      tree flavor (enum node_flag)
 /// @param[in] parent     block number of parent node
 /// @param[in] prev       block number of left sibling node
 /// @param[in] next       block number of right sibling node
 /// @return device-mapped pointer to new node
-node_ptr node_init(uint32_t node_addr, bool leaf, uint32_t parent,
-	uint32_t prev, uint32_t next) {
-	node_ptr node = node_map(node_addr, true);
+node_ptr node_init(uint32_t node_addr, uint32_t size_blk, bool leaf,
+	uint8_t flags, uint32_t parent, uint32_t prev, uint32_t next) {
+	/* the header can't say how big the node is yet */
+	node_ptr node = fs_map_blk(node_addr, size_blk, true);
+	
+	/* a lookup that started before this block was freed may still look at it */
+	node_version_write_begin(node_addr);
 	
 	node->hdr.leaf   = leaf;
 	node->hdr.cnt    = 0;
@@ -27,6 +33,29 @@ node_ptr node_init(uint32_t node_addr, bool leaf, uint32_t parent,
 	node->hdr.next   = next;
 	node->hdr.parent = parent;
 	
+	node->hdr.size_blk = size_blk;
+	
+	node->hdr.flags    = flags;
+	node->hdr.buf_used = 0;
+	
+	node->hdr.pfx_len = 0;
+	memset(node->hdr.pfx, 0, sizeof(node->hdr.pfx));
+	
+	node->hdr.heap_top = node_size_byte(node);
+	node->hdr.frag     = 0;
+	
+	node->hdr.fill = 0;
+	
+	/* the checksum is filled in when the node is unmapped */
+	node->hdr.csum = 0;
+	node_csum_fresh(node_addr);
+	node_map_track(node, true);
+	
+	node_dirty_dead(node_addr, false);
+	
+	/* whatever used to be at this block number may have left a filter */
+	leaf_bloom_drop(node_addr);
+	
 	return node;
 }
 
@@ -39,11 +68,20 @@ node_ptr node_init(uint32_t node_addr, bool leaf, uint32_t parent,
 /// @return device-mapped pointer to new node
 node_ptr node_copy_init(uint32_t dst_addr, const node_ptr src, uint32_t parent,
 	uint32_t prev, uint32_t next) {
-	node_ptr dst = node_map(dst_addr, true);
-	memcpy(dst, src, node_size_byte());
-	node_unmap(dst);
+	node_ptr node = node_init(dst_addr, node_size_blk(src), src->hdr.leaf,
+		src->hdr.flags, parent, prev, next);
+	memcpy((uint8_t *)node + sizeof(struct node_hdr),
+		(const uint8_t *)src + sizeof(struct node_hdr),
+		node_size_byte(src) - sizeof(struct node_hdr));
+	
+	node->hdr.cnt      = src->hdr.cnt;
+	node->hdr.buf_used = src->hdr.buf_used;
+	
+	node->hdr.pfx_len = src->hdr.pfx_len;
+	memcpy(node->hdr.pfx, src->hdr.pfx, sizeof(node->hdr.pfx));
+	
+	node->hdr.heap_top = src->hdr.heap_top;
+	node->hdr.frag     = src->hdr.frag;
 	
-	node_ptr node = node_init(dst_addr, src->hdr.leaf, parent, prev, next);
-	node->hdr.cnt = src->hdr.cnt;
 	return node;
 }
@@ -12,20 +12,86 @@
 /// @brief retrieves the key of a particular elem of a node
 /// @param[in] node  pointer to node
 /// @param[in] idx   elem index
-/// @return pointer to elem's key value
-key *node_key(const node_ptr node, uint16_t idx) {
+/// @return elem's key value
+key node_key(const node_ptr node, uint32_t idx) {
 	if (idx >= node->hdr.cnt) {
-		errx("%s: idx exceeds bounds: node 0x%" PRIx32 ": %" PRIu16
-			" >= %" PRIu16, __func__, node->hdr.this, idx, node->hdr.cnt);
+		errx("%s: idx exceeds bounds: node 0x%" PRIx32 ": %" PRIu32
+			" >= %" PRIu32, __func__, node->hdr.this, idx, node->hdr.cnt);
 	}
 	
-	return &(node_elem(node, idx)->key);
+	if (node->hdr.leaf) {
+		key_enc enc = leaf_key_enc(node, idx);
+		
+		node_ref ref;
+		key_decode(&enc, &ref.key);
+		
+		return ref.key;
+	} else {
+		return branch_elem(node, idx).key;
+	}
+}
+
+/// @brief reassembles the encoded key of a leaf elem from the leaf's prefix
+/// and the elem's suffix
+/// @param[in] leaf  pointer to leaf node
+/// @param[in] idx   elem index
+/// @return elem's encoded key
+key_enc leaf_key_enc(const node_ptr leaf, uint32_t idx) {
+	uint8_t pfx_len = leaf->hdr.pfx_len;
+	
+	key_enc enc;
+	memcpy(enc.b, leaf->hdr.pfx, pfx_len);
+	memcpy(enc.b + pfx_len, leaf_key_sfx(leaf, idx), KEY_ENC_LEN - pfx_len);
+	
+	return enc;
 }
 
 /// @brief retrieves the key of a node's first element
 /// @param[in] node  pointer to node
-/// @return pointer to first elem's key value
-key *node_first_key(const node_ptr node) {
+/// @return first elem's key value
+key node_first_key(const node_ptr node) {
 	ASSERT_NONEMPTY(node);
-	return &(node_elem(node, 0)->key);
+	return node_key(node, 0);
+}
+
+/// @brief compares the key of a particular elem of a node with another key
+/// @param[in] node  pointer to node
+/// @param[in] idx   elem index
+/// @param[in] key   key to compare against
+/// @return result of key_cmp(elem's key, key)
+int8_t node_key_cmp(const node_ptr node, uint32_t idx, const key *key) {
+	key_enc enc = key_encode(key);
+	return node_key_cmp_enc(node, idx, &enc);
+}
+
+/// @brief compares the key of a particular elem of a node with an encoded key;
+/// searches encode their key once up front and then use this
+/// @param[in] node  pointer to node
+/// @param[in] idx   elem index
+/// @param[in] enc   encoded key to compare against
+/// @return result of key_cmp(elem's key, decoded key)
+int8_t node_key_cmp_enc(const node_ptr node, uint32_t idx, const key_enc *enc) {
+	if (idx >= node->hdr.cnt) {
+		errx("%s: idx exceeds bounds: node 0x%" PRIx32 ": %" PRIu32
+			" >= %" PRIu32, __func__, node->hdr.this, idx, node->hdr.cnt);
+	}
+	
+	if (node->hdr.leaf) {
+		uint8_t pfx_len = node->hdr.pfx_len;
+		
+		int cmp = memcmp(node->hdr.pfx, enc->b, pfx_len);
+		if (cmp == 0) {
+			cmp = memcmp(leaf_key_sfx(node, idx), enc->b + pfx_len,
+				KEY_ENC_LEN - pfx_len);
+		}
+		
+		return (cmp > 0) - (cmp < 0);
+	} else {
+		key_norm norm = {
+			.hi = branch_key_hi(node)[idx],
+			.lo = branch_key_lo(node)[idx],
+		};
+		
+		return key_norm_cmp(norm, key_enc_norm(enc));
+	}
 }
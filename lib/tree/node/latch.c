@@ -0,0 +1,298 @@
+/* jgfs2
+ * (c) 2013 Justin Gottula
+ * The source code of this project is distributed under the terms of the
+ * simplified BSD license. See the LICENSE file for details.
+ */
+
+
+#include "../node.h"
+#include <pthread.h>
+#include "../../debug.h"
+
+
+#define LATCH_BUCKETS 256
+
+#define VERSION_STRIPES 1024
+
+
+/* latch entries exist only while some thread holds or waits on them; an
+ * exclusive owner may re-latch the same node (in either mode) recursively,
+ * which lets split and merge code map ancestors that the descent already
+ * holds without having to know about it */
+struct node_latch {
+	struct node_latch *next;
+	
+	uint32_t addr;
+	uint32_t ref;
+	
+	uint32_t  readers;
+	uint32_t  depth;
+	pthread_t owner;
+	
+	pthread_cond_t cond;
+};
+
+struct latch_bucket {
+	pthread_mutex_t lock;
+	struct node_latch *list;
+};
+
+
+/* each stripe covers every node that hashes to it: the high half of the word
+ * is bumped whenever a writable mapping of one of them is let go of, and the
+ * low half counts the writable mappings currently open; a writer that only
+ * passes through a node on its way down never maps it writable, so readers
+ * don't have to back off from it; stripes get a cache line each so that
+ * readers of different nodes don't share one */
+struct version_stripe {
+	uint64_t word;
+} __attribute__((__aligned__(64)));
+
+
+static struct latch_bucket latch_tbl[LATCH_BUCKETS] = {
+	[0 ... (LATCH_BUCKETS - 1)] = {
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.list = NULL,
+	},
+};
+
+static struct version_stripe version_tbl[VERSION_STRIPES];
+
+/* exclusive latches this thread holds, not counting recursion; most threads
+ * that ask whether they hold a particular node exclusively hold nothing at
+ * all, and can be told so without a trip through the latch table */
+static __thread uint32_t excl_held = 0;
+
+
+static struct version_stripe *node_version_stripe(uint32_t node_addr) {
+	return version_tbl + ((node_addr * UINT32_C(2654435769)) >> 16) %
+		VERSION_STRIPES;
+}
+
+/// @brief marks a node as being changed, until node_version_write_end; the
+/// caller must hold the node's latch exclusively (or have just created it)
+/// @param[in] node_addr  block number of node
+void node_version_write_begin(uint32_t node_addr) {
+	__atomic_add_fetch(&node_version_stripe(node_addr)->word, 1,
+		__ATOMIC_SEQ_CST);
+}
+
+/// @brief marks a node as no longer being changed, and invalidates every
+/// version of it read before
+/// @param[in] node_addr  block number of node
+void node_version_write_end(uint32_t node_addr) {
+	/* one more version, one less writer */
+	__atomic_add_fetch(&node_version_stripe(node_addr)->word,
+		(UINT64_C(1) << 32) - 1, __ATOMIC_RELEASE);
+}
+
+
+static struct latch_bucket *node_latch_bucket(uint32_t node_addr) {
+	/* fibonacci hashing spreads out sequentially allocated blocks */
+	return latch_tbl + ((node_addr * UINT32_C(2654435769)) >> 24) %
+		LATCH_BUCKETS;
+}
+
+static struct node_latch *node_latch_get(struct latch_bucket *bucket,
+	uint32_t node_addr, bool create) {
+	struct node_latch *entry = bucket->list;
+	while (entry != NULL) {
+		if (entry->addr == node_addr) {
+			return entry;
+		}
+		
+		entry = entry->next;
+	}
+	
+	if (!create) {
+		return NULL;
+	}
+	
+	entry = malloc(sizeof(struct node_latch));
+	entry->next = bucket->list;
+	bucket->list = entry;
+	
+	entry->addr    = node_addr;
+	entry->ref     = 0;
+	entry->readers = 0;
+	entry->depth   = 0;
+	pthread_cond_init(&entry->cond, NULL);
+	
+	return entry;
+}
+
+static void node_latch_put(struct latch_bucket *bucket,
+	struct node_latch *entry) {
+	if (--entry->ref != 0) {
+		return;
+	}
+	
+	struct node_latch **prev = &bucket->list, *node = bucket->list;
+	while (node != NULL) {
+		if (node == entry) {
+			*prev = node->next;
+			
+			pthread_cond_destroy(&entry->cond);
+			free(entry);
+			
+			return;
+		}
+		
+		prev = &node->next;
+		node = node->next;
+	}
+}
+
+static bool node_latch_owned(const struct node_latch *entry) {
+	return (entry->depth != 0 && pthread_equal(entry->owner, pthread_self()));
+}
+
+static bool node_latch_avail(const struct node_latch *entry, bool excl) {
+	if (excl) {
+		return (entry->depth == 0 && entry->readers == 0);
+	} else {
+		return (entry->depth == 0);
+	}
+}
+
+static void node_latch_grant(struct node_latch *entry, bool excl) {
+	if (excl) {
+		entry->owner = pthread_self();
+		entry->depth = 1;
+		
+		++excl_held;
+	} else {
+		++entry->readers;
+	}
+}
+
+/// @brief acquires a node latch, blocking until it is available
+/// @param[in] node_addr  block number of node
+/// @param[in] excl       acquire exclusively (for writing)
+void node_latch(uint32_t node_addr, bool excl) {
+	struct latch_bucket *bucket = node_latch_bucket(node_addr);
+	pthread_mutex_lock(&bucket->lock);
+	
+	struct node_latch *entry = node_latch_get(bucket, node_addr, true);
+	++entry->ref;
+	
+	if (node_latch_owned(entry)) {
+		++entry->depth;
+	} else {
+		while (!node_latch_avail(entry, excl)) {
+			pthread_cond_wait(&entry->cond, &bucket->lock);
+		}
+		
+		node_latch_grant(entry, excl);
+	}
+	
+	pthread_mutex_unlock(&bucket->lock);
+}
+
+/// @brief acquires a node latch only if it is immediately available
+/// @param[in] node_addr  block number of node
+/// @param[in] excl       acquire exclusively (for writing)
+/// @return true if the latch was acquired
+bool node_try_latch(uint32_t node_addr, bool excl) {
+	bool result = true;
+	
+	struct latch_bucket *bucket = node_latch_bucket(node_addr);
+	pthread_mutex_lock(&bucket->lock);
+	
+	struct node_latch *entry = node_latch_get(bucket, node_addr, true);
+	++entry->ref;
+	
+	if (node_latch_owned(entry)) {
+		++entry->depth;
+	} else if (node_latch_avail(entry, excl)) {
+		node_latch_grant(entry, excl);
+	} else {
+		node_latch_put(bucket, entry);
+		result = false;
+	}
+	
+	pthread_mutex_unlock(&bucket->lock);
+	return result;
+}
+
+/// @brief releases a node latch
+/// @param[in] node_addr  block number of node
+/// @param[in] excl       latch was acquired exclusively
+void node_unlatch(uint32_t node_addr, bool excl) {
+	struct latch_bucket *bucket = node_latch_bucket(node_addr);
+	pthread_mutex_lock(&bucket->lock);
+	
+	struct node_latch *entry = node_latch_get(bucket, node_addr, false);
+	if (entry == NULL) {
+		errx("%s: node 0x%" PRIx32 " was not latched", __func__, node_addr);
+	}
+	
+	/* shared requests made by the exclusive owner were counted as recursion */
+	bool released = false;
+	if (node_latch_owned(entry)) {
+		if (--entry->depth == 0) {
+			--excl_held;
+			
+			pthread_cond_broadcast(&entry->cond);
+			released = true;
+		}
+	} else if (!excl && entry->readers != 0) {
+		if (--entry->readers == 0) {
+			pthread_cond_broadcast(&entry->cond);
+		}
+	} else {
+		errx("%s: node 0x%" PRIx32 " not latched by this thread",
+			__func__, node_addr);
+	}
+	
+	node_latch_put(bucket, entry);
+	
+	pthread_mutex_unlock(&bucket->lock);
+	
+	/* a node freed while it was held can be handed out again now */
+	if (released) {
+		node_dealloc_release(node_addr);
+	}
+}
+
+/// @brief determines whether this thread holds a node's latch exclusively
+/// @param[in] node_addr  block number of node
+/// @return true if it does
+bool node_latch_excl(uint32_t node_addr) {
+	if (excl_held == 0) {
+		return false;
+	}
+	
+	struct latch_bucket *bucket = node_latch_bucket(node_addr);
+	pthread_mutex_lock(&bucket->lock);
+	
+	struct node_latch *entry = node_latch_get(bucket, node_addr, false);
+	bool result = (entry != NULL && node_latch_owned(entry));
+	
+	pthread_mutex_unlock(&bucket->lock);
+	return result;
+}
+
+/// @brief records the version of a node before reading it without a latch
+/// @param[in]  node_addr  block number of node
+/// @param[out] version    version to pass to node_version_check later
+/// @return false if the node may be in the middle of being modified
+bool node_version_read(uint32_t node_addr, uint64_t *version) {
+	*version = __atomic_load_n(&node_version_stripe(node_addr)->word,
+		__ATOMIC_ACQUIRE);
+	
+	return ((*version & UINT32_MAX) == 0);
+}
+
+/// @brief determines whether a node read without a latch could have changed
+/// since its version was recorded
+/// @param[in] node_addr  block number of node
+/// @param[in] version    version from node_version_read
+/// @return true if everything read in between is consistent
+bool node_version_check(uint32_t node_addr, uint64_t version) {
+	/* order the reads of the node itself before the second look */
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	
+	return (__atomic_load_n(&node_version_stripe(node_addr)->word,
+		__ATOMIC_RELAXED) == version);
+}
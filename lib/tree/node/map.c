@@ -9,19 +9,151 @@
 #include "../../debug.h"
 
 
+#define MAP_WRITABLE_MAX 64
+
+
+/* a writable node mapping this thread has open */
+struct map_ent {
+	const void *node;
+	
+	/* the node was just created, so nobody else can have it latched */
+	bool fresh;
+};
+
+
+/* the writable node mappings this thread has open; a node can only have
+ * changed if it was mapped writable, and the checksum can only be written back
+ * through such a mapping, so these are the ones that node_unmap updates */
+static __thread struct map_ent map_writable[MAP_WRITABLE_MAX];
+static __thread uint32_t map_writable_cnt = 0;
+
+
+/// @brief notes that a node mapping is writable, so that its checksum gets
+/// updated (and the node stops being marked as being changed) when it is
+/// unmapped
+/// @param[in] node   node pointer
+/// @param[in] fresh  the node was just created
+void node_map_track(const node_ptr node, bool fresh) {
+	if (map_writable_cnt == MAP_WRITABLE_MAX) {
+		errx("%s: too many writable node mappings", __func__);
+	}
+	
+	map_writable[map_writable_cnt++] = (struct map_ent){
+		.node  = node,
+		.fresh = fresh,
+	};
+}
+
+/// @brief forgets a node mapping noted by node_map_track
+/// @param[in]  node   node pointer
+/// @param[out] fresh  whether the node was just created
+/// @return true if the mapping was writable
+static bool node_map_untrack(const node_ptr node, bool *fresh) {
+	/* mappings tend to be unmapped in the reverse of the order they were
+	 * made in */
+	for (uint32_t i = map_writable_cnt; i-- != 0; ) {
+		if (map_writable[i].node == node) {
+			*fresh = map_writable[i].fresh;
+			
+			map_writable[i] = map_writable[--map_writable_cnt];
+			return true;
+		}
+	}
+	
+	return false;
+}
+
 /// @brief gets a device mapping for a node
 /// @param[in] node_addr  block number of node
 /// @param[in] writable   request a read-write mapping
 /// @return pointer to node
 node_ptr node_map(uint32_t node_addr, bool writable) {
-	return fs_map_blk(node_addr, node_size_blk(), writable);
+	node_ptr node = fs_map_blk(node_addr, 1, writable);
+	
+	/* the header is in the first block, so a node bigger than that has to be
+	 * mapped again once its size is known */
+	uint32_t size_blk = node_size_blk(node);
+	if (size_blk == 0) {
+		errx("%s: node 0x%" PRIx32 " has no size", __func__, node_addr);
+	} else if (size_blk != 1) {
+		fs_unmap_blk(node, node_addr, 1);
+		node = fs_map_blk(node_addr, size_blk, writable);
+	}
+	
+	node_csum_verify(node, node_addr);
+	
+	/* lookups without latches back off from the node until it is unmapped */
+	if (writable) {
+		node_version_write_begin(node_addr);
+		node_map_track(node, false);
+	}
+	
+	return node;
+}
+
+/// @brief gets a read-only mapping for a block that may not hold a node by
+/// now, as when a node is read without a latch and may have been freed (and its
+/// blocks handed out again) since it was found; a header too far gone to map
+/// the node by, or a wrong checksum, is the caller's cue to start over rather
+/// than being fatal, since the latched retry will find out soon enough whether
+/// a node really is bad
+/// @param[in]  node_addr  block number of node
+/// @param[out] size_blk   size of the mapping, to pass to node_unmap_try
+/// @return pointer to node, or NULL if it couldn't be mapped
+node_ptr node_map_try(uint32_t node_addr, uint32_t *size_blk) {
+	node_ptr node = fs_map_blk(node_addr, 1, false);
+	
+	*size_blk = node_size_blk(node);
+	if (*size_blk == 0 || (uint64_t)node_addr + *size_blk > fs.size_blk ||
+		node_size_byte(node) > JGFS2_NODE_SIZE_MAX) {
+		fs_unmap_blk(node, node_addr, 1);
+		return NULL;
+	} else if (*size_blk != 1) {
+		fs_unmap_blk(node, node_addr, 1);
+		node = fs_map_blk(node_addr, *size_blk, false);
+	}
+	
+	/* the header can't be trusted to say how big the mapping is anymore */
+	if (node_size_blk(node) != *size_blk ||
+		!node_csum_check(node, node_addr)) {
+		fs_unmap_blk(node, node_addr, *size_blk);
+		return NULL;
+	}
+	
+	return node;
+}
+
+/// @brief frees a mapping made by node_map_try
+/// @param[in] node       node pointer
+/// @param[in] node_addr  block number of node
+/// @param[in] size_blk   size of the mapping, from node_map_try
+void node_unmap_try(const node_ptr node, uint32_t node_addr,
+	uint32_t size_blk) {
+	fs_unmap_blk(node, node_addr, size_blk);
 }
 
 /// @brief frees a node device mapping
 /// @param[in] node  node pointer
 void node_unmap(const node_ptr node) {
-	/* msync asynchronously so we don't hurt performance too badly */
-	fs_msync_blk(node, node->hdr.this, node_size_blk(), true);
+	/* writers hold the node's latch exclusively until after this, so the
+	 * checksum is up to date again by the time anyone else can look at it */
+	bool fresh;
+	bool writable = node_map_untrack(node, &fresh);
+	bool changed = (writable && node_csum_update(node, fresh));
+	if (changed) {
+		node_dirty_mark(node->hdr.this);
+	}
+	
+	if (writable) {
+		node_version_write_end(node->hdr.this);
+	}
+	
+	/* in a commit group, changed nodes are written out together when the
+	 * group commits; otherwise, msync asynchronously so we don't hurt
+	 * performance too badly */
+	if (!(changed && node_wb_defer(node))) {
+		fs_msync_blk(node, node->hdr.this, node_size_blk(node), true);
+	}
 	
-	fs_unmap_blk(node, node->hdr.this, node_size_blk());
+	fs_unmap_blk(node, node->hdr.this, node_size_blk(node));
 }
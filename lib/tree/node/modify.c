@@ -19,13 +19,151 @@ void node_update_ref_in_parent(const node_ptr node) {
 	
 	node_ptr parent = node_map(node->hdr.parent, true);
 	
-	node_ref *this_ref = branch_search_addr(parent, node->hdr.this);
-	if (this_ref == NULL) {
+	uint32_t this_idx;
+	if (!branch_search_addr(parent, node->hdr.this, &this_idx)) {
 		errx("%s: ref not found in parent: node 0x%" PRIx32 " parent 0x%"
 			PRIx32, __func__, node->hdr.this, node->hdr.parent);
 	}
 	
-	this_ref->key = *(node_first_key(node));
+	node_ref this_ref = {
+		.key  = node_first_key(node),
+		.addr = node->hdr.this,
+	};
+	
+	/* messages waiting in a buffered tree's branches were routed by the keys
+	 * their parents had at the time, so those keys may only ever go down (to
+	 * take in a key below everything in the tree); anything else would strand
+	 * messages on the wrong side of them */
+	bool stale = true;
+	if (node->hdr.flags & NODE_BUFFERED) {
+		node_ref old_ref = branch_elem(parent, this_idx);
+		stale = (key_cmp(&this_ref.key, &old_ref.key) < 0);
+	}
+	
+	if (stale) {
+		branch_elem_set_key(parent, this_idx, &this_ref.key);
+		
+		/* the parent's first key changed too, so its own ref is now stale */
+		if (this_idx == 0) {
+			node_update_ref_in_parent(parent);
+		}
+	}
 	
 	node_unmap(parent);
 }
+
+/// @brief changes the parent field of a node
+/// @param[in] node_addr    block number of node
+/// @param[in] parent_addr  block number of new parent node
+void node_reparent(uint32_t node_addr, uint32_t parent_addr) {
+	node_latch(node_addr, true);
+	
+	node_ptr node = node_map(node_addr, true);
+	node->hdr.parent = parent_addr;
+	node_unmap(node);
+	
+	node_unlatch(node_addr, true);
+}
+
+/// @brief points the parent field of each of a branch's children at it
+/// @param[in] branch  pointer to branch node
+void node_reparent_children(const node_ptr branch) {
+	ASSERT_BRANCH(branch);
+	
+	const uint32_t *addrs = branch_addr(branch);
+	for (uint32_t i = 0; i < branch->hdr.cnt; ++i) {
+		node_reparent(addrs[i], branch->hdr.this);
+	}
+}
+
+/// @brief inserts an elem into a node, if there is room for it
+/// @param[in] node     pointer to node
+/// @param[in] key      key of new elem
+/// @param[in] payload  payload of new elem
+/// @return false if the node does not have enough free space
+bool node_insert(node_ptr node, const key *key, union elem_payload payload) {
+	uint32_t data_len = (node->hdr.leaf ? payload.l_item.len : 0);
+	if (node_free(node) < node_insert_cost(node, key, data_len)) {
+		return false;
+	}
+	
+	if (node->hdr.leaf) {
+		/* the space is there, but holes left by removed items may be keeping
+		 * it from being in one piece */
+		if (leaf_heap_gap(node) < node_insert_cost(node, key, data_len)) {
+			leaf_heap_compact(node);
+		}
+		
+		key_enc enc = key_encode(key);
+		leaf_pfx_admit(node, &enc, &enc);
+	}
+	
+	uint32_t idx_insert = node_search_hypo(node, key);
+	if (idx_insert < node->hdr.cnt) {
+		node_shift_forward(node, idx_insert, node->hdr.cnt - 1, 1);
+	}
+	
+	++node->hdr.cnt;
+	node_elem_fill(node, idx_insert, key, payload);
+	
+	if (node->hdr.leaf) {
+		leaf_bloom_add(node, key);
+	}
+	
+	if (idx_insert == 0) {
+		node_update_ref_in_parent(node);
+	}
+	
+	return true;
+}
+
+/// @brief removes an elem (and its data, if any) from a node
+/// @param[in] node  pointer to node
+/// @param[in] idx   elem index
+void node_remove(node_ptr node, uint32_t idx) {
+	if (idx >= node->hdr.cnt) {
+		errx("%s: idx >= cnt: node 0x%" PRIx32 " idx %" PRIu32 " cnt %" PRIu32,
+			__func__, node->hdr.this, idx, node->hdr.cnt);
+	}
+	
+	uint32_t last = node->hdr.cnt - 1;
+	
+	if (node->hdr.leaf) {
+		leaf_heap_release(node, idx);
+		
+		if (idx < last) {
+			node_shift_backward(node, idx + 1, last, 1);
+		}
+		
+		memset(leaf_loc(node, last), 0, leaf_ref_size(node));
+	} else {
+		if (idx < last) {
+			node_shift_backward(node, idx + 1, last, 1);
+		}
+		
+		branch_key_hi(node)[last] = 0;
+		branch_addr(node)[last]   = 0;
+		branch_key_lo(node)[last] = 0;
+	}
+	
+	--node->hdr.cnt;
+	
+	/* with nothing left in it, the heap is as good as compacted */
+	if (node->hdr.leaf && node->hdr.cnt == 0) {
+		node->hdr.heap_top = node_size_byte(node);
+		node->hdr.frag     = 0;
+	}
+	
+	/* losing either end of the key range may have lengthened the prefix */
+	if (node->hdr.leaf && (idx == 0 || idx == last)) {
+		leaf_pfx_compact(node);
+	}
+	
+	if (node->hdr.leaf) {
+		leaf_bloom_remove(node);
+	}
+	
+	if (idx == 0 && node->hdr.cnt != 0) {
+		node_update_ref_in_parent(node);
+	}
+}
@@ -0,0 +1,153 @@
+/* jgfs2
+ * (c) 2013 Justin Gottula
+ * The source code of this project is distributed under the terms of the
+ * simplified BSD license. See the LICENSE file for details.
+ */
+
+
+#include "../node.h"
+#include "../../debug.h"
+
+
+/* the prefix never covers the whole key, so that refs never end up with a
+ * zero-length suffix */
+#define PFX_MAX (KEY_ENC_LEN - 1)
+
+
+/// @brief measures the length of the prefix that two encoded keys share
+/// @param[in] lhs      first encoded key
+/// @param[in] rhs      second encoded key
+/// @param[in] max_len  maximum length to consider
+/// @return length of common prefix in bytes
+static uint8_t key_enc_lcp(const uint8_t *lhs, const uint8_t *rhs,
+	uint8_t max_len) {
+	uint8_t len = 0;
+	while (len < max_len && lhs[len] == rhs[len]) {
+		++len;
+	}
+	
+	return len;
+}
+
+/// @brief determines how long a leaf's key prefix would be if it also had to
+/// cover another key
+/// @param[in] leaf  pointer to leaf node
+/// @param[in] enc   encoded key
+/// @return new prefix length
+uint8_t leaf_pfx_fit(const node_ptr leaf, const key_enc *enc) {
+	ASSERT_LEAF(leaf);
+	
+	/* an empty leaf can take on whatever prefix it likes */
+	if (leaf->hdr.cnt == 0) {
+		return PFX_MAX;
+	}
+	
+	return key_enc_lcp(leaf->hdr.pfx, enc->b, leaf->hdr.pfx_len);
+}
+
+/// @brief changes a leaf's key prefix, rewriting every ref in place; a longer
+/// prefix must still be shared by all of the leaf's keys, and a shorter one
+/// needs enough free space for the refs to grow into
+/// @param[in] leaf     pointer to leaf node
+/// @param[in] pfx_len  new prefix length
+/// @param[in] pfx      new prefix (only the part beyond the old one is used)
+void leaf_pfx_set(node_ptr leaf, uint8_t pfx_len, const uint8_t *pfx) {
+	ASSERT_LEAF(leaf);
+	
+	if (pfx_len > PFX_MAX) {
+		errx("%s: prefix too long: leaf 0x%" PRIx32 " len %" PRIu8,
+			__func__, leaf->hdr.this, pfx_len);
+	}
+	
+	uint8_t old_len = leaf->hdr.pfx_len;
+	uint32_t old_size = leaf_ref_size(leaf);
+	uint32_t new_size = sizeof(item_loc) + (KEY_ENC_LEN - pfx_len);
+	
+	if (pfx_len == old_len) {
+		return;
+	}
+	
+	uint8_t old_pfx[PFX_MAX];
+	memcpy(old_pfx, leaf->hdr.pfx, old_len);
+	
+	/* refs move toward the end when they grow and toward the start when they
+	 * shrink, so walk them in the order that doesn't trample unread ones */
+	uint32_t cnt = leaf->hdr.cnt;
+	for (uint32_t n = 0; n < cnt; ++n) {
+		uint32_t i = (new_size > old_size ? (cnt - 1) - n : n);
+		
+		const uint8_t *old_ref = leaf->l_refs + (i * old_size);
+		uint8_t       *new_ref = leaf->l_refs + (i * new_size);
+		
+		uint8_t buf[sizeof(item_loc) + KEY_ENC_LEN];
+		memcpy(buf, old_ref, sizeof(item_loc));
+		
+		key_enc enc;
+		memcpy(enc.b, old_pfx, old_len);
+		memcpy(enc.b + old_len, old_ref + sizeof(item_loc),
+			KEY_ENC_LEN - old_len);
+		memcpy(buf + sizeof(item_loc), enc.b + pfx_len, KEY_ENC_LEN - pfx_len);
+		
+		memcpy(new_ref, buf, new_size);
+	}
+	
+	/* don't leave stale bytes behind the refs when they shrink */
+	if (new_size < old_size) {
+		memset(leaf->l_refs + (cnt * new_size), 0,
+			cnt * (old_size - new_size));
+	}
+	
+	if (pfx_len > old_len) {
+		memcpy(leaf->hdr.pfx + old_len, pfx + old_len, pfx_len - old_len);
+	}
+	memset(leaf->hdr.pfx + pfx_len, 0, PFX_MAX - pfx_len);
+	
+	leaf->hdr.pfx_len = pfx_len;
+}
+
+/// @brief shortens a leaf's key prefix, if necessary, so that a sorted range
+/// of keys which is about to be added to it will share it
+/// @param[in] leaf   pointer to leaf node
+/// @param[in] first  lowest encoded key in the range
+/// @param[in] last   highest encoded key in the range
+void leaf_pfx_admit(node_ptr leaf, const key_enc *first, const key_enc *last) {
+	ASSERT_LEAF(leaf);
+	
+	uint8_t pfx_len = key_enc_lcp(first->b, last->b, PFX_MAX);
+	
+	if (leaf->hdr.cnt == 0) {
+		/* no refs to rewrite */
+		memcpy(leaf->hdr.pfx, first->b, pfx_len);
+		memset(leaf->hdr.pfx + pfx_len, 0, PFX_MAX - pfx_len);
+		
+		leaf->hdr.pfx_len = pfx_len;
+	} else {
+		uint8_t fit_len = leaf_pfx_fit(leaf, first);
+		if (fit_len < pfx_len) {
+			pfx_len = fit_len;
+		}
+		
+		leaf_pfx_set(leaf, pfx_len, first->b);
+	}
+}
+
+/// @brief lengthens a leaf's key prefix as far as its keys allow, which is
+/// worthwhile after it has lost elems from either end
+/// @param[in] leaf  pointer to leaf node
+void leaf_pfx_compact(node_ptr leaf) {
+	ASSERT_LEAF(leaf);
+	
+	if (leaf->hdr.cnt == 0) {
+		return;
+	}
+	
+	/* the keys are sorted, so whatever the first and last have in common,
+	 * everything in between has too */
+	key_enc first = leaf_key_enc(leaf, 0);
+	key_enc last  = leaf_key_enc(leaf, leaf->hdr.cnt - 1);
+	
+	uint8_t pfx_len = key_enc_lcp(first.b, last.b, PFX_MAX);
+	if (pfx_len > leaf->hdr.pfx_len) {
+		leaf_pfx_set(leaf, pfx_len, first.b);
+	}
+}
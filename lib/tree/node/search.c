@@ -6,33 +6,86 @@
 
 
 #include "../node.h"
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE4_2__)
+#include <nmmintrin.h>
+#endif
 #include "../../debug.h"
 
 
+/* branch searches narrow the range down by branchless binary search until it
+ * is this short, and then count the remainder with vector compares */
+#define BRANCH_SCAN_LEN 16
+
+
+/// @brief compares an encoded key with the prefix shared by a leaf's keys
+/// @param[in] node  node pointer
+/// @param[in] enc   encoded key
+/// @return sign of (prefix - key's prefix), or zero for branches
+static int node_search_pfx(const node_ptr node, const key_enc *enc) {
+	if (!node->hdr.leaf) {
+		return 0;
+	}
+	
+	return memcmp(node->hdr.pfx, enc->b, node->hdr.pfx_len);
+}
+
+/// @brief compares the key of an elem with an encoded key whose prefix is
+/// already known to match, so that only leaf key suffixes need comparing
+/// @param[in] node  node pointer
+/// @param[in] idx   elem index
+/// @param[in] enc   encoded key
+/// @return result of key_cmp(elem's key, decoded key)
+static int8_t node_search_cmp(const node_ptr node, uint32_t idx,
+	const key_enc *enc) {
+	if (node->hdr.leaf) {
+		uint8_t pfx_len = node->hdr.pfx_len;
+		int cmp = memcmp(leaf_key_sfx(node, idx), enc->b + pfx_len,
+			KEY_ENC_LEN - pfx_len);
+		
+		return (cmp > 0) - (cmp < 0);
+	} else {
+		return node_key_cmp_enc(node, idx, enc);
+	}
+}
+
 /// @brief searches a node for an elem with an exactly matching key
 /// @param[in]  node  node pointer
 /// @param[in]  key   pointer to key
 /// @param[out] out   index of elem with matching key
 /// @return true if key was found
-bool node_search(const node_ptr node, const key *key, uint16_t *out) {
+bool node_search(const node_ptr node, const key *key, uint32_t *out) {
 	/* circumvent unsigned wraparound if node->hdr.cnt == 0 */
 	if (node->hdr.cnt == 0) {
 		return false;
 	}
 	
-	uint16_t first = 0;
-	uint16_t last  = node->hdr.cnt - 1;
-	uint16_t middle;
+	key_enc enc = key_encode(key);
+	
+	/* a key outside the leaf's prefix can't be in it */
+	if (node_search_pfx(node, &enc) != 0) {
+		return false;
+	}
+	
+	uint32_t first = 0;
+	uint32_t last  = node->hdr.cnt - 1;
+	uint32_t middle;
 	
 	/* goal: find key that == wanted key */
 	while (first <= last) {
 		middle = (first + last) / 2;
 		
-		int8_t cmp = key_cmp(node_key(node, middle), key);
+		int8_t cmp = node_search_cmp(node, middle, &enc);
 		
 		if (cmp < 0) {
 			first = middle + 1;
 		} else if (cmp > 0) {
+			/* circumvent unsigned wraparound if key < all keys */
+			if (middle == 0) {
+				break;
+			}
+			
 			last = middle - 1;
 		} else {
 			/* found */
@@ -49,29 +102,38 @@ bool node_search(const node_ptr node, const key *key, uint16_t *out) {
 /// @param[in]  node  node pointer
 /// @param[in]  key   pointer to key
 /// @return index at which to insert key
-uint16_t node_search_hypo(const node_ptr node, const key *key) {
+uint32_t node_search_hypo(const node_ptr node, const key *key) {
+	key_enc enc = key_encode(key);
+	
 	/* for empty node, return first index; for largest key, return very last
-	 * possible index */
+	 * possible index; a key outside a leaf's prefix goes at one end or the
+	 * other */
 	if (node->hdr.cnt == 0) {
 		return 0;
-	} else if (key_cmp(node_key(node, node->hdr.cnt - 1), key) < 0) {
+	}
+	
+	int pfx_cmp = node_search_pfx(node, &enc);
+	if (pfx_cmp > 0) {
+		return 0;
+	} else if (pfx_cmp < 0 ||
+		node_search_cmp(node, node->hdr.cnt - 1, &enc) < 0) {
 		return node->hdr.cnt;
 	}
 	
-	uint16_t first = 0;
-	uint16_t last  = node->hdr.cnt - 1;
-	uint16_t middle;
+	uint32_t first = 0;
+	uint32_t last  = node->hdr.cnt - 1;
+	uint32_t middle;
 	
 	/* goal: find lowest key that is > wanted key */
 	while (first <= last) {
 		middle = CEIL(first + last, 2);
 		
-		int8_t cmp = key_cmp(node_key(node, middle), key);
+		int8_t cmp = node_search_cmp(node, middle, &enc);
 		
 		if (cmp < 0) {
 			first = middle + 1;
 		} else if (cmp > 0) {
-			if (middle == 0 || key_cmp(node_key(node, middle - 1), key) < 0) {
+			if (middle == 0 || node_search_cmp(node, middle - 1, &enc) < 0) {
 				return middle;
 			} else {
 				last = middle - 1;
@@ -86,63 +148,124 @@ uint16_t node_search_hypo(const node_ptr node, const key *key) {
 		__func__, node->hdr.this, key_str(key));
 }
 
-/// @brief searches a branch node for the child node which contains a key
-/// @param[in]  node  node pointer
-/// @param[in]  key   pointer to key
-/// @return block number of child containing key
-uint32_t branch_search(const node_ptr branch, const key *key) {
+/// @brief counts the keys in a sorted run that are less than a target
+/// @param[in] hi      pointer to first key
+/// @param[in] len     number of keys
+/// @param[in] target  key to compare against
+/// @return number of keys less than target
+static uint32_t branch_count_below(const uint64_t *hi, uint32_t len,
+	uint64_t target) {
+	uint32_t below = 0;
+	uint32_t i = 0;
+	
+#if defined(__AVX2__) || defined(__SSE4_2__)
+	/* the only 64-bit compare is signed, so flip the sign bits first */
+	const uint64_t bias = UINT64_C(1) << 63;
+#endif
+
+#if defined(__AVX2__)
+	const __m256i v_bias   = _mm256_set1_epi64x(bias);
+	const __m256i v_target = _mm256_set1_epi64x(target ^ bias);
+	for ( ; i + 4 <= len; i += 4) {
+		__m256i v_hi = _mm256_xor_si256(v_bias,
+			_mm256_loadu_si256((const __m256i *)(hi + i)));
+		__m256i v_lt = _mm256_cmpgt_epi64(v_target, v_hi);
+		
+		below += __builtin_popcount(_mm256_movemask_pd(
+			_mm256_castsi256_pd(v_lt)));
+	}
+#elif defined(__SSE4_2__)
+	const __m128i v_bias   = _mm_set1_epi64x(bias);
+	const __m128i v_target = _mm_set1_epi64x(target ^ bias);
+	for ( ; i + 2 <= len; i += 2) {
+		__m128i v_hi = _mm_xor_si128(v_bias,
+			_mm_loadu_si128((const __m128i *)(hi + i)));
+		__m128i v_lt = _mm_cmpgt_epi64(v_target, v_hi);
+		
+		below += __builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(v_lt)));
+	}
+#endif
+	
+	for ( ; i < len; ++i) {
+		below += (hi[i] < target);
+	}
+	
+	return below;
+}
+
+/// @brief names the branch search implementation selected at build time
+/// @return "avx2", "sse4.2", or "scalar"
+const char *branch_search_impl(void) {
+#if defined(__AVX2__)
+	return "avx2";
+#elif defined(__SSE4_2__)
+	return "sse4.2";
+#else
+	return "scalar";
+#endif
+}
+
+/// @brief searches a branch node for the elem whose subtree contains a key
+/// @param[in]  branch  branch node pointer
+/// @param[in]  key     pointer to key
+/// @return index of the last elem with a key <= the wanted key, or zero if
+/// there is none
+uint32_t branch_search_idx(const node_ptr branch, const key *key) {
 	ASSERT_BRANCH(branch);
 	ASSERT_NONEMPTY(branch);
 	
-	/* if lower than all present keys, return first node_ref */
-	if (key_cmp(&branch->b_elems[0].key, key) > 0) {
-		return branch->b_elems[0].addr;
+	key_norm norm = key_normalize(key);
+	const uint64_t *hi = branch_key_hi(branch);
+	const uint8_t  *lo = branch_key_lo(branch);
+	
+	/* branchless lower bound on the high parts, stopping at a short run */
+	const uint64_t *base = hi;
+	uint32_t len = branch->hdr.cnt;
+	while (len > BRANCH_SCAN_LEN) {
+		uint32_t half = len / 2;
+		
+		base = (base[half - 1] < norm.hi ? base + half : base);
+		len -= half;
 	}
 	
-	uint16_t first = 0;
-	uint16_t last  = branch->hdr.cnt - 1;
-	uint16_t middle;
+	uint32_t below = (base - hi) + branch_count_below(base, len, norm.hi);
 	
-	/* goal: find highest key that is <= wanted key */
-	while (first <= last) {
-		middle = CEIL(first + last, 2);
-		
-		int8_t cmp = key_cmp(&branch->b_elems[middle].key, key);
-		
-		if (cmp < 0) {
-			if (middle == branch->hdr.cnt - 1 ||
-				key_cmp(&branch->b_elems[middle + 1].key, key) > 0) {
-				return branch->b_elems[middle].addr;
-			} else {
-				first = middle + 1;
-			}
-		} else if (cmp > 0) {
-			last = middle - 1;
-		} else {
-			return branch->b_elems[middle].addr;
-		}
+	/* keys with the same high part differ only in the low byte of off, so
+	 * there are rarely more than a couple to step over */
+	while (below < branch->hdr.cnt && hi[below] == norm.hi &&
+		lo[below] <= norm.lo) {
+		++below;
 	}
 	
-	errx("%s: total failure: branch 0x%" PRIx32 " key %s",
-		__func__, branch->hdr.this, key_str(key));
+	return (below != 0 ? below - 1 : 0);
+}
+
+/// @brief searches a branch node for the child node which contains a key
+/// @param[in]  node  node pointer
+/// @param[in]  key   pointer to key
+/// @return block number of child containing key
+uint32_t branch_search(const node_ptr branch, const key *key) {
+	return branch_addr(branch)[branch_search_idx(branch, key)];
 }
 
 /// @brief searches a branch node the slow way: by child block number
 /// @param[in]  branch  branch node pointer
 /// @param[in]  addr    child block number
-/// @return pointer to node_ref with wanted block number, or NULL if not found
-node_ref *branch_search_addr(const node_ptr branch, uint32_t addr) {
+/// @param[out] out     index of elem with wanted block number
+/// @return true if the block number was found
+bool branch_search_addr(const node_ptr branch, uint32_t addr, uint32_t *out) {
 	ASSERT_BRANCH(branch);
 	
 	/* this is not an optimized search because the node's elements are not
 	 * sorted by address */
-	const node_ref *elem_end = branch->b_elems + branch->hdr.cnt;
-	for (node_ref *elem = branch->b_elems; elem < elem_end; ++elem) {
-		if (elem->addr == addr) {
-			return elem;
+	const uint32_t *addrs = branch_addr(branch);
+	for (uint32_t i = 0; i < branch->hdr.cnt; ++i) {
+		if (addrs[i] == addr) {
+			*out = i;
+			return true;
 		}
 	}
 	
 	/* not found */
-	return NULL;
+	return false;
 }
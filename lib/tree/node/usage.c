@@ -9,20 +9,29 @@
 #include "../../debug.h"
 
 
+/// @brief determines the number of bytes available to a node's elems and data
+/// @param[in]  node  node pointer
+/// @return bytes available when the node is empty
+uint32_t node_capacity(const node_ptr node) {
+	if (node->hdr.leaf) {
+		return node_size_usable(node);
+	} else {
+		return branch_cap(node) * sizeof(node_ref);
+	}
+}
+
 /// @brief determines the number of bytes used by a node's elems and data
 /// @param[in]  node  node pointer
 /// @return bytes used by elems and their data
 uint32_t node_used(const node_ptr node) {
 	if (node->hdr.leaf) {
-		if (node->hdr.cnt != 0) {
-			uint32_t used_ref  = node->hdr.cnt * sizeof(item_ref);
-			uint32_t used_data = node_size_byte() -
-				node->l_elems[node->hdr.cnt - 1].off;
-			
-			return used_ref + used_data;
-		} else {
-			return 0;
-		}
+		/* holes in the heap count as free, even if using them would mean
+		 * compacting first */
+		uint32_t used_ref  = node->hdr.cnt * leaf_ref_size(node);
+		uint32_t used_data = (node_size_byte(node) - node->hdr.heap_top) -
+			node->hdr.frag;
+		
+		return used_ref + used_data;
 	} else {
 		return node->hdr.cnt * sizeof(node_ref);
 	}
@@ -32,5 +41,28 @@ uint32_t node_used(const node_ptr node) {
 /// @param[in]  node  node pointer
 /// @return bytes free for use by elems and data
 uint32_t node_free(const node_ptr node) {
-	return node_size_usable() - node_used(node);
+	return node_capacity(node) - node_used(node);
+}
+
+/// @brief determines how much free space inserting an elem into a node would
+/// take up, counting the growth of existing refs if the key prefix shrinks
+/// @param[in] node      node pointer
+/// @param[in] key       key of new elem
+/// @param[in] data_len  length of new elem's data (leaves only)
+/// @return bytes needed
+uint32_t node_insert_cost(const node_ptr node, const key *key,
+	uint32_t data_len) {
+	if (node->hdr.leaf) {
+		key_enc enc = key_encode(key);
+		uint8_t pfx_len = leaf_pfx_fit(node, &enc);
+		
+		uint32_t growth = 0;
+		if (pfx_len < node->hdr.pfx_len) {
+			growth = node->hdr.cnt * (node->hdr.pfx_len - pfx_len);
+		}
+		
+		return growth + sizeof(item_loc) + (KEY_ENC_LEN - pfx_len) + data_len;
+	} else {
+		return sizeof(node_ref);
+	}
 }
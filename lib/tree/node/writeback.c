@@ -0,0 +1,115 @@
+/* jgfs2
+ * (c) 2013 Justin Gottula
+ * The source code of this project is distributed under the terms of the
+ * simplified BSD license. See the LICENSE file for details.
+ */
+
+
+#include "../node.h"
+#include "../../debug.h"
+
+
+struct node_wb_ent {
+	uint32_t addr;
+	uint32_t size_blk;
+};
+
+
+/* the list that nodes this thread changes go on, if it is in a commit group */
+static __thread struct node_wb_list *wb_cur = NULL;
+
+
+static int node_wb_cmp(const void *lhs, const void *rhs) {
+	const struct node_wb_ent *l = lhs, *r = rhs;
+	return (l->addr > r->addr) - (l->addr < r->addr);
+}
+
+/// @brief sets up an empty writeback list
+/// @param[in] list  list to set up
+void node_wb_init(struct node_wb_list *list) {
+	pthread_mutex_init(&list->lock, NULL);
+	
+	list->ents = NULL;
+	list->cnt  = 0;
+	list->max  = 0;
+}
+
+/// @brief makes the nodes this thread changes from now on go on a writeback
+/// list instead of being written out right away
+/// @param[in] list  list to use, or NULL to go back to writing nodes out as
+/// they are unmapped
+void node_wb_attach(struct node_wb_list *list) {
+	wb_cur = list;
+}
+
+/// @brief puts a changed node on this thread's writeback list, if it has one
+/// @param[in] node  pointer to node
+/// @return false if the node should be written out now instead
+bool node_wb_defer(const node_ptr node) {
+	struct node_wb_list *list = wb_cur;
+	if (list == NULL) {
+		return false;
+	}
+	
+	pthread_mutex_lock(&list->lock);
+	
+	if (list->cnt == list->max) {
+		list->max = (list->max != 0 ? list->max * 2 : 64);
+		list->ents = realloc(list->ents,
+			list->max * sizeof(struct node_wb_ent));
+	}
+	
+	list->ents[list->cnt++] = (struct node_wb_ent){
+		.addr     = node->hdr.this,
+		.size_blk = node_size_blk(node),
+	};
+	
+	pthread_mutex_unlock(&list->lock);
+	
+	return true;
+}
+
+/// @brief writes out every node on a writeback list in block order, then
+/// waits for all of it to reach the device with a single flush, leaving the
+/// list empty
+/// @param[in] list  writeback list, which nobody is adding to anymore
+/// @return number of separate runs of blocks written
+uint32_t node_wb_flush(struct node_wb_list *list) {
+	uint32_t runs = 0;
+	
+	if (list->cnt != 0) {
+		qsort(list->ents, list->cnt, sizeof(struct node_wb_ent), node_wb_cmp);
+		
+		/* nodes that were changed more than once, or that sit right next to
+		 * each other, go out as one run */
+		uint32_t run_addr = list->ents[0].addr;
+		uint32_t run_end  = run_addr + list->ents[0].size_blk;
+		
+		for (uint32_t i = 1; i < list->cnt; ++i) {
+			const struct node_wb_ent *ent = list->ents + i;
+			
+			if (ent->addr > run_end) {
+				fs_writeback_blk(run_addr, run_end - run_addr);
+				++runs;
+				
+				run_addr = ent->addr;
+			}
+			
+			if (ent->addr + ent->size_blk > run_end) {
+				run_end = ent->addr + ent->size_blk;
+			}
+		}
+		
+		fs_writeback_blk(run_addr, run_end - run_addr);
+		++runs;
+	}
+	
+	fs_fsync();
+	
+	free(list->ents);
+	list->ents = NULL;
+	list->cnt  = 0;
+	list->max  = 0;
+	
+	return runs;
+}
@@ -15,12 +15,63 @@
 #include "node.h"
 
 
-struct tree_lock_node {
-	struct tree_lock_node *next;
+/* deepest tree a descent will handle; at 2 elems per node minimum, this is far
+ * more than a 32-bit block space can hold */
+#define TREE_MAX_DEPTH 32
+
+
+struct tree_index_stats {
+	uint8_t  levels;    // levels kept in memory above the frontier
+	uint32_t nodes;     // nodes on the frontier
+	size_t   footprint; // memory used, in bytes
 	
-	uint32_t root_addr;
+	uint64_t hits;      // lookups that started at the frontier
+	uint64_t misses;    // lookups that had to start at the root
+	uint64_t rebuilds;  // times the index was rebuilt
+};
+
+
+/* how lookups got to their leaves since the filesystem was mounted */
+struct tree_search_stats {
+	uint64_t optimistic; // lookups that got there without latches
+	uint64_t retries;    // lookups without latches that ran into a writer
+	uint64_t latched;    // lookups that gave up and took latches
+};
+
+
+struct tree_stats {
+	uint8_t  height;  // levels, counting the root's and the leaves'
+	uint32_t nodes;   // nodes on every level
+	uint64_t items;   // items in the leaves
+	uint64_t bytes;   // item data, counting overflow items at full length
+	uint32_t ovf_blk; // blocks in overflow extents
+	uint32_t fill[NODE_FILL_BUCKETS]; // leaves in each fill bucket
+};
+
+/* what only a full walk can find out, for one level of a tree */
+struct tree_level_stats {
+	uint32_t nodes;    // nodes on the level
+	uint64_t elems;    // elems in those nodes
+	uint64_t used;     // bytes taken up in those nodes
+	uint64_t capacity; // bytes those nodes could take up
+};
+
+
+/* totals for the commit groups written out since the filesystem was mounted */
+struct tree_txn_stats {
+	uint64_t groups; // groups committed
+	uint64_t ops;    // operations in those groups
+	uint64_t nodes;  // node writes deferred to them
+	uint64_t runs;   // runs of adjacent blocks written out
 };
 
+struct tree_txn;
+
+/* called with each extent that a tree takes up, and what it was allocated for
+ * (enum ext_type) */
+typedef void (*tree_blk_func)(uint32_t addr, uint32_t len, uint8_t type,
+	void *arg);
+
 
 /* locking */
 void tree_lock(uint32_t root_addr);
@@ -31,20 +82,84 @@ void tree_dump(uint32_t root_addr);
 void tree_graph(uint32_t root_addr);
 
 /* balancing */
-// ...
+void tree_split_single(node_ptr node, const key *key,
+	union elem_payload payload);
+void tree_drop_empty(node_ptr node);
+
+/* buffered trees */
+void tree_buf_insert(uint32_t root_addr, const key *key, struct item_data item);
+bool tree_buf_remove(uint32_t root_addr, const key *key);
+bool tree_buf_retrieve(uint32_t root_addr, const key *key, size_t max_len,
+	void *buf);
+bool tree_buf_last_key(uint32_t root_addr, key *out);
+
+/* level iteration */
+uint8_t tree_depth(uint32_t root_addr);
+uint32_t tree_level_first(uint32_t root_addr, uint8_t level);
+uint32_t tree_level_next(uint32_t node_addr);
+void tree_blk_walk(uint32_t root_addr, tree_blk_func func, void *arg);
+
+/* statistics */
+void tree_stat_new(void);
+void tree_stat_init(node_ptr root);
+void tree_stat_open(uint32_t root_addr);
+void tree_stat_fill(node_ptr node);
+void tree_stat_fill_drop(node_ptr node);
+void tree_stat_nodes(int32_t delta);
+void tree_stat_item_add(struct item_data item);
+void tree_stat_item_del(const node_ptr leaf, uint32_t idx);
+void tree_stat_ovf(int64_t blk_delta);
+void tree_stat_grow(uint32_t root_addr);
+void tree_stat_collapse(uint32_t root_addr);
+void tree_stat_commit(uint32_t root_addr);
+void tree_stat_aside(void);
+void tree_stat_resume(void);
+struct tree_stats tree_stat(uint32_t root_addr);
+uint8_t tree_stat_walk(uint32_t root_addr, struct tree_stats *totals,
+	struct tree_level_stats levels[TREE_MAX_DEPTH]);
+void tree_stat_done(void);
+
+/* in-memory index */
+uint32_t tree_index_find(uint32_t root_addr, const key *key, uint64_t *gen);
+bool tree_index_valid(uint32_t root_addr, uint64_t gen);
+void tree_index_bump(uint32_t root_addr);
+struct tree_index_stats tree_index_stats(uint32_t root_addr);
+void tree_index_done(void);
 
 /* querying */
 node_ptr tree_search(uint32_t root_addr, const key *key);
 bool tree_retrieve(uint32_t root_addr, const key *key, size_t max_len,
 	void *buf);
+bool tree_last_key(uint32_t root_addr, key *out);
+bool tree_seek(uint32_t root_addr, const key *from, bool below, key *found,
+	size_t max_len, void *buf);
+struct tree_search_stats tree_search_stats(void);
+void tree_search_done(void);
+
+/* overflow */
+uint32_t tree_inline_max(uint32_t root_addr);
+struct item_data tree_ovf_store(struct item_data item, struct item_ovf *ovf);
+void tree_ovf_free(const node_ptr leaf, uint32_t idx);
+void tree_ovf_read(const struct item_ovf *ovf, void *buf);
+uint32_t tree_item_len(const node_ptr leaf, uint32_t idx);
+void tree_item_read(const node_ptr leaf, uint32_t idx, void *buf);
 
 /* modifying */
 void tree_insert(uint32_t root_addr, const key *key, struct item_data item);
-void tree_remove(uint32_t root_addr, const key *key);
+bool tree_remove(uint32_t root_addr, const key *key);
+
+/* commit groups */
+struct tree_txn *tree_txn_begin(void);
+void tree_txn_commit(struct tree_txn *txn, bool wait);
+void tree_txn_sync(void);
+struct tree_txn_stats tree_txn_stats(void);
+void tree_txn_done(void);
 
 /* miscellaneous */
-void tree_init(uint32_t root_addr);
-void tree_stat(uint32_t root_addr);
+void tree_init(uint32_t root_addr, uint32_t size_blk, uint8_t flags);
+uint32_t tree_node_size(uint32_t root_addr);
+bool tree_buffered(uint32_t root_addr);
+void tree_done(void);
 
 
 #endif
@@ -16,7 +16,7 @@
 
 // for branch nodes (fixed key weight):
 //  B = 0
-// 2Q = node_space_usable() / sizeof(node_ref)
+// 2Q = branch_cap()
 //  P = node_space_usable()
 
 
@@ -32,23 +32,222 @@
 #define CANDIDATES ((B * 2) - 1)*/
 
 
-node_ptr tree_split_single(node_ptr node, const key *key,
-	uint32_t space_needed) {
+/// @brief finds the index at which a node should be split so that both halves
+/// carry about the same weight
+/// @param[in] node  pointer to node
+/// @return index of the first elem that goes to the right half
+static uint32_t tree_split_idx(const node_ptr node) {
+	if (node->hdr.cnt < 2) {
+		errx("%s: too few elems to split: node 0x%" PRIx32 " cnt %" PRIu32,
+			__func__, node->hdr.this, node->hdr.cnt);
+	}
 	
-	// split in 1:2 fashion (normal btree split)
-	// split to the right always
-	// make space for the insertion key when splitting
-	// insert the key in that spot
+	uint32_t half = node_used(node) / 2;
+	uint32_t used = 0;
 	
-	// handle root, of course
+	uint32_t idx = 0;
+	do {
+		used += node_elem_weight(node, idx++);
+	} while (used < half && idx < node->hdr.cnt - 1);
 	
-	// need to update parent refs (recursive split concern: before or after?)
-	// make sure to update this node's ref if we inserted into index 0
+	return idx;
+}
+
+/// @brief moves all elems from the split index onward to the end of another
+/// node
+/// @param[in] dst    pointer to destination node
+/// @param[in] src    pointer to node being split
+/// @param[in] split  index of the first elem to move
+static void tree_split_move(node_ptr dst, node_ptr src, uint32_t split) {
+	uint32_t move_cnt = src->hdr.cnt - split;
 	
-	// return pointer to node with spot for the key
-	// caller needs to fill the elem data afterward (if appropriate)
+	node_append_multiple(dst, src, split, move_cnt);
 	
-	return NULL;
+	node_zero_range(src, split);
+	src->hdr.cnt = split;
+	
+	/* the half that stays behind covers a narrower range of keys now */
+	if (src->hdr.leaf) {
+		leaf_pfx_compact(src);
+		
+		leaf_bloom_build(src);
+		leaf_bloom_build(dst);
+	} else if (src->hdr.flags & NODE_BUFFERED) {
+		branch_buf_split(dst, src);
+	}
+}
+
+/// @brief inserts an elem into whichever half of a freshly split node it
+/// belongs in
+/// @param[in] left     pointer to left half
+/// @param[in] right    pointer to right half
+/// @param[in] key      key of new elem, or NULL if there is none
+/// @param[in] payload  payload of new elem
+static void tree_split_insert(node_ptr left, node_ptr right, const key *key,
+	union elem_payload payload) {
+	if (key == NULL) {
+		return;
+	}
+	
+	node_ptr target = (node_key_cmp(right, 0, key) < 0 ? right : left);
+	
+	if (!node_insert(target, key, payload)) {
+		errx("%s: elem does not fit after split: node 0x%" PRIx32 " key %s",
+			__func__, target->hdr.this, key_str(key));
+	}
+	
+	/* a new child was created pointing at the node that split */
+	if (!target->hdr.leaf) {
+		node_reparent(payload.b_addr, target->hdr.this);
+	}
+}
+
+/// @brief splits the root node, which must stay at the same block number, by
+/// moving both halves to new nodes and turning it into their parent
+/// @param[in] root     pointer to root node
+/// @param[in] key      key of new elem, or NULL if there is none
+/// @param[in] payload  payload of new elem
+static void tree_split_root(node_ptr root, const key *key,
+	union elem_payload payload) {
+	bool leaf = root->hdr.leaf;
+	uint32_t root_addr = root->hdr.this;
+	uint32_t split = tree_split_idx(root);
+	
+	/* the halves go right after the root, one after the other */
+	uint32_t size_blk   = node_size_blk(root);
+	uint32_t left_addr  = node_alloc(size_blk, root_addr + size_blk);
+	uint32_t right_addr = node_alloc(size_blk, left_addr + size_blk);
+	
+	node_latch(left_addr, true);
+	node_latch(right_addr, true);
+	
+	/* the root is alone on its level, so the halves are each other's only
+	 * siblings */
+	node_ptr left  = node_copy_init(left_addr, root, root_addr, 0, right_addr);
+	node_ptr right = node_init(right_addr, size_blk, leaf,
+		root->hdr.flags, root_addr, left_addr, 0);
+	
+	tree_split_move(right, left, split);
+	
+	if (!leaf) {
+		node_reparent_children(left);
+		node_reparent_children(right);
+	}
+	
+	if (leaf) {
+		leaf_bloom_drop(root_addr);
+	}
+	
+	root->hdr.leaf = false;
+	node_zero_all(root);
+	
+	node_ref left_ref = {
+		.key  = node_first_key(left),
+		.addr = left_addr,
+	};
+	node_ref right_ref = {
+		.key  = node_first_key(right),
+		.addr = right_addr,
+	};
+	
+	root->hdr.cnt = 2;
+	node_elem_fill(root, 0, &left_ref.key,
+		(union elem_payload){ .b_addr = left_ref.addr });
+	node_elem_fill(root, 1, &right_ref.key,
+		(union elem_payload){ .b_addr = right_ref.addr });
+	
+	tree_split_insert(left, right, key, payload);
+	
+	tree_stat_fill(root);
+	tree_stat_fill(left);
+	tree_stat_fill(right);
+	tree_stat_nodes(2);
+	tree_stat_grow(root_addr);
+	
+	node_unmap(left);
+	node_unmap(right);
+	
+	node_unlatch(left_addr, true);
+	node_unlatch(right_addr, true);
+}
+
+/// @brief splits a non-root node to the right, adding the new node to the
+/// parent (which may split in turn)
+/// @param[in] node     pointer to node
+/// @param[in] key      key of new elem, or NULL if there is none
+/// @param[in] payload  payload of new elem
+static void tree_split_child(node_ptr node, const key *key,
+	union elem_payload payload) {
+	bool leaf = node->hdr.leaf;
+	uint32_t split = tree_split_idx(node);
+	
+	/* the new node goes right after the one it is split from, so that leaves
+	 * read in key order are read in block order too */
+	uint32_t new_addr = node_alloc(node_size_blk(node),
+		node->hdr.this + node_size_blk(node));
+	node_latch(new_addr, true);
+	
+	node_ptr new = node_init(new_addr, node_size_blk(node), leaf,
+		node->hdr.flags, node->hdr.parent, node->hdr.this, node->hdr.next);
+	
+	tree_split_move(new, node, split);
+	
+	/* an insert has the next node latched already (see tree_split_latch), so
+	 * this only nests; in a buffered tree, the root's latch keeps every other
+	 * writer out, and readers only ever wait on the nodes below them */
+	if (node->hdr.next != 0) {
+		node_latch(node->hdr.next, true);
+		
+		node_ptr next = node_map(node->hdr.next, true);
+		next->hdr.prev = new_addr;
+		node_unmap(next);
+		
+		node_unlatch(node->hdr.next, true);
+	}
+	
+	node->hdr.next = new_addr;
+	
+	if (!leaf) {
+		node_reparent_children(new);
+	}
+	
+	/* the parent is still latched by the descent, since this node was unsafe;
+	 * if the parent splits as well, our own parent field may change */
+	node_ref new_ref = {
+		.key  = node_first_key(new),
+		.addr = new_addr,
+	};
+	union elem_payload new_payload = {
+		.b_addr = new_ref.addr,
+	};
+	
+	node_ptr parent = node_map(node->hdr.parent, true);
+	if (!node_insert(parent, &new_ref.key, new_payload)) {
+		tree_split_single(parent, &new_ref.key, new_payload);
+	}
+	node_unmap(parent);
+	
+	tree_split_insert(node, new, key, payload);
+	
+	tree_stat_fill(node);
+	tree_stat_fill(new);
+	tree_stat_nodes(1);
+	
+	node_unmap(new);
+	node_unlatch(new_addr, true);
+}
+
+/// @brief splits a full node in 1:2 fashion and inserts a new elem into it
+/// @param[in] node     pointer to node
+/// @param[in] key      key of new elem, or NULL to only make room
+/// @param[in] payload  payload of new elem
+void tree_split_single(node_ptr node, const key *key,
+	union elem_payload payload) {
+	if (node->hdr.parent == 0) {
+		tree_split_root(node, key, payload);
+	} else {
+		tree_split_child(node, key, payload);
+	}
 }
 
 node_ptr tree_split_pair(node_ptr nodes[2], const key *key,
@@ -75,3 +274,63 @@ void tree_merge_single(node_ptr nodes[2], const key *key) {
 void tree_merge_pair(node_ptr nodes[3], const key *key) {
 	
 }
+
+/// @brief unlinks an empty non-root node from the tree and frees it, doing the
+/// same for any ancestors that become empty as a result; the caller must hold
+/// the node, its ancestors, and both siblings of each node that goes away (see
+/// tree_drop_latch)
+/// @param[in] node  pointer to empty node
+void tree_drop_empty(node_ptr node) {
+	if (node->hdr.cnt != 0 || node->hdr.parent == 0) {
+		errx("%s: not an empty non-root node: node 0x%" PRIx32 " cnt %" PRIu32,
+			__func__, node->hdr.this, node->hdr.cnt);
+	}
+	
+	if (node->hdr.prev != 0) {
+		node_ptr prev = node_map(node->hdr.prev, true);
+		prev->hdr.next = node->hdr.next;
+		node_unmap(prev);
+	}
+	
+	/* as in tree_split_child, the next node is latched already */
+	if (node->hdr.next != 0) {
+		node_latch(node->hdr.next, true);
+		
+		node_ptr next = node_map(node->hdr.next, true);
+		next->hdr.prev = node->hdr.prev;
+		node_unmap(next);
+		
+		node_unlatch(node->hdr.next, true);
+	}
+	
+	node_ptr parent = node_map(node->hdr.parent, true);
+	
+	uint32_t this_idx;
+	if (!branch_search_addr(parent, node->hdr.this, &this_idx)) {
+		errx("%s: ref not found in parent: node 0x%" PRIx32 " parent 0x%"
+			PRIx32, __func__, node->hdr.this, node->hdr.parent);
+	}
+	
+	node_remove(parent, this_idx);
+	
+	if (parent->hdr.cnt == 0) {
+		if (parent->hdr.parent == 0) {
+			/* the root lost its last child, so it is an empty leaf again */
+			parent->hdr.leaf = true;
+			node_zero_all(parent);
+			
+			tree_stat_fill(parent);
+			tree_stat_collapse(parent->hdr.this);
+		} else {
+			tree_drop_empty(parent);
+		}
+	}
+	
+	node_unmap(parent);
+	
+	tree_stat_fill_drop(node);
+	tree_stat_nodes(-1);
+	
+	leaf_bloom_drop(node->hdr.this);
+	node_dealloc(node->hdr.this, node_size_blk(node));
+}
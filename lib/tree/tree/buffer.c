@@ -0,0 +1,450 @@
+/* jgfs2
+ * (c) 2013 Justin Gottula
+ * The source code of this project is distributed under the terms of the
+ * simplified BSD license. See the LICENSE file for details.
+ */
+
+
+#include "../tree.h"
+#include "../check.h"
+#include "../../debug.h"
+
+
+/* in a buffered tree, inserts and removals don't go to the leaves right away:
+ * they are appended as messages to the root's buffer, and when a buffer fills
+ * up, the messages headed for whichever child would get the most of them are
+ * passed down in one go, so that each write to a node below the root carries
+ * a whole batch of changes; lookups see a message as soon as it is made, by
+ * taking the first one for their key that they come across on the way down
+ *
+ * writers hold the root exclusively for as long as they are at it, and latch
+ * everything they touch below it exclusively too, so lookups crabbing down
+ * with shared latches never see a message in two places or in neither
+ *
+ * a branch only ever has to take in a new elem while one of its children is
+ * splitting, and that is only allowed while it has room for one; a branch that
+ * is full stops passing messages down until its parent has split it, so that
+ * messages in the middle of being moved never end up on the wrong side of a
+ * split */
+
+
+/// @brief determines whether a branch can no longer take in another elem
+/// @param[in] branch  pointer to branch node
+/// @return true if a child split would make it split as well
+static bool tree_buf_full(const node_ptr branch) {
+	return (branch->hdr.cnt == branch_cap(branch));
+}
+
+/// @brief carries out a message that has made it down to a leaf
+/// @param[in] leaf  pointer to leaf node, latched exclusively along with all of
+/// its ancestors
+/// @param[in] key   key of item
+/// @param[in] op    what to do with the item (enum buf_op)
+/// @param[in] item  item to insert (BUF_OP_INSERT only)
+static void tree_buf_apply(node_ptr leaf, const key *key, uint8_t op,
+	struct item_data item) {
+	/* an insert replaces whatever was there before */
+	uint32_t idx;
+	if (node_search(leaf, key, &idx)) {
+		tree_stat_item_del(leaf, idx);
+		tree_ovf_free(leaf, idx);
+		node_remove(leaf, idx);
+	}
+	
+	if (op == BUF_OP_INSERT) {
+		union elem_payload payload = {
+			.l_item = item,
+		};
+		
+		if (!node_insert(leaf, key, payload)) {
+			tree_split_single(leaf, key, payload);
+		}
+		
+		tree_stat_item_add(item);
+	}
+	
+	tree_stat_fill(leaf);
+}
+
+/// @brief frees a leaf that a removal left empty, unless it is the first
+/// child of its parent: taking that one out would raise the parent's first
+/// key, which is not allowed (see node_update_ref_in_parent), so it is kept
+/// around empty until something is inserted into it again
+/// @param[in] leaf  pointer to leaf node, latched exclusively along with all of
+/// its ancestors
+/// @param[in] idx   elem index of the leaf in its parent
+/// @return true if the leaf was freed
+static bool tree_buf_drop(node_ptr leaf, uint32_t idx) {
+	if (leaf->hdr.cnt != 0 || idx == 0) {
+		return false;
+	}
+	
+	/* as in tree_remove, waiting on the left sibling could deadlock; an empty
+	 * leaf does no harm, so just leave it be */
+	uint32_t prev_addr = leaf->hdr.prev;
+	if (prev_addr != 0 && !node_try_latch(prev_addr, true)) {
+		return false;
+	}
+	
+	tree_drop_empty(leaf);
+	
+	if (prev_addr != 0) {
+		node_unlatch(prev_addr, true);
+	}
+	
+	return true;
+}
+
+static uint32_t tree_buf_flush(node_ptr branch);
+
+/// @brief lets go of the child a flush has been holding on to, if any
+/// @param[in,out] child  pointer to child node, or NULL
+static void tree_buf_release(node_ptr *child) {
+	if (*child != NULL) {
+		uint32_t child_addr = (*child)->hdr.this;
+		
+		node_unmap(*child);
+		node_unlatch(child_addr, true);
+		
+		*child = NULL;
+	}
+}
+
+/// @brief passes one message from a branch down to the child it is headed for,
+/// carrying it out if the child is a leaf, and making room in the child's
+/// buffer first if it is a branch
+/// @param[in]     branch  pointer to branch node, latched exclusively along
+/// with all of its ancestors
+/// @param[in,out] child   child held from the last message, or NULL; it stays
+/// held as long as the messages that follow are headed for it too, so that a
+/// batch costs one latch and mapping, not one per message
+/// @param[in]     key     key of item
+/// @param[in]     op      what to do with the item (enum buf_op)
+/// @param[in]     item    item to insert (BUF_OP_INSERT only)
+/// @return false if the child would have to split, but the branch is full
+static bool tree_buf_send(node_ptr branch, node_ptr *child, const key *key,
+	uint8_t op, struct item_data item) {
+	for ( ; ; ) {
+		/* splits below may have changed which child the key goes to */
+		uint32_t idx = branch_search_idx(branch, key);
+		uint32_t child_addr = branch_addr(branch)[idx];
+		
+		if (*child != NULL && (*child)->hdr.this != child_addr) {
+			tree_buf_release(child);
+		}
+		if (*child == NULL) {
+			node_latch(child_addr, true);
+			*child = node_map(child_addr, true);
+			
+			check_visit(*child, child_addr, true);
+		}
+		
+		if ((*child)->hdr.leaf) {
+			if (op == BUF_OP_INSERT && tree_buf_full(branch) &&
+				node_free(*child) < node_insert_cost(*child, key, item.len)) {
+				return false;
+			}
+			
+			tree_buf_apply(*child, key, op, item);
+			
+			/* a leaf that was dropped is gone, but still has to be let go */
+			if (tree_buf_drop(*child, idx)) {
+				tree_buf_release(child);
+			}
+			
+			return true;
+		} else if (branch_buf_append(*child, key, op, item)) {
+			return true;
+		}
+		
+		/* a flush only comes back empty-handed once the child is full */
+		if (!tree_buf_full(*child)) {
+			tree_buf_flush(*child);
+		} else if (!tree_buf_full(branch)) {
+			tree_split_single(*child, NULL, (union elem_payload){ 0 });
+		} else {
+			return false;
+		}
+	}
+}
+
+/// @brief passes the messages in a branch's buffer that are headed for its
+/// busiest child down to that child, in the order they arrived
+/// @param[in] branch  pointer to branch node with a nonempty buffer, latched
+/// exclusively along with all of its ancestors
+/// @return number of messages passed down; zero only if the branch is full
+static uint32_t tree_buf_flush(node_ptr branch) {
+	uint32_t len;
+	uint8_t *batch = branch_buf_take(branch, branch_buf_busiest(branch), &len);
+	
+	node_ptr child = NULL;
+	
+	uint32_t moved = 0;
+	uint32_t off = 0;
+	while (off < len) {
+		const struct buf_msg *msg = (const struct buf_msg *)(batch + off);
+		
+		key msg_key;
+		key_decode(&msg->key, &msg_key);
+		
+		if (!tree_buf_send(branch, &child, &msg_key, msg->op,
+			buf_msg_item(msg))) {
+			break;
+		}
+		
+		off += buf_msg_size(msg);
+		++moved;
+	}
+	
+	tree_buf_release(&child);
+	
+	/* the rest go back where they came from; nothing else was added to the
+	 * buffer in the meantime, so they still fit */
+	while (off < len) {
+		const struct buf_msg *msg = (const struct buf_msg *)(batch + off);
+		
+		key msg_key;
+		key_decode(&msg->key, &msg_key);
+		
+		if (!branch_buf_append(branch, &msg_key, msg->op,
+			buf_msg_item(msg))) {
+			errx("%s: message does not fit back: node 0x%" PRIx32 " key %s",
+				__func__, branch->hdr.this, key_str(&msg_key));
+		}
+		
+		off += buf_msg_size(msg);
+	}
+	
+	free(batch);
+	return moved;
+}
+
+/// @brief adds a message to a buffered tree at the root, flushing and
+/// splitting as needed to make room for it
+/// @param[in] root  pointer to root node, latched exclusively
+/// @param[in] key   key of item
+/// @param[in] op    what to do with the item (enum buf_op)
+/// @param[in] item  item to insert (BUF_OP_INSERT only)
+/// @return true if any node below the root may have changed
+static bool tree_buf_push(node_ptr root, const key *key, uint8_t op,
+	struct item_data item) {
+	bool deep = false;
+	
+	/* a tree that is still just one leaf has nowhere to keep messages */
+	while (!root->hdr.leaf) {
+		if (branch_buf_append(root, key, op, item)) {
+			return deep;
+		}
+		
+		if (tree_buf_full(root)) {
+			tree_split_single(root, NULL, (union elem_payload){ 0 });
+		} else {
+			tree_buf_flush(root);
+		}
+		
+		deep = true;
+	}
+	
+	tree_buf_apply(root, key, op, item);
+	return true;
+}
+
+/// @brief looks up an item in a buffered tree, going by the first message for
+/// its key on the way down, if there is one
+/// @param[in]  start    pointer to node to start at, latched by the caller
+/// @param[in]  key      key of item
+/// @param[in]  max_len  size of buffer
+/// @param[out] buf      buffer for item data, or NULL to only check whether
+/// the item exists
+/// @return false if the item doesn't exist or doesn't fit
+static bool tree_buf_lookup(const node_ptr start, const key *key,
+	size_t max_len, void *buf) {
+	bool result = false;
+	
+	node_ptr node = start;
+	for ( ; ; ) {
+		if (node->hdr.leaf) {
+			uint32_t idx;
+			if (node_search(node, key, &idx)) {
+				result = (buf == NULL || tree_item_len(node, idx) <= max_len);
+				
+				if (result && buf != NULL) {
+					tree_item_read(node, idx, buf);
+				}
+			}
+			
+			break;
+		}
+		
+		const struct buf_msg *msg = branch_buf_find(node, key);
+		if (msg != NULL) {
+			if (msg->op == BUF_OP_INSERT) {
+				const struct item_ovf *ovf = (const void *)msg->data;
+				uint32_t len = (msg->ovf ? ovf->len : msg->len);
+				
+				result = (buf == NULL || len <= max_len);
+				
+				if (result && buf != NULL) {
+					if (msg->ovf) {
+						tree_ovf_read(ovf, buf);
+					} else {
+						memcpy(buf, msg->data, len);
+					}
+				}
+			}
+			
+			break;
+		}
+		
+		/* couple the latches, as in tree_search_r */
+		uint32_t child_addr = branch_search(node, key);
+		node_latch(child_addr, false);
+		
+		if (node != start) {
+			uint32_t node_addr = node->hdr.this;
+			
+			node_unmap(node);
+			node_unlatch(node_addr, false);
+		}
+		
+		node = node_map(child_addr, false);
+		check_visit(node, child_addr, true);
+	}
+	
+	if (node != start) {
+		uint32_t node_addr = node->hdr.this;
+		
+		node_unmap(node);
+		node_unlatch(node_addr, false);
+	}
+	
+	return result;
+}
+
+/// @brief inserts an item into a buffered tree, replacing any item that
+/// already has the same key
+/// @param[in] root_addr  block number of root node
+/// @param[in] key        key of item
+/// @param[in] item       item data, already moved to an overflow extent if it
+/// is too big to keep inline
+void tree_buf_insert(uint32_t root_addr, const key *key,
+	struct item_data item) {
+	check_op_begin();
+	
+	node_latch(root_addr, true);
+	node_ptr root = node_map(root_addr, true);
+	check_visit(root, root_addr, true);
+	
+	if (tree_buf_push(root, key, BUF_OP_INSERT, item)) {
+		tree_index_bump(root_addr);
+	}
+	
+	node_unmap(root);
+	node_unlatch(root_addr, true);
+}
+
+/// @brief removes an item from a buffered tree
+/// @param[in] root_addr  block number of root node
+/// @param[in] key        key of item
+/// @return false if there was no such item
+bool tree_buf_remove(uint32_t root_addr, const key *key) {
+	check_op_begin();
+	
+	node_latch(root_addr, true);
+	node_ptr root = node_map(root_addr, true);
+	check_visit(root, root_addr, true);
+	
+	/* there's no point in sending a removal down for an item that isn't
+	 * there, and the caller wants to know anyway */
+	bool result = tree_buf_lookup(root, key, 0, NULL);
+	if (result && tree_buf_push(root, key, BUF_OP_REMOVE,
+		(struct item_data){ 0 })) {
+		tree_index_bump(root_addr);
+	}
+	
+	node_unmap(root);
+	node_unlatch(root_addr, true);
+	
+	return result;
+}
+
+/// @brief copies an item out of a buffered tree
+/// @param[in]  root_addr  block number of root node
+/// @param[in]  key        key of item
+/// @param[in]  max_len    size of buffer
+/// @param[out] buf        buffer for item data
+/// @return false if the item doesn't exist or doesn't fit
+bool tree_buf_retrieve(uint32_t root_addr, const key *key, size_t max_len,
+	void *buf) {
+	check_op_begin();
+	
+	node_latch(root_addr, false);
+	node_ptr root = node_map(root_addr, false);
+	check_visit(root, root_addr, true);
+	
+	bool result = tree_buf_lookup(root, key, max_len, buf);
+	
+	node_unmap(root);
+	node_unlatch(root_addr, false);
+	
+	return result;
+}
+
+/// @brief finds a key no less than the greatest key in a buffered tree: it is
+/// exact unless removals that haven't reached the leaves yet (or leaves they
+/// have emptied out) are involved, in which case it may be greater
+/// @param[in]  root_addr  block number of root node
+/// @param[out] out        greatest key
+/// @return false if the tree is empty
+bool tree_buf_last_key(uint32_t root_addr, key *out) {
+	bool result = false;
+	
+	uint32_t node_addr = root_addr;
+	node_latch(node_addr, false);
+	
+	node_ptr node = node_map(node_addr, false);
+	for ( ; ; ) {
+		/* everything to the left of the rightmost child is below its key, so
+		 * anything greater is either under that child or still waiting in a
+		 * buffer along the way down to it */
+		key cand[2];
+		uint8_t cand_cnt = 0;
+		
+		if (node->hdr.leaf) {
+			if (node->hdr.cnt != 0) {
+				cand[cand_cnt++] = node_key(node, node->hdr.cnt - 1);
+			}
+		} else {
+			cand[cand_cnt++] = branch_elem(node, node->hdr.cnt - 1).key;
+			
+			if (branch_buf_max_key(node, cand + cand_cnt)) {
+				++cand_cnt;
+			}
+		}
+		
+		for (uint8_t i = 0; i < cand_cnt; ++i) {
+			if (!result || key_cmp(cand + i, out) > 0) {
+				*out = cand[i];
+				result = true;
+			}
+		}
+		
+		if (node->hdr.leaf) {
+			break;
+		}
+		
+		uint32_t child_addr = branch_addr(node)[node->hdr.cnt - 1];
+		node_latch(child_addr, false);
+		
+		node_unmap(node);
+		node_unlatch(node_addr, false);
+		
+		node_addr = child_addr;
+		node = node_map(node_addr, false);
+	}
+	
+	node_unmap(node);
+	node_unlatch(node_addr, false);
+	
+	return result;
+}
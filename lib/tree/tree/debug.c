@@ -22,7 +22,7 @@ static void tree_graph_r(uint32_t node_addr, uint32_t level,
 	
 	/* draw the node space usage bar */
 	uint8_t used_round = (uint8_t)ceil(((float)node_used(node) * 12.f) /
-		(float)node_size_usable());
+		(float)node_capacity(node));
 	char used_bar[13];
 	for (uint8_t i = 0; i < 12; ++i) {
 		if (i <= used_round - 1) {
@@ -34,12 +34,13 @@ static void tree_graph_r(uint32_t node_addr, uint32_t level,
 	used_bar[sizeof(used_bar) - 1] = '\0';
 	
 	float used_pct = ((float)node_used(node) * 100.f) /
-		(float)node_size_usable();
+		(float)node_capacity(node);
 	
 	int width_bar  = 12 + 2;
 	int width_pct  = 3 + 1;
-	int width_free = log_u32(10, node_size_usable());
-	int width_cnt  = log_u32(10, node_size_usable() / sizeof(item_ref));
+	int width_free = log_u32(10, node_size_usable(node));
+	int width_cnt  = log_u32(10, node_size_usable(node) /
+		(sizeof(item_loc) + 1));
 	int width_id   = sizeof(uint32_t) * 2;
 	
 	int col_bar  = 0 - width_bar;
@@ -72,11 +73,11 @@ static void tree_graph_r(uint32_t node_addr, uint32_t level,
 	
 	if (node->hdr.cnt != 0) {
 		fprintf_col(stderr, col_id, "%0*" PRIx32,
-			width_id, node_first_key(node)->id);
+			width_id, node_first_key(node).id);
 	} else {
 		fprintf_col(stderr, col_id, "%*s", width_id, "<empty>");
 	}
-	fprintf_col(stderr, col_cnt, "%*" PRIu16, width_cnt, node->hdr.cnt);
+	fprintf_col(stderr, col_cnt, "%*" PRIu32, width_cnt, node->hdr.cnt);
 	fprintf_col(stderr, col_free, "%*" PRIu32, width_free, node_free(node));
 	fprintf_col(stderr, col_pct, "%3d%%", (int)floor(used_pct));
 	fprintf_col(stderr, col_bar, "[%s]\n", used_bar);
@@ -90,16 +91,15 @@ static void tree_graph_r(uint32_t node_addr, uint32_t level,
 		*item_qty += node->hdr.cnt;
 	} else {
 		/* recurse through child nodes */
-		const node_ref *elem_end = node->b_elems + node->hdr.cnt;
-		for (const node_ref *elem = node->b_elems; elem < elem_end; ++elem) {
-			tree_graph_r(elem->addr, level + 1, max_level,
+		for (uint32_t i = 0; i < node->hdr.cnt; ++i) {
+			tree_graph_r(branch_addr(node)[i], level + 1, max_level,
 				node_qty, item_qty, avg_fill);
 		}
 	}
 	
 	++(*node_qty);
 	*avg_fill = (*avg_fill * ((double)(*node_qty - 1) / (double)*node_qty)) +
-		(((double)node_used(node) / (double)node_size_usable()) /
+		(((double)node_used(node) / (double)node_capacity(node)) /
 		(double)*node_qty);
 	
 	node_unmap(node);
@@ -0,0 +1,364 @@
+/* jgfs2
+ * (c) 2013 Justin Gottula
+ * The source code of this project is distributed under the terms of the
+ * simplified BSD license. See the LICENSE file for details.
+ */
+
+
+#include "../tree.h"
+#include <pthread.h>
+#include "../../debug.h"
+
+
+/* trees that can have an index at once; there is one extent tree and at most
+ * a few dozen metadata partitions */
+#define TREE_INDEX_SLOTS 128
+
+/* an index stops growing downward before its bottom level would have more
+ * than this many nodes */
+#define TREE_INDEX_ELEM_MAX 0x100000
+
+
+/* the top levels of a tree, flattened: for each node on the first level that
+ * is not kept (the frontier), the key its parent refers to it by and its
+ * block number; these are laid out exactly like the elems of a branch node,
+ * so that lookups can use branch_search on the index itself
+ *
+ * routing a key through the pinned levels lands on the same frontier node as
+ * searching the flattened keys for it, because each parent's key for a child
+ * is the child's first key (which is why buffered trees go without); writers
+ * bump the generation whenever they may have changed a branch, and an index is
+ * only used while the generation it was built at is still current */
+struct tree_index {
+	uint32_t root_addr;
+	
+	pthread_rwlock_t lock;
+	
+	uint64_t gen;
+	uint64_t built_gen;
+	
+	uint8_t  levels;
+	node_ptr frontier;
+	
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t rebuilds;
+};
+
+/* a level of the tree while it is being gathered */
+struct tree_index_level {
+	uint32_t cnt;
+	uint32_t cap;
+	
+	uint64_t *key_hi;
+	uint8_t  *key_lo;
+	uint32_t *addr;
+};
+
+
+static pthread_mutex_t index_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct tree_index index_tbl[TREE_INDEX_SLOTS];
+
+
+/// @brief finds the index slot for a tree, optionally claiming one for it
+/// @param[in] root_addr  block number of root node
+/// @param[in] create     claim a slot if the tree doesn't have one yet
+/// @return pointer to slot, or NULL if indexing is off or there is no slot
+static struct tree_index *tree_index_get(uint32_t root_addr, bool create) {
+	if (fs.mount_opt.index_levels == 0) {
+		return NULL;
+	}
+	
+	/* fibonacci hashing, then linear probing; slots are never given back
+	 * while the filesystem is up, so a lookup can stop at the first free one */
+	uint32_t start = (root_addr * UINT32_C(2654435769)) >> 25;
+	for (uint32_t i = 0; i < TREE_INDEX_SLOTS; ++i) {
+		struct tree_index *index =
+			index_tbl + ((start + i) % TREE_INDEX_SLOTS);
+		
+		uint32_t addr = __atomic_load_n(&index->root_addr, __ATOMIC_ACQUIRE);
+		if (addr == root_addr) {
+			return index;
+		} else if (addr != 0) {
+			continue;
+		}
+		
+		if (!create) {
+			return NULL;
+		}
+		
+		pthread_mutex_lock(&index_lock);
+		
+		/* someone may have claimed this slot in the meantime */
+		addr = index->root_addr;
+		if (addr == 0) {
+			pthread_rwlock_init(&index->lock, NULL);
+			
+			index->gen       = 0;
+			index->built_gen = 0;
+			index->levels    = 0;
+			index->frontier  = NULL;
+			index->hits      = 0;
+			index->misses    = 0;
+			index->rebuilds  = 0;
+			
+			__atomic_store_n(&index->root_addr, root_addr, __ATOMIC_RELEASE);
+			addr = root_addr;
+		}
+		
+		pthread_mutex_unlock(&index_lock);
+		
+		if (addr == root_addr) {
+			return index;
+		}
+	}
+	
+	if (create) {
+		warnx("%s: no index slots left: root 0x%" PRIx32, __func__, root_addr);
+	}
+	return NULL;
+}
+
+/// @brief appends a ref to a level being gathered
+/// @param[in] level  pointer to level
+/// @param[in] hi     high part of normalized key
+/// @param[in] lo     low part of normalized key
+/// @param[in] addr   block number of node
+static void tree_index_level_add(struct tree_index_level *level, uint64_t hi,
+	uint8_t lo, uint32_t addr) {
+	if (level->cnt == level->cap) {
+		level->cap = (level->cap != 0 ? level->cap * 2 : 64);
+		
+		level->key_hi = realloc(level->key_hi, level->cap * sizeof(uint64_t));
+		level->key_lo = realloc(level->key_lo, level->cap * sizeof(uint8_t));
+		level->addr   = realloc(level->addr, level->cap * sizeof(uint32_t));
+	}
+	
+	level->key_hi[level->cnt] = hi;
+	level->key_lo[level->cnt] = lo;
+	level->addr[level->cnt]   = addr;
+	++level->cnt;
+}
+
+static void tree_index_level_free(struct tree_index_level *level) {
+	free(level->key_hi);
+	free(level->key_lo);
+	free(level->addr);
+	
+	*level = (struct tree_index_level){ 0 };
+}
+
+/// @brief gathers the refs held by every node on one level of a tree, which
+/// make up the level below it
+/// @param[in]  level  nodes on this level
+/// @param[out] below  nodes on the next level down
+/// @return false if this level is made of leaves, or the next level down has
+/// too many nodes to keep
+static bool tree_index_descend(const struct tree_index_level *level,
+	struct tree_index_level *below) {
+	for (uint32_t i = 0; i < level->cnt; ++i) {
+		uint32_t node_addr = level->addr[i];
+		node_latch(node_addr, false);
+		
+		node_ptr node = node_map(node_addr, false);
+		bool leaf = node->hdr.leaf;
+		bool fits = (below->cnt + node->hdr.cnt <= TREE_INDEX_ELEM_MAX);
+		
+		if (!leaf && fits) {
+			const uint64_t *key_hi = branch_key_hi(node);
+			const uint8_t  *key_lo = branch_key_lo(node);
+			const uint32_t *addr   = branch_addr(node);
+			
+			for (uint32_t j = 0; j < node->hdr.cnt; ++j) {
+				tree_index_level_add(below, key_hi[j], key_lo[j], addr[j]);
+			}
+		}
+		
+		node_unmap(node);
+		node_unlatch(node_addr, false);
+		
+		if (leaf || !fits) {
+			return false;
+		}
+	}
+	
+	return true;
+}
+
+/// @brief rebuilds a tree's index from its current top levels; each node is
+/// only latched while it is being read, so the result is consistent only if
+/// the generation hasn't moved by the time it is used
+/// @param[in] index  pointer to index slot, write-locked by the caller
+static void tree_index_build(struct tree_index *index) {
+	uint64_t gen = __atomic_load_n(&index->gen, __ATOMIC_ACQUIRE);
+	
+	/* the root by itself: its key is never compared against */
+	struct tree_index_level level = { 0 };
+	tree_index_level_add(&level, 0, 0, index->root_addr);
+	
+	uint8_t levels = 0;
+	while (levels < fs.mount_opt.index_levels) {
+		struct tree_index_level below = { 0 };
+		
+		if (!tree_index_descend(&level, &below)) {
+			tree_index_level_free(&below);
+			break;
+		}
+		
+		tree_index_level_free(&level);
+		level = below;
+		
+		++levels;
+	}
+	
+	uint32_t size_blk = BYTE_TO_BLK(BRANCH_ARR_OFF +
+		(level.cnt * sizeof(node_ref)));
+	
+	node_ptr frontier = realloc(index->frontier, BLK_TO_BYTE(size_blk));
+	memset(frontier, 0, sizeof(struct node_hdr));
+	
+	frontier->hdr.leaf     = false;
+	frontier->hdr.cnt      = level.cnt;
+	frontier->hdr.this     = index->root_addr;
+	frontier->hdr.size_blk = size_blk;
+	
+	memcpy(branch_key_hi(frontier), level.key_hi,
+		level.cnt * sizeof(uint64_t));
+	memcpy(branch_key_lo(frontier), level.key_lo,
+		level.cnt * sizeof(uint8_t));
+	memcpy(branch_addr(frontier), level.addr, level.cnt * sizeof(uint32_t));
+	
+	tree_index_level_free(&level);
+	
+	index->frontier  = frontier;
+	index->levels    = levels;
+	index->built_gen = gen;
+	
+	__atomic_add_fetch(&index->rebuilds, 1, __ATOMIC_RELAXED);
+}
+
+/// @brief finds the node on a tree's index frontier that a descent for a key
+/// can start from, instead of the root; the index is rebuilt first if the tree
+/// has been restructured since it was last built
+/// @param[in]  root_addr  block number of root node
+/// @param[in]  key        key to search for
+/// @param[out] gen        generation to pass to tree_index_valid later
+/// @return block number of node to start at; the root itself if there is no
+/// usable index, in which case the generation need not be checked
+uint32_t tree_index_find(uint32_t root_addr, const key *key, uint64_t *gen) {
+	/* a buffered tree's parent keys don't have to be its children's first
+	 * keys, and a descent that starts below the root would miss the messages
+	 * buffered above it */
+	if (tree_buffered(root_addr)) {
+		return root_addr;
+	}
+	
+	struct tree_index *index = tree_index_get(root_addr, true);
+	if (index == NULL) {
+		return root_addr;
+	}
+	
+	/* lookups never wait on the index: if it is being rebuilt, or a rebuild
+	 * would have to wait on lookups, they go through the root instead */
+	for (uint8_t try = 0; try < 2; ++try) {
+		*gen = __atomic_load_n(&index->gen, __ATOMIC_ACQUIRE);
+		
+		if (pthread_rwlock_tryrdlock(&index->lock) != 0) {
+			break;
+		}
+		
+		if (index->frontier != NULL && index->built_gen == *gen) {
+			uint32_t node_addr = branch_search(index->frontier, key);
+			pthread_rwlock_unlock(&index->lock);
+			
+			__atomic_add_fetch(&index->hits, 1, __ATOMIC_RELAXED);
+			return node_addr;
+		}
+		
+		pthread_rwlock_unlock(&index->lock);
+		
+		if (try != 0 || pthread_rwlock_trywrlock(&index->lock) != 0) {
+			break;
+		}
+		
+		/* another thread may have rebuilt it already */
+		if (index->frontier == NULL || index->built_gen !=
+			__atomic_load_n(&index->gen, __ATOMIC_ACQUIRE)) {
+			tree_index_build(index);
+		}
+		
+		pthread_rwlock_unlock(&index->lock);
+	}
+	
+	__atomic_add_fetch(&index->misses, 1, __ATOMIC_RELAXED);
+	return root_addr;
+}
+
+/// @brief determines whether a node found with tree_index_find is still the
+/// right place to start; this must be called after the node has been latched,
+/// or after its version has been recorded
+/// @param[in] root_addr  block number of root node
+/// @param[in] gen        generation from tree_index_find
+/// @return false if the tree may have been restructured in the meantime
+bool tree_index_valid(uint32_t root_addr, uint64_t gen) {
+	struct tree_index *index = tree_index_get(root_addr, false);
+	
+	return (index != NULL &&
+		__atomic_load_n(&index->gen, __ATOMIC_ACQUIRE) == gen);
+}
+
+/// @brief invalidates a tree's index after one or more of its branches may
+/// have changed; this must be called before the changed nodes are unlatched
+/// @param[in] root_addr  block number of root node
+void tree_index_bump(uint32_t root_addr) {
+	struct tree_index *index = tree_index_get(root_addr, false);
+	if (index != NULL) {
+		__atomic_add_fetch(&index->gen, 1, __ATOMIC_SEQ_CST);
+	}
+}
+
+/// @brief reports on a tree's index
+/// @param[in] root_addr  block number of root node
+/// @return index statistics; all zero if the tree has no index
+struct tree_index_stats tree_index_stats(uint32_t root_addr) {
+	struct tree_index_stats stats = { 0 };
+	
+	struct tree_index *index = tree_index_get(root_addr, false);
+	if (index == NULL) {
+		return stats;
+	}
+	
+	pthread_rwlock_rdlock(&index->lock);
+	
+	if (index->frontier != NULL) {
+		stats.levels    = index->levels;
+		stats.nodes     = index->frontier->hdr.cnt;
+		stats.footprint = sizeof(struct tree_index) +
+			node_size_byte(index->frontier);
+	}
+	
+	pthread_rwlock_unlock(&index->lock);
+	
+	stats.hits     = __atomic_load_n(&index->hits, __ATOMIC_RELAXED);
+	stats.misses   = __atomic_load_n(&index->misses, __ATOMIC_RELAXED);
+	stats.rebuilds = __atomic_load_n(&index->rebuilds, __ATOMIC_RELAXED);
+	
+	return stats;
+}
+
+/// @brief throws away every tree's index; only for when the filesystem is
+/// going away and nothing else is running
+void tree_index_done(void) {
+	for (uint32_t i = 0; i < TREE_INDEX_SLOTS; ++i) {
+		struct tree_index *index = index_tbl + i;
+		
+		if (index->root_addr != 0) {
+			free(index->frontier);
+			pthread_rwlock_destroy(&index->lock);
+			
+			index->root_addr = 0;
+			index->frontier  = NULL;
+		}
+	}
+}
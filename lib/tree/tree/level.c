@@ -0,0 +1,150 @@
+/* jgfs2
+ * (c) 2013 Justin Gottula
+ * The source code of this project is distributed under the terms of the
+ * simplified BSD license. See the LICENSE file for details.
+ */
+
+
+#include "../tree.h"
+#include "../../debug.h"
+#include "../../extent.h"
+
+
+/* every node is linked to its left and right neighbors on the same level,
+ * whether or not they share a parent, so a level can be walked from its
+ * leftmost node without going back through the levels above it; each node is
+ * only latched long enough to read its link, so a walk that runs alongside
+ * writers may miss nodes that split off behind it */
+
+
+/// @brief counts the levels in a tree
+/// @param[in] root_addr  block number of root node
+/// @return number of levels, including the root's and the leaves'
+uint8_t tree_depth(uint32_t root_addr) {
+	ASSERT_ROOT(root_addr);
+	
+	uint8_t depth = 1;
+	uint32_t node_addr = root_addr;
+	
+	node_latch(node_addr, false);
+	node_ptr node = node_map(node_addr, false);
+	
+	while (!node->hdr.leaf) {
+		if (depth == TREE_MAX_DEPTH) {
+			errx("%s: tree too deep: root 0x%" PRIx32,
+				__func__, root_addr);
+		}
+		
+		uint32_t child_addr = branch_addr(node)[0];
+		node_latch(child_addr, false);
+		
+		node_unmap(node);
+		node_unlatch(node_addr, false);
+		
+		node_addr = child_addr;
+		node = node_map(node_addr, false);
+		
+		++depth;
+	}
+	
+	node_unmap(node);
+	node_unlatch(node_addr, false);
+	
+	return depth;
+}
+
+/// @brief finds the leftmost node on one level of a tree
+/// @param[in] root_addr  block number of root node
+/// @param[in] level      level to look on; the root's is 0
+/// @return block number of node, or 0 if the tree has no such level
+uint32_t tree_level_first(uint32_t root_addr, uint8_t level) {
+	ASSERT_ROOT(root_addr);
+	
+	uint32_t node_addr = root_addr;
+	
+	node_latch(node_addr, false);
+	node_ptr node = node_map(node_addr, false);
+	
+	uint8_t i = 0;
+	while (i < level && !node->hdr.leaf) {
+		uint32_t child_addr = branch_addr(node)[0];
+		node_latch(child_addr, false);
+		
+		node_unmap(node);
+		node_unlatch(node_addr, false);
+		
+		node_addr = child_addr;
+		node = node_map(node_addr, false);
+		
+		++i;
+	}
+	
+	node_unmap(node);
+	node_unlatch(node_addr, false);
+	
+	return (i == level ? node_addr : 0);
+}
+
+/// @brief finds the node to the right of another one on the same level
+/// @param[in] node_addr  block number of node
+/// @return block number of right sibling, or 0 if the node is the last one on
+/// its level
+uint32_t tree_level_next(uint32_t node_addr) {
+	node_latch(node_addr, false);
+	node_ptr node = node_map(node_addr, false);
+	
+	uint32_t next_addr = node->hdr.next;
+	
+	node_unmap(node);
+	node_unlatch(node_addr, false);
+	
+	return next_addr;
+}
+
+/// @brief reports every extent a tree takes up: each of its nodes, and each
+/// overflow extent that an item in it (or a message on its way down) refers
+/// to; the tree must not change while this is going on
+/// @param[in] root_addr  block number of root node
+/// @param[in] func       called for each extent
+/// @param[in] arg        passed along to func
+void tree_blk_walk(uint32_t root_addr, tree_blk_func func, void *arg) {
+	uint8_t depth = tree_depth(root_addr);
+	
+	for (uint8_t level = 0; level < depth; ++level) {
+		uint32_t node_addr = tree_level_first(root_addr, level);
+		while (node_addr != 0) {
+			node_ptr node = node_map(node_addr, false);
+			
+			func(node_addr, node_size_blk(node), EXT_TYPE_META, arg);
+			
+			if (!node->hdr.leaf && (node->hdr.flags & NODE_BUFFERED)) {
+				uint32_t off = 0;
+				while (off < node->hdr.buf_used) {
+					const struct buf_msg *msg =
+						(const struct buf_msg *)(branch_buf(node) + off);
+					
+					if (msg->ovf) {
+						const struct item_ovf *ovf = (const void *)msg->data;
+						func(ovf->addr, BYTE_TO_BLK(ovf->len), EXT_TYPE_DATA,
+							arg);
+					}
+					
+					off += buf_msg_size(msg);
+				}
+			}
+			
+			if (node->hdr.leaf) {
+				for (uint32_t i = 0; i < node->hdr.cnt; ++i) {
+					if (leaf_loc(node, i)->ovf) {
+						const struct item_ovf *ovf = leaf_elem_data(node, i);
+						func(ovf->addr, BYTE_TO_BLK(ovf->len), EXT_TYPE_DATA,
+							arg);
+					}
+				}
+			}
+			
+			node_addr = node->hdr.next;
+			node_unmap(node);
+		}
+	}
+}
@@ -9,39 +9,15 @@
 #include "../../debug.h"
 
 
-struct tree_lock_node *lock_list = NULL;
-
+/* inserts, removals and searches latch nodes individually as they descend
+ * (see tree/modify.c), so holding the root only excludes operations that have
+ * not yet made it past the root; these are for whole-tree operations like
+ * tree_init that run while no other operations are in flight */
 
 void tree_lock(uint32_t root_addr) {
-	struct tree_lock_node *node = lock_list;
-	while (node != NULL) {
-		if (node->root_addr == root_addr) {
-			errx("%s: tree 0x%" PRIx32 " already locked", __func__, root_addr);
-		}
-		
-		node = node->next;
-	}
-	
-	struct tree_lock_node *new = malloc(sizeof(struct tree_lock_node));
-	new->next = lock_list;
-	lock_list = new;
-	
-	new->root_addr = root_addr;
+	node_latch(root_addr, true);
 }
 
 void tree_unlock(uint32_t root_addr) {
-	struct tree_lock_node **prev = &lock_list, *node = lock_list;
-	while (node != NULL) {
-		if (node->root_addr == root_addr) {
-			*prev = node->next;
-			free(node);
-			
-			return;
-		}
-		
-		prev = &node->next;
-		node = node->next;
-	}
-	
-	errx("%s: tree 0x%" PRIx32 " was not locked", __func__, root_addr);
+	node_unlatch(root_addr, true);
 }
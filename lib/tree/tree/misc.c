@@ -9,14 +9,88 @@
 #include "../../debug.h"
 
 
-void tree_init(uint32_t root_addr) {
+/* trees whose flavor is remembered at once; collisions just evict */
+#define TREE_FLAVOR_SLOTS 64
+
+
+/* a tree's flags never change after tree_init, and every insert and lookup
+ * needs them, so they are remembered instead of being read off the root each
+ * time; each slot packs the root's block number, a valid bit and the flags
+ * into one word, so that it can be read and written without a lock */
+static uint64_t flavor_tbl[TREE_FLAVOR_SLOTS];
+
+
+/// @brief finds the slot a tree's flags are remembered in
+/// @param[in] root_addr  block number of root node
+/// @return pointer to slot
+static uint64_t *tree_flavor_slot(uint32_t root_addr) {
+	return flavor_tbl + ((root_addr * UINT32_C(2654435769)) >> 26);
+}
+
+/// @brief remembers a tree's flags
+/// @param[in] root_addr  block number of root node
+/// @param[in] flags      tree flavor (enum node_flag)
+static void tree_flavor_set(uint32_t root_addr, uint8_t flags) {
+	__atomic_store_n(tree_flavor_slot(root_addr),
+		((uint64_t)root_addr << 32) | 0x100 | flags, __ATOMIC_RELAXED);
+}
+
+/// @brief sets up an empty tree
+/// @param[in] root_addr  block number of root node
+/// @param[in] size_blk   size in blocks of every node in the tree
+/// @param[in] flags      tree flavor (enum node_flag)
+void tree_init(uint32_t root_addr, uint32_t size_blk, uint8_t flags) {
 	tree_lock(root_addr);
-	node_unmap(node_init(root_addr, true, 0, 0, 0));
+	
+	node_ptr root = node_init(root_addr, size_blk, true, flags, 0, 0, 0);
+	tree_stat_init(root);
+	node_unmap(root);
+	
+	tree_flavor_set(root_addr, flags);
+	tree_index_bump(root_addr);
 	tree_unlock(root_addr);
 }
 
-void tree_stat(uint32_t root_addr) {
-	ASSERT_ROOT(root_addr);
+/// @brief gets the node size of a tree, which is fixed when it is created
+/// @param[in] root_addr  block number of root node
+/// @return node size in bytes
+uint32_t tree_node_size(uint32_t root_addr) {
+	node_ptr root = node_map(root_addr, false);
+	uint32_t size = node_size_byte(root);
+	node_unmap(root);
+	
+	return size;
+}
+
+/// @brief determines whether a tree was created with message buffers in its
+/// branches
+/// @param[in] root_addr  block number of root node
+/// @return true if the tree is buffered
+bool tree_buffered(uint32_t root_addr) {
+	uint64_t slot = __atomic_load_n(tree_flavor_slot(root_addr),
+		__ATOMIC_RELAXED);
+	
+	uint8_t flags;
+	if ((slot >> 32) == root_addr && (slot & 0x100)) {
+		flags = (uint8_t)slot;
+	} else {
+		node_ptr root = node_map(root_addr, false);
+		flags = root->hdr.flags;
+		node_unmap(root);
+		
+		tree_flavor_set(root_addr, flags);
+	}
+	
+	return (flags & NODE_BUFFERED);
+}
+
+/// @brief forgets everything kept in memory about every tree; only for when
+/// the filesystem is going away and nothing else is running
+void tree_done(void) {
+	tree_txn_done();
+	tree_stat_done();
+	tree_index_done();
+	tree_search_done();
 	
-	TODO("implement this");
+	memset(flavor_tbl, 0, sizeof(flavor_tbl));
 }
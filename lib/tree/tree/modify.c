@@ -6,251 +6,339 @@
 
 
 #include "../tree.h"
+#include <sched.h>
+#include "../check.h"
 #include "../../debug.h"
 
 
-static bool tree_insert_sibling(node_ptr node, uint32_t space_needed,
-	const key *key, union elem_payload payload) {
-	bool result = false;
-	
-	/* do the siblings even exist? */
-	bool prev_exist = (node->hdr.prev != 0);
-	bool next_exist = (node->hdr.next != 0);
-	if (!prev_exist && !next_exist) {
+/* nodes latched exclusively on the way down, root first; nodes before index
+ * 'first' have already been released */
+struct tree_path {
+	uint8_t  depth;
+	uint8_t  first;
+	node_ptr nodes[TREE_MAX_DEPTH];
+};
+
+
+/// @brief determines whether inserting into a node can be kept from affecting
+/// its ancestors, i.e. it will neither split nor get a new first key
+/// @param[in] node          pointer to node
+/// @param[in] key       key being inserted
+/// @param[in] data_len  length of the new item's data
+/// @return true if the ancestors can be released
+static bool tree_safe_insert(const node_ptr node, const key *key,
+	uint32_t data_len) {
+	if (node->hdr.cnt == 0 || node_key_cmp(node, 0, key) >= 0) {
 		return false;
 	}
 	
-	/* sibling node pointers */
-	node_ptr prev = (prev_exist ? node_map(node->hdr.prev, true) : NULL);
-	node_ptr next = (next_exist ? node_map(node->hdr.next, true) : NULL);
-	
-	/* room available in siblings */
-	uint32_t free_prev = (prev_exist ? node_free(prev) : 0);
-	uint32_t free_next = (next_exist ? node_free(next) : 0);
-	
-	if (free_prev + free_next < space_needed) {
-		goto done;
+	return (node_free(node) >= node_insert_cost(node, key, data_len));
+}
+
+/// @brief determines whether removing from a node can be kept from affecting
+/// its ancestors, i.e. it will neither empty out nor lose its first key
+/// @param[in] node  pointer to node
+/// @param[in] key   key being removed
+/// @return true if the ancestors can be released
+static bool tree_safe_remove(const node_ptr node, const key *key) {
+	if (node->hdr.cnt < 2) {
+		return false;
 	}
 	
-	/* were we able to export to a sibling last time? */
-	bool prev_avail = prev_exist;
-	bool next_avail = next_exist;
-	
-	/* space made available by exporting to siblings */
-	uint32_t space_total = 0;
-	uint32_t space_prev  = 0;
-	uint32_t space_next  = 0;
-	
-	/* number of elems exported to siblings */
-	uint16_t cnt_prev = 0;
-	uint16_t cnt_next = 0;
+	if (node->hdr.leaf) {
+		return (node_key_cmp(node, 0, key) < 0);
+	} else {
+		return (node_key_cmp(node, 1, key) <= 0);
+	}
+}
+
+/// @brief unmaps and unlatches path nodes up to (but not including) an index
+/// @param[in] path  pointer to path
+/// @param[in] end   index of the first node to keep
+static void tree_path_release(struct tree_path *path, uint8_t end) {
+	while (path->first < end) {
+		node_ptr node = path->nodes[path->first++];
+		uint32_t node_addr = node->hdr.this;
+		
+		node_unmap(node);
+		node_unlatch(node_addr, true);
+	}
+}
+
+/// @brief releases everything left on a path once an insert or removal is
+/// done with it, invalidating the tree's index first if any branches may have
+/// changed
+/// @param[in] path       pointer to path
+/// @param[in] root_addr  block number of root node
+static void tree_path_finish(struct tree_path *path, uint32_t root_addr) {
+	/* ancestors are only kept when the leaf was unsafe, and a leaf that is
+	 * also the root becomes a branch when it splits */
+	node_ptr leaf = path->nodes[path->depth - 1];
+	if (path->first != path->depth - 1 || leaf->hdr.parent == 0) {
+		tree_index_bump(root_addr);
+	}
 	
-	/* indexes move inward toward the insertion point */
-	uint16_t idx_insert = node_search_hypo(node, key);
-	uint16_t idx_prev   = 0;
-	uint16_t idx_next   = node->hdr.cnt - 1;
-	do {
-		/* try whichever sibling has more space first; prefer prev if equal */
-		bool try_prev = (free_prev >= free_next ? true : false);
-		bool try_next = !try_prev;
-		for (uint8_t try = 2; try > 0; --try) {
-			if (try_prev && prev_avail) {
-				if (idx_prev < idx_insert) {
-					uint32_t size_this = node_elem_weight(node, idx_prev);
-					
-					if (size_this <= free_prev) {
-						free_prev   -= size_this;
-						space_total += size_this;
-						space_prev  += size_this;
-						
-						++cnt_prev;
-						
-						++idx_prev;
-					} else {
-						prev_avail = false;
-					}
-				} else {
-					prev_avail = false;
-				}
+	tree_path_release(path, path->depth);
+}
+
+/// @brief latches the siblings of every node that a removal will free: the
+/// leaf, if its last elem is going, and each ancestor that would be left
+/// without children in turn; all of them are still on the path, since none of
+/// them is safe
+/// @param[in]  path  pointer to path, ending at the leaf
+/// @param[out] sibs  block numbers of the siblings latched, leaf level first
+/// @return number of siblings latched, or -1 (with nothing latched) if one of
+/// them was busy
+static int tree_drop_latch(const struct tree_path *path,
+	uint32_t sibs[TREE_MAX_DEPTH * 2]) {
+	int cnt = 0;
+	
+	for (int i = path->depth - 1; i >= path->first; --i) {
+		node_ptr node = path->nodes[i];
+		if (node->hdr.cnt != 1 || node->hdr.parent == 0) {
+			break;
+		}
+		
+		/* descents latch from the top down, and the siblings are off to the
+		 * side of that, so waiting on either of them here could deadlock */
+		uint32_t addrs[2] = { node->hdr.prev, node->hdr.next };
+		for (uint8_t j = 0; j < 2; ++j) {
+			if (addrs[j] == 0) {
+				continue;
 			}
 			
-			if (next_avail) {
-				if (idx_next >= idx_insert) {
-					uint32_t size_this = node_elem_weight(node, idx_next);
-					
-					if (size_this <= free_next) {
-						free_next   -= size_this;
-						space_total += size_this;
-						space_next  += size_this;
-						
-						++cnt_next;
-						
-						--idx_next;
-					} else {
-						next_avail = false;
-					}
-				} else {
-					next_avail = false;
+			if (!node_try_latch(addrs[j], true)) {
+				while (cnt > 0) {
+					node_unlatch(sibs[--cnt], true);
 				}
+				
+				return -1;
 			}
 			
-			/* try the other sibling after this one */
-			try_prev = !try_prev;
-			try_next = !try_next;
+			sibs[cnt++] = addrs[j];
 		}
-	} while (space_total < space_needed && (prev_avail || next_avail));
-	
-	
-	// NOTE: the code from here on out needs some help.
-	
-	if (space_total < space_needed) {
-		goto done;
 	}
 	
-	
-	// NOTE: we are using 'space' for 'diff_data' and this is wrong: 'space'
-	// includes bytes used for the item_ref itself
-	
-	
-	/* number of elems remaining to the sides of the insertion point */
-	uint16_t cnt_rem_left  = (idx_insert - idx_prev);
-	uint16_t cnt_rem_right = (idx_next - idx_insert) + 1;
-	
-	if (cnt_prev > 0) {
-		/* append to prev node */
-		node_append_multiple(prev, node, 0, cnt_prev, space_prev);
+	return cnt;
+}
+
+/// @brief latches everything outside of the path that the splits an insert
+/// sets off will change: the right sibling of each node that splits, whose
+/// prev field is pointed at the new node, and the children of each branch
+/// that splits, whose parent fields may move to the new node; this happens
+/// before anything is changed, so that the insert can still back off if
+/// someone else has one of them
+/// @param[in]  path      pointer to path, ending at the leaf
+/// @param[in]  key       key being inserted
+/// @param[in]  data_len  length of the new item's data
+/// @param[out] sides     block numbers of the nodes latched (to be freed by
+/// the caller), or NULL if there are none
+/// @return number of nodes latched, or -1 (with nothing latched) if one of
+/// them was busy
+static int tree_split_latch(const struct tree_path *path, const key *key,
+	uint32_t data_len, uint32_t **sides) {
+	*sides = NULL;
+	uint32_t cnt = 0;
+	
+	for (int i = path->depth - 1; i >= path->first; --i) {
+		node_ptr node = path->nodes[i];
 		
-		/* shift remaining elems before the insertion point */
-		if (cnt_rem_left != 0) {
-			node_shift_backward(node, idx_prev, idx_insert - 1, cnt_prev,
-				space_prev);
+		/* a branch only splits if the ref to a new node below doesn't fit */
+		uint32_t len = (node->hdr.leaf ? data_len : 0);
+		if (node_free(node) >= node_insert_cost(node, key, len)) {
+			break;
 		}
 		
-		// TODO: update this node's parent ref
+		uint32_t add = 1 + (node->hdr.leaf ? 0 : node->hdr.cnt);
+		*sides = realloc(*sides, (cnt + add) * sizeof(**sides));
+		
+		if (node->hdr.next != 0) {
+			(*sides)[cnt++] = node->hdr.next;
+		}
+		if (!node->hdr.leaf) {
+			memcpy(*sides + cnt, branch_addr(node),
+				node->hdr.cnt * sizeof(**sides));
+			cnt += node->hdr.cnt;
+		}
+	}
+	
+	/* as in tree_drop_latch, none of these are in the order descents latch
+	 * in, so they can't be waited on; the path's own nodes are among the
+	 * children, which is fine, since latches held exclusively nest */
+	for (uint32_t i = 0; i < cnt; ++i) {
+		if (!node_try_latch((*sides)[i], true)) {
+			while (i > 0) {
+				node_unlatch((*sides)[--i], true);
+			}
+			
+			free(*sides);
+			*sides = NULL;
+			
+			return -1;
+		}
 	}
-	if (cnt_next > 0) {
-		/* prepend to next node */
-		node_prepend_multiple(next, node, idx_next + 1, cnt_next,
-			space_next);
+	
+	return cnt;
+}
+
+/// @brief descends to the leaf for a key by latch crabbing: every node is
+/// latched exclusively, and all of its ancestors are released as soon as it
+/// is known that the operation can't propagate past it; the nodes left on the
+/// path are mapped writable
+/// @param[out] path       path of latched nodes; the leaf is the last one
+/// @param[in]  root_addr  block number of root node
+/// @param[in]  key        key being inserted or removed
+/// @param[in]  insert     true for an insert, false for a removal
+/// @param[in]  data_len   length of the new item's data (inserts only)
+static void tree_descend(struct tree_path *path, uint32_t root_addr,
+	const key *key, bool insert, uint32_t data_len) {
+	path->depth = 0;
+	path->first = 0;
+	
+	check_op_begin();
+	
+	uint32_t node_addr = root_addr;
+	for ( ; ; ) {
+		if (path->depth == TREE_MAX_DEPTH) {
+			errx("%s: tree too deep: root 0x%" PRIx32 " key %s",
+				__func__, root_addr, key_str(key));
+		}
 		
-		// WHAT IF: cnt_prev == 0 and we would insert into index 0??
+		node_latch(node_addr, true);
+		node_ptr node = node_map(node_addr, false);
+		path->nodes[path->depth++] = node;
 		
-		/* shift remaining elems after the insertion point, leaving space
-		 * for the item to be inserted */
-		if (cnt_rem_right != 0 && cnt_prev > 1) {
-			node_shift_backward(node, idx_insert, idx_next, cnt_prev - 1,
-				space_next);
+		check_visit(node, node_addr, true);
+		
+		bool safe = (insert ? tree_safe_insert(node, key, data_len) :
+			tree_safe_remove(node, key));
+		if (safe) {
+			tree_path_release(path, path->depth - 1);
 		}
 		
+		if (node->hdr.leaf) {
+			break;
+		}
 		
-		// TODO: update next node's parent ref
+		node_addr = branch_search(node, key);
 	}
 	
-	
-	// zero?
-	
-	// put key in
-	
-	// update this cnt
-	
-	// fill in data
-	
-	result = true;
-	
-done:
-	/* unmap sibling node pointers */
-	prev_exist ? node_unmap(prev) : (void)0;
-	next_exist ? node_unmap(next) : (void)0;
-	
-	return result;
+	/* only the nodes that are kept can change, so only they are mapped
+	 * writable; lookups without latches back off from any node that is */
+	for (uint8_t i = path->first; i < path->depth; ++i) {
+		node_addr = path->nodes[i]->hdr.this;
+		
+		node_unmap(path->nodes[i]);
+		path->nodes[i] = node_map(node_addr, true);
+	}
 }
 
-static bool tree_insert_normal(node_ptr node, uint32_t space_needed,
-	const key *key, union elem_payload payload) {
-	if (node_free(node) < space_needed) {
-		return false;
-	}
+void tree_insert(uint32_t root_addr, const key *key, struct item_data item) {
+	ASSERT_ROOT(root_addr);
 	
-	uint16_t idx_insert = node_search_hypo(node, key);
-	if (idx_insert < node->hdr.cnt) {
-		uint32_t diff_data = (node->hdr.leaf ? payload.l_item.len : 0);
-		node_shift_forward(node, idx_insert, node->hdr.cnt - 1, 1, diff_data);
+	/* big items are written out before taking any latches, and the leaf only
+	 * gets a fixed-size reference to them */
+	struct item_ovf ovf;
+	if (item.len > tree_inline_max(root_addr)) {
+		item = tree_ovf_store(item, &ovf);
 	}
 	
-	++node->hdr.cnt;
-	node_elem_fill(node, idx_insert, key, payload);
-	
-	if (idx_insert == 0) {
-		node_update_ref_in_parent(node);
+	if (tree_buffered(root_addr)) {
+		tree_buf_insert(root_addr, key, item);
+		tree_stat_commit(root_addr);
+		
+		return;
 	}
 	
-	return true;
-}
-
-static void tree_insert_r(uint32_t root_addr, uint32_t node_addr,
-	const key *key, union elem_payload payload) {
-	node_ptr node = node_map(node_addr, true);
-	
-	uint32_t space_needed;
-	if (node->hdr.leaf) {
-		space_needed = sizeof(item_ref) + payload.l_item.len;
-	} else {
-		space_needed = sizeof(node_ref);
-	}
+	struct tree_path path;
 	
-	/* try normal and sibling-export inserts, then split if both fail */
-	if (!tree_insert_normal(node, space_needed, key, payload) &&
-		!tree_insert_sibling(node, space_needed, key, payload)) {
-		errx("not done yet");
-		// use node_ptr * so that the split functions can reassign the ptr
+	uint32_t *sides;
+	int side_cnt;
+	for ( ; ; ) {
+		tree_descend(&path, root_addr, key, true, item.len);
 		
-		// if have neighbors, pick the one with more junk (or next if equal)
-		//  and do a 2->3 split
-		// if no neighbors, do a normal btree split (rightward)
+		/* back off and start over if a sibling or child is busy */
+		if ((side_cnt = tree_split_latch(&path, key, item.len, &sides)) >= 0) {
+			break;
+		}
 		
-		// split will return ptr to node with key
-		// if leaf, need to set elem data
+		tree_path_release(&path, path.depth);
+		sched_yield();
 	}
 	
-	node_unmap(node);
-}
-
-void tree_insert(uint32_t root_addr, const key *key, struct item_data item) {
-	ASSERT_ROOT(root_addr);
-	tree_lock(root_addr);
+	node_ptr leaf = path.nodes[path.depth - 1];
+	union elem_payload payload = {
+		.l_item = item,
+	};
 	
-	if (item.len * 10 >= node_size_usable()) {
-		warnx("%s: item len >= 10%% of node size: root 0x%" PRIx32
-			" key %s len %" PRIu32,
-			__func__, root_addr, key_str(key), item.len);
+	/* a full leaf always splits; moving elems to a sibling isn't implemented */
+	if (!node_insert(leaf, key, payload)) {
+		tree_split_single(leaf, key, payload);
 	}
 	
-	node_ptr leaf = tree_search(root_addr, key);
-	uint32_t leaf_addr = leaf->hdr.this;
-	tree_insert_r(root_addr, leaf_addr, key, (union elem_payload){
-		.l_item = item,
-	});
-	node_unmap(leaf);
+	tree_stat_item_add(item);
+	tree_stat_fill(leaf);
+	
+	while (side_cnt > 0) {
+		node_unlatch(sides[--side_cnt], true);
+	}
+	free(sides);
 	
-	tree_unlock(root_addr);
+	tree_path_finish(&path, root_addr);
+	tree_stat_commit(root_addr);
 }
 
-void tree_remove(uint32_t root_addr, const key *key) {
+bool tree_remove(uint32_t root_addr, const key *key) {
 	ASSERT_ROOT(root_addr);
-	tree_lock(root_addr);
-	
 	
+	if (tree_buffered(root_addr)) {
+		bool result = tree_buf_remove(root_addr, key);
+		tree_stat_commit(root_addr);
+		
+		return result;
+	}
 	
-	// condition for merging nodes: "if it's possible to do, then do it"
-	// it may be hard to determine if the node sweep is compressible
-	//  ALL sweeps that are dense (have too many bytes to possibly fit into n-1
-	//   nodes) can immediately be disregarded as incompressible
-	//  sweeps that are not dense, but are compressible, will take a little work
+	bool result = false;
+	struct tree_path path;
 	
-	// even easier: for branch merges, the compressibility criterion is trivial
+retry:
+	tree_descend(&path, root_addr, key, false, 0);
 	
-	// do 3->2 merge if possible
+	node_ptr leaf = path.nodes[path.depth - 1];
+	uint32_t idx;
+	if (node_search(leaf, key, &idx)) {
+		bool drop = (leaf->hdr.cnt == 1 && leaf->hdr.parent != 0);
+		
+		/* back off and start over if a sibling is busy */
+		uint32_t sibs[TREE_MAX_DEPTH * 2];
+		int sib_cnt = tree_drop_latch(&path, sibs);
+		if (sib_cnt < 0) {
+			tree_path_release(&path, path.depth);
+			sched_yield();
+			
+			goto retry;
+		}
+		
+		tree_stat_item_del(leaf, idx);
+		tree_ovf_free(leaf, idx);
+		node_remove(leaf, idx);
+		
+		if (drop) {
+			tree_drop_empty(leaf);
+		} else {
+			tree_stat_fill(leaf);
+		}
+		
+		while (sib_cnt > 0) {
+			node_unlatch(sibs[--sib_cnt], true);
+		}
+		
+		/* merges aren't implemented; nodes are only freed once they're empty */
+		result = true;
+	}
 	
+	tree_path_finish(&path, root_addr);
+	tree_stat_commit(root_addr);
 	
-	tree_unlock(root_addr);
+	return result;
 }
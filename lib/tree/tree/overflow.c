@@ -0,0 +1,100 @@
+/* jgfs2
+ * (c) 2013 Justin Gottula
+ * The source code of this project is distributed under the terms of the
+ * simplified BSD license. See the LICENSE file for details.
+ */
+
+
+#include "../tree.h"
+#include "../../debug.h"
+#include "../../extent.h"
+
+
+/// @brief determines the largest item that is kept inline in a leaf; anything
+/// bigger goes to an overflow extent, so that no one item can take up enough
+/// of a leaf to throw off splitting; the limit goes by the whole node, so that
+/// it doesn't move whenever the node header grows
+/// @param[in] root_addr  block number of root node
+/// @return max inline item length in bytes
+uint32_t tree_inline_max(uint32_t root_addr) {
+	return tree_node_size(root_addr) / 10;
+}
+
+/// @brief writes the data of an oversized item out to a newly allocated
+/// overflow extent
+/// @param[in]  item  item to store
+/// @param[out] ovf   reference to the overflow extent
+/// @return item data to put in the leaf in place of the original
+struct item_data tree_ovf_store(struct item_data item, struct item_ovf *ovf) {
+	uint32_t blk_cnt = BYTE_TO_BLK(item.len);
+	
+	ovf->addr = ext_alloc(blk_cnt, EXT_TYPE_DATA, 0);
+	ovf->len  = item.len;
+	
+	tree_stat_ovf(blk_cnt);
+	
+	uint8_t *ext = fs_map_blk(ovf->addr, blk_cnt, true);
+	
+	memcpy(ext, item.data, item.len);
+	memset(ext + item.len, 0, BLK_TO_BYTE(blk_cnt) - item.len);
+	
+	fs_msync_blk(ext, ovf->addr, blk_cnt, true);
+	fs_unmap_blk(ext, ovf->addr, blk_cnt);
+	
+	return (struct item_data){
+		.len  = sizeof(struct item_ovf),
+		.data = ovf,
+		.ovf  = true,
+	};
+}
+
+/// @brief frees the overflow extent of a leaf elem, if it has one
+/// @param[in] leaf  pointer to leaf node
+/// @param[in] idx   elem index
+void tree_ovf_free(const node_ptr leaf, uint32_t idx) {
+	if (!leaf_loc(leaf, idx)->ovf) {
+		return;
+	}
+	
+	const struct item_ovf *ovf = leaf_elem_data(leaf, idx);
+	ext_dealloc(ovf->addr, BYTE_TO_BLK(ovf->len));
+	
+	tree_stat_ovf(-(int64_t)BYTE_TO_BLK(ovf->len));
+}
+
+/// @brief copies out the data held in an overflow extent
+/// @param[in]  ovf  reference to the overflow extent
+/// @param[out] buf  buffer of at least ovf->len bytes
+void tree_ovf_read(const struct item_ovf *ovf, void *buf) {
+	uint32_t blk_cnt = BYTE_TO_BLK(ovf->len);
+	
+	const uint8_t *ext = fs_map_blk(ovf->addr, blk_cnt, false);
+	memcpy(buf, ext, ovf->len);
+	fs_unmap_blk((void *)ext, ovf->addr, blk_cnt);
+}
+
+/// @brief gets the real length of a leaf elem's data, wherever it is stored
+/// @param[in] leaf  pointer to leaf node
+/// @param[in] idx   elem index
+/// @return data length in bytes
+uint32_t tree_item_len(const node_ptr leaf, uint32_t idx) {
+	if (leaf_loc(leaf, idx)->ovf) {
+		const struct item_ovf *ovf = leaf_elem_data(leaf, idx);
+		return ovf->len;
+	} else {
+		return leaf_loc(leaf, idx)->len;
+	}
+}
+
+/// @brief copies out a leaf elem's data, reading it from its overflow extent
+/// if necessary
+/// @param[in]  leaf  pointer to leaf node
+/// @param[in]  idx   elem index
+/// @param[out] buf   buffer of at least tree_item_len() bytes
+void tree_item_read(const node_ptr leaf, uint32_t idx, void *buf) {
+	if (leaf_loc(leaf, idx)->ovf) {
+		tree_ovf_read(leaf_elem_data(leaf, idx), buf);
+	} else {
+		memcpy(buf, leaf_elem_data(leaf, idx), leaf_loc(leaf, idx)->len);
+	}
+}
@@ -6,59 +6,460 @@
 
 
 #include "../tree.h"
-#include "../../debug.h"
+#include <sched.h>
 #include "../check.h"
+#include "../../debug.h"
+
+
+/* optimistic descents that run into writers this many times in a row give up
+ * and take latches instead */
+#define TREE_OPTIMISTIC_TRIES 8
+
+/* lookups run concurrently on every tree, so the counters are atomic */
+#define SEARCH_STAT_ADD(_field) \
+	__atomic_add_fetch(&search_stats._field, 1, __ATOMIC_RELAXED)
+#define SEARCH_STAT_GET(_field) \
+	__atomic_load_n(&search_stats._field, __ATOMIC_RELAXED)
 
 
+static struct tree_search_stats search_stats;
+
+
+/* expects node_addr to be latched (shared) by the caller; returns the leaf,
+ * still latched, or NULL (with nothing latched) if bloom is given and the
+ * leaf's filter rules the key out */
 static node_ptr tree_search_r(uint32_t root_addr, uint32_t node_addr,
-	const key *key) {
-	node_ptr node = node_map(node_addr, true);
+	const key *key, enum bloom_answer *bloom) {
+	/* the root is rarely a leaf, and every lookup would contend for its
+	 * filter's bucket just to find that out */
+	if (bloom != NULL && node_addr != root_addr) {
+		*bloom = leaf_bloom_query(node_addr, key);
+		
+		if (*bloom == BLOOM_ABSENT) {
+			node_unlatch(node_addr, false);
+			return NULL;
+		}
+	}
 	
-	/* remove this later for performance */
-	check_node(node_addr, false);
+	node_ptr node = node_map(node_addr, false);
+	check_visit(node, node_addr, true);
 	
 	if (node->hdr.leaf) {
+		/* the latch keeps writers out while the filter is built */
+		if (bloom != NULL && *bloom == BLOOM_NONE && node_addr != root_addr) {
+			leaf_bloom_build(node);
+		}
+		
 		return node;
 	} else {
+		/* couple the latches: let go of this node only once the child is held,
+		 * so that a writer can't restructure things in between */
 		uint32_t child_addr = branch_search(node, key);
-		node_ptr child = tree_search_r(root_addr, child_addr, key);
+		node_latch(child_addr, false);
 		
 		node_unmap(node);
-		return child;
+		node_unlatch(node_addr, false);
+		
+		return tree_search_r(root_addr, child_addr, key, bloom);
+	}
+}
+
+/// @brief latches the node that a latched descent for a key starts from: the
+/// node on the index frontier if the tree's index is usable, or else the root
+/// @param[in] root_addr  block number of root node
+/// @param[in] key        key to search for
+/// @return block number of node, latched (shared)
+static uint32_t tree_search_start(uint32_t root_addr, const key *key) {
+	uint64_t gen;
+	uint32_t node_addr = tree_index_find(root_addr, key, &gen);
+	node_latch(node_addr, false);
+	
+	/* the node can't split or go away while it is held, so the index only
+	 * needs to have been current at some point after it was latched */
+	if (node_addr != root_addr && !tree_index_valid(root_addr, gen)) {
+		node_unlatch(node_addr, false);
+		
+		node_addr = root_addr;
+		node_latch(node_addr, false);
+	}
+	
+	return node_addr;
+}
+
+/// @brief descends to the leaf for a key without taking any latches: each node
+/// is searched in place, and its version, recorded before it was mapped, is
+/// validated once the child's version has been recorded, so that the child
+/// can't have been split off or freed in between; a descent that starts from
+/// the index frontier validates the index in place of the levels above
+/// @param[in]  root_addr     block number of root node
+/// @param[in]  key           key to search for
+/// @param[out] leaf_addr     block number of the leaf
+/// @param[out] leaf          the leaf, mapped by node_map_try (NULL if the
+/// leaf's filter rules the key out); nothing read from it can be trusted until
+/// the caller has validated leaf_version
+/// @param[out] leaf_size     size of the leaf's mapping, for node_unmap_try
+/// @param[out] leaf_version  version of the leaf, recorded before it was mapped
+/// @param[out] bloom         if not NULL, what the leaf's filter says
+/// @return false if a writer got in the way and the descent should restart
+static bool tree_search_optimistic(uint32_t root_addr, const key *key,
+	uint32_t *leaf_addr, node_ptr *leaf, uint32_t *leaf_size,
+	uint64_t *leaf_version, enum bloom_answer *bloom) {
+	*leaf = NULL;
+	
+	uint64_t gen;
+	uint32_t node_addr = tree_index_find(root_addr, key, &gen);
+	uint64_t version;
+	if (!node_version_read(node_addr, &version)) {
+		return false;
+	}
+	
+	if (node_addr != root_addr && !tree_index_valid(root_addr, gen)) {
+		return false;
+	}
+	
+	for (uint8_t depth = 0; depth < TREE_MAX_DEPTH; ++depth) {
+		/* as in tree_search_r, the root's filter isn't worth asking for; if
+		 * this node's says "absent", the answer holds as long as nothing
+		 * changed it in the meantime */
+		if (bloom != NULL && node_addr != root_addr) {
+			*bloom = leaf_bloom_query(node_addr, key);
+			
+			if (*bloom == BLOOM_ABSENT) {
+				*leaf_addr = node_addr;
+				return node_version_check(node_addr, version);
+			}
+		}
+		
+		/* the node may have been freed, and its blocks put to some other use,
+		 * since its parent was validated; a header that doesn't add up is
+		 * taken as a sign of that, and a node that really is bad gets reported
+		 * by the latched descent that the retries end in */
+		uint32_t size_blk;
+		node_ptr node = node_map_try(node_addr, &size_blk);
+		if (node == NULL) {
+			return false;
+		} else if (check_node_hdr(node, node_addr).type != RESULT_TYPE_OK) {
+			node_unmap_try(node, node_addr, size_blk);
+			return false;
+		}
+		
+		if (node->hdr.leaf) {
+			if (bloom != NULL && *bloom == BLOOM_NONE &&
+				node_addr != root_addr) {
+				leaf_bloom_offer(node, version);
+			}
+			
+			*leaf_addr    = node_addr;
+			*leaf         = node;
+			*leaf_size    = size_blk;
+			*leaf_version = version;
+			return true;
+		}
+		
+		uint32_t child_addr = branch_search(node, key);
+		node_unmap_try(node, node_addr, size_blk);
+		
+		uint64_t child_version;
+		if (!node_version_read(child_addr, &child_version) ||
+			!node_version_check(node_addr, version)) {
+			return false;
+		}
+		
+		node_addr = child_addr;
+		version   = child_version;
 	}
+	
+	return false;
 }
 
+/* the leaf is returned unlatched, so its contents are only stable while there
+ * are no concurrent writers; in a buffered tree, it may not have caught up with
+ * every insert and removal yet */
 node_ptr tree_search(uint32_t root_addr, const key *key) {
 	ASSERT_ROOT(root_addr);
-	tree_lock(root_addr);
 	
-	node_ptr result = tree_search_r(root_addr, root_addr, key);
+	check_op_begin();
 	
-	tree_unlock(root_addr);
-	return result;
+	/* only the leaf's address is wanted, and the leaf's parent vouched for
+	 * that, so the leaf itself needn't be validated */
+	for (uint8_t try = 0; try < TREE_OPTIMISTIC_TRIES && !check_op_deep();
+		++try) {
+		uint32_t leaf_addr, leaf_size;
+		node_ptr leaf;
+		uint64_t version;
+		if (tree_search_optimistic(root_addr, key, &leaf_addr, &leaf,
+			&leaf_size, &version, NULL)) {
+			SEARCH_STAT_ADD(optimistic);
+			
+			node_unmap_try(leaf, leaf_addr, leaf_size);
+			return node_map(leaf_addr, false);
+		}
+		
+		SEARCH_STAT_ADD(retries);
+		sched_yield();
+	}
+	
+	SEARCH_STAT_ADD(latched);
+	node_ptr leaf = tree_search_r(root_addr,
+		tree_search_start(root_addr, key), key, NULL);
+	uint32_t leaf_addr = leaf->hdr.this;
+	
+	node_unmap(leaf);
+	node_unlatch(leaf_addr, false);
+	
+	return node_map(leaf_addr, false);
+}
+
+/// @brief copies an item out of a leaf
+/// @param[in]  leaf     pointer to leaf node
+/// @param[in]  key      key of item
+/// @param[in]  max_len  size of buffer
+/// @param[out] buf      buffer for item data
+/// @param[in]  bloom    what the leaf's filter said about the key
+/// @return false if the item doesn't exist or doesn't fit
+static bool tree_retrieve_leaf(const node_ptr leaf, const key *key,
+	size_t max_len, void *buf, enum bloom_answer bloom) {
+	uint32_t idx;
+	if (node_search(leaf, key, &idx)) {
+		if (tree_item_len(leaf, idx) <= max_len) {
+			tree_item_read(leaf, idx, buf);
+			
+			return true;
+		}
+	} else if (bloom == BLOOM_MAYBE) {
+		leaf_bloom_false_pos();
+	}
+	
+	return false;
+}
+
+/// @brief looks an item up without taking any latches: only the item itself
+/// is copied out of the leaf (or, for an overflow item, its reference), and
+/// the leaf is validated after that, and once more after an overflow extent
+/// is read, since the extent is only the item's for as long as the leaf says so
+/// @param[in]  root_addr  block number of root node
+/// @param[in]  key        key of item
+/// @param[in]  max_len    size of buffer
+/// @param[out] buf        buffer for item data
+/// @param[out] result     false if the item doesn't exist or doesn't fit
+/// @return false if a writer got in the way and the lookup should restart
+static bool tree_retrieve_optimistic(uint32_t root_addr, const key *key,
+	size_t max_len, void *buf, bool *result) {
+	uint32_t leaf_addr, leaf_size;
+	node_ptr leaf;
+	uint64_t version;
+	enum bloom_answer bloom = BLOOM_NONE;
+	if (!tree_search_optimistic(root_addr, key, &leaf_addr, &leaf, &leaf_size,
+		&version, &bloom)) {
+		return false;
+	} else if (leaf == NULL) {
+		*result = false;
+		return true;
+	}
+	
+	/* the item's place in the leaf is checked against the leaf's bounds, so
+	 * that a leaf changing underneath can't send the copy outside of it */
+	uint32_t idx;
+	bool found = node_search(leaf, key, &idx);
+	
+	item_loc loc = { 0 };
+	struct item_ovf ovf = { 0 };
+	bool fits = false;
+	if (found) {
+		loc = *leaf_loc(leaf, idx);
+		
+		uint32_t len = (loc.ovf ? sizeof(ovf) : loc.len);
+		if ((uint64_t)loc.off + len > BLK_TO_BYTE(leaf_size)) {
+			node_unmap_try(leaf, leaf_addr, leaf_size);
+			return false;
+		}
+		
+		if (loc.ovf) {
+			memcpy(&ovf, (const uint8_t *)leaf + loc.off, sizeof(ovf));
+		} else if (loc.len <= max_len) {
+			memcpy(buf, (const uint8_t *)leaf + loc.off, loc.len);
+			fits = true;
+		}
+	}
+	
+	node_unmap_try(leaf, leaf_addr, leaf_size);
+	
+	if (!node_version_check(leaf_addr, version)) {
+		return false;
+	}
+	
+	if (!found && bloom == BLOOM_MAYBE) {
+		leaf_bloom_false_pos();
+	}
+	
+	if (loc.ovf && ovf.len <= max_len) {
+		tree_ovf_read(&ovf, buf);
+		
+		if (!node_version_check(leaf_addr, version)) {
+			return false;
+		}
+		
+		fits = true;
+	}
+	
+	*result = (found && fits);
+	return true;
 }
 
 bool tree_retrieve(uint32_t root_addr, const key *key, size_t max_len,
 	void *buf) {
 	ASSERT_ROOT(root_addr);
-	tree_lock(root_addr);
 	
-	bool result = false;
-	const node_ptr leaf = tree_search_r(root_addr, root_addr, key);
-	uint16_t idx;
-	if (node_search(leaf, key, &idx)) {
-		item_ref *elem = leaf->l_elems + idx;
-		
-		if (elem->len <= max_len) {
-			uint8_t *data_ptr = leaf_elem_data(leaf, idx);
-			memcpy(buf, data_ptr, elem->len);
-			
-			result = true;
+	/* the leaves of a buffered tree may be behind on what happened to the
+	 * item, and their filters even more so */
+	if (tree_buffered(root_addr)) {
+		return tree_buf_retrieve(root_addr, key, max_len, buf);
+	}
+	
+	check_op_begin();
+	
+	/* lookups that get deep checks need the nodes held, so they go straight
+	 * to latches */
+	for (uint8_t try = 0; try < TREE_OPTIMISTIC_TRIES && !check_op_deep();
+		++try) {
+		bool result;
+		if (tree_retrieve_optimistic(root_addr, key, max_len, buf, &result)) {
+			SEARCH_STAT_ADD(optimistic);
+			return result;
 		}
+		
+		SEARCH_STAT_ADD(retries);
+		sched_yield();
+	}
+	
+	SEARCH_STAT_ADD(latched);
+	enum bloom_answer bloom = BLOOM_NONE;
+	node_ptr leaf = tree_search_r(root_addr,
+		tree_search_start(root_addr, key), key, &bloom);
+	if (leaf == NULL) {
+		return false;
 	}
 	
+	uint32_t leaf_addr = leaf->hdr.this;
+	
+	bool result = tree_retrieve_leaf(leaf, key, max_len, buf, bloom);
+	
 	node_unmap(leaf);
-	tree_unlock(root_addr);
+	node_unlatch(leaf_addr, false);
 	
 	return result;
 }
+
+/// @brief finds the greatest key in a tree
+/// @param[in]  root_addr  block number of root node
+/// @param[out] out        greatest key
+/// @return false if the tree is empty
+bool tree_last_key(uint32_t root_addr, key *out) {
+	ASSERT_ROOT(root_addr);
+	
+	if (tree_buffered(root_addr)) {
+		return tree_buf_last_key(root_addr, out);
+	}
+	
+	uint32_t node_addr = root_addr;
+	node_latch(node_addr, false);
+	
+	node_ptr node = node_map(node_addr, false);
+	while (!node->hdr.leaf) {
+		uint32_t child_addr = branch_addr(node)[node->hdr.cnt - 1];
+		node_latch(child_addr, false);
+		
+		node_unmap(node);
+		node_unlatch(node_addr, false);
+		
+		node_addr = child_addr;
+		node = node_map(node_addr, false);
+	}
+	
+	bool result = (node->hdr.cnt != 0);
+	if (result) {
+		*out = node_key(node, node->hdr.cnt - 1);
+	}
+	
+	node_unmap(node);
+	node_unlatch(node_addr, false);
+	
+	return result;
+}
+
+/// @brief finds the nearest item to a key, in one direction or the other,
+/// walking across leaves as needed; like tree_search, this is only stable
+/// while there are no concurrent writers
+/// @param[in]  root_addr  block number of root node
+/// @param[in]  from       key to start from
+/// @param[in]  below      find the greatest key less than the given one,
+/// rather than the least key greater than or equal to it
+/// @param[out] found      key that was found
+/// @param[in]  max_len    size of buffer
+/// @param[out] buf        buffer for item data, or NULL to leave the item be
+/// @return false if there is no such key in the tree
+bool tree_seek(uint32_t root_addr, const key *from, bool below, key *found,
+	size_t max_len, void *buf) {
+	ASSERT_ROOT(root_addr);
+	
+	/* the leaves of a buffered tree don't know about everything yet */
+	if (tree_buffered(root_addr)) {
+		errx("%s: not supported on buffered trees: root 0x%" PRIx32,
+			__func__, root_addr);
+	}
+	
+	node_ptr leaf = tree_search(root_addr, from);
+	
+	uint32_t idx;
+	if (!node_search(leaf, from, &idx)) {
+		idx = node_search_hypo(leaf, from);
+	}
+	
+	/* idx is now where the key is or would go; empty leaves and running off
+	 * the end of one mean going on to its neighbor */
+	while (below ? idx == 0 : idx >= leaf->hdr.cnt) {
+		uint32_t next_addr = (below ? leaf->hdr.prev : leaf->hdr.next);
+		node_unmap(leaf);
+		
+		if (next_addr == 0) {
+			return false;
+		}
+		
+		leaf = node_map(next_addr, false);
+		idx  = (below ? leaf->hdr.cnt : 0);
+	}
+	
+	if (below) {
+		--idx;
+	}
+	
+	*found = node_key(leaf, idx);
+	
+	if (buf != NULL) {
+		if (tree_item_len(leaf, idx) > max_len) {
+			errx("%s: item too big: key %s", __func__, key_str(found));
+		}
+		
+		tree_item_read(leaf, idx, buf);
+	}
+	
+	node_unmap(leaf);
+	
+	return true;
+}
+
+/// @brief reports how lookups have gotten to their leaves
+/// @return lookup statistics
+struct tree_search_stats tree_search_stats(void) {
+	return (struct tree_search_stats){
+		.optimistic = SEARCH_STAT_GET(optimistic),
+		.retries    = SEARCH_STAT_GET(retries),
+		.latched    = SEARCH_STAT_GET(latched),
+	};
+}
+
+/// @brief resets the lookup statistics; only for when the filesystem is going
+/// away and nothing else is running
+void tree_search_done(void) {
+	search_stats = (struct tree_search_stats){ 0 };
+}
@@ -0,0 +1,517 @@
+/* jgfs2
+ * (c) 2013 Justin Gottula
+ * The source code of this project is distributed under the terms of the
+ * simplified BSD license. See the LICENSE file for details.
+ */
+
+
+#include "../tree.h"
+#include <pthread.h>
+#include "../../debug.h"
+#include "../../extent.h"
+
+
+/* trees whose totals can be kept at once; as with the index, there is one
+ * extent tree and at most a few dozen metadata partitions */
+#define TREE_STAT_SLOTS 128
+
+
+/* every tree's totals are kept in memory while the filesystem is up and only
+ * written to the statistics table that the super block points to when it is
+ * unmounted, so that writers don't all have to write to the table (or to the
+ * root, which would have to carry room for the totals in every node) just to
+ * count what they did; a tree's record is marked unclean while the totals in
+ * it are out of date, and a tree whose record is found that way, or that has
+ * no record at all, when the filesystem comes up is counted again from scratch
+ *
+ * nodes other than the root don't know which tree they are in, so changes are
+ * added up per thread as an insert or removal goes, and only added to the
+ * tree's totals once it is done; the height is the exception, since it only
+ * changes while the root itself is latched exclusively */
+struct tree_stat_slot {
+	uint32_t root_addr;
+	
+	uint8_t height;
+	int64_t nodes;
+	int64_t items;
+	int64_t bytes;
+	int64_t ovf_blk;
+	int64_t fill[NODE_FILL_BUCKETS];
+};
+
+/* a tree's totals as they are kept in the statistics table */
+struct __attribute__((__packed__)) tree_stat_rec {
+	uint32_t root_addr; // zero if the record is unused
+	uint8_t  clean;     // totals were saved at the last unmount
+	uint8_t  height;    // levels, counting the root's and the leaves'
+	uint32_t nodes;     // nodes on every level
+	uint64_t items;     // items in the leaves
+	uint64_t bytes;     // item data, counting overflow items at full length
+	uint32_t ovf_blk;   // blocks in overflow extents
+	uint32_t fill[NODE_FILL_BUCKETS]; // leaves in each fill bucket
+};
+
+/* changes made by the current operation that haven't been committed yet */
+struct tree_stat_delta {
+	bool dirty;
+	
+	int64_t nodes;
+	int64_t items;
+	int64_t bytes;
+	int64_t ovf_blk;
+	int64_t fill[NODE_FILL_BUCKETS];
+};
+
+
+static pthread_mutex_t stat_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct tree_stat_slot stat_tbl[TREE_STAT_SLOTS];
+
+static __thread struct tree_stat_delta stat_delta;
+
+/* the changes of an operation that another one, on some other tree, was
+ * started in the middle of */
+static __thread struct tree_stat_delta stat_aside;
+static __thread bool stat_aside_used = false;
+
+
+/// @brief finds the totals slot for a tree, optionally claiming one for it
+/// @param[in] root_addr  block number of root node
+/// @param[in] create     claim a slot if the tree doesn't have one yet
+/// @return pointer to slot, or NULL if there is no slot
+static struct tree_stat_slot *tree_stat_get(uint32_t root_addr, bool create) {
+	/* same scheme as tree_index_get: slots are never given back while the
+	 * filesystem is up, so a lookup can stop at the first free one */
+	uint32_t start = (root_addr * UINT32_C(2654435769)) >> 25;
+	for (uint32_t i = 0; i < TREE_STAT_SLOTS; ++i) {
+		struct tree_stat_slot *slot =
+			stat_tbl + ((start + i) % TREE_STAT_SLOTS);
+		
+		uint32_t addr = __atomic_load_n(&slot->root_addr, __ATOMIC_ACQUIRE);
+		if (addr == root_addr) {
+			return slot;
+		} else if (addr != 0) {
+			continue;
+		}
+		
+		if (!create) {
+			return NULL;
+		}
+		
+		pthread_mutex_lock(&stat_lock);
+		
+		addr = slot->root_addr;
+		if (addr == 0) {
+			__atomic_store_n(&slot->root_addr, root_addr, __ATOMIC_RELEASE);
+			addr = root_addr;
+		}
+		
+		pthread_mutex_unlock(&stat_lock);
+		
+		if (addr == root_addr) {
+			return slot;
+		}
+	}
+	
+	if (create) {
+		errx("%s: no stat slots left: root 0x%" PRIx32, __func__, root_addr);
+	}
+	return NULL;
+}
+
+/// @brief finds which fill bucket a leaf belongs in
+/// @param[in] leaf  pointer to leaf node
+/// @return bucket index
+static uint8_t tree_stat_bucket(const node_ptr leaf) {
+	uint64_t bucket = ((uint64_t)node_used(leaf) * NODE_FILL_BUCKETS) /
+		node_capacity(leaf);
+	
+	return (bucket < NODE_FILL_BUCKETS ? bucket : NODE_FILL_BUCKETS - 1);
+}
+
+/// @brief finds a tree's record in the statistics table
+/// @param[in] tbl        mapped table
+/// @param[in] root_addr  block number of root node
+/// @param[in] create     use an unused record if the tree doesn't have one yet
+/// @return pointer to record, or NULL if there is none
+static struct tree_stat_rec *tree_stat_rec(struct tree_stat_rec *tbl,
+	uint32_t root_addr, bool create) {
+	uint32_t cnt = BLK_TO_BYTE((uint64_t)fs.sblk->s_stat_blk) / sizeof(*tbl);
+	
+	struct tree_stat_rec *unused = NULL;
+	for (uint32_t i = 0; i < cnt; ++i) {
+		if (tbl[i].root_addr == root_addr) {
+			return tbl + i;
+		} else if (tbl[i].root_addr == 0 && unused == NULL) {
+			unused = tbl + i;
+		}
+	}
+	
+	if (create && unused == NULL) {
+		errx("%s: statistics table is full: root 0x%" PRIx32, __func__,
+			root_addr);
+	}
+	return (create ? unused : NULL);
+}
+
+/// @brief copies a tree's totals out of the statistics table
+/// @param[in]  root_addr  block number of root node
+/// @param[out] slot       slot to copy into
+/// @return false if the tree has no totals in the table that can be trusted
+static bool tree_stat_load(uint32_t root_addr, struct tree_stat_slot *slot) {
+	struct tree_stat_rec *tbl = fs_map_blk(fs.sblk->s_addr_stat,
+		fs.sblk->s_stat_blk, false);
+	
+	const struct tree_stat_rec *rec = tree_stat_rec(tbl, root_addr, false);
+	bool clean = (rec != NULL && rec->clean);
+	
+	if (clean) {
+		slot->height  = rec->height;
+		slot->nodes   = rec->nodes;
+		slot->items   = rec->items;
+		slot->bytes   = rec->bytes;
+		slot->ovf_blk = rec->ovf_blk;
+		for (uint8_t i = 0; i < NODE_FILL_BUCKETS; ++i) {
+			slot->fill[i] = rec->fill[i];
+		}
+	}
+	
+	fs_unmap_blk(tbl, fs.sblk->s_addr_stat, fs.sblk->s_stat_blk);
+	
+	return clean;
+}
+
+/// @brief writes a tree's totals to the statistics table
+/// @param[in] slot   slot holding the totals
+/// @param[in] clean  whether the totals will still be right at the next mount
+static void tree_stat_save(const struct tree_stat_slot *slot, bool clean) {
+	struct tree_stat_rec *tbl = fs_map_blk(fs.sblk->s_addr_stat,
+		fs.sblk->s_stat_blk, true);
+	
+	struct tree_stat_rec *rec = tree_stat_rec(tbl, slot->root_addr, true);
+	
+	rec->root_addr = slot->root_addr;
+	rec->clean     = clean;
+	rec->height    = slot->height;
+	rec->nodes     = slot->nodes;
+	rec->items     = slot->items;
+	rec->bytes     = slot->bytes;
+	rec->ovf_blk   = slot->ovf_blk;
+	for (uint8_t i = 0; i < NODE_FILL_BUCKETS; ++i) {
+		rec->fill[i] = slot->fill[i];
+	}
+	
+	/* an unclean mark has to be on disk before anything it covers is */
+	fs_msync_blk(tbl, fs.sblk->s_addr_stat, fs.sblk->s_stat_blk, false);
+	fs_unmap_blk(tbl, fs.sblk->s_addr_stat, fs.sblk->s_stat_blk);
+}
+
+/// @brief reserves and clears the statistics table on a new filesystem
+void tree_stat_new(void) {
+	fs.sblk->s_stat_blk = BYTE_TO_BLK(TREE_STAT_SLOTS *
+		sizeof(struct tree_stat_rec));
+	fs.sblk->s_addr_stat = ext_alloc(fs.sblk->s_stat_blk, EXT_TYPE_META, 0);
+	
+	void *tbl = fs_map_blk(fs.sblk->s_addr_stat, fs.sblk->s_stat_blk, true);
+	memset(tbl, 0, BLK_TO_BYTE((uint64_t)fs.sblk->s_stat_blk));
+	
+	fs_msync_blk(tbl, fs.sblk->s_addr_stat, fs.sblk->s_stat_blk, false);
+	fs_unmap_blk(tbl, fs.sblk->s_addr_stat, fs.sblk->s_stat_blk);
+}
+
+/// @brief starts the totals of a tree that was just set up, which has nothing
+/// but an empty root leaf; nothing is written to the table until the
+/// filesystem is unmounted
+/// @param[in] root  pointer to root node
+void tree_stat_init(node_ptr root) {
+	struct tree_stat_slot *slot = tree_stat_get(root->hdr.this, true);
+	
+	*slot = (struct tree_stat_slot){
+		.root_addr = root->hdr.this,
+		
+		.height  = 1,
+		.nodes   = 1,
+		.fill[0] = 1,
+	};
+	
+	root->hdr.fill = 1;
+}
+
+/// @brief brings a tree's totals into memory, counting them from scratch if
+/// the table's copy is out of date; must be called before anything else uses
+/// the tree
+/// @param[in] root_addr  block number of root node
+void tree_stat_open(uint32_t root_addr) {
+	ASSERT_ROOT(root_addr);
+	
+	if (tree_stat_get(root_addr, false) != NULL) {
+		return;
+	}
+	
+	struct tree_stat_slot *slot = tree_stat_get(root_addr, true);
+	
+	if (!tree_stat_load(root_addr, slot)) {
+		warnx("tree 0x%" PRIx32 ": statistics were not saved; recounting",
+			root_addr);
+		
+		struct tree_stats totals;
+		tree_stat_walk(root_addr, &totals, NULL);
+		
+		slot->height  = totals.height;
+		slot->nodes   = totals.nodes;
+		slot->items   = totals.items;
+		slot->bytes   = totals.bytes;
+		slot->ovf_blk = totals.ovf_blk;
+		for (uint8_t i = 0; i < NODE_FILL_BUCKETS; ++i) {
+			slot->fill[i] = totals.fill[i];
+		}
+	}
+	
+	/* the copy in the table goes stale as soon as anything is written */
+	if (!fs.mount_opt.read_only) {
+		tree_stat_save(slot, false);
+	}
+}
+
+/// @brief moves a node to the fill bucket it now belongs in, taking it out
+/// of the histogram if it is not a leaf (anymore)
+/// @param[in] node  pointer to node, latched exclusively
+void tree_stat_fill(node_ptr node) {
+	uint8_t fill = (node->hdr.leaf ? tree_stat_bucket(node) + 1 : 0);
+	
+	if (fill != node->hdr.fill) {
+		if (node->hdr.fill != 0) {
+			--stat_delta.fill[node->hdr.fill - 1];
+		}
+		if (fill != 0) {
+			++stat_delta.fill[fill - 1];
+		}
+		
+		node->hdr.fill = fill;
+		stat_delta.dirty = true;
+	}
+}
+
+/// @brief takes a node that is going away out of the fill histogram
+/// @param[in] node  pointer to node, latched exclusively
+void tree_stat_fill_drop(node_ptr node) {
+	if (node->hdr.fill != 0) {
+		--stat_delta.fill[node->hdr.fill - 1];
+		
+		node->hdr.fill = 0;
+		stat_delta.dirty = true;
+	}
+}
+
+/// @brief counts nodes that were added to or freed from a tree
+/// @param[in] delta  change in node count
+void tree_stat_nodes(int32_t delta) {
+	stat_delta.nodes += delta;
+	stat_delta.dirty = true;
+}
+
+/// @brief counts an item that made it into a leaf
+/// @param[in] item  item data, as stored in the leaf
+void tree_stat_item_add(struct item_data item) {
+	++stat_delta.items;
+	stat_delta.bytes += (item.ovf ?
+		((const struct item_ovf *)item.data)->len : item.len);
+	stat_delta.dirty = true;
+}
+
+/// @brief counts an item that is about to be taken out of a leaf
+/// @param[in] leaf  pointer to leaf node
+/// @param[in] idx   elem index
+void tree_stat_item_del(const node_ptr leaf, uint32_t idx) {
+	--stat_delta.items;
+	stat_delta.bytes -= tree_item_len(leaf, idx);
+	stat_delta.dirty = true;
+}
+
+/// @brief counts blocks given to or taken back from overflow extents
+/// @param[in] blk_delta  change in overflow block count
+void tree_stat_ovf(int64_t blk_delta) {
+	stat_delta.ovf_blk += blk_delta;
+	stat_delta.dirty = true;
+}
+
+/// @brief counts a new level on top of a tree, after its root split
+/// @param[in] root_addr  block number of root node, latched exclusively
+void tree_stat_grow(uint32_t root_addr) {
+	struct tree_stat_slot *slot = tree_stat_get(root_addr, false);
+	if (slot != NULL) {
+		__atomic_add_fetch(&slot->height, 1, __ATOMIC_RELAXED);
+	}
+}
+
+/// @brief counts a tree as a lone root again, after it lost its last leaf
+/// @param[in] root_addr  block number of root node, latched exclusively
+void tree_stat_collapse(uint32_t root_addr) {
+	struct tree_stat_slot *slot = tree_stat_get(root_addr, false);
+	if (slot != NULL) {
+		__atomic_store_n(&slot->height, 1, __ATOMIC_RELAXED);
+	}
+}
+
+/// @brief adds what the current operation changed to a tree's totals
+/// @param[in] root_addr  block number of root node
+void tree_stat_commit(uint32_t root_addr) {
+	if (!stat_delta.dirty) {
+		return;
+	}
+	
+	struct tree_stat_slot *slot = tree_stat_get(root_addr, false);
+	if (slot != NULL) {
+		__atomic_add_fetch(&slot->nodes, stat_delta.nodes, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&slot->items, stat_delta.items, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&slot->bytes, stat_delta.bytes, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&slot->ovf_blk, stat_delta.ovf_blk,
+			__ATOMIC_RELAXED);
+		
+		for (uint8_t i = 0; i < NODE_FILL_BUCKETS; ++i) {
+			if (stat_delta.fill[i] != 0) {
+				__atomic_add_fetch(&slot->fill[i], stat_delta.fill[i],
+					__ATOMIC_RELAXED);
+			}
+		}
+	}
+	
+	memset(&stat_delta, 0, sizeof(stat_delta));
+}
+
+/// @brief sets aside what the current operation has changed so far, so that
+/// an operation on another tree can be done in the middle of it (as when a
+/// tree allocates a node); only one operation can be set aside at a time
+void tree_stat_aside(void) {
+	if (stat_aside_used) {
+		errx("%s: an operation is already set aside", __func__);
+	}
+	
+	stat_aside = stat_delta;
+	stat_aside_used = true;
+	
+	memset(&stat_delta, 0, sizeof(stat_delta));
+}
+
+/// @brief picks up the operation that tree_stat_aside set aside, once the one
+/// in the middle of it has committed
+void tree_stat_resume(void) {
+	if (!stat_aside_used) {
+		errx("%s: no operation was set aside", __func__);
+	} else if (stat_delta.dirty) {
+		errx("%s: the operation in between never committed", __func__);
+	}
+	
+	stat_delta = stat_aside;
+	stat_aside_used = false;
+}
+
+/// @brief reports a tree's running totals, without looking at the tree
+/// @param[in] root_addr  block number of root node
+/// @return totals (all zero if the tree was never opened)
+struct tree_stats tree_stat(uint32_t root_addr) {
+	ASSERT_ROOT(root_addr);
+	
+	struct tree_stats stats = { 0 };
+	
+	const struct tree_stat_slot *slot = tree_stat_get(root_addr, false);
+	if (slot != NULL) {
+		stats.height  = __atomic_load_n(&slot->height, __ATOMIC_RELAXED);
+		stats.nodes   = __atomic_load_n(&slot->nodes, __ATOMIC_RELAXED);
+		stats.items   = __atomic_load_n(&slot->items, __ATOMIC_RELAXED);
+		stats.bytes   = __atomic_load_n(&slot->bytes, __ATOMIC_RELAXED);
+		stats.ovf_blk = __atomic_load_n(&slot->ovf_blk, __ATOMIC_RELAXED);
+		for (uint8_t i = 0; i < NODE_FILL_BUCKETS; ++i) {
+			stats.fill[i] = __atomic_load_n(&slot->fill[i], __ATOMIC_RELAXED);
+		}
+	}
+	
+	return stats;
+}
+
+/// @brief counts everything in a tree by walking every level of it; the tree
+/// must not change while this is going on
+/// @param[in]  root_addr  block number of root node
+/// @param[out] totals     what the running totals should be
+/// @param[out] levels     per-level figures, root first (may be NULL)
+/// @return number of levels
+uint8_t tree_stat_walk(uint32_t root_addr, struct tree_stats *totals,
+	struct tree_level_stats levels[TREE_MAX_DEPTH]) {
+	ASSERT_ROOT(root_addr);
+	
+	memset(totals, 0, sizeof(*totals));
+	
+	uint8_t depth = tree_depth(root_addr);
+	totals->height = depth;
+	
+	for (uint8_t level = 0; level < depth; ++level) {
+		struct tree_level_stats level_stats = { 0 };
+		
+		uint32_t node_addr = tree_level_first(root_addr, level);
+		while (node_addr != 0) {
+			node_ptr node = node_map(node_addr, false);
+			
+			++level_stats.nodes;
+			level_stats.elems    += node->hdr.cnt;
+			level_stats.used     += node_used(node);
+			level_stats.capacity += node_capacity(node);
+			
+			/* overflow extents are handed out when an item is inserted, not
+			 * when it gets to a leaf */
+			if (!node->hdr.leaf && (node->hdr.flags & NODE_BUFFERED)) {
+				uint32_t off = 0;
+				while (off < node->hdr.buf_used) {
+					const struct buf_msg *msg =
+						(const struct buf_msg *)(branch_buf(node) + off);
+					
+					if (msg->ovf) {
+						totals->ovf_blk += BYTE_TO_BLK(
+							((const struct item_ovf *)msg->data)->len);
+					}
+					
+					off += buf_msg_size(msg);
+				}
+			}
+			
+			if (node->hdr.leaf) {
+				totals->items += node->hdr.cnt;
+				++totals->fill[tree_stat_bucket(node)];
+				
+				for (uint32_t i = 0; i < node->hdr.cnt; ++i) {
+					uint32_t len = tree_item_len(node, i);
+					
+					totals->bytes += len;
+					if (leaf_loc(node, i)->ovf) {
+						totals->ovf_blk += BYTE_TO_BLK(len);
+					}
+				}
+			}
+			
+			node_addr = node->hdr.next;
+			node_unmap(node);
+		}
+		
+		totals->nodes += level_stats.nodes;
+		if (levels != NULL) {
+			levels[level] = level_stats;
+		}
+	}
+	
+	return depth;
+}
+
+/// @brief saves every tree's totals to the table and forgets them; only for
+/// when the filesystem is going away and nothing else is running
+void tree_stat_done(void) {
+	for (uint32_t i = 0; i < TREE_STAT_SLOTS; ++i) {
+		struct tree_stat_slot *slot = stat_tbl + i;
+		
+		if (slot->root_addr != 0) {
+			if (!fs.mount_opt.read_only) {
+				tree_stat_save(slot, true);
+			}
+			
+			memset(slot, 0, sizeof(*slot));
+		}
+	}
+}
@@ -0,0 +1,210 @@
+/* jgfs2
+ * (c) 2013 Justin Gottula
+ * The source code of this project is distributed under the terms of the
+ * simplified BSD license. See the LICENSE file for details.
+ */
+
+
+#include "../tree.h"
+#include "../../debug.h"
+
+
+/* a commit group gathers up the nodes that any number of operations change,
+ * and writes them all out at once when it commits: in block order, and with a
+ * single flush at the end, instead of an msync as each node is unmapped;
+ * operations join whichever group is open at the time they begin, and a group
+ * stays open across operations until it is closed, either because it has
+ * gotten big or because someone is waiting on it; it commits once the last
+ * operation in it is done, and groups always commit in the order they were
+ * opened in
+ *
+ * this is not atomic: the nodes are changed in place and can be written out
+ * by the kernel whenever it likes; what it buys is one flush per group rather
+ * than a write per node, and far fewer moments at which a crash leaves the
+ * trees half-written */
+
+
+/* a group with this many node writes in it is closed as soon as an operation
+ * in it commits */
+#define TXN_GROUP_NODES 1024
+
+
+struct tree_txn {
+	uint64_t id;
+	
+	uint32_t members; // operations in the group that haven't committed
+	uint32_t ops;     // operations that have joined the group
+	bool     closed;  // no more operations may join
+	
+	struct node_wb_list wb;
+};
+
+
+static pthread_mutex_t txn_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  txn_cond = PTHREAD_COND_INITIALIZER;
+
+static struct tree_txn *txn_open = NULL;
+static uint64_t txn_next_id   = 1;
+static uint64_t txn_done_id   = 0;
+
+static struct tree_txn_stats txn_stats;
+
+/* the group this thread's operation is in; operations may nest */
+static __thread struct tree_txn *txn_cur   = NULL;
+static __thread uint32_t         txn_depth = 0;
+
+
+/// @brief closes the open group to new operations; txn_lock must be held
+/// @param[in] txn  group to close
+static void tree_txn_close(struct tree_txn *txn) {
+	txn->closed = true;
+	
+	if (txn_open == txn) {
+		txn_open = NULL;
+	}
+}
+
+/// @brief writes out a closed group that has no operations left in it, once
+/// every group before it has been written out; txn_lock must be held, and is
+/// let go of while the writing is done
+/// @param[in] txn  group to write out, which is freed afterward
+static void tree_txn_write(struct tree_txn *txn) {
+	while (txn_done_id != txn->id - 1) {
+		pthread_cond_wait(&txn_cond, &txn_lock);
+	}
+	
+	uint32_t nodes = txn->wb.cnt;
+	
+	pthread_mutex_unlock(&txn_lock);
+	uint32_t runs = node_wb_flush(&txn->wb);
+	pthread_mutex_lock(&txn_lock);
+	
+	++txn_stats.groups;
+	txn_stats.ops   += txn->ops;
+	txn_stats.nodes += nodes;
+	txn_stats.runs  += runs;
+	
+	txn_done_id = txn->id;
+	pthread_cond_broadcast(&txn_cond);
+	
+	pthread_mutex_destroy(&txn->wb.lock);
+	free(txn);
+}
+
+/// @brief starts an operation, joining it to the open commit group (or to the
+/// one this thread's operation is already in)
+/// @return group joined
+struct tree_txn *tree_txn_begin(void) {
+	if (txn_depth++ != 0) {
+		return txn_cur;
+	}
+	
+	pthread_mutex_lock(&txn_lock);
+	
+	struct tree_txn *txn = txn_open;
+	if (txn == NULL) {
+		txn = malloc(sizeof(*txn));
+		
+		txn->id      = txn_next_id++;
+		txn->members = 0;
+		txn->ops     = 0;
+		txn->closed  = false;
+		node_wb_init(&txn->wb);
+		
+		txn_open = txn;
+	}
+	
+	++txn->members;
+	++txn->ops;
+	
+	pthread_mutex_unlock(&txn_lock);
+	
+	txn_cur = txn;
+	node_wb_attach(&txn->wb);
+	
+	return txn;
+}
+
+/// @brief ends an operation; the nodes it changed go out when its group
+/// commits
+/// @param[in] txn   group from tree_txn_begin
+/// @param[in] wait  close the group, and don't return until it has committed
+void tree_txn_commit(struct tree_txn *txn, bool wait) {
+	if (txn != txn_cur || txn_depth == 0) {
+		errx("%s: not in this group", __func__);
+	}
+	
+	/* a nested operation is part of the outer one */
+	if (--txn_depth != 0) {
+		return;
+	}
+	
+	node_wb_attach(NULL);
+	txn_cur = NULL;
+	
+	pthread_mutex_lock(&txn_lock);
+	
+	uint64_t id = txn->id;
+	
+	if (!txn->closed && (wait || txn->wb.cnt >= TXN_GROUP_NODES)) {
+		tree_txn_close(txn);
+	}
+	
+	if (--txn->members == 0 && txn->closed) {
+		tree_txn_write(txn);
+	} else if (wait) {
+		while (txn_done_id < id) {
+			pthread_cond_wait(&txn_cond, &txn_lock);
+		}
+	}
+	
+	pthread_mutex_unlock(&txn_lock);
+}
+
+/// @brief closes the open commit group, if there is one, and waits for it and
+/// every group before it to commit
+void tree_txn_sync(void) {
+	pthread_mutex_lock(&txn_lock);
+	
+	uint64_t id = txn_next_id - 1;
+	
+	struct tree_txn *txn = txn_open;
+	if (txn != NULL) {
+		tree_txn_close(txn);
+		
+		if (txn->members == 0) {
+			tree_txn_write(txn);
+		}
+	}
+	
+	while (txn_done_id < id) {
+		pthread_cond_wait(&txn_cond, &txn_lock);
+	}
+	
+	pthread_mutex_unlock(&txn_lock);
+}
+
+/// @brief gets the totals for the commit groups written so far
+/// @return totals
+struct tree_txn_stats tree_txn_stats(void) {
+	pthread_mutex_lock(&txn_lock);
+	struct tree_txn_stats stats = txn_stats;
+	pthread_mutex_unlock(&txn_lock);
+	
+	return stats;
+}
+
+/// @brief commits whatever is left in the open group; only for when the
+/// filesystem is going away and nothing else is running
+void tree_txn_done(void) {
+	/* an operation that never committed has nobody left to wait for */
+	if (txn_open != NULL && txn_open->members != 0) {
+		warnx("%s: %" PRIu32 " operations still in a commit group",
+			__func__, txn_open->members);
+		txn_open->members = 0;
+	}
+	
+	tree_txn_sync();
+	
+	memset(&txn_stats, 0, sizeof(txn_stats));
+}
@@ -22,6 +22,9 @@ char *dev_path;
 void *jg_init(struct fuse_conn_info *conn) {
 	struct jgfs2_mount_options mount_opt = {
 		.read_only = false,
+		
+		.index_levels = 2,
+		.bloom_bits   = 10,
 	};
 	
 	warnx("TODO: implement mount options");
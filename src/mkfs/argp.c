@@ -33,6 +33,15 @@ struct jgfs2_mkfs_param param = {
 	
 	.blk_size   = 0,  // auto
 	
+	.meta_parts = 0,  // one
+	
+	.ext_node_size  = 0,  // 4 KiB
+	.meta_node_size = 0,  // 4 KiB
+	
+	.meta_buffered = false,
+	
+	.log_size = 0,  // 1 MiB
+	
 	.zap_vbr    = false,
 	.zap_boot   = false,
 };
@@ -69,7 +78,7 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
 		}
 		strlcpy(param.label, arg, JGFS2_LIMIT_LABEL + 1);
 		break;
-		
+	
 	case 's':
 		switch (sscanf(arg, "%" SCNu32, &param.total_sect)) {
 		case EOF:
@@ -99,6 +108,49 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
 		}
 		break;
 	
+	case 'P':
+		switch (sscanf(arg, "%" SCNu16, &param.meta_parts)) {
+		case EOF:
+			warnx("meta_parts: don't understand '%s'", arg);
+			argp_usage(state);
+		case 1:
+			break;
+		}
+		break;
+	
+	case 'E':
+		switch (sscanf(arg, "%" SCNu32, &param.ext_node_size)) {
+		case EOF:
+			warnx("ext_node_size: don't understand '%s'", arg);
+			argp_usage(state);
+		case 1:
+			break;
+		}
+		break;
+	case 'M':
+		switch (sscanf(arg, "%" SCNu32, &param.meta_node_size)) {
+		case EOF:
+			warnx("meta_node_size: don't understand '%s'", arg);
+			argp_usage(state);
+		case 1:
+			break;
+		}
+		break;
+	
+	case 'J':
+		switch (sscanf(arg, "%" SCNu32, &param.log_size)) {
+		case EOF:
+			warnx("log_size: don't understand '%s'", arg);
+			argp_usage(state);
+		case 1:
+			break;
+		}
+		break;
+	
+	case 'W':
+		param.meta_buffered = true;
+		break;
+	
 	case 'z':
 	{
 		size_t tok_num = 0;
@@ -181,8 +233,13 @@ static struct argp_option options[] = {
 	{ "size", 's', "SECTORS", 0, NULL, 2, },
 	{ "boot", 'b', "SECTORS", 0, NULL, 2, },
 	{ "blk-size", 'B', "SECTORS", 0, NULL, 2, },
+	{ "meta-parts", 'P', "COUNT", 0, NULL, 2, },
+	{ "ext-node-size", 'E', "BYTES", 0, NULL, 2, },
+	{ "meta-node-size", 'M', "BYTES", 0, NULL, 2, },
+	{ "log-size", 'J', "BYTES", 0, NULL, 2, },
 	
 	{ NULL, 0, NULL, 0, "initialization options:", 3 },
+	{ "meta-buffered", 'W', NULL, 0, NULL, 3 },
 	{ "zap", 'z', "AREAS", 0, NULL, 3 },
 	
 	{ NULL, 0, NULL, 0, "debug options:", 4 },
@@ -231,7 +288,34 @@ static void set_docs(void) {
 				"block size\n"
 				"> default: auto";
 			break;
+		case 'P':
+			opt->doc = sprintf_alloc(
+				"meta tree partitions [power of 2, 1-%u]\n"
+				"> default: 1",
+				JGFS2_LIMIT_META_PART);
+			break;
 		
+		case 'E':
+		case 'M':
+			opt->doc = sprintf_alloc(
+				"%s tree node size [power of 2, %u-%u]\n"
+				"> default: %u",
+				(opt->key == 'E' ? "extent" : "metadata"),
+				JGFS2_NODE_SIZE_MIN, JGFS2_NODE_SIZE_MAX, JGFS2_NODE_SIZE_MIN);
+			break;
+		case 'J':
+			opt->doc = sprintf_alloc(
+				"intent log size [at least %u]\n"
+				"> default: %u",
+				JGFS2_LOG_SIZE_MIN, JGFS2_LOG_SIZE_DEFAULT);
+			break;
+		
+		case 'W':
+			opt->doc =
+				"use the buffered (write-optimized) tree flavor for the meta "
+				"tree\n"
+				"> default: plain B+tree";
+			break;
 		case 'z':
 			opt->doc =
 				"zero-fill device area(s)\n"
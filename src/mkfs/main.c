@@ -6,6 +6,7 @@
 
 
 #include <err.h>
+#include <inttypes.h>
 #include "../../lib/jgfs2.h"
 #include "argp.h"
 
@@ -14,7 +15,22 @@ int main(int argc, char **argv) {
 	do_argp(argc, argv);
 	
 	jgfs2_new(dev_path, &mount_opt, &param);
-	warnx("TODO: report statistics");
+	
+	uint32_t blk_size, blk_total, blk_used;
+	jgfs2_stat(&blk_size, &blk_total, &blk_used);
+	
+	warnx("%" PRIu32 " blocks of %" PRIu32 " bytes, %" PRIu32 " in use",
+		blk_total, blk_size, blk_used);
+	
+	static const char *const tree_names[] = { "ext", "meta" };
+	for (int tree = JGFS2_TREE_EXT; tree <= JGFS2_TREE_META; ++tree) {
+		struct jgfs2_tree_stats stats;
+		jgfs2_tree_stats(tree, false, &stats);
+		
+		warnx("%s tree: height %" PRIu8 ", %" PRIu32 " nodes",
+			tree_names[tree], stats.height, stats.nodes);
+	}
+	
 	jgfs2_done();
 	
 	warnx("success");
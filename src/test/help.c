@@ -8,10 +8,15 @@
 #include "help.h"
 #include <err.h>
 #include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include "../../lib/jgfs2.h"
+#include "../../lib/tree.h"
 #include "../../lib/tree/check.h"
 #include "argp.h"
+#include "rand.h"
 
 
 void help_init(void) {
@@ -23,10 +28,19 @@ void help_init(void) {
 	jgfs2_init(param.dev_path, &mount_opt);
 }
 
-void help_new(void) {
+/// @brief makes a new filesystem and mounts it
+/// @param[in] opts  how it differs from the defaults
+void help_new_with(const struct help_new_opts *opts) {
 	struct jgfs2_mount_options mount_opt = {
 		.read_only = false,
 		.debug_map = param.debug_map,
+		
+		.index_levels = opts->index_levels,
+		.bloom_bits   = opts->bloom_bits,
+		
+		.check_level  = opts->check_level,
+		.check_sample = opts->check_sample,
+		.check_dirty  = opts->check_dirty,
 	};
 	struct jgfs2_mkfs_param mkfs_param = {
 		.uuid = { 0 },
@@ -38,6 +52,15 @@ void help_new(void) {
 		
 		.blk_size = 0,
 		
+		.meta_parts = opts->meta_parts,
+		
+		.ext_node_size  = opts->node_size,
+		.meta_node_size = opts->node_size,
+		
+		.meta_buffered = opts->meta_buffered,
+		
+		.log_size = opts->log_size,
+		
 		.zap_vbr  = true,
 		.zap_boot = true,
 	};
@@ -45,8 +68,166 @@ void help_new(void) {
 	jgfs2_new(param.dev_path, &mount_opt, &mkfs_param);
 }
 
+void help_new(void) {
+	help_new_with(&(struct help_new_opts){ 0 });
+}
+
+/// @brief reads the monotonic clock, for timing
+/// @return seconds since some fixed point
+double help_now(void) {
+	struct timespec ts;
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0) {
+		err(1, "clock_gettime failed");
+	}
+	
+	return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+/// @brief makes up a random set of items to fill trees with
+/// @param[out] items      items
+/// @param[in]  cnt        number of key ids
+/// @param[in]  len_max    longest item, other than overflow items
+/// @param[in]  ovf_every  key ids that are a multiple of this get overflow
+/// items instead, or 0 for none
+/// @param[in]  ovf_len    overflow item length
+void help_items_new(struct help_items *items, uint32_t cnt, uint32_t len_max,
+	uint32_t ovf_every, uint32_t ovf_len) {
+	items->cnt       = cnt;
+	items->len_max   = len_max;
+	items->ovf_every = ovf_every;
+	items->ovf_len   = (ovf_every != 0 ? ovf_len : 0);
+	
+	/* an item starts anywhere in the first len_max bytes */
+	uint32_t data_len = len_max + (items->ovf_len > len_max ?
+		items->ovf_len : len_max);
+	data_len = (data_len + 3) & ~3;
+	
+	items->data = malloc(data_len);
+	rand32_fill_range((uint32_t *)items->data, data_len / sizeof(uint32_t),
+		UINT32_MAX);
+	
+	items->key_ids = malloc(sizeof(uint32_t) * cnt);
+	rand32_permute_init(items->key_ids, cnt);
+	
+	items->item_lens = malloc(sizeof(uint32_t) * cnt);
+	rand32_fill_range(items->item_lens, cnt, len_max);
+}
+
+void help_items_free(struct help_items *items) {
+	free(items->item_lens);
+	free(items->key_ids);
+	free(items->data);
+}
+
+/// @brief makes up the item for a key id
+/// @param[in] items  items
+/// @param[in] id     key id
+/// @param[in] gen    how many times the item has been overwritten
+/// @return item data
+struct item_data help_item(const struct help_items *items, uint32_t id,
+	uint32_t gen) {
+	bool ovf = (items->ovf_every != 0 && id % items->ovf_every == 0);
+	
+	return (struct item_data){
+		.len  = (ovf ? items->ovf_len : items->item_lens[id]),
+		.data = items->data + ((id + gen) % items->len_max),
+	};
+}
+
+/// @brief inserts the items for a range of the insertion order
+/// @param[in] root_addr  block number of root node
+/// @param[in] items      items
+/// @param[in] first      first index into the insertion order
+/// @param[in] end        index past the last one
+/// @param[in] gen        how many times the items have been overwritten
+void help_items_insert(uint32_t root_addr, const struct help_items *items,
+	uint32_t first, uint32_t end, uint32_t gen) {
+	key the_key = {
+		0x00000000,
+		0x00,
+		0x00000000,
+	};
+	
+	for (uint32_t i = first; i < end; ++i) {
+		the_key.id = items->key_ids[i];
+		tree_insert(root_addr, &the_key, help_item(items, the_key.id, gen));
+	}
+}
+
+/// @brief removes the items for a range of the insertion order
+/// @param[in] root_addr  block number of root node
+/// @param[in] items      items
+/// @param[in] first      first index into the insertion order
+/// @param[in] end        index past the last one
+/// @return true if every item was there to be removed
+bool help_items_remove(uint32_t root_addr, const struct help_items *items,
+	uint32_t first, uint32_t end) {
+	key the_key = {
+		0x00000000,
+		0x00,
+		0x00000000,
+	};
+	
+	for (uint32_t i = first; i < end; ++i) {
+		the_key.id = items->key_ids[i];
+		FAIL_ON(tree_remove(root_addr, &the_key));
+	}
+	
+	return true;
+}
+
+/// @brief looks up the items for a range of the insertion order, and makes
+/// sure the ones that were removed are gone
+/// @param[in] root_addr  block number of root node
+/// @param[in] items      items
+/// @param[in] first      first index into the insertion order
+/// @param[in] end        index past the last one
+/// @param[in] removed    number of key ids (from the start of the insertion
+/// order) that were removed
+/// @param[in] gen        how many times the items that are left were
+/// overwritten
+/// @return true if every lookup came out as expected
+bool help_items_lookup(uint32_t root_addr, const struct help_items *items,
+	uint32_t first, uint32_t end, uint32_t removed, uint32_t gen) {
+	key the_key = {
+		0x00000000,
+		0x00,
+		0x00000000,
+	};
+	
+	uint32_t buf_len = (items->ovf_len > items->len_max ?
+		items->ovf_len : items->len_max);
+	uint8_t *buf = malloc(buf_len);
+	
+	bool result = true;
+	for (uint32_t i = first; i < end && result; ++i) {
+		the_key.id = items->key_ids[i];
+		
+		struct item_data item = help_item(items, the_key.id, gen);
+		
+		bool found = tree_retrieve(root_addr, &the_key, buf_len, buf);
+		if (found != (i >= removed)) {
+			warnx("retrieve %s: key %s", (found ? "succeeded" : "failed"),
+				key_str(&the_key));
+			result = false;
+		} else if (found && memcmp(buf, item.data, item.len) != 0) {
+			warnx("bad data: key %s", key_str(&the_key));
+			result = false;
+		}
+	}
+	
+	free(buf);
+	return result;
+}
+
 bool help_check_tree(uint32_t root_addr) {
 	struct check_result result = check_tree(root_addr);
 	check_print(result, false);
 	return (result.type == RESULT_TYPE_OK);
 }
+
+bool help_check_dirty(void) {
+	struct check_result result = check_dirty();
+	check_print(result, false);
+	return (result.type == RESULT_TYPE_OK);
+}
@@ -13,10 +13,59 @@
 	if (!(_cond)) { return false; }
 
 
+/* what a new filesystem should have other than the defaults; anything left
+ * zero keeps its default */
+struct help_new_opts {
+	/* mkfs parameters */
+	uint16_t meta_parts;    // meta tree partitions
+	uint32_t node_size;     // node size for both trees
+	bool     meta_buffered; // use the buffered flavor for the meta tree
+	uint32_t log_size;      // intent log size
+	
+	/* mount options */
+	uint8_t  index_levels;  // tree levels to keep indexed in memory
+	uint8_t  bloom_bits;    // Bloom filter bits per leaf item
+	uint8_t  check_level;   // enum jgfs2_check_level
+	uint32_t check_sample;  // sampled checks: one in this many operations
+	bool     check_dirty;   // keep track of nodes changed since the last check
+};
+
+/* items for a test to fill a tree with; key ids are 0 through cnt - 1, and
+ * each item's bytes are taken from somewhere in data, depending on its key id
+ * and how many times it has been overwritten */
+struct help_items {
+	uint32_t cnt;        // number of key ids
+	uint32_t *key_ids;   // insertion order of key ids
+	uint32_t *item_lens; // item length for each key id
+	uint8_t *data;       // item data
+	
+	uint32_t len_max;    // longest item, other than overflow items
+	uint32_t ovf_every;  // key ids that are a multiple of this get overflow
+	                     // items instead, or 0 for none
+	uint32_t ovf_len;    // overflow item length
+};
+
+
 void help_init(void);
 void help_new(void);
+void help_new_with(const struct help_new_opts *opts);
+
+double help_now(void);
+
+void help_items_new(struct help_items *items, uint32_t cnt, uint32_t len_max,
+	uint32_t ovf_every, uint32_t ovf_len);
+void help_items_free(struct help_items *items);
+struct item_data help_item(const struct help_items *items, uint32_t id,
+	uint32_t gen);
+void help_items_insert(uint32_t root_addr, const struct help_items *items,
+	uint32_t first, uint32_t end, uint32_t gen);
+bool help_items_remove(uint32_t root_addr, const struct help_items *items,
+	uint32_t first, uint32_t end);
+bool help_items_lookup(uint32_t root_addr, const struct help_items *items,
+	uint32_t first, uint32_t end, uint32_t removed, uint32_t gen);
 
 bool help_check_tree(uint32_t root_addr);
+bool help_check_dirty(void);
 
 
 #endif
@@ -13,7 +13,24 @@
 #include <sys/time.h>
 #include "../../lib/jgfs2.h"
 #include "argp.h"
+#include "tests/bloom.h"
+#include "tests/branch.h"
+#include "tests/buffer.h"
+#include "tests/check.h"
+#include "tests/concurrent.h"
+#include "tests/csum.h"
+#include "tests/dirty.h"
+#include "tests/ext.h"
+#include "tests/group.h"
+#include "tests/index.h"
 #include "tests/insert.h"
+#include "tests/item.h"
+#include "tests/level.h"
+#include "tests/log.h"
+#include "tests/node.h"
+#include "tests/overflow.h"
+#include "tests/stat.h"
+#include "tests/txn.h"
 
 
 unsigned long rep;
@@ -56,6 +73,40 @@ int main(int argc, char **argv) {
 	bool (*test_func)(uint32_t) = NULL;
 	if (strcasecmp(param.test_name, "insert") == 0) {
 		test_func = test_insert;
+	} else if (strcasecmp(param.test_name, "branch") == 0) {
+		test_func = test_branch;
+	} else if (strcasecmp(param.test_name, "concurrent") == 0) {
+		test_func = test_concurrent;
+	} else if (strcasecmp(param.test_name, "overflow") == 0) {
+		test_func = test_overflow;
+	} else if (strcasecmp(param.test_name, "item") == 0) {
+		test_func = test_item;
+	} else if (strcasecmp(param.test_name, "node") == 0) {
+		test_func = test_node;
+	} else if (strcasecmp(param.test_name, "index") == 0) {
+		test_func = test_index;
+	} else if (strcasecmp(param.test_name, "bloom") == 0) {
+		test_func = test_bloom;
+	} else if (strcasecmp(param.test_name, "buffer") == 0) {
+		test_func = test_buffer;
+	} else if (strcasecmp(param.test_name, "level") == 0) {
+		test_func = test_level;
+	} else if (strcasecmp(param.test_name, "stat") == 0) {
+		test_func = test_stat;
+	} else if (strcasecmp(param.test_name, "check") == 0) {
+		test_func = test_check;
+	} else if (strcasecmp(param.test_name, "csum") == 0) {
+		test_func = test_csum;
+	} else if (strcasecmp(param.test_name, "dirty") == 0) {
+		test_func = test_dirty;
+	} else if (strcasecmp(param.test_name, "txn") == 0) {
+		test_func = test_txn;
+	} else if (strcasecmp(param.test_name, "log") == 0) {
+		test_func = test_log;
+	} else if (strcasecmp(param.test_name, "ext") == 0) {
+		test_func = test_ext;
+	} else if (strcasecmp(param.test_name, "group") == 0) {
+		test_func = test_group;
 	} else {
 		errx(1, "test does not exist: '%s'", param.test_name);
 	}
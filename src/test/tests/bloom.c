@@ -0,0 +1,89 @@
+/* jgfs2
+ * (c) 2013 Justin Gottula
+ * The source code of this project is distributed under the terms of the
+ * simplified BSD license. See the LICENSE file for details.
+ */
+
+
+#include "bloom.h"
+#include <err.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "../../../lib/fs.h"
+#include "../../../lib/tree.h"
+#include "../argp.h"
+#include "../help.h"
+#include "../rand.h"
+
+
+#define ITEM_LEN_MAX 8
+
+/* filter density to try besides none at all */
+#define BLOOM_BITS 10
+
+
+/// @brief fills a fresh tree, looks up keys that are there and keys that
+/// aren't, then empties half of it and does it all again
+/// @param[in] bloom_bits  filter bits per item
+/// @param[in] items       items, of which only the second half is inserted
+/// @return true if the tree checks out and every lookup comes out right
+static bool run_bits(uint8_t bloom_bits, const struct help_items *items) {
+	help_new_with(&(struct help_new_opts){ .bloom_bits = bloom_bits });
+	uint32_t meta = fs.sblk->s_addr_meta_tree;
+	
+	/* the first half of the key ids are never inserted, so that there are
+	 * keys to miss on */
+	uint32_t cnt = items->cnt / 2;
+	help_items_insert(meta, items, cnt, cnt * 2, 0);
+	
+	FAIL_ON(help_check_tree(meta));
+	
+	double time_begin = help_now();
+	FAIL_ON(help_items_lookup(meta, items, cnt, cnt * 2, cnt, 0));
+	double time_hit = help_now() - time_begin;
+	
+	time_begin = help_now();
+	FAIL_ON(help_items_lookup(meta, items, 0, cnt, cnt, 0));
+	double time_miss = help_now() - time_begin;
+	
+	struct leaf_bloom_stats stats = leaf_bloom_stats();
+	fprintf(stderr, "bits %2" PRIu8 ": filters %" PRIu32 " footprint %zu "
+		"hit %.0f ops/s miss %.0f ops/s\n", bloom_bits, stats.filters,
+		stats.footprint, cnt / time_hit, cnt / time_miss);
+	fprintf(stderr, "bits %2" PRIu8 ": queries %" PRIu64 " negatives %" PRIu64
+		" false positives %" PRIu64 " rebuilds %" PRIu64 "\n", bloom_bits,
+		stats.queries, stats.negatives, stats.false_pos, stats.rebuilds);
+	
+	if (bloom_bits != 0) {
+		/* nearly all of the misses should have been caught by a filter */
+		FAIL_ON(stats.filters != 0);
+		FAIL_ON(stats.false_pos < cnt / 16);
+	}
+	
+	/* removals leave stale bits behind until the filters are rebuilt */
+	uint32_t removed = cnt + (cnt / 2);
+	FAIL_ON(help_items_remove(meta, items, cnt, removed));
+	
+	FAIL_ON(help_check_tree(meta));
+	FAIL_ON(help_items_lookup(meta, items, 0, cnt * 2, removed, 0));
+	
+	jgfs2_done();
+	return true;
+}
+
+bool test_bloom(uint32_t cnt) {
+	srand48(param.rand_seed);
+	
+	cnt = (1 << cnt);
+	
+	struct help_items items;
+	help_items_new(&items, cnt * 2, ITEM_LEN_MAX, 0, 0);
+	
+	FAIL_ON(run_bits(0, &items));
+	FAIL_ON(run_bits(BLOOM_BITS, &items));
+	
+	help_items_free(&items);
+	
+	return true;
+}
@@ -0,0 +1,161 @@
+/* jgfs2
+ * (c) 2013 Justin Gottula
+ * The source code of this project is distributed under the terms of the
+ * simplified BSD license. See the LICENSE file for details.
+ */
+
+
+#include "branch.h"
+#include <err.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../../lib/fs.h"
+#include "../../../lib/tree.h"
+#include "../argp.h"
+#include "../help.h"
+#include "../rand.h"
+
+
+/* keys are drawn from a small space so that many share everything but the low
+ * byte of off, which is the slow path in the normalized search */
+#define KEY_ID_MAX   0x3f
+#define KEY_TYPE_MAX 0x03
+#define KEY_OFF_MAX  0x3ff
+
+
+static key rand_key(void) {
+	return (key){
+		.id   = rand32_range(KEY_ID_MAX),
+		.type = rand32_range(KEY_TYPE_MAX),
+		.off  = rand32_range(KEY_OFF_MAX),
+	};
+}
+
+static int ref_cmp(const void *lhs, const void *rhs) {
+	return key_cmp(&((const node_ref *)lhs)->key,
+		&((const node_ref *)rhs)->key);
+}
+
+/* the search used with the old layout of packed node_refs */
+static uint32_t branch_search_packed(const node_ref *elems, uint32_t cnt,
+	const key *key) {
+	if (key_cmp(&elems[0].key, key) > 0) {
+		return elems[0].addr;
+	}
+	
+	uint32_t first = 0;
+	uint32_t last  = cnt - 1;
+	uint32_t middle;
+	
+	while (first <= last) {
+		middle = CEIL(first + last, 2);
+		
+		int8_t cmp = key_cmp(&elems[middle].key, key);
+		
+		if (cmp < 0) {
+			if (middle == cnt - 1 || key_cmp(&elems[middle + 1].key, key) > 0) {
+				return elems[middle].addr;
+			} else {
+				first = middle + 1;
+			}
+		} else if (cmp > 0) {
+			last = middle - 1;
+		} else {
+			return elems[middle].addr;
+		}
+	}
+	
+	errx(1, "%s: total failure", __func__);
+}
+
+bool test_branch(uint32_t cnt) {
+	srand48(param.rand_seed);
+	
+	help_new();
+	
+	cnt = (1 << cnt);
+	
+	/* a standalone branch the size of a meta tree node */
+	uint32_t size_blk = fs.sblk->s_meta_node_blk;
+	node_ptr branch = aligned_alloc(64, size_blk * fs.blk_size);
+	memset(branch, 0, size_blk * fs.blk_size);
+	branch->hdr.leaf     = false;
+	branch->hdr.size_blk = size_blk;
+	
+	uint32_t fanout_packed = node_size_usable(branch) / sizeof(node_ref);
+	uint32_t fanout        = branch_cap(branch);
+	
+	fprintf(stderr, "impl %s fanout %" PRIu32 " (packed %" PRIu32 ")\n",
+		branch_search_impl(), fanout, fanout_packed);
+	
+	/* the same sorted, unique keys in both layouts */
+	node_ref *elems = malloc(sizeof(node_ref) * fanout);
+	uint32_t elem_cnt = 0;
+	while (elem_cnt < fanout) {
+		elems[elem_cnt].key  = rand_key();
+		elems[elem_cnt].addr = elem_cnt + 1;
+		
+		++elem_cnt;
+		
+		qsort(elems, elem_cnt, sizeof(node_ref), ref_cmp);
+		for (uint32_t i = 1; i < elem_cnt; ++i) {
+			if (key_cmp(&elems[i - 1].key, &elems[i].key) == 0) {
+				memmove(elems + i, elems + i + 1,
+					sizeof(node_ref) * (elem_cnt - (i + 1)));
+				--elem_cnt;
+				break;
+			}
+		}
+	}
+	
+	branch->hdr.cnt = fanout;
+	for (uint32_t i = 0; i < fanout; ++i) {
+		node_elem_fill(branch, i, &elems[i].key,
+			(union elem_payload){ .b_addr = elems[i].addr });
+	}
+	
+	key *keys = malloc(sizeof(key) * cnt);
+	for (uint32_t i = 0; i < cnt; ++i) {
+		keys[i] = rand_key();
+	}
+	
+	warnx("comparing against packed layout");
+	for (uint32_t i = 0; i < cnt; ++i) {
+		uint32_t expect = branch_search_packed(elems, fanout, keys + i);
+		uint32_t actual = branch_search(branch, keys + i);
+		
+		if (actual != expect) {
+			warnx("mismatch: key %s expect %" PRIu32 " actual %" PRIu32,
+				key_str(keys + i), expect, actual);
+			return false;
+		}
+	}
+	
+	/* keep the compiler from throwing the results away */
+	volatile uint32_t sink = 0;
+	
+	double t_begin = help_now();
+	for (uint32_t i = 0; i < cnt; ++i) {
+		sink += branch_search_packed(elems, fanout, keys + i);
+	}
+	double t_packed = help_now() - t_begin;
+	
+	t_begin = help_now();
+	for (uint32_t i = 0; i < cnt; ++i) {
+		sink += branch_search(branch, keys + i);
+	}
+	double t_split = help_now() - t_begin;
+	
+	fprintf(stderr, "lookups %" PRIu32 ": packed %.1f ns split %.1f ns "
+		"(%.2fx)\n", cnt, (t_packed * 1e9) / cnt, (t_split * 1e9) / cnt,
+		t_packed / t_split);
+	
+	free(keys);
+	free(branch);
+	free(elems);
+	
+	jgfs2_done();
+	return true;
+}
@@ -0,0 +1,113 @@
+/* jgfs2
+ * (c) 2013 Justin Gottula
+ * The source code of this project is distributed under the terms of the
+ * simplified BSD license. See the LICENSE file for details.
+ */
+
+
+#include "buffer.h"
+#include <err.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "../../../lib/fs.h"
+#include "../../../lib/tree.h"
+#include "../argp.h"
+#include "../help.h"
+#include "../rand.h"
+
+
+#define ITEM_LEN_MAX 64
+
+/* every so often, an item is made too big to keep inline, so that overflow
+ * extents travel through the buffers too */
+#define ITEM_OVF_EVERY 64
+#define ITEM_OVF_LEN   1000
+
+
+/// @brief fills a fresh tree of one flavor or the other, overwrites some of
+/// it, then empties half of it, reading it back after each step
+/// @param[in] buffered  make the tree buffered
+/// @param[in] items     items
+/// @return true if the tree checks out and every lookup comes out right
+static bool run_flavor(bool buffered, const struct help_items *items) {
+	help_new_with(&(struct help_new_opts){ .meta_buffered = buffered });
+	uint32_t meta = fs.sblk->s_addr_meta_tree;
+	uint32_t cnt = items->cnt;
+	
+	FAIL_ON(tree_buffered(meta) == buffered);
+	
+	double time_begin = help_now();
+	help_items_insert(meta, items, 0, cnt, 0);
+	double time_insert = help_now() - time_begin;
+	
+	FAIL_ON(help_check_tree(meta));
+	
+	time_begin = help_now();
+	FAIL_ON(help_items_lookup(meta, items, 0, cnt, 0, 0));
+	double time_lookup = help_now() - time_begin;
+	
+	fprintf(stderr, "%s: insert %.0f ops/s lookup %.0f ops/s\n",
+		(buffered ? "buffered" : "plain"), cnt / time_insert,
+		cnt / time_lookup);
+	
+	/* only a buffered tree takes an insert of an existing key as an update */
+	uint32_t gen = 0;
+	if (buffered) {
+		gen = 1;
+		help_items_insert(meta, items, 0, cnt, gen);
+		
+		FAIL_ON(help_check_tree(meta));
+		FAIL_ON(help_items_lookup(meta, items, 0, cnt, 0, gen));
+	}
+	
+	/* the second time around, the removals have to see the first ones, even
+	 * while they are still on their way down */
+	uint32_t removed = cnt / 2;
+	FAIL_ON(help_items_remove(meta, items, 0, removed));
+	
+	key the_key = {
+		0x00000000,
+		0x00,
+		0x00000000,
+	};
+	
+	for (uint32_t i = 0; i < removed; ++i) {
+		the_key.id = items->key_ids[i];
+		FAIL_ON(!tree_remove(meta, &the_key));
+	}
+	
+	FAIL_ON(help_check_tree(meta));
+	FAIL_ON(help_items_lookup(meta, items, 0, cnt, removed, gen));
+	
+	/* key ids are 0 through cnt - 1; a buffered tree may overshoot */
+	uint32_t last_id = 0;
+	for (uint32_t i = removed; i < cnt; ++i) {
+		if (items->key_ids[i] > last_id) {
+			last_id = items->key_ids[i];
+		}
+	}
+	
+	key last;
+	FAIL_ON(tree_last_key(meta, &last));
+	FAIL_ON(buffered ? last.id >= last_id : last.id == last_id);
+	
+	jgfs2_done();
+	return true;
+}
+
+bool test_buffer(uint32_t cnt) {
+	srand48(param.rand_seed);
+	
+	cnt = (1 << cnt);
+	
+	struct help_items items;
+	help_items_new(&items, cnt, ITEM_LEN_MAX, ITEM_OVF_EVERY, ITEM_OVF_LEN);
+	
+	FAIL_ON(run_flavor(false, &items));
+	FAIL_ON(run_flavor(true, &items));
+	
+	help_items_free(&items);
+	
+	return true;
+}
@@ -0,0 +1,111 @@
+/* jgfs2
+ * (c) 2013 Justin Gottula
+ * The source code of this project is distributed under the terms of the
+ * simplified BSD license. See the LICENSE file for details.
+ */
+
+
+#include "check.h"
+#include <err.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "../../../lib/fs.h"
+#include "../../../lib/tree.h"
+#include "../argp.h"
+#include "../help.h"
+#include "../rand.h"
+
+
+#define ITEM_LEN_MAX 64
+
+/* small enough that even short runs get a fair number of sampled operations */
+#define CHECK_SAMPLE 16
+
+
+static const char *level_names[] = {
+	[JGFS2_CHECK_OFF]     = "off",
+	[JGFS2_CHECK_HEADER]  = "header",
+	[JGFS2_CHECK_SAMPLED] = "sampled",
+	[JGFS2_CHECK_FULL]    = "full",
+};
+
+
+static double per_check(struct jgfs2_check_counter counter) {
+	return (counter.checks != 0 ? (double)counter.nsec / counter.checks : 0.);
+}
+
+/// @brief inserts, looks up and removes items at one check level, then makes
+/// sure the counters show the checks that level calls for, and no others
+/// @param[in] level  check level (enum jgfs2_check_level)
+/// @param[in] items  items
+/// @return true if the counters add up
+static bool run_level(uint8_t level, const struct help_items *items) {
+	help_new_with(&(struct help_new_opts){
+		.check_level  = level,
+		.check_sample = CHECK_SAMPLE,
+	});
+	uint32_t meta = fs.sblk->s_addr_meta_tree;
+	uint32_t cnt = items->cnt;
+	
+	double time_begin = help_now();
+	help_items_insert(meta, items, 0, cnt, 0);
+	FAIL_ON(help_items_lookup(meta, items, 0, cnt, 0, 0));
+	FAIL_ON(help_items_remove(meta, items, 0, cnt / 2));
+	double time_ops = help_now() - time_begin;
+	
+	/* every operation comes to at least one node */
+	uint64_t ops = cnt + cnt + (cnt / 2);
+	
+	FAIL_ON(help_check_tree(meta));
+	
+	struct jgfs2_check_stats stats;
+	jgfs2_check_stats(&stats);
+	
+	fprintf(stderr, "%-7s: %.0f ops/s header %" PRIu64 " (%.0f ns) sampled %"
+		PRIu64 " (%.0f ns) full %" PRIu64 " (%.0f ns)\n", level_names[level],
+		ops / time_ops, stats.header.checks, per_check(stats.header),
+		stats.sampled.checks, per_check(stats.sampled), stats.full.checks,
+		per_check(stats.full));
+	
+	/* a build that leaves out a level does less than that level asks for */
+	if (level > CHECK_LEVEL_MAX) {
+		level = CHECK_LEVEL_MAX;
+	}
+	
+	FAIL_ON((stats.header.checks != 0) == (level >= JGFS2_CHECK_HEADER));
+	FAIL_ON((stats.sampled.checks != 0) == (level == JGFS2_CHECK_SAMPLED));
+	FAIL_ON((stats.full.checks != 0) == (level == JGFS2_CHECK_FULL));
+	
+	/* header checks are counted in batches that may not be full yet */
+	if (level >= JGFS2_CHECK_HEADER) {
+		FAIL_ON(stats.header.checks + 64 >= ops);
+	}
+	if (level == JGFS2_CHECK_SAMPLED) {
+		FAIL_ON(stats.sampled.checks >= ops / CHECK_SAMPLE);
+		FAIL_ON(stats.sampled.checks < stats.header.checks);
+	}
+	if (level == JGFS2_CHECK_FULL) {
+		FAIL_ON(stats.full.checks >= ops);
+	}
+	
+	jgfs2_done();
+	return true;
+}
+
+bool test_check(uint32_t cnt) {
+	srand48(param.rand_seed);
+	
+	cnt = (1 << cnt);
+	
+	struct help_items items;
+	help_items_new(&items, cnt, ITEM_LEN_MAX, 0, 0);
+	
+	for (uint8_t level = JGFS2_CHECK_OFF; level <= JGFS2_CHECK_FULL; ++level) {
+		FAIL_ON(run_level(level, &items));
+	}
+	
+	help_items_free(&items);
+	
+	return true;
+}
@@ -0,0 +1,493 @@
+/* jgfs2
+ * (c) 2013 Justin Gottula
+ * The source code of this project is distributed under the terms of the
+ * simplified BSD license. See the LICENSE file for details.
+ */
+
+
+#include "concurrent.h"
+#include <err.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../../../lib/fs.h"
+#include "../../../lib/meta.h"
+#include "../../../lib/tree.h"
+#include "../argp.h"
+#include "../help.h"
+#include "../rand.h"
+
+
+/* each thread works within its own range of key ids, which is also its own
+ * meta tree partition when there are enough of them */
+#define THREAD_ID_SHIFT 26
+#define THREAD_MAX      (1 << (32 - THREAD_ID_SHIFT))
+
+/* creates are run with at least this many threads, even on fewer cpus, to
+ * have them contend for the id allocator */
+#define CREATE_THREADS  4
+
+
+struct worker {
+	pthread_t thread;
+	
+	uint32_t thread_num;
+	uint32_t cnt;
+	
+	/* mrand48 is not thread-safe, so all randomness is generated up front */
+	uint32_t *key_ids;
+	uint32_t *item_lens;
+	
+	uint8_t *data;
+	
+	/* key ids handed out by meta_alloc_id, in the create phase */
+	uint32_t *new_ids;
+	
+	pthread_barrier_t *barrier;
+	
+	bool ok;
+};
+
+
+/* inserts and removes items in every thread's key id range, to have lookups
+ * run alongside; its keys have a type of their own, so they are never the
+ * ones being looked up */
+struct writer {
+	pthread_t thread;
+	
+	uint32_t thread_cnt;
+	uint32_t per;
+	
+	bool stop;
+	uint64_t ops;
+};
+
+
+static uint8_t data[4096];
+
+
+static void *worker_main(void *arg) {
+	struct worker *w = arg;
+	
+	key the_key = {
+		0x00000000,
+		0x00,
+		0x00000000,
+	};
+	
+	/* phase 1: insert every key */
+	pthread_barrier_wait(w->barrier);
+	for (uint32_t i = 0; i < w->cnt; ++i) {
+		uint32_t idx = w->key_ids[i];
+		the_key.id = (w->thread_num << THREAD_ID_SHIFT) | idx;
+		
+		tree_insert(meta_root(the_key.id), &the_key,
+			(struct item_data){ .len = w->item_lens[idx], .data = w->data });
+	}
+	pthread_barrier_wait(w->barrier);
+	
+	/* phase 2: remove the odd keys */
+	pthread_barrier_wait(w->barrier);
+	for (uint32_t i = 0; i < w->cnt; ++i) {
+		uint32_t idx = w->key_ids[i];
+		if (idx % 2 == 0) {
+			continue;
+		}
+		
+		the_key.id = (w->thread_num << THREAD_ID_SHIFT) | idx;
+		
+		if (!tree_remove(meta_root(the_key.id), &the_key)) {
+			warnx("remove failed: thread %" PRIu32 " idx %" PRIu32,
+				w->thread_num, idx);
+			w->ok = false;
+		}
+	}
+	pthread_barrier_wait(w->barrier);
+	
+	/* phase 3: look up the remaining keys, and then (phase 4) do it again
+	 * while the writer is busy */
+	uint8_t buf[4096];
+	for (uint8_t phase = 3; phase <= 4; ++phase) {
+		pthread_barrier_wait(w->barrier);
+		for (uint32_t i = 0; i < w->cnt; ++i) {
+			uint32_t idx = w->key_ids[i];
+			if (idx % 2 != 0) {
+				continue;
+			}
+			
+			the_key.id = (w->thread_num << THREAD_ID_SHIFT) | idx;
+			
+			if (!tree_retrieve(meta_root(the_key.id), &the_key, sizeof(buf),
+				buf)) {
+				warnx("lookup failed: phase %" PRIu8 " thread %" PRIu32
+					" idx %" PRIu32, phase, w->thread_num, idx);
+				w->ok = false;
+			}
+		}
+		pthread_barrier_wait(w->barrier);
+	}
+	
+	return NULL;
+}
+
+static void *writer_main(void *arg) {
+	struct writer *wr = arg;
+	
+	key the_key = {
+		0x00000000,
+		0x01,
+		0x00000000,
+	};
+	
+	uint32_t total = wr->thread_cnt * wr->per;
+	while (!__atomic_load_n(&wr->stop, __ATOMIC_RELAXED)) {
+		uint32_t end = 0;
+		while (end < total && !__atomic_load_n(&wr->stop, __ATOMIC_RELAXED)) {
+			the_key.id = ((end % wr->thread_cnt) << THREAD_ID_SHIFT) |
+				(end / wr->thread_cnt);
+			
+			tree_insert(meta_root(the_key.id), &the_key,
+				(struct item_data){ .len = 100, .data = data });
+			++end;
+		}
+		
+		for (uint32_t i = 0; i < end; ++i) {
+			the_key.id = ((i % wr->thread_cnt) << THREAD_ID_SHIFT) |
+				(i / wr->thread_cnt);
+			
+			tree_remove(meta_root(the_key.id), &the_key);
+		}
+		
+		wr->ops += end * 2;
+	}
+	
+	return NULL;
+}
+
+/* creates items under whatever key ids the allocator picks for this cpu */
+static void *create_main(void *arg) {
+	struct worker *w = arg;
+	
+	key the_key = {
+		0x00000000,
+		0x00,
+		0x00000000,
+	};
+	
+	pthread_barrier_wait(w->barrier);
+	for (uint32_t i = 0; i < w->cnt; ++i) {
+		the_key.id = w->new_ids[i] = meta_alloc_id();
+		
+		tree_insert(meta_root(the_key.id), &the_key,
+			(struct item_data){ .len = w->item_lens[i], .data = w->data });
+	}
+	pthread_barrier_wait(w->barrier);
+	
+	return NULL;
+}
+
+static int id_cmp(const void *lhs, const void *rhs) {
+	uint32_t l = *(const uint32_t *)lhs, r = *(const uint32_t *)rhs;
+	return (l > r) - (l < r);
+}
+
+static bool verify(struct worker *w) {
+	key the_key = {
+		0x00000000,
+		0x00,
+		0x00000000,
+	};
+	
+	uint8_t buf[4096];
+	for (uint32_t idx = 0; idx < w->cnt; ++idx) {
+		the_key.id = (w->thread_num << THREAD_ID_SHIFT) | idx;
+		
+		bool found = tree_retrieve(meta_root(the_key.id), &the_key,
+			sizeof(buf), buf);
+		if (found != (idx % 2 == 0)) {
+			warnx("%s: thread %" PRIu32 " idx %" PRIu32, (found ?
+				"removed item found" : "item missing"), w->thread_num, idx);
+			return false;
+		}
+		
+		if (found && memcmp(buf, data, w->item_lens[idx]) != 0) {
+			warnx("bad data: thread %" PRIu32 " idx %" PRIu32,
+				w->thread_num, idx);
+			return false;
+		}
+	}
+	
+	return true;
+}
+
+static bool check_parts(void) {
+	for (uint32_t i = 0; i < meta_part_cnt(); ++i) {
+		FAIL_ON(help_check_tree(meta_part_root(i)));
+	}
+	
+	return true;
+}
+
+/// @brief runs one round of inserts and removals with a given thread count
+/// @param[in]  meta_parts  number of meta tree partitions
+/// @param[in]  thread_cnt  number of worker threads
+/// @param[in]  cnt         total number of items
+/// @param[out] ops_sec     throughput of the modifying phases and of the
+/// lookup phase
+/// @return false if the tree was found to be inconsistent afterward
+static bool run_threads(uint16_t meta_parts, uint32_t thread_cnt,
+	uint32_t cnt, double ops_sec[2]) {
+	help_new_with(&(struct help_new_opts){ .meta_parts = meta_parts });
+	FAIL_ON(check_parts());
+	
+	pthread_barrier_t barrier;
+	pthread_barrier_init(&barrier, NULL, thread_cnt + 1);
+	
+	struct worker *workers = calloc(thread_cnt, sizeof(struct worker));
+	for (uint32_t t = 0; t < thread_cnt; ++t) {
+		struct worker *w = workers + t;
+		
+		w->thread_num = t;
+		w->cnt        = cnt / thread_cnt;
+		w->data       = data;
+		w->barrier    = &barrier;
+		w->ok         = true;
+		
+		w->key_ids = malloc(sizeof(uint32_t) * w->cnt);
+		rand32_permute_init(w->key_ids, w->cnt);
+		
+		w->item_lens = malloc(sizeof(uint32_t) * w->cnt);
+		rand32_fill_range(w->item_lens, w->cnt, 400);
+		
+		if ((errno = pthread_create(&w->thread, NULL, worker_main, w)) != 0) {
+			err(1, "pthread_create failed");
+		}
+	}
+	
+	pthread_barrier_wait(&barrier);
+	double t_begin = help_now();
+	pthread_barrier_wait(&barrier);
+	double t_insert = help_now() - t_begin;
+	
+	pthread_barrier_wait(&barrier);
+	t_begin = help_now();
+	pthread_barrier_wait(&barrier);
+	double t_remove = help_now() - t_begin;
+	
+	pthread_barrier_wait(&barrier);
+	t_begin = help_now();
+	pthread_barrier_wait(&barrier);
+	double t_lookup = help_now() - t_begin;
+	
+	struct writer writer = {
+		.thread_cnt = thread_cnt,
+		.per        = cnt / thread_cnt,
+	};
+	if ((errno = pthread_create(&writer.thread, NULL, writer_main,
+		&writer)) != 0) {
+		err(1, "pthread_create failed");
+	}
+	
+	struct tree_search_stats search = tree_search_stats();
+	
+	pthread_barrier_wait(&barrier);
+	t_begin = help_now();
+	pthread_barrier_wait(&barrier);
+	double t_busy = help_now() - t_begin;
+	
+	struct tree_search_stats busy = tree_search_stats();
+	
+	__atomic_store_n(&writer.stop, true, __ATOMIC_RELAXED);
+	pthread_join(writer.thread, NULL);
+	
+	for (uint32_t t = 0; t < thread_cnt; ++t) {
+		pthread_join(workers[t].thread, NULL);
+	}
+	pthread_barrier_destroy(&barrier);
+	
+	uint32_t ops = (cnt / thread_cnt) * thread_cnt;
+	ops_sec[0] = (ops + (ops / 2)) / (t_insert + t_remove);
+	ops_sec[1] = (ops / 2) / t_lookup;
+	
+	fprintf(stderr, "parts %2" PRIu16 " threads %2" PRIu32 ": insert %.3fs "
+		"remove %.3fs (%.0f ops/s) lookup %.3fs (%.0f ops/s)\n", meta_parts,
+		thread_cnt, t_insert, t_remove, ops_sec[0], t_lookup, ops_sec[1]);
+	
+	/* lookups only have to take latches when they keep running into the
+	 * nodes the writer is changing, not just because it is around */
+	uint64_t retries = busy.retries - search.retries;
+	uint64_t latched = busy.latched - search.latched;
+	fprintf(stderr, "parts %2" PRIu16 " threads %2" PRIu32 ": lookup with "
+		"writer %.3fs (%.0f ops/s, writer %.0f ops/s) %" PRIu64 " retries %"
+		PRIu64 " latched\n", meta_parts, thread_cnt, t_busy,
+		(ops / 2) / t_busy, writer.ops / t_busy, retries, latched);
+	
+	bool result = check_parts();
+	if (latched * 8 > ops / 2) {
+		warnx("%" PRIu64 " of %" PRIu32 " lookups with a writer took latches",
+			latched, ops / 2);
+		result = false;
+	}
+	for (uint32_t t = 0; t < thread_cnt; ++t) {
+		struct worker *w = workers + t;
+		
+		if (result) {
+			result = (w->ok && verify(w));
+		}
+		
+		free(w->key_ids);
+		free(w->item_lens);
+	}
+	free(workers);
+	
+	jgfs2_done();
+	return result;
+}
+
+/// @brief has threads create items under key ids from meta_alloc_id, and makes
+/// sure that no id was handed out twice, even after a remount
+/// @param[in] meta_parts  number of meta tree partitions
+/// @param[in] thread_cnt  number of worker threads
+/// @param[in] cnt         total number of items
+/// @return false if an id was reused or an item went missing
+static bool run_creates(uint16_t meta_parts, uint32_t thread_cnt,
+	uint32_t cnt) {
+	help_new_with(&(struct help_new_opts){ .meta_parts = meta_parts });
+	
+	pthread_barrier_t barrier;
+	pthread_barrier_init(&barrier, NULL, thread_cnt + 1);
+	
+	uint32_t per = cnt / thread_cnt, total = per * thread_cnt;
+	uint32_t *ids = malloc(sizeof(uint32_t) * total);
+	
+	struct worker *workers = calloc(thread_cnt, sizeof(struct worker));
+	for (uint32_t t = 0; t < thread_cnt; ++t) {
+		struct worker *w = workers + t;
+		
+		w->thread_num = t;
+		w->cnt        = per;
+		w->data       = data;
+		w->new_ids    = ids + (t * per);
+		w->barrier    = &barrier;
+		
+		w->item_lens = malloc(sizeof(uint32_t) * w->cnt);
+		rand32_fill_range(w->item_lens, w->cnt, 400);
+		
+		if ((errno = pthread_create(&w->thread, NULL, create_main, w)) != 0) {
+			err(1, "pthread_create failed");
+		}
+	}
+	
+	pthread_barrier_wait(&barrier);
+	double t_begin = help_now();
+	pthread_barrier_wait(&barrier);
+	double t_create = help_now() - t_begin;
+	
+	for (uint32_t t = 0; t < thread_cnt; ++t) {
+		pthread_join(workers[t].thread, NULL);
+		free(workers[t].item_lens);
+	}
+	free(workers);
+	pthread_barrier_destroy(&barrier);
+	
+	qsort(ids, total, sizeof(*ids), id_cmp);
+	
+	uint32_t parts_used = 0;
+	for (uint32_t i = 0; i < total; ++i) {
+		if (i != 0 && ids[i] == ids[i - 1]) {
+			warnx("id handed out twice: 0x%08" PRIx32, ids[i]);
+			return false;
+		}
+		
+		if (i == 0 || meta_part_of(ids[i]) != meta_part_of(ids[i - 1])) {
+			++parts_used;
+		}
+	}
+	
+	fprintf(stderr, "parts %2" PRIu16 " threads %2" PRIu32 ": create %.3fs "
+		"(%.0f ops/s) in %" PRIu32 " parts\n", meta_parts, thread_cnt,
+		t_create, total / t_create, parts_used);
+	
+	FAIL_ON(check_parts());
+	
+	/* the allocator's hints are worked out again from the trees at mount */
+	jgfs2_done();
+	help_init();
+	
+	uint8_t buf[4096];
+	for (uint32_t i = 0; i < total; ++i) {
+		key the_key = {
+			ids[i],
+			0x00,
+			0x00000000,
+		};
+		
+		FAIL_ON(tree_retrieve(meta_root(ids[i]), &the_key, sizeof(buf), buf));
+	}
+	
+	for (uint32_t i = 0; i < thread_cnt; ++i) {
+		uint32_t id = meta_alloc_id();
+		FAIL_ON(bsearch(&id, ids, total, sizeof(*ids), id_cmp) == NULL);
+	}
+	
+	free(ids);
+	
+	jgfs2_done();
+	return true;
+}
+
+bool test_concurrent(uint32_t cnt) {
+	srand48(param.rand_seed);
+	
+	rand32_fill_range((uint32_t *)data, sizeof(data) / sizeof(uint32_t),
+		UINT32_MAX);
+	
+	cnt = (1 << cnt);
+	
+	long nproc = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nproc < 1) {
+		nproc = 1;
+	}
+	
+	fprintf(stderr, "total %" PRIu32 " cpus %ld\n", cnt, nproc);
+	
+	if (nproc > THREAD_MAX) {
+		nproc = THREAD_MAX;
+	}
+	
+	/* a single meta tree, and then one partition per thread */
+	uint16_t meta_parts[] = { 1, JGFS2_LIMIT_META_PART };
+	for (size_t i = 0; i < sizeof(meta_parts) / sizeof(*meta_parts); ++i) {
+		/* powers of two, plus the number of cpus if it isn't one */
+		double base[2] = { 0., 0. };
+		for (uint32_t thread_cnt = 1; thread_cnt <= (uint32_t)nproc; ) {
+			double ops_sec[2];
+			FAIL_ON(run_threads(meta_parts[i], thread_cnt, cnt, ops_sec));
+			
+			if (thread_cnt == 1) {
+				base[0] = ops_sec[0];
+				base[1] = ops_sec[1];
+			} else {
+				fprintf(stderr, "parts %2" PRIu16 " threads %2" PRIu32
+					": speedup %.2fx lookup speedup %.2fx\n", meta_parts[i],
+					thread_cnt, ops_sec[0] / base[0], ops_sec[1] / base[1]);
+			}
+			
+			if (thread_cnt < (uint32_t)nproc &&
+				thread_cnt * 2 > (uint32_t)nproc) {
+				thread_cnt = nproc;
+			} else {
+				thread_cnt *= 2;
+			}
+		}
+		
+		FAIL_ON(run_creates(meta_parts[i],
+			(nproc < CREATE_THREADS ? CREATE_THREADS : nproc), cnt));
+	}
+	
+	return true;
+}
@@ -0,0 +1,143 @@
+/* jgfs2
+ * (c) 2013 Justin Gottula
+ * The source code of this project is distributed under the terms of the
+ * simplified BSD license. See the LICENSE file for details.
+ */
+
+
+#include "csum.h"
+#include <err.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../../lib/crc.h"
+#include "../../../lib/fs.h"
+#include "../../../lib/tree.h"
+#include "../argp.h"
+#include "../help.h"
+#include "../rand.h"
+
+
+#define ITEM_LEN_MAX 64
+
+#define CRC_BUF_LEN 4096
+
+
+/// @brief makes sure the CRC-32C implementation gives the standard check
+/// value, and gives the same answer however a buffer is split up
+/// @return true if it does
+static bool crc_sane(void) {
+	FAIL_ON(crc32c(0, "123456789", 9) == UINT32_C(0xe3069283));
+	
+	uint8_t buf[CRC_BUF_LEN];
+	rand32_fill_range((uint32_t *)buf, sizeof(buf) / sizeof(uint32_t),
+		UINT32_MAX);
+	
+	/* odd lengths and offsets exercise the unaligned head and tail */
+	for (uint32_t i = 0; i < 64; ++i) {
+		uint32_t off = lrand48() % 16;
+		uint32_t len = lrand48() % (CRC_BUF_LEN - off);
+		uint32_t cut = lrand48() % (len + 1);
+		
+		uint32_t whole = crc32c(0, buf + off, len);
+		uint32_t parts = crc32c(crc32c(0, buf + off, cut), buf + off + cut,
+			len - cut);
+		
+		FAIL_ON(whole == parts);
+	}
+	
+	return true;
+}
+
+/// @brief checks the stored checksum of every node in a tree, one level at a
+/// time
+/// @param[in] root_addr  block number of root node
+/// @return number of nodes checked, or 0 if any of them was off
+static uint32_t csum_all(uint32_t root_addr) {
+	uint32_t nodes = 0;
+	
+	uint8_t depth = tree_depth(root_addr);
+	for (uint8_t level = 0; level < depth; ++level) {
+		uint32_t node_addr = tree_level_first(root_addr, level);
+		while (node_addr != 0) {
+			node_ptr node = node_map(node_addr, false);
+			
+			if (node_csum(node) != node->hdr.csum) {
+				warnx("checksum stale: node 0x%" PRIx32, node_addr);
+				node_unmap(node);
+				
+				return 0;
+			}
+			
+			node_addr = node->hdr.next;
+			node_unmap(node);
+			
+			++nodes;
+		}
+	}
+	
+	return nodes;
+}
+
+bool test_csum(uint32_t cnt) {
+	srand48(param.rand_seed);
+	
+	fprintf(stderr, "crc32c: %s\n", crc32c_impl());
+	FAIL_ON(crc_sane());
+	
+	cnt = (1 << cnt);
+	
+	struct help_items items;
+	help_items_new(&items, cnt, ITEM_LEN_MAX, 0, 0);
+	
+	help_new();
+	uint32_t meta = fs.sblk->s_addr_meta_tree;
+	
+	help_items_insert(meta, &items, 0, cnt, 0);
+	
+	/* removals shift elems around without splitting anything */
+	FAIL_ON(help_items_remove(meta, &items, 0, cnt / 4));
+	
+	FAIL_ON(help_check_tree(meta));
+	FAIL_ON(csum_all(meta) != 0);
+	
+	/* after a remount, every node is verified again as it is first mapped */
+	jgfs2_done();
+	help_init();
+	
+	FAIL_ON(help_check_tree(meta));
+	
+	uint32_t nodes = csum_all(meta);
+	FAIL_ON(nodes != 0);
+	
+	/* a single flipped bit anywhere in a node has to show up; the damage is
+	 * done behind the tree's back, and put right before the node is mapped
+	 * the usual way again */
+	uint32_t leaf_addr = tree_level_first(meta, tree_depth(meta) - 1);
+	node_ptr leaf = node_map(leaf_addr, false);
+	uint32_t size_blk = leaf->hdr.size_blk;
+	uint32_t size_byte = node_size_byte(leaf);
+	node_unmap(leaf);
+	
+	uint8_t *raw = fs_map_blk(leaf_addr, size_blk, true);
+	for (uint32_t i = 0; i < 64; ++i) {
+		uint32_t off = lrand48() % size_byte;
+		uint8_t bit = 1 << (lrand48() % 8);
+		
+		raw[off] ^= bit;
+		FAIL_ON(node_csum((node_ptr)raw) != ((node_ptr)raw)->hdr.csum ||
+			(off >= offsetof(struct node_hdr, csum) &&
+			off < offsetof(struct node_hdr, csum) + sizeof(uint32_t)));
+		raw[off] ^= bit;
+	}
+	fs_unmap_blk(raw, leaf_addr, size_blk);
+	
+	fprintf(stderr, "verified %" PRIu32 " nodes\n", nodes);
+	
+	jgfs2_done();
+	
+	help_items_free(&items);
+	
+	return true;
+}
@@ -0,0 +1,102 @@
+/* jgfs2
+ * (c) 2013 Justin Gottula
+ * The source code of this project is distributed under the terms of the
+ * simplified BSD license. See the LICENSE file for details.
+ */
+
+
+#include "dirty.h"
+#include <err.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../../lib/fs.h"
+#include "../../../lib/tree.h"
+#include "../../../lib/tree/check.h"
+#include "../argp.h"
+#include "../help.h"
+#include "../rand.h"
+
+
+#define ITEM_LEN_MAX 200
+
+
+/// @brief breaks the link from one leaf to the next behind the tree's back,
+/// makes sure the incremental check notices, then puts it right
+/// @param[in] root_addr  block number of root node
+/// @return true if the check failed while the link was broken and passed again
+/// once it was fixed
+static bool break_link(uint32_t root_addr) {
+	uint32_t first = tree_level_first(root_addr, tree_depth(root_addr) - 1);
+	uint32_t middle = tree_level_next(first);
+	uint32_t last = tree_level_next(middle);
+	FAIL_ON(middle != 0 && last != 0);
+	
+	/* the last of the three now claims to follow the first one directly; the
+	 * latch makes this the node's writer, so that its checksum is kept up */
+	node_latch(last, true);
+	node_ptr node = node_map(last, true);
+	node->hdr.prev = first;
+	node_unmap(node);
+	node_unlatch(last, true);
+	
+	struct check_result result = check_dirty();
+	FAIL_ON(result.type == RESULT_TYPE_TREE);
+	FAIL_ON(result.tree.code == ERR_TREE_NEXT_SKIP ||
+		result.tree.code == ERR_TREE_PREV_SKIP);
+	
+	node_latch(last, true);
+	node = node_map(last, true);
+	node->hdr.prev = middle;
+	node_unmap(node);
+	node_unlatch(last, true);
+	
+	FAIL_ON(help_check_dirty());
+	
+	return true;
+}
+
+bool test_dirty(uint32_t cnt) {
+	srand48(param.rand_seed);
+	
+	cnt = (1 << cnt);
+	
+	struct help_items items;
+	help_items_new(&items, cnt, ITEM_LEN_MAX, 0, 0);
+	
+	help_new_with(&(struct help_new_opts){ .check_dirty = true });
+	uint32_t meta = fs.sblk->s_addr_meta_tree;
+	
+	/* making the filesystem wrote to plenty of nodes already */
+	FAIL_ON(help_check_dirty());
+	
+	/* every operation is checked right after it is done */
+	double time_begin = help_now();
+	for (uint32_t i = 0; i < cnt; ++i) {
+		help_items_insert(meta, &items, i, i + 1, 0);
+		FAIL_ON(help_check_dirty());
+	}
+	double time_insert = help_now() - time_begin;
+	
+	FAIL_ON(help_check_tree(meta));
+	
+	fprintf(stderr, "insert + check_dirty: %.0f ops/s\n", cnt / time_insert);
+	
+	FAIL_ON(break_link(meta));
+	
+	/* removals empty out and drop leaves, which then must not be checked */
+	uint32_t removed = cnt - (cnt / 8);
+	for (uint32_t i = 0; i < removed; ++i) {
+		FAIL_ON(help_items_remove(meta, &items, i, i + 1));
+		FAIL_ON(help_check_dirty());
+	}
+	
+	FAIL_ON(help_check_tree(meta));
+	
+	jgfs2_done();
+	
+	help_items_free(&items);
+	
+	return true;
+}
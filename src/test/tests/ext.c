@@ -0,0 +1,575 @@
+/* jgfs2
+ * (c) 2013 Justin Gottula
+ * The source code of this project is distributed under the terms of the
+ * simplified BSD license. See the LICENSE file for details.
+ */
+
+
+#include "ext.h"
+#include <err.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "../../../lib/extent.h"
+#include "../../../lib/fs.h"
+#include "../../../lib/tree.h"
+#include "../argp.h"
+#include "../help.h"
+#include "../rand.h"
+
+
+#define EXT_LEN_MAX 16
+
+
+static int ext_cmp(const void *lhs, const void *rhs) {
+	const struct jgfs2_extent *l = lhs, *r = rhs;
+	return (l->e_addr > r->e_addr) - (l->e_addr < r->e_addr);
+}
+
+/// @brief adds up the blocks that the allocator knows about: those free and
+/// those its trees are made of, once they are up to date
+/// @return number of blocks
+static uint64_t ext_blk_known(void) {
+	ext_flush();
+	
+	uint64_t nodes = tree_stat(fs.sblk->s_addr_ext_tree).nodes +
+		tree_stat(fs.sblk->s_addr_ext_size_tree).nodes;
+	
+	return ext_free_blk() + (nodes * fs.sblk->s_ext_node_blk);
+}
+
+/// @brief makes sure that allocated extents are in bounds and don't overlap
+/// @param[in] exts  extents, which get sorted
+/// @param[in] cnt   number of extents
+/// @return total blocks, or zero if anything is wrong
+static uint64_t check_exts(struct jgfs2_extent *exts, uint32_t cnt) {
+	qsort(exts, cnt, sizeof(*exts), ext_cmp);
+	
+	uint64_t total = 0;
+	for (uint32_t i = 0; i < cnt; ++i) {
+		const struct jgfs2_extent *ext = exts + i;
+		
+		if (ext->e_addr < fs.data_blk_first ||
+			(uint64_t)ext->e_addr + ext->e_len > fs.size_blk) {
+			warnx("out of bounds: 0x%" PRIx32 "+%" PRIu32,
+				ext->e_addr, ext->e_len);
+			return 0;
+		}
+		
+		if (i != 0 && exts[i - 1].e_addr + exts[i - 1].e_len > ext->e_addr) {
+			warnx("overlap: 0x%" PRIx32 "+%" PRIu32 " and 0x%" PRIx32 "+%"
+				PRIu32, exts[i - 1].e_addr, exts[i - 1].e_len,
+				ext->e_addr, ext->e_len);
+			return 0;
+		}
+		
+		total += ext->e_len;
+	}
+	
+	return total;
+}
+
+/// @brief brings the free space trees up to date and walks them in address
+/// order, making sure that no two free extents are next to each other (short
+/// of a group boundary), and that the trees agree with the allocator
+/// @return true if they were all merged and counted properly
+static bool check_free(void) {
+	ext_flush();
+	
+	uint32_t addr_root = fs.sblk->s_addr_ext_tree;
+	
+	key the_key = {
+		0x00000000,
+		KEY_EXT_FREE,
+		0x00000000,
+	};
+	
+	uint64_t total = 0, extents = 0;
+	uint32_t prev_end = 0;
+	
+	key found;
+	uint32_t len;
+	while (tree_seek(addr_root, &the_key, false, &found, sizeof(len), &len)) {
+		/* chunk types are kept in the same tree */
+		if (found.type == KEY_EXT_CHUNK) {
+			the_key = found;
+			++the_key.off;
+			continue;
+		}
+		
+		if (extents != 0 && (found.id < prev_end ||
+			(found.id == prev_end && found.id % EXT_GROUP_BLK != 0))) {
+			warnx("unmerged free extents: 0x%" PRIx32 " and 0x%" PRIx32,
+				prev_end, found.id);
+			return false;
+		}
+		
+		total += len;
+		++extents;
+		
+		prev_end = found.id + len;
+		the_key = found;
+		the_key.id = prev_end;
+	}
+	
+	struct ext_stats stats = ext_stats();
+	if (stats.dirty != 0 || total != stats.free_blk ||
+		extents != stats.extents ||
+		extents != tree_stat(fs.sblk->s_addr_ext_size_tree).items) {
+		warnx("free space doesn't add up: %" PRIu64 " blocks in %" PRIu64
+			" extents", total, extents);
+		return false;
+	}
+	
+	return true;
+}
+
+static int len_cmp_desc(const void *lhs, const void *rhs) {
+	const uint32_t *l = lhs, *r = rhs;
+	return (*l < *r) - (*l > *r);
+}
+
+/// @brief adds up the lengths of some extents
+/// @param[in] exts  extents
+/// @param[in] cnt   number of extents
+/// @return number of blocks
+static uint64_t sum_exts(const struct jgfs2_extent *exts, uint32_t cnt) {
+	uint64_t total = 0;
+	for (uint32_t i = 0; i < cnt; ++i) {
+		total += exts[i].e_len;
+	}
+	
+	return total;
+}
+
+/// @brief fills free space up until all that is left is holes between other
+/// extents, then allocates across them, with and without a hint
+/// @param[in] exts  room for extents
+/// @param[in] lens  room for extent lengths
+/// @param[in] cnt   number of extents
+/// @return true if every allocation came to as few extents as it could have
+static bool multi_ops(struct jgfs2_extent *exts, uint32_t *lens,
+	uint32_t cnt) {
+	struct jgfs2_extent *multi = malloc(sizeof(*multi) * cnt);
+	struct jgfs2_extent *fill  = malloc(sizeof(*fill) * cnt);
+	
+	rand32_fill_range(lens, cnt, EXT_LEN_MAX - 1);
+	for (uint32_t i = 0; i < cnt; ++i) {
+		exts[i].e_len  = lens[i] + 1;
+		exts[i].e_addr = ext_alloc(exts[i].e_len, EXT_TYPE_DATA, 0);
+	}
+	check_exts(exts, cnt);
+	
+	/* whatever is left over, within chunks and past the last one, is used up;
+	 * what is left in the chunks the filesystem was made with isn't for data,
+	 * so that much strays */
+	uint64_t strays = ext_stats().strays;
+	uint32_t filled = ext_alloc_multi(ext_free_blk(), 0, fill, cnt);
+	FAIL_ON(filled != 0);
+	FAIL_ON(ext_free_blk() == 0);
+	FAIL_ON(ext_stats().strays > strays);
+	
+	/* every other extent becomes a hole that can't be merged with another */
+	uint32_t holes = 0;
+	for (uint32_t i = 0; i < cnt; i += 2) {
+		ext_dealloc(exts[i].e_addr, exts[i].e_len);
+		lens[holes++] = exts[i].e_len;
+	}
+	qsort(lens, holes, sizeof(*lens), len_cmp_desc);
+	
+	/* the hole at the hint comes first, and the rest fits in one more */
+	uint32_t len = exts[0].e_len + exts[2].e_len;
+	uint32_t got = ext_alloc_multi(len, exts[0].e_addr, multi, cnt);
+	FAIL_ON(got == 2);
+	FAIL_ON(multi[0].e_addr == exts[0].e_addr);
+	FAIL_ON(multi[0].e_len == exts[0].e_len);
+	FAIL_ON(sum_exts(multi, got) == len);
+	
+	for (uint32_t i = 0; i < got; ++i) {
+		ext_dealloc(multi[i].e_addr, multi[i].e_len);
+	}
+	FAIL_ON(ext_stats().extents == holes);
+	
+	/* one block more than the largest holes hold takes one more extent than
+	 * there are of them */
+	uint32_t big = holes / 4;
+	len = 1;
+	for (uint32_t i = 0; i < big; ++i) {
+		len += lens[i];
+	}
+	
+	struct ext_stats before = ext_stats();
+	FAIL_ON(ext_alloc_multi(len, 0, multi, big) == 0);
+	FAIL_ON(ext_alloc_multi(ext_free_blk() + 1, 0, multi, cnt) == 0);
+	
+	struct ext_stats after = ext_stats();
+	FAIL_ON(after.free_blk == before.free_blk);
+	FAIL_ON(after.extents == before.extents);
+	FAIL_ON(after.multi_allocs == before.multi_allocs);
+	
+	got = ext_alloc_multi(len, 0, multi, cnt);
+	FAIL_ON(got == big + 1);
+	FAIL_ON(sum_exts(multi, got) == len);
+	FAIL_ON(check_free());
+	
+	/* and every hole is there to be had, if need be */
+	uint32_t rest = ext_free_blk();
+	uint32_t left = ext_stats().extents;
+	FAIL_ON(ext_alloc_multi(rest, 0, multi + got, cnt - got) == left);
+	FAIL_ON(ext_free_blk() == 0);
+	
+	got += left;
+	
+	for (uint32_t i = 0; i < got; ++i) {
+		ext_dealloc(multi[i].e_addr, multi[i].e_len);
+	}
+	for (uint32_t i = 1; i < cnt; i += 2) {
+		ext_dealloc(exts[i].e_addr, exts[i].e_len);
+	}
+	for (uint32_t i = 0; i < filled; ++i) {
+		ext_dealloc(fill[i].e_addr, fill[i].e_len);
+	}
+	
+	FAIL_ON(check_free());
+	
+	free(fill);
+	free(multi);
+	
+	return true;
+}
+
+/// @brief allocates tree nodes and data one after the other, each following on
+/// from the last of its type, then fills a tree with overflow items and walks
+/// its leaves
+/// @param[in] cnt  number of extents and of items
+/// @return true if each type kept to itself, and the leaves stayed together
+static bool locality_ops(uint32_t cnt) {
+	uint32_t node_blk = fs.sblk->s_meta_node_blk;
+	uint32_t meta_hint = 0, data_hint = 0;
+	
+	/* each type only keeps to its own chunks while there are chunks left for
+	 * it to have, so what is allocated at once has to fit with room to spare */
+	while (cnt > 1 &&
+		(uint64_t)cnt * (node_blk + EXT_LEN_MAX) > ext_free_blk() / 2) {
+		cnt /= 2;
+	}
+	
+	struct jgfs2_extent *exts = malloc(sizeof(*exts) * cnt * 2);
+	
+	for (uint32_t i = 0; i < cnt; ++i) {
+		struct jgfs2_extent *meta = exts + (i * 2), *data = meta + 1;
+		
+		meta->e_len  = node_blk;
+		meta->e_addr = ext_alloc(meta->e_len, EXT_TYPE_META, meta_hint);
+		data->e_len  = EXT_LEN_MAX;
+		data->e_addr = ext_alloc(data->e_len, EXT_TYPE_DATA, data_hint);
+		
+		/* nothing is in the way, short of the end of a chunk */
+		if (i != 0 && meta->e_addr % EXT_CHUNK_BLK != 0) {
+			FAIL_ON(meta->e_addr == meta_hint);
+		}
+		if (i != 0 && data->e_addr % EXT_CHUNK_BLK != 0) {
+			FAIL_ON(data->e_addr == data_hint);
+		}
+		
+		meta_hint = meta->e_addr + meta->e_len;
+		data_hint = data->e_addr + data->e_len;
+	}
+	
+	FAIL_ON(check_exts(exts, cnt * 2) != 0);
+	
+	for (uint32_t i = 0; i < cnt * 2; ++i) {
+		ext_dealloc(exts[i].e_addr, exts[i].e_len);
+	}
+	
+	free(exts);
+	
+	/* the overflow extents go in data chunks, not in between the leaves */
+	uint32_t meta = fs.sblk->s_addr_meta_tree;
+	
+	uint32_t item_len = tree_inline_max(meta) + 1;
+	uint8_t *item = calloc(1, item_len);
+	
+	key the_key = {
+		0x00000000,
+		0x00,
+		0x00000000,
+	};
+	
+	for (uint32_t i = 0; i < cnt; ++i) {
+		the_key.id = i;
+		tree_insert(meta, &the_key, (struct item_data){
+			.len  = item_len,
+			.data = item,
+		});
+	}
+	
+	uint32_t leaves = 0, adjacent = 0, prev_addr = 0;
+	uint32_t node_addr = tree_level_first(meta, tree_depth(meta) - 1);
+	while (node_addr != 0) {
+		if (leaves++ != 0 && node_addr == prev_addr + node_blk) {
+			++adjacent;
+		}
+		
+		prev_addr = node_addr;
+		node_addr = tree_level_next(node_addr);
+	}
+	
+	fprintf(stderr, "%" PRIu32 " of %" PRIu32 " leaves right after the one "
+		"before; %" PRIu64 " allocs outside their chunks\n", adjacent, leaves,
+		ext_stats().strays);
+	FAIL_ON(adjacent * 2 > leaves);
+	
+	for (uint32_t i = 0; i < cnt; ++i) {
+		the_key.id = i;
+		FAIL_ON(tree_remove(meta, &the_key));
+	}
+	
+	free(item);
+	
+	return true;
+}
+
+/// @brief counts an extent that a tree takes up whose chunk isn't of the type
+/// it was allocated as
+/// @param[in] addr  first block
+/// @param[in] len   length in blocks
+/// @param[in] type  enum ext_type
+/// @param[in] arg   count of such extents (uint32_t)
+static void count_mistyped(uint32_t addr, uint32_t len, uint8_t type,
+	void *arg) {
+	if (ext_chunk_type(addr) != type) {
+		warnx("0x%" PRIx32 "+%" PRIu32 " is type %" PRIu8 " in a chunk of "
+			"type %" PRIu8, addr, len, type, ext_chunk_type(addr));
+		++*(uint32_t *)arg;
+	}
+}
+
+/// @brief allocates extents in another process, which then exits without
+/// unmounting, having flushed only some of them to the free space trees
+/// @param[in] lens  extent lengths, less one
+/// @param[in] cnt   number of extents
+/// @return true if the other process did all of that
+static bool crash_after(const uint32_t *lens, uint32_t cnt) {
+	pid_t pid = fork();
+	if (pid < 0) {
+		err(1, "fork failed");
+	}
+	
+	if (pid == 0) {
+		help_init();
+		
+		for (uint32_t i = 0; i < cnt; ++i) {
+			ext_alloc(lens[i] + 1, EXT_TYPE_DATA, 0);
+			
+			if (i == cnt / 2) {
+				ext_flush();
+			}
+		}
+		
+		_exit(0);
+	}
+	
+	int status;
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid failed");
+	}
+	
+	return (WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+/// @brief fills a tree with overflow items, then mounts without the free space
+/// trees being up to date, so that free space and the type of each chunk have
+/// to be worked out from the tree
+/// @param[in] cnt  number of items
+/// @return true if the nodes and the overflow extents are still in chunks of
+/// their own type afterward
+static bool rebuild_ops(uint32_t cnt) {
+	uint32_t meta = fs.sblk->s_addr_meta_tree;
+	
+	uint32_t item_len = tree_inline_max(meta) + 1;
+	while (cnt > 1 && (uint64_t)cnt * BYTE_TO_BLK(item_len) >
+		ext_free_blk() / 2) {
+		cnt /= 2;
+	}
+	
+	uint8_t *item = calloc(1, item_len);
+	
+	key the_key = {
+		0x00000000,
+		0x00,
+		0x00000000,
+	};
+	
+	for (uint32_t i = 0; i < cnt; ++i) {
+		the_key.id = i;
+		tree_insert(meta, &the_key, (struct item_data){
+			.len  = item_len,
+			.data = item,
+		});
+	}
+	
+	free(item);
+	
+	uint32_t mistyped = 0;
+	tree_blk_walk(meta, count_mistyped, &mistyped);
+	FAIL_ON(mistyped == 0);
+	
+	/* another process mounts and exits without unmounting */
+	jgfs2_done();
+	FAIL_ON(crash_after(NULL, 0));
+	help_init();
+	
+	FAIL_ON(ext_stats().rebuilds == 1);
+	FAIL_ON(check_free());
+	
+	tree_blk_walk(meta, count_mistyped, &mistyped);
+	FAIL_ON(mistyped == 0);
+	
+	FAIL_ON(help_check_tree(meta));
+	
+	return true;
+}
+
+bool test_ext(uint32_t cnt) {
+	srand48(param.rand_seed);
+	
+	cnt = (1 << cnt);
+	
+	help_new();
+	
+	/* everything past what was allocated when the filesystem was made starts
+	 * out free, in no more than one extent for each type of chunk, and one
+	 * more for each group boundary */
+	struct ext_stats start = ext_stats();
+	uint64_t extents = start.extents;
+	FAIL_ON(extents <= EXT_TYPE_DATA + (start.groups - 1));
+	FAIL_ON(check_free());
+	
+	uint64_t known = ext_blk_known();
+	
+	struct jgfs2_extent *exts = malloc(sizeof(*exts) * cnt);
+	
+	uint32_t *lens = malloc(sizeof(uint32_t) * cnt);
+	rand32_fill_range(lens, cnt, EXT_LEN_MAX - 1);
+	
+	double time_begin = help_now();
+	for (uint32_t i = 0; i < cnt; ++i) {
+		exts[i].e_len  = lens[i] + 1;
+		exts[i].e_addr = ext_alloc(exts[i].e_len, EXT_TYPE_DATA, 0);
+	}
+	double time_alloc = help_now() - time_begin;
+	
+	uint64_t used = check_exts(exts, cnt);
+	FAIL_ON(used != 0);
+	FAIL_ON(ext_blk_known() + used == known);
+	FAIL_ON(check_free());
+	
+	/* free every other extent, which leaves holes that can't be merged, and
+	 * fill them back in with extents of other lengths */
+	for (uint32_t i = 0; i < cnt; i += 2) {
+		ext_dealloc(exts[i].e_addr, exts[i].e_len);
+	}
+	FAIL_ON(check_free());
+	
+	rand32_fill_range(lens, cnt, EXT_LEN_MAX - 1);
+	for (uint32_t i = 0; i < cnt; i += 2) {
+		exts[i].e_len  = lens[i] + 1;
+		exts[i].e_addr = ext_alloc(exts[i].e_len, EXT_TYPE_DATA, 0);
+	}
+	
+	used = check_exts(exts, cnt);
+	FAIL_ON(used != 0);
+	FAIL_ON(ext_blk_known() + used == known);
+	
+	/* with everything freed, in no particular order, whatever free space is
+	 * next to other free space has to have been merged with it */
+	rand32_permute_init(lens, cnt);
+	
+	time_begin = help_now();
+	for (uint32_t i = 0; i < cnt; ++i) {
+		const struct jgfs2_extent *ext = exts + lens[i];
+		ext_dealloc(ext->e_addr, ext->e_len);
+	}
+	double time_dealloc = help_now() - time_begin;
+	
+	FAIL_ON(ext_blk_known() == known);
+	FAIL_ON(check_free());
+	
+	/* short of the nodes the free space trees grew by while all of that was
+	 * flushed, which can sit anywhere in their chunk */
+	uint64_t grown = tree_stat(fs.sblk->s_addr_ext_tree).nodes +
+		tree_stat(fs.sblk->s_addr_ext_size_tree).nodes - 2;
+	FAIL_ON(ext_stats().extents <= extents + grown);
+	
+	FAIL_ON(help_check_tree(fs.sblk->s_addr_ext_tree));
+	FAIL_ON(help_check_tree(fs.sblk->s_addr_ext_size_tree));
+	
+	FAIL_ON(multi_ops(exts, lens, cnt));
+	FAIL_ON(ext_blk_known() == known);
+	
+	struct ext_stats stats = ext_stats();
+	
+	fprintf(stderr, "alloc: %.0f ext/s, dealloc: %.0f ext/s\n",
+		cnt / time_alloc, cnt / time_dealloc);
+	fprintf(stderr, "%" PRIu64 " allocs, %" PRIu64 " deallocs, %" PRIu64
+		" merges; %" PRIu64 " free blocks in %" PRIu64 " extents\n",
+		stats.allocs, stats.deallocs, stats.merges, stats.free_blk,
+		stats.extents);
+	fprintf(stderr, "%" PRIu64 " tree changes in %" PRIu64 " flushes\n",
+		stats.flushed, stats.flushes);
+	fprintf(stderr, "%" PRIu64 " multi-extent allocs in %" PRIu64
+		" extents\n", stats.multi_allocs, stats.multi_frags);
+	
+	/* the free space stays as it was across a remount */
+	jgfs2_done();
+	help_init();
+	
+	struct ext_stats after = ext_stats();
+	FAIL_ON(after.rebuilds == 0);
+	FAIL_ON(after.free_blk == stats.free_blk);
+	FAIL_ON(after.extents == stats.extents);
+	FAIL_ON(check_free());
+	
+	jgfs2_done();
+	
+	/* what was handed out without being in any tree is free again once the
+	 * free space trees are rebuilt, and the trees are whole again */
+	rand32_fill_range(lens, cnt, EXT_LEN_MAX - 1);
+	FAIL_ON(crash_after(lens, cnt));
+	
+	help_init();
+	
+	FAIL_ON(ext_stats().rebuilds == 1);
+	FAIL_ON(ext_blk_known() == known);
+	FAIL_ON(check_free());
+	
+	FAIL_ON(help_check_tree(fs.sblk->s_addr_ext_tree));
+	FAIL_ON(help_check_tree(fs.sblk->s_addr_ext_size_tree));
+	
+	jgfs2_done();
+	
+	/* with nothing in the way, each type of allocation keeps to its own
+	 * chunks, and the type of each chunk is still known after a remount */
+	help_new();
+	known = ext_blk_known();
+	
+	FAIL_ON(locality_ops(cnt));
+	FAIL_ON(ext_blk_known() == known);
+	FAIL_ON(check_free());
+	
+	jgfs2_done();
+	
+	/* and a rebuild tells file data from metadata again */
+	help_new();
+	FAIL_ON(rebuild_ops(cnt));
+	jgfs2_done();
+	
+	free(lens);
+	free(exts);
+	
+	return true;
+}
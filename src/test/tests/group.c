@@ -0,0 +1,296 @@
+/* jgfs2
+ * (c) 2013 Justin Gottula
+ * The source code of this project is distributed under the terms of the
+ * simplified BSD license. See the LICENSE file for details.
+ */
+
+
+#include "group.h"
+#include <err.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../../../lib/extent.h"
+#include "../../../lib/fs.h"
+#include "../../../lib/tree.h"
+#include "../argp.h"
+#include "../help.h"
+#include "../rand.h"
+
+
+#define EXT_LEN_MAX 16
+#define THREAD_MAX  8
+
+/* each thread allocates all of its extents and frees them again this many
+ * times over */
+#define ROUNDS 32
+
+
+struct worker {
+	pthread_t thread;
+	
+	uint32_t cnt;
+	
+	/* mrand48 is not thread-safe, so all randomness is generated up front */
+	uint32_t *lens;
+	
+	/* block to start each round from, or zero to use the thread's own group */
+	uint32_t hint;
+	
+	/* bring the free space trees up to date after each round's allocations */
+	bool flush;
+	
+	struct jgfs2_extent *exts;
+	
+	/* extents that didn't follow on from the one before */
+	uint32_t breaks;
+	
+	/* when the thread started and finished allocating */
+	double t_begin;
+	double t_end;
+	
+	pthread_barrier_t *barrier;
+};
+
+
+static int ext_cmp(const void *lhs, const void *rhs) {
+	const struct jgfs2_extent *l = lhs, *r = rhs;
+	return (l->e_addr > r->e_addr) - (l->e_addr < r->e_addr);
+}
+
+/* each extent is hinted to follow the one before, as a file being written
+ * out would be; the last round's extents are kept to be looked over */
+static void *worker_main(void *arg) {
+	struct worker *w = arg;
+	
+	pthread_barrier_wait(w->barrier);
+	w->t_begin = help_now();
+	for (uint32_t r = 0; r < ROUNDS; ++r) {
+		uint32_t hint = w->hint;
+		
+		for (uint32_t i = 0; i < w->cnt; ++i) {
+			struct jgfs2_extent *ext = w->exts + i;
+			
+			ext->e_len  = w->lens[i];
+			ext->e_addr = ext_alloc(ext->e_len, EXT_TYPE_DATA, hint);
+			
+			if (i != 0 && ext->e_addr != hint) {
+				++w->breaks;
+			}
+			hint = ext->e_addr + ext->e_len;
+		}
+		
+		if (w->flush) {
+			ext_flush();
+		}
+		
+		if (r == ROUNDS - 1) {
+			break;
+		}
+		
+		for (uint32_t i = 0; i < w->cnt; ++i) {
+			ext_dealloc(w->exts[i].e_addr, w->exts[i].e_len);
+		}
+	}
+	w->t_end = help_now();
+	pthread_barrier_wait(w->barrier);
+	
+	return NULL;
+}
+
+/// @brief makes sure that allocated extents are in bounds and don't overlap
+/// @param[in] exts  extents, which get sorted
+/// @param[in] cnt   number of extents
+/// @return true if they are all where they should be
+static bool check_exts(struct jgfs2_extent *exts, uint32_t cnt) {
+	qsort(exts, cnt, sizeof(*exts), ext_cmp);
+	
+	for (uint32_t i = 0; i < cnt; ++i) {
+		const struct jgfs2_extent *ext = exts + i;
+		
+		if (ext->e_addr < fs.data_blk_first ||
+			(uint64_t)ext->e_addr + ext->e_len > fs.size_blk) {
+			warnx("out of bounds: 0x%" PRIx32 "+%" PRIu32,
+				ext->e_addr, ext->e_len);
+			return false;
+		}
+		
+		if (i != 0 && exts[i - 1].e_addr + exts[i - 1].e_len > ext->e_addr) {
+			warnx("overlap: 0x%" PRIx32 "+%" PRIu32 " and 0x%" PRIx32 "+%"
+				PRIu32, exts[i - 1].e_addr, exts[i - 1].e_len,
+				ext->e_addr, ext->e_len);
+			return false;
+		}
+	}
+	
+	return true;
+}
+
+/// @brief runs allocating threads, and frees whatever they leave allocated
+/// @param[in]  thread_cnt  number of threads
+/// @param[in]  cnt         extents allocated per round, over all threads
+/// @param[in]  hint        block for every thread to start from, or zero for
+/// each to use its own group
+/// @param[in]  flush       have the threads flush the free space trees too
+/// @param[out] allocs_sec  allocations (and as many deallocations) per second
+/// @param[out] breaks      allocations that didn't follow on from the one
+/// before, over all threads
+/// @return false if extents were handed out twice, or not given back
+static bool run_threads(uint32_t thread_cnt, uint32_t cnt, uint32_t hint,
+	bool flush, double *allocs_sec, uint32_t *breaks) {
+	uint32_t free_begin = ext_free_blk();
+	
+	pthread_barrier_t barrier;
+	pthread_barrier_init(&barrier, NULL, thread_cnt + 1);
+	
+	struct worker *workers = calloc(thread_cnt, sizeof(struct worker));
+	for (uint32_t t = 0; t < thread_cnt; ++t) {
+		struct worker *w = workers + t;
+		
+		w->cnt     = cnt / thread_cnt;
+		w->hint    = hint;
+		w->flush   = flush;
+		w->barrier = &barrier;
+		
+		w->lens = malloc(sizeof(uint32_t) * w->cnt);
+		rand32_fill_range(w->lens, w->cnt, EXT_LEN_MAX - 1);
+		for (uint32_t i = 0; i < w->cnt; ++i) {
+			++w->lens[i];
+		}
+		
+		w->exts = malloc(sizeof(struct jgfs2_extent) * w->cnt);
+		
+		if ((errno = pthread_create(&w->thread, NULL, worker_main, w)) != 0) {
+			err(1, "pthread_create failed");
+		}
+	}
+	
+	pthread_barrier_wait(&barrier);
+	pthread_barrier_wait(&barrier);
+	
+	for (uint32_t t = 0; t < thread_cnt; ++t) {
+		pthread_join(workers[t].thread, NULL);
+	}
+	pthread_barrier_destroy(&barrier);
+	
+	uint32_t per = cnt / thread_cnt, total = per * thread_cnt;
+	struct jgfs2_extent *exts = malloc(sizeof(*exts) * total);
+	
+	/* this thread may not get to run again until the others are done, so
+	 * they keep their own time */
+	double t_begin = workers[0].t_begin, t_end = workers[0].t_end;
+	
+	*breaks = 0;
+	for (uint32_t t = 0; t < thread_cnt; ++t) {
+		struct worker *w = workers + t;
+		
+		memcpy(exts + (t * per), w->exts, sizeof(*exts) * per);
+		*breaks += w->breaks;
+		
+		if (w->t_begin < t_begin) {
+			t_begin = w->t_begin;
+		}
+		if (w->t_end > t_end) {
+			t_end = w->t_end;
+		}
+		
+		free(w->lens);
+		free(w->exts);
+	}
+	free(workers);
+	
+	*allocs_sec = (double)total * ROUNDS / (t_end - t_begin);
+	
+	bool result = check_exts(exts, total);
+	for (uint32_t i = 0; i < total; ++i) {
+		ext_dealloc(exts[i].e_addr, exts[i].e_len);
+	}
+	free(exts);
+	
+	/* the threads' own flushes may have changed the trees' size */
+	if (!flush && ext_free_blk() != free_begin) {
+		warnx("%" PRIu32 " free blocks, not %" PRIu32, ext_free_blk(),
+			free_begin);
+		result = false;
+	}
+	
+	return result;
+}
+
+bool test_group(uint32_t cnt) {
+	srand48(param.rand_seed);
+	
+	cnt = (1 << cnt);
+	
+	long nproc = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nproc < 1) {
+		nproc = 1;
+	}
+	
+	help_new();
+	
+	/* what the threads have allocated at once has to fit on the device,
+	 * with room to spare */
+	while (cnt > 1 && (uint64_t)cnt * EXT_LEN_MAX > ext_free_blk() / 2) {
+		cnt /= 2;
+	}
+	
+	struct ext_stats stats = ext_stats();
+	fprintf(stderr, "total %" PRIu32 " cpus %ld groups %" PRIu64 "\n", cnt,
+		nproc, stats.groups);
+	
+	/* every thread in a group of its own, and then every thread starting from
+	 * the same place, which is how it would be with a single group; threads
+	 * are run even past the number of cpus, to have them interleave */
+	for (uint32_t thread_cnt = 1; thread_cnt <= THREAD_MAX; thread_cnt *= 2) {
+		double own_sec, one_sec;
+		uint32_t own_breaks, one_breaks;
+		
+		uint64_t steals = ext_stats().steals;
+		FAIL_ON(run_threads(thread_cnt, cnt, 0, false, &own_sec,
+			&own_breaks));
+		steals = ext_stats().steals - steals;
+		
+		FAIL_ON(run_threads(thread_cnt, cnt, fs.data_blk_first, false,
+			&one_sec, &one_breaks));
+		
+		fprintf(stderr, "threads %" PRIu32 ": own groups %.0f allocs/s (%"
+			PRIu32 " breaks, %" PRIu64 " steals), one group %.0f allocs/s (%"
+			PRIu32 " breaks)\n", thread_cnt, own_sec, own_breaks, steals,
+			one_sec, one_breaks);
+		
+		/* as long as each thread has a group to itself, what it allocates
+		 * comes out mostly in one piece */
+		if (thread_cnt <= stats.groups) {
+			FAIL_ON(own_breaks * 4 < cnt * ROUNDS);
+		}
+	}
+	
+	/* the trees can be flushed while other threads allocate and free */
+	double flush_sec;
+	uint32_t flush_breaks;
+	FAIL_ON(run_threads(THREAD_MAX, cnt, 0, true, &flush_sec, &flush_breaks));
+	
+	ext_flush();
+	FAIL_ON(ext_stats().dirty == 0);
+	
+	FAIL_ON(help_check_tree(fs.sblk->s_addr_ext_tree));
+	FAIL_ON(help_check_tree(fs.sblk->s_addr_ext_size_tree));
+	
+	/* and what they say is free is still free after a remount */
+	uint32_t free_blk = ext_free_blk();
+	jgfs2_done();
+	help_init();
+	
+	stats = ext_stats();
+	FAIL_ON(stats.rebuilds == 0);
+	FAIL_ON(stats.free_blk == free_blk);
+	
+	jgfs2_done();
+	
+	return true;
+}
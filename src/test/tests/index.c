@@ -0,0 +1,93 @@
+/* jgfs2
+ * (c) 2013 Justin Gottula
+ * The source code of this project is distributed under the terms of the
+ * simplified BSD license. See the LICENSE file for details.
+ */
+
+
+#include "index.h"
+#include <err.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "../../../lib/fs.h"
+#include "../../../lib/tree.h"
+#include "../argp.h"
+#include "../help.h"
+#include "../rand.h"
+
+
+#define ITEM_LEN_MAX 64
+
+/* the deepest index tried; trees this test builds are never taller */
+#define LEVELS_MAX 3
+
+
+/// @brief fills a fresh tree with a given number of levels indexed, reads it
+/// back, then empties half of it and reads it back again
+/// @param[in] levels  tree levels to index
+/// @param[in] items   items
+/// @return true if the tree checks out and every lookup comes out right
+static bool run_levels(uint8_t levels, const struct help_items *items) {
+	help_new_with(&(struct help_new_opts){ .index_levels = levels });
+	uint32_t meta = fs.sblk->s_addr_meta_tree;
+	uint32_t cnt = items->cnt;
+	
+	/* interleave lookups with the inserts so that the index is rebuilt over
+	 * and over as the tree grows */
+	for (uint32_t i = 0; i < cnt; ++i) {
+		help_items_insert(meta, items, i, i + 1, 0);
+		
+		if (i % 16 == 0) {
+			FAIL_ON(help_items_lookup(meta, items, i / 2, (i / 2) + 1, 0, 0));
+		}
+	}
+	
+	FAIL_ON(help_check_tree(meta));
+	
+	double time_begin = help_now();
+	FAIL_ON(help_items_lookup(meta, items, 0, cnt, 0, 0));
+	double time_lookup = help_now() - time_begin;
+	
+	struct tree_index_stats stats = tree_index_stats(meta);
+	fprintf(stderr, "levels %" PRIu8 ": indexed %" PRIu8 " frontier %" PRIu32
+		" footprint %zu lookup %.3fs (%.0f ops/s)\n", levels, stats.levels,
+		stats.nodes, stats.footprint, time_lookup, cnt / time_lookup);
+	
+	if (levels != 0) {
+		FAIL_ON(stats.levels != 0 && stats.footprint != 0);
+		FAIL_ON(stats.hits > stats.misses);
+	}
+	
+	/* removals take out leaves and branches, which must invalidate it */
+	uint32_t removed = cnt / 2;
+	FAIL_ON(help_items_remove(meta, items, 0, removed));
+	
+	FAIL_ON(help_check_tree(meta));
+	FAIL_ON(help_items_lookup(meta, items, 0, cnt, removed, 0));
+	
+	stats = tree_index_stats(meta);
+	fprintf(stderr, "levels %" PRIu8 ": hits %" PRIu64 " misses %" PRIu64
+		" rebuilds %" PRIu64 "\n", levels, stats.hits, stats.misses,
+		stats.rebuilds);
+	
+	jgfs2_done();
+	return true;
+}
+
+bool test_index(uint32_t cnt) {
+	srand48(param.rand_seed);
+	
+	cnt = (1 << cnt);
+	
+	struct help_items items;
+	help_items_new(&items, cnt, ITEM_LEN_MAX, 0, 0);
+	
+	for (uint8_t levels = 0; levels <= LEVELS_MAX; ++levels) {
+		FAIL_ON(run_levels(levels, &items));
+	}
+	
+	help_items_free(&items);
+	
+	return true;
+}
@@ -58,7 +58,8 @@ bool test_insert(uint32_t cnt) {
 		the_key.id = key_ids[i];
 		uint32_t len = item_lens[the_key.id];
 		
-		tree_insert(meta, &the_key, (struct item_data){ len, data });
+		tree_insert(meta, &the_key,
+			(struct item_data){ .len = len, .data = data });
 	}
 	fputc('\n', stderr);
 	
@@ -75,7 +76,7 @@ bool test_insert(uint32_t cnt) {
 		the_key.id = i;
 		uint32_t len = item_lens[i];
 		
-		uint16_t item_idx;
+		uint32_t item_idx;
 		
 		/* FAST node elem search using leaf node linked list */
 		while (!node_search(leaf, &the_key, &item_idx)) {
@@ -89,16 +90,16 @@ bool test_insert(uint32_t cnt) {
 			leaf = next;
 		}
 		
-		item_ref *item = leaf->l_elems + item_idx;
+		item_ref item = leaf_elem(leaf, item_idx);
 		
-		if (item->len != len) {
-			warnx("wrong len: i = %" PRIu32 " item->len = %" PRIu32 " len = %"
-				PRIu32 "\n", i, item->len, len);
+		if (item.len != len) {
+			warnx("wrong len: i = %" PRIu32 " item.len = %" PRIu32 " len = %"
+				PRIu32 "\n", i, item.len, len);
 			abort();
 		}
 		
 		uint8_t *item_data = leaf_elem_data(leaf, item_idx);
-		if (memcmp(item_data, data, item->len) != 0) {
+		if (memcmp(item_data, data, item.len) != 0) {
 			warnx("bad data: i = %" PRIu32 "\n", i);
 			abort();
 		}
@@ -0,0 +1,265 @@
+/* jgfs2
+ * (c) 2013 Justin Gottula
+ * The source code of this project is distributed under the terms of the
+ * simplified BSD license. See the LICENSE file for details.
+ */
+
+
+#include "item.h"
+#include <err.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../../lib/fs.h"
+#include "../../../lib/tree.h"
+#include "../argp.h"
+#include "../help.h"
+#include "../rand.h"
+
+
+/* encode and decode are each timed over this many passes of the inodes */
+#define CODEC_PASSES 16
+
+
+/* inodes that look like what a typical system has lying around: mostly regular
+ * files owned by one user, most of them small and never written after being
+ * created, and a few directories */
+static struct inode_item rand_inode(void) {
+	bool dir = (rand32_range(8) == 0);
+	uint16_t owner = (rand32_range(4) == 0 ? 0 : 1000);
+	
+	int64_t ctime = INT64_C(1380000000) + rand32_range(0x1000000);
+	int64_t mtime = ctime;
+	int64_t atime;
+	
+	if (rand32_range(4) == 0) {
+		mtime += rand32_range(0x100000);
+	}
+	if (rand32_range(2) == 0) {
+		atime = mtime;
+	} else {
+		atime = mtime + rand32_range(0x10000);
+	}
+	
+	return (struct inode_item){
+		.i_attr  = 0,
+		.i_mode  = (dir ? 0040755 : 0100644),
+		.i_uid   = owner,
+		.i_gid   = owner,
+		.i_size  = (dir ? 0 : rand32_range(1 << rand32_range(24))),
+		.i_atime = atime,
+		.i_ctime = ctime,
+		.i_mtime = mtime,
+		.i_nlink = (dir ? 2 : 1),
+		.i_gen   = 0,
+	};
+}
+
+/// @brief walks the leaf level of a tree, counting leaves
+/// @param[in]  root_addr  block number of root node
+/// @param[out] item_cnt   number of items found
+/// @return number of leaves
+static uint32_t count_leaves(uint32_t root_addr, uint32_t *item_cnt) {
+	key first = { 0x00000000, 0x00, 0x00000000 };
+	node_ptr leaf = tree_search(root_addr, &first);
+	
+	uint32_t leaf_cnt = 0;
+	*item_cnt = 0;
+	
+	for ( ; ; ) {
+		++leaf_cnt;
+		*item_cnt += leaf->hdr.cnt;
+		
+		uint32_t next = leaf->hdr.next;
+		node_unmap(leaf);
+		
+		if (next == 0) {
+			break;
+		}
+		leaf = node_map(next, false);
+	}
+	
+	return leaf_cnt;
+}
+
+/// @brief fills a fresh tree with the inodes, either raw or encoded
+/// @param[in] inodes  inodes to insert
+/// @param[in] cnt     number of inodes
+/// @param[in] encode  store the compact encoding instead of the raw struct
+/// @return average number of items per leaf, or zero on failure
+static double fill_tree(const struct inode_item *inodes, uint32_t cnt,
+	bool encode) {
+	help_new();
+	uint32_t meta = fs.sblk->s_addr_meta_tree;
+	
+	key the_key = {
+		0x00000000,
+		KEY_INODE,
+		0x00000000,
+	};
+	
+	uint8_t buf[ITEM_ENC_MAX];
+	for (uint32_t i = 0; i < cnt; ++i) {
+		the_key.id = i;
+		
+		struct item_data item;
+		if (encode) {
+			item = (struct item_data){
+				.len  = item_encode(KEY_INODE, inodes + i, buf),
+				.data = buf,
+			};
+		} else {
+			item = (struct item_data){
+				.len  = sizeof(struct inode_item),
+				.data = (void *)(inodes + i),
+			};
+		}
+		
+		tree_insert(meta, &the_key, item);
+	}
+	
+	if (!help_check_tree(meta)) {
+		return 0.;
+	}
+	
+	/* everything must come back out the same regardless of the form */
+	for (uint32_t i = 0; i < cnt; ++i) {
+		the_key.id = i;
+		
+		uint8_t item_buf[sizeof(struct inode_item)];
+		struct inode_item inode;
+		
+		memset(item_buf, 0, sizeof(item_buf));
+		if (!tree_retrieve(meta, &the_key, sizeof(item_buf), item_buf)) {
+			warnx("retrieve failed: key %s", key_str(&the_key));
+			return 0.;
+		}
+		
+		if (encode) {
+			uint32_t len = item_encode(KEY_INODE, inodes + i, buf);
+			if (!item_decode(KEY_INODE, item_buf, len, &inode)) {
+				warnx("decode failed: key %s", key_str(&the_key));
+				return 0.;
+			}
+		} else {
+			memcpy(&inode, item_buf, sizeof(inode));
+		}
+		
+		if (memcmp(&inode, inodes + i, sizeof(inode)) != 0) {
+			warnx("bad inode: key %s", key_str(&the_key));
+			return 0.;
+		}
+	}
+	
+	uint32_t item_cnt;
+	uint32_t leaf_cnt = count_leaves(meta, &item_cnt);
+	
+	if (item_cnt != cnt) {
+		warnx("leaves hold %" PRIu32 " items, expected %" PRIu32,
+			item_cnt, cnt);
+		return 0.;
+	}
+	
+	jgfs2_done();
+	return (double)item_cnt / leaf_cnt;
+}
+
+bool test_item(uint32_t cnt) {
+	srand48(param.rand_seed);
+	
+	cnt = (1 << cnt);
+	
+	struct inode_item *inodes = malloc(sizeof(struct inode_item) * cnt);
+	struct inode_item *decoded = malloc(sizeof(struct inode_item) * cnt);
+	uint8_t *enc_bufs = malloc(ITEM_ENC_MAX * cnt);
+	uint32_t *enc_lens = malloc(sizeof(uint32_t) * cnt);
+	
+	for (uint32_t i = 0; i < cnt; ++i) {
+		inodes[i] = rand_inode();
+	}
+	
+	/* a few that have every field away from its default, and some extremes */
+	inodes[0].i_attr  = UINT32_MAX;
+	inodes[0].i_uid   = UINT16_MAX;
+	inodes[0].i_gid   = UINT16_MAX;
+	inodes[0].i_size  = UINT32_MAX;
+	inodes[0].i_nlink = 0;
+	inodes[0].i_gen   = UINT32_MAX;
+	inodes[0].i_ctime = INT64_MAX;
+	inodes[0].i_mtime = INT64_MIN;
+	inodes[0].i_atime = INT64_MAX;
+	
+	if (cnt > 1) {
+		inodes[1].i_ctime = -1;
+		inodes[1].i_mtime = 0;
+		inodes[1].i_atime = -2;
+	}
+	
+	uint64_t enc_total = 0;
+	for (uint32_t i = 0; i < cnt; ++i) {
+		enc_lens[i] = item_encode(KEY_INODE, inodes + i,
+			enc_bufs + (i * ITEM_ENC_MAX));
+		enc_total += enc_lens[i];
+		
+		FAIL_ON(enc_lens[i] <= ITEM_ENC_MAX);
+		FAIL_ON(item_decode(KEY_INODE, enc_bufs + (i * ITEM_ENC_MAX),
+			enc_lens[i], decoded + i));
+		FAIL_ON(memcmp(decoded + i, inodes + i,
+			sizeof(struct inode_item)) == 0);
+		
+		/* truncated encodings must be caught rather than misread */
+		FAIL_ON(!item_decode(KEY_INODE, enc_bufs + (i * ITEM_ENC_MAX),
+			enc_lens[i] - 1, decoded + i));
+	}
+	
+	double time_begin = help_now();
+	for (uint32_t p = 0; p < CODEC_PASSES; ++p) {
+		for (uint32_t i = 0; i < cnt; ++i) {
+			enc_lens[i] = item_encode(KEY_INODE, inodes + i,
+				enc_bufs + (i * ITEM_ENC_MAX));
+		}
+	}
+	double time_enc = help_now() - time_begin;
+	
+	time_begin = help_now();
+	for (uint32_t p = 0; p < CODEC_PASSES; ++p) {
+		for (uint32_t i = 0; i < cnt; ++i) {
+			item_decode(KEY_INODE, enc_bufs + (i * ITEM_ENC_MAX), enc_lens[i],
+				decoded + i);
+		}
+	}
+	double time_dec = help_now() - time_begin;
+	
+	time_begin = help_now();
+	for (uint32_t p = 0; p < CODEC_PASSES; ++p) {
+		for (uint32_t i = 0; i < cnt; ++i) {
+			memcpy(decoded + i, inodes + i, sizeof(struct inode_item));
+		}
+	}
+	double time_copy = help_now() - time_begin;
+	
+	FAIL_ON(memcmp(decoded, inodes, sizeof(struct inode_item) * cnt) == 0);
+	
+	double per_leaf_raw = fill_tree(inodes, cnt, false);
+	FAIL_ON(per_leaf_raw != 0.);
+	
+	double per_leaf_enc = fill_tree(inodes, cnt, true);
+	FAIL_ON(per_leaf_enc != 0.);
+	
+	double ns = 1e9 / ((double)cnt * CODEC_PASSES);
+	
+	fprintf(stderr, "size:   raw %zu enc %.1f avg\n",
+		sizeof(struct inode_item), (double)enc_total / cnt);
+	fprintf(stderr, "leaves: raw %.1f enc %.1f items/leaf (%.2fx)\n",
+		per_leaf_raw, per_leaf_enc, per_leaf_enc / per_leaf_raw);
+	fprintf(stderr, "codec:  enc %.1f dec %.1f copy %.1f ns/item\n",
+		time_enc * ns, time_dec * ns, time_copy * ns);
+	
+	free(enc_lens);
+	free(enc_bufs);
+	free(decoded);
+	free(inodes);
+	
+	return true;
+}
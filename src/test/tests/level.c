@@ -0,0 +1,162 @@
+/* jgfs2
+ * (c) 2013 Justin Gottula
+ * The source code of this project is distributed under the terms of the
+ * simplified BSD license. See the LICENSE file for details.
+ */
+
+
+#include "level.h"
+#include <err.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../../lib/fs.h"
+#include "../../../lib/tree.h"
+#include "../argp.h"
+#include "../help.h"
+#include "../rand.h"
+
+
+/* the smallest nodes make for the most levels, and for the most branches
+ * that empty out and take their links with them */
+#define LEVEL_NODE_SIZE JGFS2_NODE_SIZE_MIN
+
+/* and fat items make for the most leaves */
+#define LEVEL_ITEM_LEN 96
+
+/* the tree is checked this many times while it is being emptied */
+#define LEVEL_CHECKS 8
+
+
+/// @brief counts the nodes on each level by recursing from a node
+/// @param[in]     node_addr  block number of node
+/// @param[in]     level      level of node
+/// @param[in,out] counts     node count for each level
+static void count_recurse(uint32_t node_addr, uint8_t level,
+	uint32_t *counts) {
+	node_ptr node = node_map(node_addr, false);
+	
+	++counts[level];
+	
+	if (!node->hdr.leaf) {
+		for (uint32_t i = 0; i < node->hdr.cnt; ++i) {
+			count_recurse(branch_addr(node)[i], level + 1, counts);
+		}
+	}
+	
+	node_unmap(node);
+}
+
+/// @brief walks every level of a tree along its sibling links, making sure
+/// that each one turns up as many nodes as recursing from the root does
+/// @param[in] root_addr  block number of root node
+/// @return true if the counts match
+static bool walk_levels(uint32_t root_addr) {
+	uint8_t depth = tree_depth(root_addr);
+	
+	uint32_t counts_recurse[TREE_MAX_DEPTH] = { 0 };
+	uint32_t counts_walk[TREE_MAX_DEPTH] = { 0 };
+	
+	double time_begin = help_now();
+	count_recurse(root_addr, 0, counts_recurse);
+	double time_recurse = help_now() - time_begin;
+	
+	time_begin = help_now();
+	for (uint8_t level = 0; level < depth; ++level) {
+		uint32_t node_addr = tree_level_first(root_addr, level);
+		while (node_addr != 0) {
+			++counts_walk[level];
+			node_addr = tree_level_next(node_addr);
+		}
+	}
+	double time_walk = help_now() - time_begin;
+	
+	fprintf(stderr, "depth %" PRIu8 ":", depth);
+	for (uint8_t level = 0; level < depth; ++level) {
+		fprintf(stderr, " %" PRIu32, counts_walk[level]);
+	}
+	fprintf(stderr, " (recurse %.3fs walk %.3fs)\n", time_recurse, time_walk);
+	
+	FAIL_ON(tree_level_first(root_addr, depth) == 0);
+	
+	for (uint8_t level = 0; level < depth; ++level) {
+		if (counts_walk[level] != counts_recurse[level]) {
+			warnx("level %" PRIu8 ": walked %" PRIu32 " recursed %" PRIu32,
+				level, counts_walk[level], counts_recurse[level]);
+			return false;
+		}
+	}
+	
+	return true;
+}
+
+bool test_level(uint32_t cnt) {
+	srand48(param.rand_seed);
+	
+	help_new_with(&(struct help_new_opts){ .node_size = LEVEL_NODE_SIZE });
+	uint32_t meta = fs.sblk->s_addr_meta_tree;
+	
+	cnt = (1 << cnt);
+	
+	uint32_t *key_ids = malloc(sizeof(uint32_t) * cnt);
+	rand32_permute_init(key_ids, cnt);
+	
+	key the_key = {
+		0x00000000,
+		0x00,
+		0x00000000,
+	};
+	
+	uint8_t data[LEVEL_ITEM_LEN] = { 0 };
+	for (uint32_t i = 0; i < cnt; ++i) {
+		the_key.id = key_ids[i];
+		memcpy(data, &the_key.id, sizeof(the_key.id));
+		
+		tree_insert(meta, &the_key, (struct item_data){
+			.len  = sizeof(data),
+			.data = data,
+		});
+	}
+	
+	FAIL_ON(help_check_tree(meta));
+	FAIL_ON(walk_levels(meta));
+	
+	/* nodes only go away once they are empty, so the middle half of the keys
+	 * is removed in order first, taking out whole subtrees that have siblings
+	 * on both sides; the rest go in random order */
+	uint32_t *order = malloc(sizeof(uint32_t) * cnt);
+	uint32_t mid_begin = cnt / 4;
+	uint32_t mid_end   = mid_begin + (cnt / 2);
+	
+	uint32_t order_cnt = 0;
+	for (uint32_t id = mid_begin; id < mid_end; ++id) {
+		order[order_cnt++] = id;
+	}
+	for (uint32_t i = 0; i < cnt; ++i) {
+		if (key_ids[i] < mid_begin || key_ids[i] >= mid_end) {
+			order[order_cnt++] = key_ids[i];
+		}
+	}
+	
+	uint32_t per_check = cnt / LEVEL_CHECKS;
+	for (uint32_t i = 0; i < cnt; ++i) {
+		the_key.id = order[i];
+		FAIL_ON(tree_remove(meta, &the_key));
+		
+		if (per_check != 0 && (i + 1) % per_check == 0) {
+			FAIL_ON(help_check_tree(meta));
+			FAIL_ON(walk_levels(meta));
+		}
+	}
+	
+	/* once the last leaf goes, the root is all that is left */
+	FAIL_ON(help_check_tree(meta));
+	FAIL_ON(tree_depth(meta) == 1);
+	
+	free(order);
+	free(key_ids);
+	
+	jgfs2_done();
+	return true;
+}
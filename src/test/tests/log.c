@@ -0,0 +1,267 @@
+/* jgfs2
+ * (c) 2013 Justin Gottula
+ * The source code of this project is distributed under the terms of the
+ * simplified BSD license. See the LICENSE file for details.
+ */
+
+
+#include "log.h"
+#include <err.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "../../../lib/fs.h"
+#include "../../../lib/log.h"
+#include "../../../lib/tree.h"
+#include "../argp.h"
+#include "../help.h"
+#include "../rand.h"
+
+
+#define ITEM_LEN_MAX 200
+
+/* room for every record from one pass of log_ops, with the log less than half
+ * full so that nothing gets checkpointed */
+#define LOG_SIZE_FOR(_cnt) \
+	(JGFS2_LOG_SIZE_MIN + ((_cnt) * 3 * (sizeof(struct log_rec) + \
+	ITEM_LEN_MAX + LOG_REC_ALIGN) * 2))
+
+
+/// @brief inserts every key id up to a count, then updates the even ones and
+/// removes every third one, all through the log
+/// @param[in] root_addr  block number of root node
+/// @param[in] cnt        number of key ids
+/// @param[in] item_lens  two item lengths for each key id
+/// @param[in] data       item data, and then some
+static void log_ops(uint32_t root_addr, uint32_t cnt,
+	const uint32_t *item_lens, const uint8_t *data) {
+	key the_key = {
+		0x00000000,
+		0x00,
+		0x00000000,
+	};
+	
+	for (uint32_t i = 0; i < cnt; ++i) {
+		the_key.id = i;
+		log_insert(root_addr, &the_key, (struct item_data){
+			.len  = item_lens[i * 2],
+			.data = (void *)data,
+		});
+	}
+	
+	for (uint32_t i = 0; i < cnt; i += 2) {
+		the_key.id = i;
+		log_update(root_addr, &the_key, (struct item_data){
+			.len  = item_lens[i * 2 + 1],
+			.data = (void *)(data + 1),
+		});
+	}
+	
+	for (uint32_t i = 0; i < cnt; i += 3) {
+		the_key.id = i;
+		if (!log_remove(root_addr, &the_key)) {
+			errx(1, "remove failed: key %s", key_str(&the_key));
+		}
+	}
+}
+
+/// @brief makes sure a tree holds what log_ops leaves behind
+/// @param[in] root_addr  block number of root node
+/// @param[in] cnt        number of key ids
+/// @param[in] item_lens  two item lengths for each key id
+/// @param[in] data       item data, and then some
+/// @return true if every key is as it should be
+static bool lookup_ops(uint32_t root_addr, uint32_t cnt,
+	const uint32_t *item_lens, const uint8_t *data) {
+	key the_key = {
+		0x00000000,
+		0x00,
+		0x00000000,
+	};
+	
+	for (uint32_t i = 0; i < cnt; ++i) {
+		the_key.id = i;
+		
+		uint8_t buf[ITEM_LEN_MAX];
+		bool found = tree_retrieve(root_addr, &the_key, sizeof(buf), buf);
+		
+		if (i % 3 == 0) {
+			if (found) {
+				warnx("removed key is there: key %s", key_str(&the_key));
+				return false;
+			}
+			continue;
+		}
+		
+		if (!found) {
+			warnx("retrieve failed: key %s", key_str(&the_key));
+			return false;
+		}
+		
+		bool even = (i % 2 == 0);
+		if (memcmp(buf, data + (even ? 1 : 0),
+			item_lens[i * 2 + (even ? 1 : 0)]) != 0) {
+			warnx("bad data: key %s", key_str(&the_key));
+			return false;
+		}
+	}
+	
+	return true;
+}
+
+/// @brief runs log_ops and syncs the log in another process, which then exits
+/// without unmounting, as if the machine had gone down
+/// @param[in] cnt        number of key ids
+/// @param[in] item_lens  two item lengths for each key id
+/// @param[in] data       item data, and then some
+/// @param[in] lose       take everything back out of the tree before exiting,
+/// as if none of the node writes had made it to the device
+/// @return true if the other process did all of that
+static bool crash_after(uint32_t cnt, const uint32_t *item_lens,
+	const uint8_t *data, bool lose) {
+	pid_t pid = fork();
+	if (pid < 0) {
+		err(1, "fork failed");
+	}
+	
+	if (pid == 0) {
+		help_init();
+		uint32_t meta = fs.sblk->s_addr_meta_tree;
+		
+		log_ops(meta, cnt, item_lens, data);
+		log_sync();
+		
+		/* the records have to be all there is for replay to work from */
+		if (lose) {
+			if (log_stats().checkpoints != 0) {
+				_exit(2);
+			}
+			
+			key the_key = {
+				0x00000000,
+				0x00,
+				0x00000000,
+			};
+			
+			for (uint32_t i = 0; i < cnt; ++i) {
+				the_key.id = i;
+				tree_remove(meta, &the_key);
+			}
+		}
+		
+		_exit(0);
+	}
+	
+	int status;
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid failed");
+	}
+	
+	return (WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+bool test_log(uint32_t cnt) {
+	srand48(param.rand_seed);
+	
+	cnt = (1 << cnt);
+	
+	uint8_t data[ITEM_LEN_MAX + 1];
+	rand32_fill_range((uint32_t *)data, sizeof(data) / sizeof(uint32_t),
+		UINT32_MAX);
+	
+	uint32_t *item_lens = malloc(sizeof(uint32_t) * cnt * 2);
+	rand32_fill_range(item_lens, cnt * 2, ITEM_LEN_MAX);
+	
+	/* the tree lost every change, so all of it has to come from the log */
+	help_new_with(&(struct help_new_opts){ .log_size = LOG_SIZE_FOR(cnt) });
+	jgfs2_done();
+	
+	FAIL_ON(crash_after(cnt, item_lens, data, true));
+	
+	help_init();
+	uint32_t meta = fs.sblk->s_addr_meta_tree;
+	
+	struct log_stats stats = log_stats();
+	FAIL_ON(stats.replayed == cnt + CEIL(cnt, 2) + CEIL(cnt, 3));
+	FAIL_ON(stats.used == 0);
+	
+	FAIL_ON(help_check_tree(meta));
+	FAIL_ON(lookup_ops(meta, cnt, item_lens, data));
+	
+	/* a clean unmount leaves nothing behind to replay */
+	jgfs2_done();
+	help_init();
+	
+	FAIL_ON(log_stats().replayed == 0);
+	FAIL_ON(lookup_ops(meta, cnt, item_lens, data));
+	
+	jgfs2_done();
+	
+	/* a small log wraps around and gets checkpointed along the way, and
+	 * whatever is after the last checkpoint is replayed on top of trees that
+	 * have it already */
+	help_new_with(&(struct help_new_opts){ .log_size = JGFS2_LOG_SIZE_MIN });
+	jgfs2_done();
+	
+	FAIL_ON(crash_after(cnt, item_lens, data, false));
+	
+	help_init();
+	meta = fs.sblk->s_addr_meta_tree;
+	
+	FAIL_ON(help_check_tree(meta));
+	FAIL_ON(lookup_ops(meta, cnt, item_lens, data));
+	
+	/* compare syncing the log after each operation against committing each
+	 * one's nodes */
+	key the_key = {
+		0x00000000,
+		0x00,
+		0x00000000,
+	};
+	
+	double time_begin = help_now();
+	for (uint32_t i = 0; i < cnt; ++i) {
+		the_key.id = cnt + i;
+		
+		log_insert(meta, &the_key, (struct item_data){
+			.len  = item_lens[i * 2],
+			.data = data,
+		});
+		log_sync();
+	}
+	double time_log = help_now() - time_begin;
+	
+	time_begin = help_now();
+	for (uint32_t i = 0; i < cnt; ++i) {
+		the_key.id = cnt * 2 + i;
+		
+		struct tree_txn *txn = tree_txn_begin();
+		tree_insert(meta, &the_key, (struct item_data){
+			.len  = item_lens[i * 2],
+			.data = data,
+		});
+		tree_txn_commit(txn, true);
+	}
+	double time_txn = help_now() - time_begin;
+	
+	stats = log_stats();
+	FAIL_ON(stats.syncs != 0);
+	FAIL_ON(stats.checkpoints != 0);
+	
+	fprintf(stderr, "log + sync: %.0f ops/s, commit + wait: %.0f ops/s\n",
+		cnt / time_log, cnt / time_txn);
+	fprintf(stderr, "%" PRIu64 " records, %" PRIu64 " syncs, %" PRIu64
+		" checkpoints, %" PRIu64 " replayed\n", stats.records, stats.syncs,
+		stats.checkpoints, stats.replayed);
+	
+	FAIL_ON(help_check_tree(meta));
+	
+	jgfs2_done();
+	
+	free(item_lens);
+	
+	return true;
+}
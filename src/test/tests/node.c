@@ -0,0 +1,88 @@
+/* jgfs2
+ * (c) 2013 Justin Gottula
+ * The source code of this project is distributed under the terms of the
+ * simplified BSD license. See the LICENSE file for details.
+ */
+
+
+#include "node.h"
+#include <err.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "../../../lib/fs.h"
+#include "../../../lib/tree.h"
+#include "../argp.h"
+#include "../help.h"
+#include "../rand.h"
+
+
+#define ITEM_LEN_MAX 64
+
+
+/// @brief measures the height of a tree by following its leftmost edge
+/// @param[in] root_addr  block number of root node
+/// @return number of levels, counting the leaves
+static uint32_t tree_height(uint32_t root_addr) {
+	uint32_t height = 1;
+	
+	node_ptr node = node_map(root_addr, false);
+	while (!node->hdr.leaf) {
+		uint32_t child_addr = branch_addr(node)[0];
+		
+		node_unmap(node);
+		node = node_map(child_addr, false);
+		
+		++height;
+	}
+	node_unmap(node);
+	
+	return height;
+}
+
+/// @brief fills a fresh tree with nodes of a given size and reads it back
+/// @param[in] node_size  node size in bytes
+/// @param[in] items      items
+/// @return true if the tree checks out and every item comes back intact
+static bool run_size(uint32_t node_size, const struct help_items *items) {
+	help_new_with(&(struct help_new_opts){ .node_size = node_size });
+	uint32_t meta = fs.sblk->s_addr_meta_tree;
+	uint32_t cnt = items->cnt;
+	
+	FAIL_ON(tree_node_size(meta) == node_size);
+	
+	double time_begin = help_now();
+	help_items_insert(meta, items, 0, cnt, 0);
+	double time_insert = help_now() - time_begin;
+	
+	FAIL_ON(help_check_tree(meta));
+	
+	time_begin = help_now();
+	FAIL_ON(help_items_lookup(meta, items, 0, cnt, 0, 0));
+	double time_lookup = help_now() - time_begin;
+	
+	fprintf(stderr, "node %7" PRIu32 ": height %" PRIu32 " insert %.3fs "
+		"lookup %.3fs (%.0f ops/s)\n", node_size, tree_height(meta),
+		time_insert, time_lookup, cnt / time_lookup);
+	
+	jgfs2_done();
+	return true;
+}
+
+bool test_node(uint32_t cnt) {
+	srand48(param.rand_seed);
+	
+	cnt = (1 << cnt);
+	
+	struct help_items items;
+	help_items_new(&items, cnt, ITEM_LEN_MAX, 0, 0);
+	
+	for (uint32_t size = JGFS2_NODE_SIZE_MIN; size <= JGFS2_NODE_SIZE_MAX;
+		size *= 4) {
+		FAIL_ON(run_size(size, &items));
+	}
+	
+	help_items_free(&items);
+	
+	return true;
+}
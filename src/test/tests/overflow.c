@@ -0,0 +1,124 @@
+/* jgfs2
+ * (c) 2013 Justin Gottula
+ * The source code of this project is distributed under the terms of the
+ * simplified BSD license. See the LICENSE file for details.
+ */
+
+
+#include "overflow.h"
+#include <err.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../../lib/fs.h"
+#include "../../../lib/tree.h"
+#include "../argp.h"
+#include "../help.h"
+#include "../rand.h"
+
+
+/* items range up to a few blocks long, so that roughly half of them are too
+ * big to keep inline */
+#define ITEM_LEN_MAX 0x2800
+
+
+/// @brief reads an item back and compares it against what was inserted
+/// @param[in] root_addr  block number of root node
+/// @param[in] key        key of item
+/// @param[in] data       expected data
+/// @param[in] len        expected length
+/// @return true if the item matches
+static bool check_item_data(uint32_t root_addr, const key *key,
+	const uint8_t *data, uint32_t len) {
+	uint8_t buf[ITEM_LEN_MAX];
+	
+	if (!tree_retrieve(root_addr, key, sizeof(buf), buf)) {
+		warnx("retrieve failed: key %s", key_str(key));
+		return false;
+	}
+	
+	if (memcmp(buf, data, len) != 0) {
+		warnx("bad data: key %s len %" PRIu32, key_str(key), len);
+		return false;
+	}
+	
+	return true;
+}
+
+bool test_overflow(uint32_t cnt) {
+	srand48(param.rand_seed);
+	
+	help_new();
+	uint32_t meta = fs.sblk->s_addr_meta_tree;
+	FAIL_ON(help_check_tree(meta));
+	
+	uint8_t *data = malloc(ITEM_LEN_MAX);
+	rand32_fill_range((uint32_t *)data, ITEM_LEN_MAX / sizeof(uint32_t),
+		UINT32_MAX);
+	
+	cnt = (1 << cnt);
+	
+	uint32_t *key_ids = malloc(sizeof(uint32_t) * cnt);
+	rand32_permute_init(key_ids, cnt);
+	
+	uint32_t *item_lens = malloc(sizeof(uint32_t) * cnt);
+	rand32_fill_range(item_lens, cnt, ITEM_LEN_MAX);
+	
+	fprintf(stderr, "total %" PRIu32 " inline max %" PRIu32 "\n",
+		cnt, tree_inline_max(meta));
+	
+	key the_key = {
+		0x00000000,
+		0x00,
+		0x00000000,
+	};
+	
+	for (uint32_t i = 0; i < cnt; ++i) {
+		the_key.id = key_ids[i];
+		
+		/* each item starts at a different place in the data, so that a mixup
+		 * between items shows */
+		uint32_t len = item_lens[the_key.id];
+		uint8_t *item = data + (the_key.id % (ITEM_LEN_MAX - len + 1));
+		
+		tree_insert(meta, &the_key,
+			(struct item_data){ .len = len, .data = item });
+	}
+	
+	warnx("tree check");
+	FAIL_ON(help_check_tree(meta));
+	
+	for (uint32_t i = 0; i < cnt; ++i) {
+		the_key.id = i;
+		
+		uint32_t len = item_lens[i];
+		uint8_t *item = data + (i % (ITEM_LEN_MAX - len + 1));
+		
+		FAIL_ON(check_item_data(meta, &the_key, item, len));
+	}
+	
+	/* take out every other item; the rest must be unaffected */
+	for (uint32_t i = 0; i < cnt; i += 2) {
+		the_key.id = i;
+		FAIL_ON(tree_remove(meta, &the_key));
+	}
+	
+	FAIL_ON(help_check_tree(meta));
+	
+	for (uint32_t i = 1; i < cnt; i += 2) {
+		the_key.id = i;
+		
+		uint32_t len = item_lens[i];
+		uint8_t *item = data + (i % (ITEM_LEN_MAX - len + 1));
+		
+		FAIL_ON(check_item_data(meta, &the_key, item, len));
+	}
+	
+	free(item_lens);
+	free(key_ids);
+	free(data);
+	
+	jgfs2_done();
+	return true;
+}
@@ -0,0 +1,15 @@
+/* jgfs2
+ * (c) 2013 Justin Gottula
+ * The source code of this project is distributed under the terms of the
+ * simplified BSD license. See the LICENSE file for details.
+ */
+
+
+#ifndef JGFS2_SRC_TEST_TESTS_OVERFLOW_H
+#define JGFS2_SRC_TEST_TESTS_OVERFLOW_H
+
+
+bool test_overflow(uint32_t cnt);
+
+
+#endif
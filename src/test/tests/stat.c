@@ -0,0 +1,117 @@
+/* jgfs2
+ * (c) 2013 Justin Gottula
+ * The source code of this project is distributed under the terms of the
+ * simplified BSD license. See the LICENSE file for details.
+ */
+
+
+#include "stat.h"
+#include <err.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../../lib/fs.h"
+#include "../../../lib/tree.h"
+#include "../argp.h"
+#include "../help.h"
+#include "../rand.h"
+
+
+#define ITEM_LEN_MAX 64
+
+/* every so often, an item is made too big to keep inline, so that the
+ * overflow block count has something to track */
+#define ITEM_OVF_EVERY 32
+#define ITEM_OVF_LEN   3000
+
+
+/// @brief makes sure a tree's running totals agree with what a full walk of
+/// it finds
+/// @param[in] root_addr  block number of root node
+/// @return true if every figure matches
+static bool stats_match(uint32_t root_addr) {
+	struct tree_stats running = tree_stat(root_addr);
+	struct tree_stats walked;
+	tree_stat_walk(root_addr, &walked, NULL);
+	
+	if (memcmp(&running, &walked, sizeof(running)) != 0) {
+		warnx("running: height %" PRIu8 " nodes %" PRIu32 " items %" PRIu64
+			" bytes %" PRIu64 " ovf_blk %" PRIu32, running.height,
+			running.nodes, running.items, running.bytes, running.ovf_blk);
+		warnx("walked:  height %" PRIu8 " nodes %" PRIu32 " items %" PRIu64
+			" bytes %" PRIu64 " ovf_blk %" PRIu32, walked.height,
+			walked.nodes, walked.items, walked.bytes, walked.ovf_blk);
+		
+		for (uint32_t i = 0; i < NODE_FILL_BUCKETS; ++i) {
+			if (running.fill[i] != walked.fill[i]) {
+				warnx("fill[%" PRIu32 "]: running %" PRIu32 " walked %" PRIu32,
+					i, running.fill[i], walked.fill[i]);
+			}
+		}
+		
+		return false;
+	}
+	
+	return true;
+}
+
+/// @brief fills a fresh tree of one flavor or the other, then empties most of
+/// it, comparing the running totals against a walk after each step and once
+/// more after remounting
+/// @param[in] buffered  make the tree buffered
+/// @param[in] items     items
+/// @return true if the totals always agree with the walk
+static bool run_flavor(bool buffered, const struct help_items *items) {
+	help_new_with(&(struct help_new_opts){ .meta_buffered = buffered });
+	uint32_t meta = fs.sblk->s_addr_meta_tree;
+	uint32_t cnt = items->cnt;
+	
+	FAIL_ON(stats_match(meta));
+	
+	help_items_insert(meta, items, 0, cnt, 0);
+	
+	FAIL_ON(help_check_tree(meta));
+	FAIL_ON(stats_match(meta));
+	
+	struct tree_stats full = tree_stat(meta);
+	FAIL_ON(full.height > 1);
+	FAIL_ON(full.ovf_blk != 0);
+	
+	/* taking out most of the items empties out leaves, which plain trees drop
+	 * right away */
+	FAIL_ON(help_items_remove(meta, items, 0, cnt - (cnt / 8)));
+	
+	FAIL_ON(help_check_tree(meta));
+	FAIL_ON(stats_match(meta));
+	
+	struct tree_stats before = tree_stat(meta);
+	FAIL_ON(before.items < full.items);
+	
+	/* the totals saved at unmount have to come back as they were, without
+	 * having to be counted over */
+	jgfs2_done();
+	help_init();
+	
+	struct tree_stats after = tree_stat(meta);
+	FAIL_ON(memcmp(&before, &after, sizeof(before)) == 0);
+	FAIL_ON(stats_match(meta));
+	
+	jgfs2_done();
+	return true;
+}
+
+bool test_stat(uint32_t cnt) {
+	srand48(param.rand_seed);
+	
+	cnt = (1 << cnt);
+	
+	struct help_items items;
+	help_items_new(&items, cnt, ITEM_LEN_MAX, ITEM_OVF_EVERY, ITEM_OVF_LEN);
+	
+	FAIL_ON(run_flavor(false, &items));
+	FAIL_ON(run_flavor(true, &items));
+	
+	help_items_free(&items);
+	
+	return true;
+}
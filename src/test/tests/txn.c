@@ -0,0 +1,196 @@
+/* jgfs2
+ * (c) 2013 Justin Gottula
+ * The source code of this project is distributed under the terms of the
+ * simplified BSD license. See the LICENSE file for details.
+ */
+
+
+#include "txn.h"
+#include <err.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../../lib/fs.h"
+#include "../../../lib/tree.h"
+#include "../argp.h"
+#include "../help.h"
+#include "../rand.h"
+
+
+#define ITEM_LEN_MAX 200
+
+/* every this many operations, one of them waits for its group to commit */
+#define OPS_PER_SYNC 64
+
+#define THREAD_CNT 4
+
+
+struct worker {
+	pthread_t thread;
+	
+	uint32_t root_addr;
+	uint32_t first_id;
+	uint32_t cnt;
+	
+	const uint32_t *item_lens;
+	const uint8_t *data;
+};
+
+
+/// @brief inserts a run of key ids, each in a commit group of its own or
+/// joined to whatever group is open
+/// @param[in] root_addr  block number of root node
+/// @param[in] first_id   first key id
+/// @param[in] cnt        number of key ids
+/// @param[in] item_lens  item length for each key id
+/// @param[in] data       item data
+/// @param[in] grouped    only wait for a commit every OPS_PER_SYNC operations
+static void insert_run(uint32_t root_addr, uint32_t first_id, uint32_t cnt,
+	const uint32_t *item_lens, const uint8_t *data, bool grouped) {
+	key the_key = {
+		0x00000000,
+		0x00,
+		0x00000000,
+	};
+	
+	for (uint32_t i = 0; i < cnt; ++i) {
+		the_key.id = first_id + i;
+		
+		struct tree_txn *txn = tree_txn_begin();
+		tree_insert(root_addr, &the_key, (struct item_data){
+			.len  = item_lens[the_key.id],
+			.data = (void *)data,
+		});
+		tree_txn_commit(txn, !grouped || (i + 1) % OPS_PER_SYNC == 0);
+	}
+}
+
+static void *worker_main(void *arg) {
+	struct worker *w = arg;
+	
+	insert_run(w->root_addr, w->first_id, w->cnt, w->item_lens, w->data,
+		true);
+	
+	return NULL;
+}
+
+/// @brief makes sure every key id up to a count is in a tree with the right
+/// data
+/// @param[in] root_addr  block number of root node
+/// @param[in] cnt        number of key ids
+/// @param[in] item_lens  item length for each key id
+/// @param[in] data       item data
+/// @return true if every item is there
+static bool lookup_all(uint32_t root_addr, uint32_t cnt,
+	const uint32_t *item_lens, const uint8_t *data) {
+	key the_key = {
+		0x00000000,
+		0x00,
+		0x00000000,
+	};
+	
+	for (uint32_t i = 0; i < cnt; ++i) {
+		the_key.id = i;
+		
+		uint8_t buf[ITEM_LEN_MAX];
+		if (!tree_retrieve(root_addr, &the_key, sizeof(buf), buf)) {
+			warnx("retrieve failed: key %s", key_str(&the_key));
+			return false;
+		}
+		if (memcmp(buf, data, item_lens[i]) != 0) {
+			warnx("bad data: key %s", key_str(&the_key));
+			return false;
+		}
+	}
+	
+	return true;
+}
+
+bool test_txn(uint32_t cnt) {
+	srand48(param.rand_seed);
+	
+	cnt = (1 << cnt);
+	
+	uint8_t data[ITEM_LEN_MAX];
+	rand32_fill_range((uint32_t *)data, sizeof(data) / sizeof(uint32_t),
+		UINT32_MAX);
+	
+	/* four runs' worth: alone, grouped, and the rest for the threads */
+	uint32_t *item_lens = malloc(sizeof(uint32_t) * cnt * 4);
+	rand32_fill_range(item_lens, cnt * 4, ITEM_LEN_MAX);
+	
+	help_new();
+	uint32_t meta = fs.sblk->s_addr_meta_tree;
+	
+	/* every operation waiting on its own group */
+	double time_begin = help_now();
+	insert_run(meta, 0, cnt, item_lens, data, false);
+	double time_alone = help_now() - time_begin;
+	
+	struct tree_txn_stats alone = tree_txn_stats();
+	FAIL_ON(alone.groups == cnt);
+	FAIL_ON(alone.ops == cnt);
+	
+	/* operations sharing groups */
+	time_begin = help_now();
+	insert_run(meta, cnt, cnt, item_lens, data, true);
+	double time_grouped = help_now() - time_begin;
+	
+	struct tree_txn_stats grouped = tree_txn_stats();
+	FAIL_ON(grouped.groups - alone.groups <= cnt / OPS_PER_SYNC);
+	FAIL_ON(grouped.ops - alone.ops == cnt);
+	FAIL_ON(grouped.runs <= grouped.nodes);
+	
+	fprintf(stderr, "alone: %.0f ops/s, grouped: %.0f ops/s\n",
+		cnt / time_alone, cnt / time_grouped);
+	
+	/* threads joining each other's groups */
+	struct worker workers[THREAD_CNT];
+	for (uint32_t i = 0; i < THREAD_CNT; ++i) {
+		workers[i] = (struct worker){
+			.root_addr = meta,
+			.first_id  = cnt * 2 + i * (cnt / 2),
+			.cnt       = cnt / 2,
+			
+			.item_lens = item_lens,
+			.data      = data,
+		};
+		
+		if ((errno = pthread_create(&workers[i].thread, NULL, worker_main,
+			workers + i)) != 0) {
+			err(1, "pthread_create failed");
+		}
+	}
+	for (uint32_t i = 0; i < THREAD_CNT; ++i) {
+		pthread_join(workers[i].thread, NULL);
+	}
+	
+	/* the threads' last groups may still be open */
+	tree_txn_sync();
+	
+	struct tree_txn_stats threaded = tree_txn_stats();
+	FAIL_ON(threaded.ops - grouped.ops == cnt * 2);
+	FAIL_ON(threaded.groups - grouped.groups <= cnt * 2 / OPS_PER_SYNC);
+	
+	fprintf(stderr, "%" PRIu64 " groups, %" PRIu64 " ops, %" PRIu64
+		" node writes, %" PRIu64 " runs\n", threaded.groups, threaded.ops,
+		threaded.nodes, threaded.runs);
+	
+	FAIL_ON(help_check_tree(meta));
+	
+	/* everything has to have made it to the device */
+	jgfs2_done();
+	help_init();
+	
+	FAIL_ON(help_check_tree(meta));
+	FAIL_ON(lookup_all(meta, cnt * 4, item_lens, data));
+	
+	jgfs2_done();
+	
+	free(item_lens);
+	
+	return true;
+}